@@ -0,0 +1,171 @@
+// ranger_proxy - A SOCKS5 proxy
+// Copyright (C) 2015  RangerUFO <ufownl@gmail.com>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "common.hpp"
+#include "admission_control.hpp"
+#include <stdlib.h>
+
+namespace ranger { namespace proxy {
+
+namespace {
+
+bool parse_count(const std::string& str, size_t& count) {
+  auto begin = str.c_str();
+  char* end = nullptr;
+  auto n = strtoul(begin, &end, 10);
+  if (end == begin || *end != '\0') {
+    return false;
+  }
+  count = n;
+  return true;
+}
+
+}
+
+bool parse_connection_limit(const std::string& str, size_t& total, size_t& per_ip) {
+  if (str.empty()) {
+    total = 0;
+    per_ip = 0;
+    return true;
+  }
+
+  size_t t = 0;
+  size_t p = 0;
+  auto pos = str.find(':');
+  if (pos == std::string::npos) {
+    if (!parse_count(str, t)) {
+      return false;
+    }
+  } else if (!parse_count(str.substr(0, pos), t)
+             || !parse_count(str.substr(pos + 1), p)) {
+    return false;
+  }
+
+  total = t;
+  per_ip = p;
+  return true;
+}
+
+admission_limits share_admission_limits(const admission_limits& limits, size_t shares) {
+  auto share = [shares] (size_t total) -> size_t {
+    return shares == 0 ? total : (total + shares - 1) / shares;
+  };
+  auto result = limits;
+  result.sessions = share(limits.sessions);
+  result.handshakes = share(limits.handshakes);
+  result.accept_rate = share_rate_spec(limits.accept_rate, shares);
+  return result;
+}
+
+admission_control::ticket::ticket(std::shared_ptr<admission_control> ctrl, std::string ip)
+  : m_ctrl(std::move(ctrl))
+  , m_ip(std::move(ip)) {
+  // nop
+}
+
+admission_control::ticket::~ticket() {
+  m_ctrl->release(m_ip, m_handshaking);
+}
+
+void admission_control::ticket::handshake_done() {
+  if (m_handshaking) {
+    m_handshaking = false;
+    m_ctrl->finish_handshake(m_ip);
+  }
+}
+
+admission_control::admission_control(const admission_limits& limits)
+  : m_limits(limits) {
+  if (limits.accept_rate.rate > 0) {
+    m_accept_bucket.reset(new token_bucket(limits.accept_rate));
+  }
+}
+
+std::shared_ptr<admission_control::ticket>
+admission_control::admit(const std::string& ip) {
+  std::lock_guard<std::mutex> lock(m_mtx);
+  if (m_limits.sessions > 0 && m_stats.sessions >= m_limits.sessions) {
+    ++m_stats.rejected_sessions;
+    return nullptr;
+  }
+  if (m_limits.handshakes > 0 && m_stats.handshakes >= m_limits.handshakes) {
+    ++m_stats.rejected_handshakes;
+    return nullptr;
+  }
+
+  auto it = m_usage.find(ip);
+  if (it != m_usage.end()) {
+    if (m_limits.sessions_per_ip > 0 && it->second.sessions >= m_limits.sessions_per_ip) {
+      ++m_stats.rejected_sessions;
+      return nullptr;
+    }
+    if (m_limits.handshakes_per_ip > 0 && it->second.handshakes >= m_limits.handshakes_per_ip) {
+      ++m_stats.rejected_handshakes;
+      return nullptr;
+    }
+  }
+
+  // only connections that passed the caps count towards the rate
+  if (m_accept_bucket) {
+    if (m_accept_bucket->wait(token_bucket::clock::now()) > token_bucket::clock::duration::zero()) {
+      ++m_stats.rejected_rate;
+      return nullptr;
+    }
+    m_accept_bucket->consume(1);
+  }
+
+  auto& u = m_usage[ip];
+  ++u.sessions;
+  ++u.handshakes;
+  ++m_stats.sessions;
+  ++m_stats.handshakes;
+  ++m_stats.accepted;
+  return std::make_shared<ticket>(shared_from_this(), ip);
+}
+
+admission_stats admission_control::stats() const {
+  std::lock_guard<std::mutex> lock(m_mtx);
+  return m_stats;
+}
+
+void admission_control::release(const std::string& ip, bool handshaking) {
+  std::lock_guard<std::mutex> lock(m_mtx);
+  auto it = m_usage.find(ip);
+  if (it == m_usage.end()) {
+    return;
+  }
+
+  --it->second.sessions;
+  --m_stats.sessions;
+  if (handshaking) {
+    --it->second.handshakes;
+    --m_stats.handshakes;
+  }
+  if (it->second.sessions == 0) {
+    m_usage.erase(it);
+  }
+}
+
+void admission_control::finish_handshake(const std::string& ip) {
+  std::lock_guard<std::mutex> lock(m_mtx);
+  auto it = m_usage.find(ip);
+  if (it != m_usage.end()) {
+    --it->second.handshakes;
+    --m_stats.handshakes;
+  }
+}
+
+} }
@@ -0,0 +1,106 @@
+// ranger_proxy - A SOCKS5 proxy
+// Copyright (C) 2015  RangerUFO <ufownl@gmail.com>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef RANGER_PROXY_ADMISSION_CONTROL_HPP
+#define RANGER_PROXY_ADMISSION_CONTROL_HPP
+
+#include "token_bucket.hpp"
+#include <unordered_map>
+#include <string>
+#include <memory>
+#include <mutex>
+#include <stdint.h>
+
+namespace ranger { namespace proxy {
+
+// 0 is unlimited everywhere
+struct admission_limits {
+  size_t sessions {0};           // open sessions
+  size_t sessions_per_ip {0};
+  size_t handshakes {0};         // sessions that haven't sent their request yet
+  size_t handshakes_per_ip {0};
+  rate_spec accept_rate;         // connections per second, and a burst
+};
+
+// Accepts "<total>" or "<total>:<per IP>".
+bool parse_connection_limit(const std::string& str, size_t& total, size_t& per_ip);
+
+// One of `shares` equal parts of the total limits, see share_rate_spec().
+// The per IP limits are kept, the connections of an IP don't split
+// evenly.
+admission_limits share_admission_limits(const admission_limits& limits, size_t shares);
+
+struct admission_stats {
+  uint64_t accepted {0};
+  uint64_t rejected_sessions {0};    // over either session limit
+  uint64_t rejected_handshakes {0};  // over either handshake limit
+  uint64_t rejected_rate {0};        // over the accept rate
+  size_t sessions {0};
+  size_t handshakes {0};
+};
+
+// Decides whether the service takes a new connection. It is asked
+// before the connection gets a session, so a flood is turned away
+// without allocating anything. An admitted connection holds a ticket
+// that frees its slots once the session is gone.
+class admission_control : public std::enable_shared_from_this<admission_control> {
+public:
+  class ticket {
+  public:
+    ticket(std::shared_ptr<admission_control> ctrl, std::string ip);
+    ~ticket();
+
+    ticket(const ticket&) = delete;
+    ticket& operator = (const ticket&) = delete;
+
+    // the client sent its request, the handshake slot is free again
+    void handshake_done();
+
+  private:
+    std::shared_ptr<admission_control> m_ctrl;
+    std::string m_ip;
+    bool m_handshaking {true};
+  };
+
+  explicit admission_control(const admission_limits& limits);
+
+  admission_control(const admission_control&) = delete;
+  admission_control& operator = (const admission_control&) = delete;
+
+  // nullptr if the connection has to be closed
+  std::shared_ptr<ticket> admit(const std::string& ip);
+
+  admission_stats stats() const;
+
+private:
+  struct usage {
+    size_t sessions {0};
+    size_t handshakes {0};
+  };
+
+  void release(const std::string& ip, bool handshaking);
+  void finish_handshake(const std::string& ip);
+
+  const admission_limits m_limits;
+  std::unique_ptr<token_bucket> m_accept_bucket;
+  mutable std::mutex m_mtx;
+  std::unordered_map<std::string, usage> m_usage;
+  admission_stats m_stats;
+};
+
+} }
+
+#endif  // RANGER_PROXY_ADMISSION_CONTROL_HPP
@@ -0,0 +1,416 @@
+// ranger_proxy - A SOCKS5 proxy
+// Copyright (C) 2015  RangerUFO <ufownl@gmail.com>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "common.hpp"
+#include "aead_encryptor.hpp"
+#include "buffer_pool.hpp"
+#include <openssl/hmac.h>
+#include <openssl/rand.h>
+#include <algorithm>
+#include <stdexcept>
+#include <new>
+#include <string.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <cpuid.h>
+#endif
+
+namespace ranger { namespace proxy {
+
+namespace {
+
+const size_t nonce_size = 12;
+const char stream_info[] = "ranger_proxy aead";
+const char datagram_info[] = "ranger_proxy udp";
+
+// a peer seals with a single prefix, the few more allowed keep a flood of
+// forged prefixes from growing the windows, which couldn't happen anyway
+// as the prefix is authenticated
+const size_t max_replay_windows = 4;
+
+// RFC 5869 with SHA-256
+std::vector<uint8_t> hkdf_sha256(const std::vector<uint8_t>& ikm,
+                                 const std::vector<uint8_t>& salt,
+                                 const char* info,
+                                 size_t len) {
+  uint8_t prk[EVP_MAX_MD_SIZE];
+  unsigned int prk_len = 0;
+  if (!HMAC(EVP_sha256(), salt.data(), static_cast<int>(salt.size()),
+            ikm.data(), ikm.size(), prk, &prk_len)) {
+    throw std::runtime_error("HKDF extract failed");
+  }
+
+  std::vector<uint8_t> okm;
+  std::vector<uint8_t> block;
+  for (uint8_t i = 1; okm.size() < len; ++i) {
+    block.insert(block.end(), info, info + strlen(info));
+    block.push_back(i);
+    uint8_t t[EVP_MAX_MD_SIZE];
+    unsigned int t_len = 0;
+    if (!HMAC(EVP_sha256(), prk, static_cast<int>(prk_len),
+              block.data(), block.size(), t, &t_len)) {
+      throw std::runtime_error("HKDF expand failed");
+    }
+    block.assign(t, t + t_len);
+    okm.insert(okm.end(), t, t + t_len);
+  }
+  okm.resize(len);
+  return okm;
+}
+
+const EVP_CIPHER* aead_cipher(cipher_type type) {
+  switch (type) {
+  case cipher_type::aes_128_gcm:
+    return EVP_aes_128_gcm();
+  case cipher_type::chacha20_poly1305:
+#if OPENSSL_VERSION_NUMBER >= 0x10100000L && !defined(OPENSSL_NO_CHACHA)
+    return EVP_chacha20_poly1305();
+#else
+    throw std::runtime_error("ChaCha20-Poly1305 requires OpenSSL 1.1.0 or later");
+#endif
+  default:
+    throw std::invalid_argument("not an AEAD cipher");
+  }
+}
+
+// little-endian record counter padded to the 96-bit nonce
+void make_nonce(uint64_t seq, uint8_t (&nonce)[nonce_size]) {
+  memset(nonce, 0, sizeof(nonce));
+  for (size_t i = 0; i < sizeof(seq); ++i) {
+    nonce[i] = static_cast<uint8_t>(seq >> (i * 8));
+  }
+}
+
+}
+
+bool parse_cipher_type(const std::string& name, cipher_type& type) {
+  if (name.empty() || name == "aes-cfb128") {
+    type = cipher_type::aes_cfb128;
+  } else if (name == "aes-128-gcm") {
+    type = cipher_type::aes_128_gcm;
+  } else if (name == "chacha20-poly1305") {
+    type = cipher_type::chacha20_poly1305;
+  } else if (name == "aead") {
+    type = cipher_type::aead;
+  } else {
+    return false;
+  }
+  return true;
+}
+
+bool is_aead_cipher(cipher_type type) {
+  return type != cipher_type::aes_cfb128;
+}
+
+cipher_type select_aead_cipher() {
+#if OPENSSL_VERSION_NUMBER >= 0x10100000L && !defined(OPENSSL_NO_CHACHA)
+#if defined(__x86_64__) || defined(__i386__)
+  unsigned int eax, ebx, ecx, edx;
+  if (__get_cpuid(1, &eax, &ebx, &ecx, &edx) && (ecx & bit_AES)) {
+    return cipher_type::aes_128_gcm;
+  }
+  return cipher_type::chacha20_poly1305;
+#else
+  return cipher_type::aes_128_gcm;
+#endif
+#else
+  return cipher_type::aes_128_gcm;
+#endif
+}
+
+uint8_t aead_cipher_id(cipher_type type) {
+  switch (type) {
+  case cipher_type::aes_128_gcm:
+    return 0x01;
+  case cipher_type::chacha20_poly1305:
+    return 0x02;
+  default:
+    throw std::invalid_argument("not an AEAD cipher");
+  }
+}
+
+bool aead_cipher_from_id(uint8_t id, cipher_type& type) {
+  switch (id) {
+  case 0x01:
+    type = cipher_type::aes_128_gcm;
+    return true;
+  case 0x02:
+    type = cipher_type::chacha20_poly1305;
+    return true;
+  default:
+    return false;
+  }
+}
+
+const size_t aead_state::max_record_size;
+const size_t aead_state::tag_size;
+
+aead_state::~aead_state() {
+  EVP_CIPHER_CTX_free(m_encrypt_ctx);
+  EVP_CIPHER_CTX_free(m_decrypt_ctx);
+}
+
+void aead_state::init(cipher_type type,
+                      const std::vector<uint8_t>& key,
+                      const std::vector<uint8_t>& salt,
+                      bool server) {
+  auto cipher = aead_cipher(type);
+  auto key_len = static_cast<size_t>(EVP_CIPHER_key_length(cipher));
+  // one subkey per direction: client to server first, then server to client
+  auto okm = hkdf_sha256(key, salt, stream_info, key_len * 2);
+  auto upstream_key = okm.data();
+  auto downstream_key = okm.data() + key_len;
+
+  m_encrypt_ctx = EVP_CIPHER_CTX_new();
+  m_decrypt_ctx = EVP_CIPHER_CTX_new();
+  if (!m_encrypt_ctx || !m_decrypt_ctx) {
+    throw std::bad_alloc();
+  }
+
+  if (!EVP_CipherInit_ex(m_encrypt_ctx, cipher, nullptr,
+                         server ? downstream_key : upstream_key, nullptr, 1)
+      || !EVP_CipherInit_ex(m_decrypt_ctx, cipher, nullptr,
+                            server ? upstream_key : downstream_key, nullptr, 0)) {
+    throw std::runtime_error("EVP_CipherInit_ex failed");
+  }
+  OPENSSL_cleanse(okm.data(), okm.size());
+}
+
+std::vector<char> aead_state::encrypt(const std::vector<char>& in) {
+  auto records = (in.size() + max_record_size - 1) / max_record_size;
+  auto out = buffer_pool::local().acquire(in.size() + records * (2 + tag_size));
+  out.resize(in.size() + records * (2 + tag_size));
+  auto src = in.data();
+  auto dst = out.data();
+  for (auto left = in.size(); left > 0;) {
+    auto len = std::min(left, max_record_size);
+    seal(src, len, dst);
+    src += len;
+    dst += 2 + len + tag_size;
+    left -= len;
+  }
+  return out;
+}
+
+std::vector<char> aead_state::decrypt(const std::vector<char>& in) {
+  // frames from the previous call that were not complete yet go first
+  const char* data = in.data();
+  size_t size = in.size();
+  if (!m_pending.empty()) {
+    m_pending.insert(m_pending.end(), in.begin(), in.end());
+    data = m_pending.data();
+    size = m_pending.size();
+  }
+
+  auto out = buffer_pool::local().acquire(size);
+  size_t pos = 0;
+  while (size - pos >= 2) {
+    size_t len = (static_cast<uint8_t>(data[pos]) << 8) | static_cast<uint8_t>(data[pos + 1]);
+    if (size - pos < 2 + len + tag_size) {
+      break;
+    }
+
+    auto old_size = out.size();
+    out.resize(old_size + len);
+    open(data + pos, len, out.data() + old_size);
+    pos += 2 + len + tag_size;
+  }
+
+  std::vector<char> rest(data + pos, data + size);
+  m_pending.swap(rest);
+  return out;
+}
+
+void aead_state::seal(const char* in, size_t len, char* out) {
+  uint8_t nonce[nonce_size];
+  make_nonce(m_encrypt_seq++, nonce);
+  out[0] = static_cast<char>(len >> 8);
+  out[1] = static_cast<char>(len & 0xFF);
+
+  int out_len = 0;
+  auto header = reinterpret_cast<uint8_t*>(out);
+  auto payload = header + 2;
+  if (!EVP_EncryptInit_ex(m_encrypt_ctx, nullptr, nullptr, nullptr, nonce)
+      || !EVP_EncryptUpdate(m_encrypt_ctx, nullptr, &out_len, header, 2)
+      || !EVP_EncryptUpdate(m_encrypt_ctx, payload, &out_len,
+                            reinterpret_cast<const uint8_t*>(in), static_cast<int>(len))
+      || !EVP_EncryptFinal_ex(m_encrypt_ctx, payload + out_len, &out_len)
+      || !EVP_CIPHER_CTX_ctrl(m_encrypt_ctx, EVP_CTRL_GCM_GET_TAG,
+                              static_cast<int>(tag_size), payload + len)) {
+    throw std::runtime_error("AEAD seal failed");
+  }
+}
+
+void aead_state::open(const char* in, size_t len, char* out) {
+  uint8_t nonce[nonce_size];
+  make_nonce(m_decrypt_seq++, nonce);
+
+  int out_len = 0;
+  auto header = reinterpret_cast<const uint8_t*>(in);
+  auto payload = header + 2;
+  auto plain = reinterpret_cast<uint8_t*>(out);
+  if (!EVP_DecryptInit_ex(m_decrypt_ctx, nullptr, nullptr, nullptr, nonce)
+      || !EVP_DecryptUpdate(m_decrypt_ctx, nullptr, &out_len, header, 2)
+      || !EVP_DecryptUpdate(m_decrypt_ctx, plain, &out_len, payload, static_cast<int>(len))
+      || !EVP_CIPHER_CTX_ctrl(m_decrypt_ctx, EVP_CTRL_GCM_SET_TAG,
+                              static_cast<int>(tag_size),
+                              const_cast<uint8_t*>(payload + len))
+      || EVP_DecryptFinal_ex(m_decrypt_ctx, plain + out_len, &out_len) <= 0) {
+    throw std::runtime_error("AEAD record authentication failed");
+  }
+}
+
+const size_t aead_datagram::overhead;
+
+aead_datagram::~aead_datagram() {
+  EVP_CIPHER_CTX_free(m_seal_ctx);
+  EVP_CIPHER_CTX_free(m_open_ctx);
+}
+
+void aead_datagram::init(cipher_type type,
+                         const std::vector<uint8_t>& key,
+                         const std::vector<uint8_t>& salt,
+                         bool server) {
+  auto cipher = aead_cipher(type);
+  auto key_len = static_cast<size_t>(EVP_CIPHER_key_length(cipher));
+  auto okm = hkdf_sha256(key, salt, datagram_info, key_len * 2);
+  auto upstream_key = okm.data();
+  auto downstream_key = okm.data() + key_len;
+
+  m_seal_ctx = EVP_CIPHER_CTX_new();
+  m_open_ctx = EVP_CIPHER_CTX_new();
+  if (!m_seal_ctx || !m_open_ctx) {
+    throw std::bad_alloc();
+  }
+
+  if (!EVP_CipherInit_ex(m_seal_ctx, cipher, nullptr,
+                         server ? downstream_key : upstream_key, nullptr, 1)
+      || !EVP_CipherInit_ex(m_open_ctx, cipher, nullptr,
+                            server ? upstream_key : downstream_key, nullptr, 0)) {
+    throw std::runtime_error("EVP_CipherInit_ex failed");
+  }
+  OPENSSL_cleanse(okm.data(), okm.size());
+
+  if (RAND_bytes(m_prefix, sizeof(m_prefix)) != 1) {
+    throw std::runtime_error("RAND_bytes failed");
+  }
+}
+
+bool replay_window::check(uint64_t seq) const {
+  if (m_empty || seq > m_top) {
+    return true;
+  }
+
+  auto behind = m_top - seq;
+  return behind < size && (m_bits & (uint64_t(1) << behind)) == 0;
+}
+
+void replay_window::update(uint64_t seq) {
+  if (m_empty) {
+    m_empty = false;
+    m_top = seq;
+    m_bits = 1;
+  } else if (seq > m_top) {
+    auto ahead = seq - m_top;
+    m_bits = ahead < size ? (m_bits << ahead) | 1 : 1;
+    m_top = seq;
+  } else {
+    m_bits |= uint64_t(1) << (m_top - seq);
+  }
+}
+
+size_t aead_datagram::seal(const char* head, size_t head_len,
+                           const char* body, size_t body_len, char* out) {
+  // the random prefix keeps nonces apart when a key is ever reused
+  auto nonce = reinterpret_cast<uint8_t*>(out);
+  memcpy(nonce, m_prefix, sizeof(m_prefix));
+  auto seq = m_seq++;
+  for (size_t i = 0; i < sizeof(seq); ++i) {
+    nonce[sizeof(m_prefix) + i] = static_cast<uint8_t>(seq >> (i * 8));
+  }
+
+  int out_len = 0;
+  auto payload = nonce + nonce_size;
+  auto len = head_len + body_len;
+  if (!EVP_EncryptInit_ex(m_seal_ctx, nullptr, nullptr, nullptr, nonce)
+      || !EVP_EncryptUpdate(m_seal_ctx, payload, &out_len,
+                            reinterpret_cast<const uint8_t*>(head), static_cast<int>(head_len))
+      || !EVP_EncryptUpdate(m_seal_ctx, payload + head_len, &out_len,
+                            reinterpret_cast<const uint8_t*>(body), static_cast<int>(body_len))
+      || !EVP_EncryptFinal_ex(m_seal_ctx, payload + len, &out_len)
+      || !EVP_CIPHER_CTX_ctrl(m_seal_ctx, EVP_CTRL_GCM_GET_TAG,
+                              static_cast<int>(aead_state::tag_size), payload + len)) {
+    throw std::runtime_error("AEAD seal failed");
+  }
+  return nonce_size + len + aead_state::tag_size;
+}
+
+ssize_t aead_datagram::open(const char* in, size_t len, char* out) {
+  if (len < overhead) {
+    return -1;
+  }
+
+  // the counter is checked before and only counts once it authenticated
+  auto nonce = reinterpret_cast<const uint8_t*>(in);
+  uint32_t prefix = 0;
+  memcpy(&prefix, nonce, sizeof(prefix));
+  uint64_t seq = 0;
+  for (size_t i = 0; i < sizeof(seq); ++i) {
+    seq |= static_cast<uint64_t>(nonce[sizeof(prefix) + i]) << (i * 8);
+  }
+  auto window = m_windows.find(prefix);
+  if (window == m_windows.end()) {
+    if (m_windows.size() >= max_replay_windows) {
+      return -1;
+    }
+  } else if (!window->second.check(seq)) {
+    return -1;
+  }
+
+  int out_len = 0;
+  auto payload = nonce + nonce_size;
+  auto payload_len = len - overhead;
+  auto plain = reinterpret_cast<uint8_t*>(out);
+  if (!EVP_DecryptInit_ex(m_open_ctx, nullptr, nullptr, nullptr, nonce)
+      || !EVP_DecryptUpdate(m_open_ctx, plain, &out_len, payload,
+                            static_cast<int>(payload_len))
+      || !EVP_CIPHER_CTX_ctrl(m_open_ctx, EVP_CTRL_GCM_SET_TAG,
+                              static_cast<int>(aead_state::tag_size),
+                              const_cast<uint8_t*>(payload + payload_len))
+      || EVP_DecryptFinal_ex(m_open_ctx, plain + out_len, &out_len) <= 0) {
+    return -1;
+  }
+  m_windows[prefix].update(seq);
+  return static_cast<ssize_t>(payload_len);
+}
+
+encryptor::behavior_type
+aead_encryptor_impl(encryptor::stateful_pointer<aead_state> self,
+                    cipher_type type,
+                    const std::vector<uint8_t>& key,
+                    const std::vector<uint8_t>& salt,
+                    bool server) {
+  self->state.init(type, key, salt, server);
+  return {
+    [self] (encrypt_atom, const std::vector<char>& data) {
+      return std::make_tuple(encrypt_atom::value, self->state.encrypt(data));
+    },
+    [self] (decrypt_atom, const std::vector<char>& data) {
+      return std::make_tuple(decrypt_atom::value, self->state.decrypt(data));
+    }
+  };
+}
+
+} }
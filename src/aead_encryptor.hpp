@@ -0,0 +1,146 @@
+// ranger_proxy - A SOCKS5 proxy
+// Copyright (C) 2015  RangerUFO <ufownl@gmail.com>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef RANGER_PROXY_AEAD_ENCRYPTOR_HPP
+#define RANGER_PROXY_AEAD_ENCRYPTOR_HPP
+
+#include "encryptor.hpp"
+#include "cipher_pipeline.hpp"
+#include <openssl/evp.h>
+#include <string>
+#include <unordered_map>
+#include <sys/types.h>
+
+namespace ranger { namespace proxy {
+
+enum class cipher_type : uint8_t {
+  aes_cfb128,
+  aes_128_gcm,
+  chacha20_poly1305,
+  aead  // picks one of the AEAD ciphers, see select_aead_cipher()
+};
+
+bool parse_cipher_type(const std::string& name, cipher_type& type);
+bool is_aead_cipher(cipher_type type);
+
+// AES-128-GCM on CPUs with AES-NI, ChaCha20-Poly1305 otherwise.
+cipher_type select_aead_cipher();
+
+// The server opens an AEAD tunnel with a header of one cipher id byte
+// followed by a random salt the session keys are derived from.
+const size_t aead_salt_size = 16;
+const size_t aead_header_size = 1 + aead_salt_size;
+
+uint8_t aead_cipher_id(cipher_type type);
+bool aead_cipher_from_id(uint8_t id, cipher_type& type);
+
+// Records are framed as a 2-byte big-endian payload length, the sealed
+// payload and a 16-byte tag. The length is authenticated as additional
+// data and the nonce is a per-direction record counter.
+class aead_state : public cipher_stage {
+public:
+  static const size_t max_record_size = 16 * 1024 - 1;
+  static const size_t tag_size = 16;
+
+  aead_state() = default;
+  ~aead_state();
+
+  aead_state(const aead_state&) = delete;
+  aead_state& operator = (const aead_state&) = delete;
+
+  void init(cipher_type type,
+            const std::vector<uint8_t>& key,
+            const std::vector<uint8_t>& salt,
+            bool server);
+
+  std::vector<char> encrypt(const std::vector<char>& in) override;
+  std::vector<char> decrypt(const std::vector<char>& in) override;
+
+private:
+  void seal(const char* in, size_t len, char* out);
+  void open(const char* in, size_t len, char* out);
+
+  EVP_CIPHER_CTX* m_encrypt_ctx {nullptr};
+  uint64_t m_encrypt_seq {0};
+  EVP_CIPHER_CTX* m_decrypt_ctx {nullptr};
+  uint64_t m_decrypt_seq {0};
+  std::vector<char> m_pending;
+};
+
+// Accepts each counter once, and none more than `size` behind the
+// highest one accepted so far, like the anti-replay window of IPsec
+// (RFC 4303, section 3.4.3).
+class replay_window {
+public:
+  static const uint64_t size = 64;
+
+  bool check(uint64_t seq) const;
+  void update(uint64_t seq);
+
+private:
+  bool m_empty {true};
+  uint64_t m_top {0};
+  uint64_t m_bits {0};  // bit i stands for m_top - i
+};
+
+// Seals the datagrams of the UDP relay one by one, so they may be lost
+// or reordered. A datagram is framed as a 12-byte nonce, the sealed
+// payload and a 16-byte tag. The keys derive from the tunnel key and
+// salt like those of the stream, under their own label, and the nonce is
+// a random prefix followed by a per-direction counter. Replayed
+// datagrams are dropped.
+class aead_datagram {
+public:
+  static const size_t overhead = 12 + aead_state::tag_size;
+
+  aead_datagram() = default;
+  ~aead_datagram();
+
+  aead_datagram(const aead_datagram&) = delete;
+  aead_datagram& operator = (const aead_datagram&) = delete;
+
+  void init(cipher_type type,
+            const std::vector<uint8_t>& key,
+            const std::vector<uint8_t>& salt,
+            bool server);
+
+  // Seals head followed by body into out, which needs room for both and
+  // the overhead, and returns the sealed size.
+  size_t seal(const char* head, size_t head_len,
+              const char* body, size_t body_len, char* out);
+  // Opens a sealed datagram into out, returns the payload size or -1 if
+  // it doesn't authenticate or its nonce was seen before.
+  ssize_t open(const char* in, size_t len, char* out);
+
+private:
+  EVP_CIPHER_CTX* m_seal_ctx {nullptr};
+  EVP_CIPHER_CTX* m_open_ctx {nullptr};
+  uint8_t m_prefix[4];
+  uint64_t m_seq {0};
+  // one window for each prefix the peer seals with
+  std::unordered_map<uint32_t, replay_window> m_windows;
+};
+
+encryptor::behavior_type
+aead_encryptor_impl(encryptor::stateful_pointer<aead_state> self,
+                    cipher_type type,
+                    const std::vector<uint8_t>& key,
+                    const std::vector<uint8_t>& salt,
+                    bool server);
+
+} }
+
+#endif  // RANGER_PROXY_AEAD_ENCRYPTOR_HPP
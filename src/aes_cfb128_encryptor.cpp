@@ -16,10 +16,50 @@
 
 #include "common.hpp"
 #include "aes_cfb128_encryptor.hpp"
+#include "buffer_pool.hpp"
+#include <algorithm>
+#include <stdexcept>
+#include <new>
+#include <limits.h>
 #include <string.h>
 
 namespace ranger { namespace proxy {
 
+namespace {
+
+const EVP_CIPHER* aes_cfb128_cipher(size_t key_bits) {
+  switch (key_bits) {
+  case 256:
+    return EVP_aes_256_cfb128();
+  case 192:
+    return EVP_aes_192_cfb128();
+  default:
+    return EVP_aes_128_cfb128();
+  }
+}
+
+void cipher_update(EVP_CIPHER_CTX* ctx, const char* in, char* out, size_t len) {
+  // CFB128 is a stream mode, the output length always equals the input
+  while (len > 0) {
+    auto n = static_cast<int>(std::min<size_t>(len, INT_MAX));
+    int out_len = 0;
+    if (!EVP_CipherUpdate(ctx, reinterpret_cast<uint8_t*>(out), &out_len,
+                          reinterpret_cast<const uint8_t*>(in), n)) {
+      throw std::runtime_error("EVP_CipherUpdate failed");
+    }
+    in += n;
+    out += n;
+    len -= n;
+  }
+}
+
+}
+
+aes_cfb128_state::~aes_cfb128_state() {
+  EVP_CIPHER_CTX_free(m_encrypt_ctx);
+  EVP_CIPHER_CTX_free(m_decrypt_ctx);
+}
+
 void aes_cfb128_state::init(std::vector<uint8_t> key, std::vector<uint8_t> ivec) {
   if (key.size() * 8 > 192) {
     key.resize(256 / 8);
@@ -28,29 +68,51 @@ void aes_cfb128_state::init(std::vector<uint8_t> key, std::vector<uint8_t> ivec)
   } else {
     key.resize(128 / 8);
   }
-  AES_set_encrypt_key(key.data(), key.size() * 8, &m_key);
-
   ivec.resize(128 / 8);
-  m_encrypt_ivec = ivec;
-  m_decrypt_ivec = std::move(ivec);
+
+  auto cipher = aes_cfb128_cipher(key.size() * 8);
+  m_encrypt_ctx = EVP_CIPHER_CTX_new();
+  m_decrypt_ctx = EVP_CIPHER_CTX_new();
+  if (!m_encrypt_ctx || !m_decrypt_ctx) {
+    throw std::bad_alloc();
+  }
+
+  if (!EVP_CipherInit_ex(m_encrypt_ctx, cipher, nullptr, key.data(), ivec.data(), 1)
+      || !EVP_CipherInit_ex(m_decrypt_ctx, cipher, nullptr, key.data(), ivec.data(), 0)) {
+    throw std::runtime_error("EVP_CipherInit_ex failed");
+  }
 }
 
 std::vector<char> aes_cfb128_state::encrypt(const std::vector<char>& in) {
-  std::vector<char> out(in.size());
-  AES_cfb128_encrypt(reinterpret_cast<const uint8_t*>(in.data()),
-                     reinterpret_cast<uint8_t*>(out.data()), in.size(),
-                     &m_key, m_encrypt_ivec.data(), &m_encrypt_num, AES_ENCRYPT);
+  auto out = buffer_pool::local().acquire(in.size());
+  out.resize(in.size());
+  encrypt(in.data(), out.data(), in.size());
   return out;
 }
 
 std::vector<char> aes_cfb128_state::decrypt(const std::vector<char>& in) {
-  std::vector<char> out(in.size());
-  AES_cfb128_encrypt(reinterpret_cast<const uint8_t*>(in.data()),
-                     reinterpret_cast<uint8_t*>(out.data()), in.size(),
-                     &m_key, m_decrypt_ivec.data(), &m_decrypt_num, AES_DECRYPT);
+  auto out = buffer_pool::local().acquire(in.size());
+  out.resize(in.size());
+  decrypt(in.data(), out.data(), in.size());
   return out;
 }
 
+void aes_cfb128_state::encrypt_in_place(std::vector<char>& buf) {
+  encrypt(buf.data(), buf.data(), buf.size());
+}
+
+void aes_cfb128_state::decrypt_in_place(std::vector<char>& buf) {
+  decrypt(buf.data(), buf.data(), buf.size());
+}
+
+void aes_cfb128_state::encrypt(const char* in, char* out, size_t len) {
+  cipher_update(m_encrypt_ctx, in, out, len);
+}
+
+void aes_cfb128_state::decrypt(const char* in, char* out, size_t len) {
+  cipher_update(m_decrypt_ctx, in, out, len);
+}
+
 encryptor::behavior_type
 aes_cfb128_encryptor_impl(encryptor::stateful_pointer<aes_cfb128_state> self,
                           const std::vector<uint8_t>& key,
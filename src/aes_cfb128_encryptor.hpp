@@ -18,28 +18,33 @@
 #define RANGER_PROXY_AES_CFB128_ENCRYPTOR_HPP
 
 #include "encryptor.hpp"
-#include <openssl/aes.h>
+#include "cipher_pipeline.hpp"
+#include <openssl/evp.h>
 
 namespace ranger { namespace proxy {
 
-class aes_cfb128_state {
+class aes_cfb128_state : public cipher_stage {
 public:
   aes_cfb128_state() = default;
+  ~aes_cfb128_state();
 
   aes_cfb128_state(const aes_cfb128_state&) = delete;
   aes_cfb128_state& operator = (const aes_cfb128_state&) = delete;
 
   void init(std::vector<uint8_t> key, std::vector<uint8_t> ivec);
 
-  std::vector<char> encrypt(const std::vector<char>& in);
-  std::vector<char> decrypt(const std::vector<char>& in);
+  std::vector<char> encrypt(const std::vector<char>& in) override;
+  std::vector<char> decrypt(const std::vector<char>& in) override;
+  void encrypt_in_place(std::vector<char>& buf) override;
+  void decrypt_in_place(std::vector<char>& buf) override;
+
+  // in and out may point to the same buffer
+  void encrypt(const char* in, char* out, size_t len);
+  void decrypt(const char* in, char* out, size_t len);
 
 private:
-  AES_KEY m_key {{0}};
-  std::vector<uint8_t> m_encrypt_ivec;
-  int m_encrypt_num {0};
-  std::vector<uint8_t> m_decrypt_ivec;
-  int m_decrypt_num {0};
+  EVP_CIPHER_CTX* m_encrypt_ctx {nullptr};
+  EVP_CIPHER_CTX* m_decrypt_ctx {nullptr};
 };
 
 encryptor::behavior_type
@@ -18,10 +18,13 @@
 #define RANGER_PROXY_ASYNC_CONNECT_HPP
 
 #include "logger_ostream.hpp"
+#include "dns_resolver.hpp"
+#include "happy_eyeballs.hpp"
 #include <caf/io/network/asio_multiplexer.hpp>
 #include <netinet/in.h>
 #include <arpa/inet.h>
 #include <memory>
+#include <string.h>
 
 namespace ranger { namespace proxy {
 
@@ -54,29 +57,45 @@ void handle_connect_completed(T* self,
   }
 }
 
+template <class T>
+void connect_endpoint(intrusive_ptr<T> self, const boost::asio::ip::tcp::endpoint& ep,
+                      const std::string& ep_info) {
+  auto fd = std::make_shared<network::default_socket>(*self->parent().backend().pimpl());
+  fd->async_connect(ep,
+    [self, ep_info, fd] (const boost::system::error_code& ec) {
+      handle_connect_completed(self.get(), ep_info, std::move(*fd), ec);
+    }
+  );
+}
+
 }
 
 template <class T>
 void async_connect(intrusive_ptr<T> self, const in_addr& addr, uint16_t port) {
   std::string ep_info = std::string(inet_ntoa(addr)) + ":" + std::to_string(port);
-  auto fd = std::make_shared<network::default_socket>(*self->parent().backend().pimpl());
   using boost::asio::ip::tcp;
   using boost::asio::ip::address_v4;
-  fd->async_connect(tcp::endpoint(address_v4(ntohl(addr.s_addr)), port),
-    [self, ep_info, fd] (const boost::system::error_code& ec) {
-      handle_connect_completed(self.get(), ep_info, std::move(*fd), ec);
-    }
-  );
+  connect_endpoint(self, tcp::endpoint(address_v4(ntohl(addr.s_addr)), port), ep_info);
+}
+
+template <class T>
+void async_connect(intrusive_ptr<T> self, const in6_addr& addr, uint16_t port) {
+  using boost::asio::ip::tcp;
+  using boost::asio::ip::address_v6;
+  address_v6::bytes_type bytes;
+  memcpy(bytes.data(), &addr, bytes.size());
+  address_v6 addr_v6(bytes);
+  std::string ep_info = "[" + addr_v6.to_string() + "]:" + std::to_string(port);
+  connect_endpoint(self, tcp::endpoint(addr_v6, port), ep_info);
 }
 
 template <class T>
 void async_connect(intrusive_ptr<T> self, const std::string& host, uint16_t port) {
   std::string ep_info = host + ":" + std::to_string(port);
-  using boost::asio::ip::tcp;
-  auto r = std::make_shared<tcp::resolver>(*self->parent().backend().pimpl());
+  auto& ios = *self->parent().backend().pimpl();
   using boost::system::error_code;
-  r->async_resolve(tcp::resolver::query(host, std::to_string(port)),
-    [self, ep_info, r] (const error_code& ec, tcp::resolver::iterator it) {
+  dns_resolver::instance().resolve(ios, host,
+    [self, ep_info, port] (const error_code& ec, const dns_resolver::address_list& addrs) {
       if (ec) {
         if (self->exit_reason() == exit_reason::not_exited) {
           log(self.get()) << "ERROR: " << ec.message() << ": " << ep_info << std::endl;
@@ -86,12 +105,16 @@ void async_connect(intrusive_ptr<T> self, const std::string& host, uint16_t port
           log(tmp) << "ERROR: " << ec.message() << ": " << ep_info << std::endl;
         }
       } else if (self->exit_reason() == exit_reason::not_exited) {
-        auto fd = std::make_shared<network::default_socket>(*self->parent().backend().pimpl());
-        boost::asio::async_connect(*fd, it,
-          [self, ep_info, fd] (const error_code& ec, tcp::resolver::iterator it) {
-            handle_connect_completed(self.get(), ep_info, std::move(*fd), ec);
-          }
-        );
+        using boost::asio::ip::tcp;
+        std::vector<tcp::endpoint> eps;
+        for (auto& addr : addrs) {
+          eps.emplace_back(addr, port);
+        }
+        auto conn = std::make_shared<happy_eyeballs>(*self->parent().backend().pimpl(),
+                                                     eps, CONNECTION_ATTEMPT_DELAY);
+        conn->start([self, ep_info] (const error_code& ec, tcp::socket sock) {
+          handle_connect_completed(self.get(), ep_info, std::move(sock), ec);
+        });
       }
     }
   );
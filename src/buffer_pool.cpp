@@ -0,0 +1,86 @@
+// ranger_proxy - A SOCKS5 proxy
+// Copyright (C) 2015  RangerUFO <ufownl@gmail.com>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "common.hpp"
+#include "buffer_pool.hpp"
+#include <algorithm>
+
+namespace ranger { namespace proxy {
+
+const size_t buffer_pool::min_size;
+
+buffer_pool::buffer_pool(size_t max_size, size_t max_class_bytes)
+  : m_max_class_bytes(max_class_bytes) {
+  for (auto size = min_size; size <= max_size; size *= 2) {
+    m_classes.push_back({size, {}});
+  }
+}
+
+std::vector<char> buffer_pool::acquire(size_t capacity) {
+  // the smallest class that holds the request
+  auto it = std::find_if(m_classes.begin(), m_classes.end(),
+                         [capacity] (const size_class& c) { return c.size >= capacity; });
+  std::vector<char> buf;
+  if (it == m_classes.end()) {
+    ++m_stats.misses;
+    buf.reserve(capacity);
+  } else if (it->buffers.empty()) {
+    ++m_stats.misses;
+    buf.reserve(it->size);
+  } else {
+    ++m_stats.hits;
+    buf.swap(it->buffers.back());
+    it->buffers.pop_back();
+    m_stats.cached_bytes -= buf.capacity();
+  }
+  return buf;
+}
+
+std::vector<char> buffer_pool::copy(const std::vector<char>& buf) {
+  auto res = acquire(buf.size());
+  res.assign(buf.begin(), buf.end());
+  return res;
+}
+
+void buffer_pool::release(std::vector<char> buf) {
+  if (m_classes.empty() || buf.capacity() < min_size
+      || buf.capacity() >= m_classes.back().size * 2) {
+    return;
+  }
+
+  // the largest class the buffer can serve
+  auto it = std::find_if(m_classes.rbegin(), m_classes.rend(),
+                         [&buf] (const size_class& c) { return c.size <= buf.capacity(); });
+  if ((it->buffers.size() + 1) * it->size > m_max_class_bytes) {
+    return;
+  }
+
+  buf.clear();
+  m_stats.cached_bytes += buf.capacity();
+  m_stats.peak_bytes = std::max(m_stats.peak_bytes, m_stats.cached_bytes);
+  it->buffers.emplace_back(std::move(buf));
+}
+
+const buffer_pool_stats& buffer_pool::stats() const {
+  return m_stats;
+}
+
+buffer_pool& buffer_pool::local() {
+  static thread_local buffer_pool pool(BUFFER_SIZE, 4 * BUFFER_SIZE);
+  return pool;
+}
+
+} }
@@ -0,0 +1,71 @@
+// ranger_proxy - A SOCKS5 proxy
+// Copyright (C) 2015  RangerUFO <ufownl@gmail.com>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef RANGER_PROXY_BUFFER_POOL_HPP
+#define RANGER_PROXY_BUFFER_POOL_HPP
+
+#include <vector>
+#include <stddef.h>
+#include <stdint.h>
+
+namespace ranger { namespace proxy {
+
+struct buffer_pool_stats {
+  uint64_t hits {0};           // served from a cached buffer
+  uint64_t misses {0};         // had to allocate
+  size_t cached_bytes {0};     // capacity held by the free lists
+  size_t peak_bytes {0};       // highest cached_bytes so far
+};
+
+// Recycles relay chunks in power-of-two size classes from min_size up to
+// max_size. Buffers keep their std::allocator storage, so one acquired
+// here may be released to any pool, and a released buffer that doesn't
+// fit a class, or whose class already caches max_class_bytes, is freed.
+// A pool is not thread-safe; local() gives each thread its own.
+class buffer_pool {
+public:
+  static const size_t min_size = 512;
+
+  buffer_pool(size_t max_size, size_t max_class_bytes);
+
+  buffer_pool(const buffer_pool&) = delete;
+  buffer_pool& operator = (const buffer_pool&) = delete;
+
+  // Returns an empty buffer with at least the given capacity.
+  std::vector<char> acquire(size_t capacity);
+  // Returns a pooled copy of buf.
+  std::vector<char> copy(const std::vector<char>& buf);
+  void release(std::vector<char> buf);
+
+  const buffer_pool_stats& stats() const;
+
+  // the pool of the calling thread, classes up to BUFFER_SIZE
+  static buffer_pool& local();
+
+private:
+  struct size_class {
+    size_t size;
+    std::vector<std::vector<char>> buffers;
+  };
+
+  std::vector<size_class> m_classes;
+  size_t m_max_class_bytes;
+  buffer_pool_stats m_stats;
+};
+
+} }
+
+#endif  // RANGER_PROXY_BUFFER_POOL_HPP
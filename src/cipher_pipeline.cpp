@@ -0,0 +1,118 @@
+// ranger_proxy - A SOCKS5 proxy
+// Copyright (C) 2015  RangerUFO <ufownl@gmail.com>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "common.hpp"
+#include "cipher_pipeline.hpp"
+#include "aes_cfb128_encryptor.hpp"
+#include "aead_encryptor.hpp"
+#include "codec.hpp"
+
+namespace ranger { namespace proxy {
+
+void cipher_pipeline::init(const std::vector<uint8_t>& key,
+                           const std::vector<uint8_t>& ivec,
+                           const codec_spec& codec) {
+  std::unique_ptr<aes_cfb128_state> aes;
+  if (!key.empty()) {
+    aes.reset(new aes_cfb128_state);
+    aes->init(key, ivec);
+  }
+  init(std::move(aes), codec);
+}
+
+void cipher_pipeline::init(std::unique_ptr<cipher_stage> cipher, const codec_spec& codec) {
+  // same order as the actor chain: compress first, then encrypt
+  if (codec) {
+    std::unique_ptr<codec_stage> stage(new codec_stage);
+    stage->init(codec);
+    m_codec = stage.get();
+    add_stage(std::move(stage));
+  }
+
+  if (cipher) {
+    add_stage(std::move(cipher));
+  }
+}
+
+void cipher_pipeline::init(cipher_type cipher,
+                           const std::vector<uint8_t>& key,
+                           const std::vector<uint8_t>& iv,
+                           bool server,
+                           const codec_spec& codec) {
+  if (!key.empty() && is_aead_cipher(cipher)) {
+    std::unique_ptr<aead_state> aead(new aead_state);
+    aead->init(cipher, key, iv, server);
+    init(std::move(aead), codec);
+  } else {
+    init(key, iv, codec);
+  }
+}
+
+void cipher_pipeline::add_stage(std::unique_ptr<cipher_stage> stage) {
+  m_stages.emplace_back(std::move(stage));
+}
+
+bool cipher_pipeline::empty() const {
+  return m_stages.empty();
+}
+
+cipher_pipeline::operator bool () const {
+  return !empty();
+}
+
+const codec_stage* cipher_pipeline::codec() const {
+  return m_codec;
+}
+
+std::vector<char> cipher_pipeline::encrypt(const std::vector<char>& in) {
+  if (m_stages.empty()) {
+    return in;
+  }
+
+  auto it = m_stages.begin();
+  auto out = (*it)->encrypt(in);
+  for (++it; it != m_stages.end(); ++it) {
+    out = (*it)->encrypt(out);
+  }
+  return out;
+}
+
+std::vector<char> cipher_pipeline::decrypt(const std::vector<char>& in) {
+  if (m_stages.empty()) {
+    return in;
+  }
+
+  auto it = m_stages.rbegin();
+  auto out = (*it)->decrypt(in);
+  for (++it; it != m_stages.rend(); ++it) {
+    out = (*it)->decrypt(out);
+  }
+  return out;
+}
+
+void cipher_pipeline::encrypt_in_place(std::vector<char>& buf) {
+  for (auto& stage : m_stages) {
+    stage->encrypt_in_place(buf);
+  }
+}
+
+void cipher_pipeline::decrypt_in_place(std::vector<char>& buf) {
+  for (auto it = m_stages.rbegin(); it != m_stages.rend(); ++it) {
+    (*it)->decrypt_in_place(buf);
+  }
+}
+
+} }
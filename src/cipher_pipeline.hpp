@@ -0,0 +1,100 @@
+// ranger_proxy - A SOCKS5 proxy
+// Copyright (C) 2015  RangerUFO <ufownl@gmail.com>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef RANGER_PROXY_CIPHER_PIPELINE_HPP
+#define RANGER_PROXY_CIPHER_PIPELINE_HPP
+
+#include <vector>
+#include <memory>
+#include <stdint.h>
+
+namespace ranger { namespace proxy {
+
+enum class cipher_type : uint8_t;
+struct codec_spec;
+class codec_stage;
+
+class cipher_stage {
+public:
+  virtual ~cipher_stage() = default;
+
+  virtual std::vector<char> encrypt(const std::vector<char>& in) = 0;
+  virtual std::vector<char> decrypt(const std::vector<char>& in) = 0;
+
+  // Stages that keep the length override these to skip the copy.
+  virtual void encrypt_in_place(std::vector<char>& buf) {
+    buf = encrypt(buf);
+  }
+
+  virtual void decrypt_in_place(std::vector<char>& buf) {
+    buf = decrypt(buf);
+  }
+
+  // Encrypts onto the end of `out`, after whatever it already holds.
+  // Stages that can write there directly override this.
+  virtual void encrypt_append(const std::vector<char>& in, std::vector<char>& out) {
+    auto buf = encrypt(in);
+    out.insert(out.end(), buf.begin(), buf.end());
+  }
+
+  // Decrypts a slice of a larger buffer onto the end of `out`. Stages
+  // that can read the slice where it is override this.
+  virtual void decrypt_append(const char* data, size_t len, std::vector<char>& out) {
+    auto buf = decrypt(std::vector<char>(data, data + len));
+    out.insert(out.end(), buf.begin(), buf.end());
+  }
+};
+
+// A stack of cipher stages called in-line by the session brokers.
+// Encryption runs the stages front to back, decryption back to front.
+class cipher_pipeline {
+public:
+  cipher_pipeline() = default;
+
+  cipher_pipeline(const cipher_pipeline&) = delete;
+  cipher_pipeline& operator = (const cipher_pipeline&) = delete;
+
+  void init(const std::vector<uint8_t>& key,
+            const std::vector<uint8_t>& ivec,
+            const codec_spec& codec);
+  void init(std::unique_ptr<cipher_stage> cipher, const codec_spec& codec);
+  // iv is the AES-CFB128 IV, or the salt the AEAD keys are derived from
+  void init(cipher_type cipher,
+            const std::vector<uint8_t>& key,
+            const std::vector<uint8_t>& iv,
+            bool server,
+            const codec_spec& codec);
+  void add_stage(std::unique_ptr<cipher_stage> stage);
+
+  bool empty() const;
+  explicit operator bool () const;
+
+  // the compression stage, if any, for its counters
+  const codec_stage* codec() const;
+
+  std::vector<char> encrypt(const std::vector<char>& in);
+  std::vector<char> decrypt(const std::vector<char>& in);
+  void encrypt_in_place(std::vector<char>& buf);
+  void decrypt_in_place(std::vector<char>& buf);
+
+private:
+  std::vector<std::unique_ptr<cipher_stage>> m_stages;
+  codec_stage* m_codec {nullptr};
+};
+
+} }
+
+#endif  // RANGER_PROXY_CIPHER_PIPELINE_HPP
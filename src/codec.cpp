@@ -0,0 +1,388 @@
+// ranger_proxy - A SOCKS5 proxy
+// Copyright (C) 2015  RangerUFO <ufownl@gmail.com>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "common.hpp"
+#include "codec.hpp"
+#include "zlib_encryptor.hpp"
+#include "lz4_codec.hpp"
+#include "zstd_codec.hpp"
+#include <algorithm>
+#include <stdexcept>
+#include <stdlib.h>
+#include <time.h>
+
+namespace ranger { namespace proxy {
+
+namespace {
+
+// first byte of a zlib stream with the default window, an LZ4 frame and
+// a Zstd frame respectively
+const uint8_t zlib_magic = 0x78;
+const uint8_t lz4_magic = 0x04;
+const uint8_t zstd_magic = 0x28;
+
+// kind bytes of the adaptive frames
+const uint8_t stored_frame = 0xC0;
+const uint8_t compressed_frame = 0xC1;
+const size_t frame_header_size = 5;
+
+// a chunk is poor if it keeps more than 90% of its size
+const size_t poor_chunk_limit = 4;
+const size_t min_probe_interval = 8;
+const size_t max_probe_interval = 64;
+
+// one chunk in this many is timed and stands for the others, reading
+// the thread's CPU clock costs a system call
+const size_t cpu_sample_interval = 16;
+
+std::chrono::nanoseconds thread_cpu_time() {
+  timespec ts;
+  if (clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts) != 0) {
+    return std::chrono::nanoseconds(0);
+  }
+  return std::chrono::seconds(ts.tv_sec) + std::chrono::nanoseconds(ts.tv_nsec);
+}
+
+// Adds the CPU time of its scope to `total` if the chunk is sampled.
+class cpu_sample {
+public:
+  cpu_sample(size_t& countdown, std::chrono::nanoseconds& total)
+    : m_total(total) {
+    if (countdown == 0) {
+      countdown = cpu_sample_interval - 1;
+      m_timed = true;
+      m_begin = thread_cpu_time();
+    } else {
+      --countdown;
+    }
+  }
+
+  ~cpu_sample() {
+    if (m_timed) {
+      m_total += (thread_cpu_time() - m_begin) * cpu_sample_interval;
+    }
+  }
+
+  cpu_sample(const cpu_sample&) = delete;
+  cpu_sample& operator = (const cpu_sample&) = delete;
+
+private:
+  std::chrono::nanoseconds& m_total;
+  bool m_timed {false};
+  std::chrono::nanoseconds m_begin {0};
+};
+
+// a spare frame buffer bigger than this is given back after use
+const size_t max_frame_buffer_size = 2 * BUFFER_SIZE;
+
+// fills in the header room at the front of a frame
+void write_frame_header(std::vector<char>& frame, uint8_t kind) {
+  auto len = static_cast<uint32_t>(frame.size() - frame_header_size);
+  frame[0] = static_cast<char>(kind);
+  frame[1] = static_cast<char>(len >> 24);
+  frame[2] = static_cast<char>(len >> 16);
+  frame[3] = static_cast<char>(len >> 8);
+  frame[4] = static_cast<char>(len);
+}
+
+void recycle_frame_buffer(std::vector<char>& buf) {
+  if (buf.capacity() > max_frame_buffer_size) {
+    std::vector<char>().swap(buf);
+  } else {
+    buf.clear();
+  }
+}
+
+std::unique_ptr<cipher_stage> make_codec(const codec_spec& spec) {
+  switch (spec.type) {
+  case codec_type::zlib: {
+    std::unique_ptr<zlib_codec> codec(new zlib_codec);
+    codec->init(spec.level);
+    return std::move(codec);
+  }
+#ifdef RANGER_PROXY_HAVE_LZ4
+  case codec_type::lz4: {
+    std::unique_ptr<lz4_codec> codec(new lz4_codec);
+    codec->init(spec.level);
+    return std::move(codec);
+  }
+#endif
+#ifdef RANGER_PROXY_HAVE_ZSTD
+  case codec_type::zstd: {
+    std::unique_ptr<zstd_codec> codec(new zstd_codec);
+    codec->init(spec.level);
+    return std::move(codec);
+  }
+#endif
+  default:
+    throw std::runtime_error(std::string("Unsupported codec[") + codec_name(spec.type) + "]");
+  }
+}
+
+std::unique_ptr<cipher_stage> make_decoder(uint8_t magic) {
+  switch (magic) {
+  case zlib_magic:
+    return make_codec(codec_type::zlib);
+  case lz4_magic:
+    return make_codec(codec_type::lz4);
+  case zstd_magic:
+    return make_codec(codec_type::zstd);
+  default:
+    throw std::runtime_error("Unknown compressed stream from the peer");
+  }
+}
+
+}
+
+bool parse_codec(const std::string& name, codec_spec& spec) {
+  static const std::string adaptive_suffix = "+adaptive";
+  auto base = name;
+  auto adaptive = false;
+  if (base.size() > adaptive_suffix.size()
+      && base.compare(base.size() - adaptive_suffix.size(),
+                      adaptive_suffix.size(), adaptive_suffix) == 0) {
+    base.resize(base.size() - adaptive_suffix.size());
+    adaptive = true;
+  }
+
+  auto pos = base.find(':');
+  auto type_name = base.substr(0, pos);
+  codec_spec res;
+  if (type_name.empty()) {
+    res = codec_spec();
+  } else if (type_name == "zlib") {
+    res = codec_spec(codec_type::zlib, Z_BEST_COMPRESSION);
+  } else if (type_name == "lz4") {
+    res = codec_spec(codec_type::lz4, 0);
+  } else if (type_name == "zstd") {
+    res = codec_spec(codec_type::zstd, 3);
+  } else {
+    return false;
+  }
+
+  if (pos != std::string::npos) {
+    auto level = base.c_str() + pos + 1;
+    char* end = nullptr;
+    res.level = static_cast<int>(strtol(level, &end, 10));
+    if (!res || end == level || *end != '\0') {
+      return false;
+    }
+  }
+
+  res.adaptive = adaptive;
+  spec = res;
+  return true;
+}
+
+bool codec_supported(codec_type type) {
+  switch (type) {
+  case codec_type::none:
+  case codec_type::zlib:
+    return true;
+  case codec_type::lz4:
+#ifdef RANGER_PROXY_HAVE_LZ4
+    return true;
+#else
+    return false;
+#endif
+  case codec_type::zstd:
+#ifdef RANGER_PROXY_HAVE_ZSTD
+    return true;
+#else
+    return false;
+#endif
+  }
+  return false;
+}
+
+const char* codec_name(codec_type type) {
+  switch (type) {
+  case codec_type::zlib:
+    return "zlib";
+  case codec_type::lz4:
+    return "lz4";
+  case codec_type::zstd:
+    return "zstd";
+  default:
+    return "none";
+  }
+}
+
+void codec_stage::init(const codec_spec& spec) {
+  m_encoder = make_codec(spec);
+  m_adaptive = spec.adaptive;
+}
+
+std::vector<char> codec_stage::encrypt(const std::vector<char>& in) {
+  if (m_adaptive) {
+    auto buf = in;
+    encrypt_in_place(buf);
+    return buf;
+  }
+
+  std::vector<char> out;
+  {
+    cpu_sample sample(m_cpu_countdown, m_stats.cpu_time);
+    out = m_encoder->encrypt(in);
+  }
+  m_stats.plain_bytes += in.size();
+  m_stats.encoded_bytes += out.size();
+  return out;
+}
+
+std::vector<char> codec_stage::decrypt(const std::vector<char>& in) {
+  if (!detect_decoder(in)) {
+    return {};
+  }
+
+  cpu_sample sample(m_cpu_countdown, m_stats.cpu_time);
+  if (m_framed) {
+    std::vector<char> out;
+    decode_frames(in, out);
+    return out;
+  }
+  return m_decoder->decrypt(in);
+}
+
+void codec_stage::encrypt_in_place(std::vector<char>& buf) {
+  auto size = buf.size();
+  {
+    cpu_sample sample(m_cpu_countdown, m_stats.cpu_time);
+    if (m_adaptive) {
+      encode_frames(buf);
+    } else {
+      m_encoder->encrypt_in_place(buf);
+    }
+  }
+  m_stats.plain_bytes += size;
+  m_stats.encoded_bytes += buf.size();
+}
+
+void codec_stage::decrypt_in_place(std::vector<char>& buf) {
+  if (!detect_decoder(buf)) {
+    return;
+  }
+
+  cpu_sample sample(m_cpu_countdown, m_stats.cpu_time);
+  if (m_framed) {
+    decode_frames(buf, m_decoded);
+    buf.swap(m_decoded);
+    recycle_frame_buffer(m_decoded);
+  } else {
+    m_decoder->decrypt_in_place(buf);
+  }
+}
+
+const codec_stats& codec_stage::stats() const {
+  return m_stats;
+}
+
+bool codec_stage::detect_decoder(const std::vector<char>& in) {
+  if (m_decoder || m_framed) {
+    return true;
+  } else if (in.empty()) {
+    return false;
+  }
+
+  auto magic = static_cast<uint8_t>(in.front());
+  if (magic == stored_frame || magic == compressed_frame) {
+    m_framed = true;
+  } else {
+    m_decoder = make_decoder(magic);
+  }
+  return true;
+}
+
+void codec_stage::encode_frames(std::vector<char>& buf) {
+  if (buf.empty()) {
+    return;
+  }
+
+  // the frame is built in the spare buffer behind room for its header,
+  // then swapped with `buf`
+  auto& frame = m_encoded;
+  frame.resize(frame_header_size);
+  auto probe = !m_compressing && --m_probe_countdown == 0;
+  if (!m_compressing && !probe) {
+    m_stats.stored_bytes += buf.size();
+    frame.insert(frame.end(), buf.begin(), buf.end());
+    write_frame_header(frame, stored_frame);
+    buf.swap(frame);
+    recycle_frame_buffer(frame);
+    return;
+  }
+
+  // the compressed frames carry one continuous stream, so the output is
+  // sent even when it didn't pay off
+  auto size = buf.size();
+  m_encoder->encrypt_append(buf, frame);
+  auto compressed = frame.size() - frame_header_size;
+  if (compressed * 10 < size * 9) {
+    m_compressing = true;
+    m_poor_chunks = 0;
+  } else if (probe) {
+    m_probe_interval = std::min(m_probe_interval * 2, max_probe_interval);
+    m_probe_countdown = m_probe_interval;
+  } else if (++m_poor_chunks >= poor_chunk_limit) {
+    m_compressing = false;
+    m_probe_interval = min_probe_interval;
+    m_probe_countdown = m_probe_interval;
+  }
+  write_frame_header(frame, compressed_frame);
+  buf.swap(frame);
+  recycle_frame_buffer(frame);
+}
+
+void codec_stage::decode_frames(const std::vector<char>& in, std::vector<char>& out) {
+  out.clear();
+  size_t pos = 0;
+  while (pos < in.size()) {
+    if (m_frame_left == 0) {
+      auto n = std::min(frame_header_size - m_frame_header.size(), in.size() - pos);
+      m_frame_header.insert(m_frame_header.end(), in.begin() + pos, in.begin() + pos + n);
+      pos += n;
+      if (m_frame_header.size() < frame_header_size) {
+        break;
+      }
+
+      auto hdr = reinterpret_cast<const uint8_t*>(m_frame_header.data());
+      m_frame_kind = hdr[0];
+      if (m_frame_kind != stored_frame && m_frame_kind != compressed_frame) {
+        throw std::runtime_error("Malformed compressed frame from the peer");
+      }
+      m_frame_left = (static_cast<size_t>(hdr[1]) << 24)
+                     | (static_cast<size_t>(hdr[2]) << 16)
+                     | (static_cast<size_t>(hdr[3]) << 8)
+                     | static_cast<size_t>(hdr[4]);
+      m_frame_header.clear();
+      continue;
+    }
+
+    auto n = std::min(m_frame_left, in.size() - pos);
+    if (m_frame_kind == stored_frame) {
+      out.insert(out.end(), in.begin() + pos, in.begin() + pos + n);
+    } else {
+      if (!m_decoder) {
+        m_decoder = make_decoder(static_cast<uint8_t>(in[pos]));
+      }
+      m_decoder->decrypt_append(in.data() + pos, n, out);
+    }
+    pos += n;
+    m_frame_left -= n;
+  }
+}
+
+} }
@@ -0,0 +1,120 @@
+// ranger_proxy - A SOCKS5 proxy
+// Copyright (C) 2015  RangerUFO <ufownl@gmail.com>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef RANGER_PROXY_CODEC_HPP
+#define RANGER_PROXY_CODEC_HPP
+
+#include "cipher_pipeline.hpp"
+#include <string>
+#include <chrono>
+
+namespace ranger { namespace proxy {
+
+enum class codec_type : uint8_t {
+  none,
+  zlib,
+  lz4,
+  zstd
+};
+
+struct codec_spec {
+  codec_spec(codec_type t = codec_type::none, int l = 0, bool a = false)
+    : type(t)
+    , level(l)
+    , adaptive(a) {
+    // nop
+  }
+
+  explicit operator bool () const {
+    return type != codec_type::none;
+  }
+
+  codec_type type;
+  int level;
+  bool adaptive;
+};
+
+struct codec_stats {
+  uint64_t plain_bytes {0};    // handed to the stage for sending
+  uint64_t encoded_bytes {0};  // sent for them, framing included
+  uint64_t stored_bytes {0};   // sent in stored frames
+  std::chrono::nanoseconds cpu_time {0};  // thread CPU time, both directions, sampled
+
+  int64_t saved_bytes() const {
+    return static_cast<int64_t>(plain_bytes) - static_cast<int64_t>(encoded_bytes);
+  }
+};
+
+// Accepts "zlib", "lz4" or "zstd", optionally followed by ":<level>" and
+// then by "+adaptive". An empty name disables compression.
+bool parse_codec(const std::string& name, codec_spec& spec);
+bool codec_supported(codec_type type);
+const char* codec_name(codec_type type);
+
+// Compresses with the configured codec and decompresses with whichever
+// codec the peer's stream starts with, so each side picks its own codec
+// and level. The zlib, LZ4 frame and Zstd frame formats all open with a
+// distinct magic byte, which keeps the streams of older peers readable.
+//
+// In adaptive mode the output is a sequence of frames, a kind byte and a
+// 4-byte big-endian length followed by either stored bytes or a slice of
+// the compressed stream. The kind bytes differ from the magic bytes
+// above. Chunks that keep compressing poorly switch the encoder to stored
+// frames, and it probes with a compressed chunk at growing intervals
+// until the data compresses again.
+class codec_stage : public cipher_stage {
+public:
+  codec_stage() = default;
+
+  codec_stage(const codec_stage&) = delete;
+  codec_stage& operator = (const codec_stage&) = delete;
+
+  void init(const codec_spec& spec);
+
+  std::vector<char> encrypt(const std::vector<char>& in) override;
+  std::vector<char> decrypt(const std::vector<char>& in) override;
+  void encrypt_in_place(std::vector<char>& buf) override;
+  void decrypt_in_place(std::vector<char>& buf) override;
+
+  const codec_stats& stats() const;
+
+private:
+  bool detect_decoder(const std::vector<char>& in);
+  void encode_frames(std::vector<char>& buf);
+  void decode_frames(const std::vector<char>& in, std::vector<char>& out);
+
+  std::unique_ptr<cipher_stage> m_encoder;
+  bool m_adaptive {false};
+  bool m_compressing {true};
+  size_t m_poor_chunks {0};
+  size_t m_probe_interval {0};
+  size_t m_probe_countdown {0};
+  std::vector<char> m_encoded;  // spare buffer the next frame is built in
+
+  std::unique_ptr<cipher_stage> m_decoder;
+  bool m_framed {false};
+  std::vector<char> m_frame_header;
+  uint8_t m_frame_kind {0};
+  size_t m_frame_left {0};
+  std::vector<char> m_decoded;  // spare buffer the next chunk is decoded into
+
+  codec_stats m_stats;
+  size_t m_cpu_countdown {0};
+};
+
+} }
+
+#endif  // RANGER_PROXY_CODEC_HPP
@@ -24,10 +24,65 @@ namespace ranger { namespace proxy {
 
 const size_t BUFFER_SIZE = 256 * 1024;  // default: 256k
 
+// connections start reading this much and grow towards BUFFER_SIZE
+const size_t MIN_RECEIVE_SIZE = 4 * 1024;
+
+// bytes queued for a peer before reading from its producer pauses, and
+// the level they have to drain to before it resumes
+const size_t HIGH_WATERMARK = 4 * BUFFER_SIZE;
+const size_t LOW_WATERMARK = BUFFER_SIZE;
+
 using namespace caf;
 using namespace caf::io;
 using namespace caf::io::experimental;
 
+// CAF 0.14 does not report written bytes, a paused session polls its
+// write buffer instead
+using drain_atom = atom_constant<atom("drain")>;
+const std::chrono::milliseconds DRAIN_CHECK_INTERVAL(10);
+
+// sent to a session whose rate limits had it stop reading once there
+// are tokens again
+using shape_atom = atom_constant<atom("shape")>;
+
+// the shared DNS resolver: parallel lookups, how long addresses and
+// names that don't exist are cached, and how many names it keeps
+const size_t DNS_RESOLVER_THREADS = 4;
+const std::chrono::seconds DNS_CACHE_TTL(60);
+const std::chrono::seconds DNS_NEGATIVE_TTL(10);
+const size_t DNS_CACHE_SIZE = 4096;
+
+// a domain-name connect starts its next attempt when an attempt hasn't
+// completed after this long, the value RFC 8305 recommends
+const std::chrono::milliseconds CONNECTION_ATTEMPT_DELAY(250);
+
+// UDP ASSOCIATE: datagrams moved per system call, the largest datagram,
+// and how long and how many targets an association accepts replies from
+const size_t UDP_BATCH_SIZE = 16;
+const size_t UDP_DATAGRAM_SIZE = 64 * 1024;
+const std::chrono::seconds UDP_NAT_TIMEOUT(60);
+const size_t UDP_NAT_ENTRIES = 1024;
+
+// how often a user file is checked for changes
+const std::chrono::seconds USER_FILE_CHECK_INTERVAL(1);
+
+// has a service listen with SO_REUSEPORT, so the reactor processes
+// started by --reactors share its ports
+using reuse_port_atom = atom_constant<atom("reuseport")>;
+
+// sent by the timer wheel to a session that has been idle too long
+using idle_atom = atom_constant<atom("idle")>;
+
+// Seconds a session may spend on the client's handshake up to its
+// request, on connecting to the target, and relaying without traffic in
+// either direction. The first two are short so half-open clients don't
+// hold on to their sessions.
+struct session_timeouts {
+  int handshake {10};
+  int connect {10};
+  int idle {300};
+};
+
 } }
 
 #endif  // RANGER_PROXY_COMMON_HPP
@@ -0,0 +1,247 @@
+// ranger_proxy - A SOCKS5 proxy
+// Copyright (C) 2015  RangerUFO <ufownl@gmail.com>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "common.hpp"
+#include "dns_resolver.hpp"
+#include <algorithm>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netdb.h>
+#include <string.h>
+#include <errno.h>
+
+namespace ranger { namespace proxy {
+
+namespace {
+
+boost::system::error_code translate_addrinfo_error(int err) {
+  switch (err) {
+  case EAI_AGAIN:
+    return boost::asio::error::host_not_found_try_again;
+  case EAI_MEMORY:
+    return boost::asio::error::no_memory;
+  case EAI_NONAME:
+#if defined(EAI_NODATA) && EAI_NODATA != EAI_NONAME
+  case EAI_NODATA:
+#endif
+    return boost::asio::error::host_not_found;
+  case EAI_SYSTEM:
+    return boost::system::error_code(errno, boost::system::system_category());
+  default:
+    return boost::system::error_code(err, boost::asio::error::get_addrinfo_category());
+  }
+}
+
+}
+
+dns_resolver::dns_resolver(size_t threads,
+                           std::chrono::milliseconds ttl,
+                           std::chrono::milliseconds negative_ttl,
+                           size_t max_entries,
+                           lookup_function lookup)
+  : m_max_threads(std::max<size_t>(threads, 1))
+  , m_ttl(ttl)
+  , m_negative_ttl(negative_ttl)
+  , m_max_entries(max_entries)
+  , m_lookup(std::move(lookup)) {
+  // nop
+}
+
+dns_resolver::~dns_resolver() {
+  {
+    std::lock_guard<std::mutex> lk(m_mtx);
+    m_stopped = true;
+  }
+  m_cv.notify_all();
+  for (auto& t : m_threads) {
+    t.join();
+  }
+}
+
+void dns_resolver::resolve(boost::asio::io_service& ios,
+                           const std::string& host, handler hdl) {
+  std::unique_lock<std::mutex> lk(m_mtx);
+  auto it = m_cache.find(host);
+  if (it != m_cache.end()) {
+    if (it->second.expiry > clock::now()) {
+      if (it->second.ec) {
+        ++m_stats.negative_hits;
+      } else {
+        ++m_stats.hits;
+      }
+      auto ec = it->second.ec;
+      auto addrs = it->second.addrs;
+      lk.unlock();
+      ios.post([hdl, ec, addrs] {
+        hdl(ec, addrs);
+      });
+      return;
+    }
+    m_cache.erase(it);
+  }
+
+  auto& waiters = m_pending[host];
+  waiters.push_back({&ios, std::move(hdl)});
+  if (waiters.size() > 1) {
+    ++m_stats.coalesced;
+    return;
+  }
+
+  ++m_stats.misses;
+  m_queue.push_back(host);
+  if (m_idle_threads == 0 && m_threads.size() < m_max_threads) {
+    m_threads.emplace_back([this] { work(); });
+  } else {
+    m_cv.notify_one();
+  }
+}
+
+dns_resolver_stats dns_resolver::stats() const {
+  std::lock_guard<std::mutex> lk(m_mtx);
+  auto res = m_stats;
+  res.entries = m_cache.size();
+  return res;
+}
+
+boost::system::error_code dns_resolver::system_lookup(const std::string& host,
+                                                      address_list& addrs) {
+  addrinfo hints;
+  memset(&hints, 0, sizeof(hints));
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+  hints.ai_flags = AI_ADDRCONFIG;
+  addrinfo* res = nullptr;
+  auto err = getaddrinfo(host.c_str(), nullptr, &hints, &res);
+  if (err != 0) {
+    return translate_addrinfo_error(err);
+  }
+
+  for (auto i = res; i; i = i->ai_next) {
+    boost::asio::ip::address addr;
+    if (i->ai_family == AF_INET) {
+      auto sin = reinterpret_cast<const sockaddr_in*>(i->ai_addr);
+      addr = boost::asio::ip::address_v4(ntohl(sin->sin_addr.s_addr));
+    } else if (i->ai_family == AF_INET6) {
+      auto sin6 = reinterpret_cast<const sockaddr_in6*>(i->ai_addr);
+      boost::asio::ip::address_v6::bytes_type bytes;
+      memcpy(bytes.data(), &sin6->sin6_addr, bytes.size());
+      addr = boost::asio::ip::address_v6(bytes, sin6->sin6_scope_id);
+    } else {
+      continue;
+    }
+
+    if (std::find(addrs.begin(), addrs.end(), addr) == addrs.end()) {
+      addrs.push_back(addr);
+    }
+  }
+  freeaddrinfo(res);
+
+  if (addrs.empty()) {
+    return boost::asio::error::host_not_found;
+  }
+  return {};
+}
+
+dns_resolver& dns_resolver::instance() {
+  // never destroyed, a worker may still be blocked in a lookup at exit
+  static auto res = new dns_resolver(DNS_RESOLVER_THREADS, DNS_CACHE_TTL,
+                                     DNS_NEGATIVE_TTL, DNS_CACHE_SIZE);
+  return *res;
+}
+
+void dns_resolver::work() {
+  std::unique_lock<std::mutex> lk(m_mtx);
+  for (;;) {
+    ++m_idle_threads;
+    m_cv.wait(lk, [this] { return m_stopped || !m_queue.empty(); });
+    --m_idle_threads;
+    if (m_stopped) {
+      return;
+    }
+
+    auto host = std::move(m_queue.front());
+    m_queue.pop_front();
+    lk.unlock();
+
+    auto begin = clock::now();
+    address_list addrs;
+    auto ec = m_lookup(host, addrs);
+    auto end = clock::now();
+
+    lk.lock();
+    ++m_stats.lookups;
+    auto latency = std::chrono::duration_cast<std::chrono::nanoseconds>(end - begin);
+    m_stats.total_latency += latency;
+    m_stats.max_latency = std::max(m_stats.max_latency, latency);
+    if (ec) {
+      ++m_stats.failures;
+    }
+    store(host, ec, addrs, end);
+
+    auto it = m_pending.find(host);
+    auto waiters = std::move(it->second);
+    m_pending.erase(it);
+    lk.unlock();
+
+    for (auto& w : waiters) {
+      auto hdl = std::move(w.hdl);
+      w.ios->post([hdl, ec, addrs] {
+        hdl(ec, addrs);
+      });
+    }
+    lk.lock();
+  }
+}
+
+void dns_resolver::store(const std::string& host,
+                         const boost::system::error_code& ec, const address_list& addrs,
+                         clock::time_point now) {
+  // only a name that doesn't exist is worth remembering as a failure,
+  // temporary errors are retried by the next request
+  clock::duration ttl;
+  if (!ec) {
+    ttl = m_ttl;
+  } else if (ec == boost::asio::error::host_not_found) {
+    ttl = m_negative_ttl;
+  } else {
+    return;
+  }
+
+  if (ttl <= clock::duration::zero() || m_max_entries == 0) {
+    return;
+  }
+
+  if (m_cache.size() >= m_max_entries) {
+    for (auto i = m_cache.begin(); i != m_cache.end();) {
+      if (i->second.expiry <= now) {
+        i = m_cache.erase(i);
+      } else {
+        ++i;
+      }
+    }
+    if (m_cache.size() >= m_max_entries) {
+      m_cache.erase(m_cache.begin());
+    }
+  }
+
+  auto& e = m_cache[host];
+  e.ec = ec;
+  e.addrs = addrs;
+  e.expiry = now + ttl;
+}
+
+} }
@@ -0,0 +1,120 @@
+// ranger_proxy - A SOCKS5 proxy
+// Copyright (C) 2015  RangerUFO <ufownl@gmail.com>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef RANGER_PROXY_DNS_RESOLVER_HPP
+#define RANGER_PROXY_DNS_RESOLVER_HPP
+
+#include <boost/asio.hpp>
+#include <condition_variable>
+#include <unordered_map>
+#include <functional>
+#include <chrono>
+#include <string>
+#include <vector>
+#include <thread>
+#include <deque>
+#include <mutex>
+#include <stdint.h>
+
+namespace ranger { namespace proxy {
+
+struct dns_resolver_stats {
+  uint64_t hits {0};           // answered from a cached address list
+  uint64_t negative_hits {0};  // answered from a cached failure
+  uint64_t misses {0};         // started a lookup
+  uint64_t coalesced {0};      // joined a lookup already in flight
+  uint64_t lookups {0};        // finished lookups
+  uint64_t failures {0};       // lookups that ended in an error
+  std::chrono::nanoseconds total_latency {0};  // of all finished lookups
+  std::chrono::nanoseconds max_latency {0};
+  size_t entries {0};          // cached names, failures included
+};
+
+// Resolves host names for the whole proxy. Lookups run on a few worker
+// threads, so a slow name doesn't hold up the others, and concurrent
+// requests for the same name share one lookup. Address lists are cached
+// for ttl and names that don't exist for negative_ttl, getaddrinfo
+// doesn't report the record TTLs. Handlers always run on the io_service
+// they were requested from.
+class dns_resolver {
+public:
+  using address_list = std::vector<boost::asio::ip::address>;
+  using handler = std::function<void(const boost::system::error_code&,
+                                     const address_list&)>;
+  // runs on a worker thread and blocks until the name is resolved
+  using lookup_function = std::function<boost::system::error_code(const std::string&,
+                                                                  address_list&)>;
+
+  dns_resolver(size_t threads,
+               std::chrono::milliseconds ttl,
+               std::chrono::milliseconds negative_ttl,
+               size_t max_entries,
+               lookup_function lookup = system_lookup);
+  ~dns_resolver();
+
+  dns_resolver(const dns_resolver&) = delete;
+  dns_resolver& operator = (const dns_resolver&) = delete;
+
+  void resolve(boost::asio::io_service& ios, const std::string& host, handler hdl);
+
+  dns_resolver_stats stats() const;
+
+  // getaddrinfo for stream sockets on the configured address families
+  static boost::system::error_code system_lookup(const std::string& host,
+                                                 address_list& addrs);
+
+  // the resolver shared by all sessions
+  static dns_resolver& instance();
+
+private:
+  using clock = std::chrono::steady_clock;
+
+  struct waiter {
+    boost::asio::io_service* ios;
+    handler hdl;
+  };
+
+  struct entry {
+    boost::system::error_code ec;
+    address_list addrs;
+    clock::time_point expiry;
+  };
+
+  void work();
+  void store(const std::string& host,
+             const boost::system::error_code& ec, const address_list& addrs,
+             clock::time_point now);
+
+  const size_t m_max_threads;
+  const clock::duration m_ttl;
+  const clock::duration m_negative_ttl;
+  const size_t m_max_entries;
+  const lookup_function m_lookup;
+
+  mutable std::mutex m_mtx;
+  std::condition_variable m_cv;
+  std::vector<std::thread> m_threads;
+  size_t m_idle_threads {0};
+  bool m_stopped {false};
+  std::deque<std::string> m_queue;
+  std::unordered_map<std::string, std::vector<waiter>> m_pending;
+  std::unordered_map<std::string, entry> m_cache;
+  dns_resolver_stats m_stats;
+};
+
+} }
+
+#endif  // RANGER_PROXY_DNS_RESOLVER_HPP
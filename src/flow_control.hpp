@@ -0,0 +1,53 @@
+// ranger_proxy - A SOCKS5 proxy
+// Copyright (C) 2015  RangerUFO <ufownl@gmail.com>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef RANGER_PROXY_FLOW_CONTROL_HPP
+#define RANGER_PROXY_FLOW_CONTROL_HPP
+
+#include <stddef.h>
+
+namespace ranger { namespace proxy {
+
+// Watermarks on the bytes queued for a peer. Reading from the producing
+// side stops once the queue grows past the high watermark and resumes
+// only after it drained down to the low one.
+class flow_control {
+public:
+  flow_control(size_t high, size_t low)
+    : m_high(high)
+    , m_low(low) {
+    // nop
+  }
+
+  // Returns whether the producer may read the next chunk.
+  bool update(size_t pending) {
+    m_paused = pending > (m_paused ? m_low : m_high);
+    return !m_paused;
+  }
+
+  bool paused() const {
+    return m_paused;
+  }
+
+private:
+  size_t m_high;
+  size_t m_low;
+  bool m_paused {false};
+};
+
+} }
+
+#endif  // RANGER_PROXY_FLOW_CONTROL_HPP
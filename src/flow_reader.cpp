@@ -0,0 +1,91 @@
+// ranger_proxy - A SOCKS5 proxy
+// Copyright (C) 2015  RangerUFO <ufownl@gmail.com>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "common.hpp"
+#include "flow_reader.hpp"
+#include "buffer_pool.hpp"
+
+namespace ranger { namespace proxy {
+
+flow_reader::flow_reader(boost::asio::io_service& ios, int fd, size_t read_size)
+  : m_ios(ios)
+  , m_fd(ios, fd)
+  , m_read_size(read_size) {
+  m_fd.non_blocking(true);
+}
+
+void flow_reader::start(data_handler handler) {
+  m_handler = std::move(handler);
+  read_next();
+}
+
+void flow_reader::read_next() {
+  if (m_reading || m_finished) {
+    return;
+  }
+
+  m_reading = true;
+  if (m_buf.capacity() < m_read_size) {
+    m_buf = buffer_pool::local().acquire(m_read_size);
+  }
+  m_buf.resize(m_read_size);
+  auto self = shared_from_this();
+  m_fd.async_read_some(boost::asio::buffer(m_buf),
+    [self] (const boost::system::error_code& ec, size_t len) {
+      self->m_reading = false;
+      if (self->m_finished) {
+        return;
+      } else if (ec || len == 0) {
+        self->finish();
+        return;
+      }
+
+      self->m_buf.resize(len);
+      self->m_handler(std::move(self->m_buf));
+      self->m_buf.clear();
+    }
+  );
+}
+
+void flow_reader::set_read_size(size_t read_size) {
+  m_read_size = read_size;
+}
+
+void flow_reader::stop() {
+  auto self = shared_from_this();
+  m_ios.post([self] {
+    self->m_handler = nullptr;
+    self->finish();
+  });
+}
+
+void flow_reader::finish() {
+  if (m_finished) {
+    return;
+  }
+
+  m_finished = true;
+  boost::system::error_code ignored_ec;
+  m_fd.close(ignored_ec);
+
+  if (m_handler) {
+    auto handler = std::move(m_handler);
+    m_handler = nullptr;
+    handler(std::vector<char>());
+  }
+}
+
+} }
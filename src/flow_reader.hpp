@@ -0,0 +1,62 @@
+// ranger_proxy - A SOCKS5 proxy
+// Copyright (C) 2015  RangerUFO <ufownl@gmail.com>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef RANGER_PROXY_FLOW_READER_HPP
+#define RANGER_PROXY_FLOW_READER_HPP
+
+#include <boost/asio.hpp>
+#include <functional>
+#include <memory>
+#include <vector>
+
+namespace ranger { namespace proxy {
+
+// Reads a connection one chunk at a time on request. A CAF 0.14 scribe
+// keeps reading once started, so sessions read the producing side of a
+// relay through a duplicate descriptor instead and only ask for the next
+// chunk while the peer keeps up. The scribe is still used for writing.
+class flow_reader : public std::enable_shared_from_this<flow_reader> {
+public:
+  // an empty buffer reports EOF or an error, nothing is read after it
+  using data_handler = std::function<void(std::vector<char>)>;
+
+  flow_reader(boost::asio::io_service& ios, int fd, size_t read_size);
+
+  flow_reader(const flow_reader&) = delete;
+  flow_reader& operator = (const flow_reader&) = delete;
+
+  void start(data_handler handler);
+  // does nothing while a read is outstanding
+  void read_next();
+  // takes effect from the next read on
+  void set_read_size(size_t read_size);
+  void stop();
+
+private:
+  void finish();
+
+  boost::asio::io_service& m_ios;
+  boost::asio::posix::stream_descriptor m_fd;
+  size_t m_read_size;
+  std::vector<char> m_buf;
+  data_handler m_handler;
+  bool m_reading {false};
+  bool m_finished {false};
+};
+
+} }
+
+#endif  // RANGER_PROXY_FLOW_READER_HPP
@@ -18,6 +18,7 @@
 #include "gate_service.hpp"
 #include "gate_session.hpp"
 #include "logger_ostream.hpp"
+#include "reuse_port_acceptor.hpp"
 
 namespace ranger { namespace proxy {
 
@@ -43,9 +44,61 @@ gate_service_state::host_info gate_service_state::query_host() {
   return m_hosts[(*m_dist)(*m_rand_engine)];
 }
 
+void gate_service_state::add_doorman_recv(accept_handle hdl, const receive_spec& recv) {
+  m_recv_map[hdl] = recv;
+}
+
+receive_spec gate_service_state::get_doorman_recv(accept_handle hdl) const {
+  auto it = m_recv_map.find(hdl);
+  if (it == m_recv_map.end()) {
+    return {};
+  } else {
+    return it->second;
+  }
+}
+
+void gate_service_state::set_reuse_port(bool reuse_port) {
+  m_reuse_port = reuse_port;
+}
+
+bool gate_service_state::get_reuse_port() const {
+  return m_reuse_port;
+}
+
+namespace {
+
+either<ok_atom, uint16_t>::or_else<error_atom, std::string>
+publish(gate_service::stateful_broker_pointer<gate_service_state> self,
+        const char* host, uint16_t port, const std::string& recv_name) {
+  receive_spec recv;
+  if (!parse_receive_spec(recv_name, recv)) {
+    return {error_atom::value, "Invalid receive size[" + recv_name + "]"};
+  }
+
+  if (self->state.get_reuse_port() && port == 0) {
+    return {error_atom::value, "Reactors can't share an ephemeral port"};
+  }
+
+  try {
+    std::pair<accept_handle, uint16_t> doorman;
+    if (self->state.get_reuse_port()) {
+      doorman = {self->add_tcp_doorman(new_reuse_port_acceptor(host, port)), port};
+    } else {
+      doorman = self->add_tcp_doorman(port, host, true);
+    }
+    self->state.add_doorman_recv(doorman.first, recv);
+    return {ok_atom::value, doorman.second};
+  } catch (const network_error& e) {
+    return {error_atom::value, e.what()};
+  }
+}
+
+}
+
 gate_service::behavior_type
 gate_service_impl(gate_service::stateful_broker_pointer<gate_service_state> self,
-                  int timeout, const std::string& log) {
+                  const session_timeouts& timeouts, bool offload, bool verbose,
+                  const std::string& log) {
   self->trap_exit(true);
 
   if (!log.empty()) {
@@ -53,12 +106,13 @@ gate_service_impl(gate_service::stateful_broker_pointer<gate_service_state> self
   }
 
   return {
-    [self, timeout] (const new_connection_msg& msg) {
+    [self, timeouts, offload, verbose] (const new_connection_msg& msg) {
       auto host = self->state.query_host();
       if (host.port != 0) {
         auto forked =
           self->fork(gate_session_impl, msg.handle, host.addr, host.port,
-                     host.key, host.zlib, timeout);
+                     host.key, host.cipher, host.codec, offload,
+                     self->state.get_doorman_recv(msg.source), timeouts, verbose);
         self->link_to(forked);
       } else {
         ranger::proxy::log(self) << "ERROR: Hosts list is empty" << std::endl;
@@ -70,35 +124,40 @@ gate_service_impl(gate_service::stateful_broker_pointer<gate_service_state> self
     [] (const acceptor_closed_msg&) {},
     [self] (publish_atom, uint16_t port)
       -> either<ok_atom, uint16_t>::or_else<error_atom, std::string> {
-      try {
-        return {
-          ok_atom::value,
-          self->add_tcp_doorman(port, nullptr, true).second
-        };
-      } catch (const network_error& e) {
-        return {error_atom::value, e.what()};
-      }
+      return publish(self, nullptr, port, std::string());
     },
     [self] (publish_atom, const std::string& host, uint16_t port)
       -> either<ok_atom, uint16_t>::or_else<error_atom, std::string> {
-      try {
-        return {
-          ok_atom::value,
-          self->add_tcp_doorman(port, host.c_str(), true).second
-        };
-      } catch (const network_error& e) {
-        return {error_atom::value, e.what()};
-      }
+      return publish(self, host.c_str(), port, std::string());
+    },
+    [self] (publish_atom, uint16_t port, const std::string& recv_name)
+      -> either<ok_atom, uint16_t>::or_else<error_atom, std::string> {
+      return publish(self, nullptr, port, recv_name);
+    },
+    [self] (publish_atom, const std::string& host, uint16_t port, const std::string& recv_name)
+      -> either<ok_atom, uint16_t>::or_else<error_atom, std::string> {
+      return publish(self, host.c_str(), port, recv_name);
     },
     [self] (add_atom, const std::string& addr, uint16_t port,
-            const std::vector<uint8_t>& key, bool zlib) {
+            const std::vector<uint8_t>& key, const std::string& codec,
+            const std::string& cipher) {
       gate_service_state::host_info host;
       host.addr = addr;
       host.port = port;
       host.key = key;
-      host.zlib = zlib;
+      if (!parse_codec(codec, host.codec) || !codec_supported(host.codec.type)) {
+        ranger::proxy::log(self) << "ERROR: Unsupported codec[" << codec << "]" << std::endl;
+        return;
+      }
+      if (!parse_cipher_type(cipher, host.cipher)) {
+        ranger::proxy::log(self) << "ERROR: Unsupported cipher[" << cipher << "]" << std::endl;
+        return;
+      }
       self->state.add_host(std::move(host));
     },
+    [self] (reuse_port_atom, uint32_t) {
+      self->state.set_reuse_port(true);
+    },
     [self] (const exit_msg& msg) {
       if (msg.reason != exit_reason::normal
           && msg.reason != exit_reason::user_shutdown
@@ -21,6 +21,10 @@
 #include <vector>
 #include <utility>
 #include <random>
+#include <unordered_map>
+#include "aead_encryptor.hpp"
+#include "codec.hpp"
+#include "receive_sizer.hpp"
 
 namespace ranger { namespace proxy {
 
@@ -32,7 +36,15 @@ using gate_service =
     replies_to<publish_atom, std::string, uint16_t>
       ::with_either<ok_atom, uint16_t>
       ::or_else<error_atom, std::string>,
-    reacts_to<add_atom, std::string, uint16_t, std::vector<uint8_t>, bool>
+    replies_to<publish_atom, uint16_t, std::string>
+      ::with_either<ok_atom, uint16_t>
+      ::or_else<error_atom, std::string>,
+    replies_to<publish_atom, std::string, uint16_t, std::string>
+      ::with_either<ok_atom, uint16_t>
+      ::or_else<error_atom, std::string>,
+    reacts_to<add_atom, std::string, uint16_t,
+              std::vector<uint8_t>, std::string, std::string>,
+    reacts_to<reuse_port_atom, uint32_t>
   >;
 
 class gate_service_state {
@@ -41,7 +53,8 @@ public:
     std::string addr;
     uint16_t port;
     std::vector<uint8_t> key;
-    bool zlib;
+    codec_spec codec;
+    cipher_type cipher;
   };
 
   gate_service_state() = default;
@@ -52,15 +65,24 @@ public:
   void add_host(host_info host);
   host_info query_host();
 
+  void add_doorman_recv(accept_handle hdl, const receive_spec& recv);
+  receive_spec get_doorman_recv(accept_handle hdl) const;
+
+  void set_reuse_port(bool reuse_port);
+  bool get_reuse_port() const;
+
 private:
   std::unique_ptr<std::minstd_rand> m_rand_engine;
   std::unique_ptr<std::uniform_int_distribution<size_t>> m_dist;
   std::vector<host_info> m_hosts;
+  std::unordered_map<accept_handle, receive_spec> m_recv_map;
+  bool m_reuse_port {false};
 };
 
 gate_service::behavior_type
 gate_service_impl(gate_service::stateful_broker_pointer<gate_service_state> self,
-                  int timeout, const std::string& log);
+                  const session_timeouts& timeouts, bool offload, bool verbose,
+                  const std::string& log);
 
 } }
 
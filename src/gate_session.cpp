@@ -16,10 +16,14 @@
 
 #include "common.hpp"
 #include "gate_session.hpp"
-#include "aes_cfb128_encryptor.hpp"
-#include "zlib_encryptor.hpp"
+#include "pipeline_encryptor.hpp"
 #include "async_connect.hpp"
+#include "relay_buffer.hpp"
+#include "buffer_pool.hpp"
 #include <chrono>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
 
 namespace ranger { namespace proxy {
 
@@ -28,117 +32,159 @@ gate_state::gate_state(gate_session::broker_pointer self)
   // nop
 }
 
-void gate_state::init(connection_handle hdl, const std::string& host, uint16_t port,
-                      const std::vector<uint8_t>& key, bool zlib, int timeout) {
-  m_timer = m_self->spawn<linked>(deadline_timer_impl, timeout);
+gate_state::~gate_state() {
+  if (m_relay) {
+    m_relay->stop();
+  }
+  if (m_remote_reader) {
+    m_remote_reader->stop();
+  }
 
-  m_local_hdl = hdl;
-  m_self->configure_read(m_local_hdl, receive_policy::at_most(BUFFER_SIZE));
+  if (m_verbose) {
+    try {
+      log(m_self) << "INFO: Gate session destroyed"
+        << (m_spliced ? " [spliced]" : "")
+        << " [local recv: " << m_counters.local_recv << "]"
+        << " [remote recv: " << m_counters.remote_recv << "]"
+        << " [local send: " << m_counters.local_send << "]"
+        << " [remote send: " << m_counters.remote_send << "]"
+        << std::endl;
+    } catch (...) {
+      // ignore all exceptions
+    }
+  }
+}
 
+void gate_state::init(connection_handle hdl, const std::string& host, uint16_t port,
+                      const std::vector<uint8_t>& key, cipher_type cipher,
+                      const codec_spec& codec, bool offload,
+                      const receive_spec& recv, const session_timeouts& timeouts,
+                      bool verbose) {
+  m_local_hdl = hdl;
+  m_timeouts = timeouts;
+  m_verbose = verbose;
+  // the wheel ticks once a second, the remote host has to accept and
+  // then send its header before the session counts idle time
+  intrusive_ptr<gate_session::broker_base> self = m_self;
+  auto wheel = timer_wheel::local(*m_self->parent().backend().pimpl());
+  wheel->arm(m_timer, m_timeouts.connect, [self] {
+    if (self->exit_reason() == exit_reason::not_exited) {
+      self->send(self, idle_atom::value);
+    }
+  });
+  m_local_sizer = receive_sizer(recv);
+  m_remote_sizer = receive_sizer(recv);
   m_key = key;
-  m_zlib = zlib;
+  m_cipher = cipher;
+  m_codec = codec;
+  m_offload = offload;
+
+  // plaintext tunnels are relayed in the kernel once the remote side is
+  // up, the local scribe of the others starts reading once the remote
+  // host's header set up the cipher
+  m_splice = m_key.empty() && !m_codec && splice_relay::supported();
 
   async_connect<gate_session::broker_base>(m_self, host, port);
 }
 
-void gate_state::handle_new_data(const new_data_msg& msg) {
+void gate_state::handle_new_data(new_data_msg& msg) {
+  adapt_read_size(msg.handle, msg.buf.size());
   if (msg.handle == m_local_hdl) {
-    m_self->send(m_timer, reset_atom::value);
-    if (m_remote_hdl.invalid()) {
-      m_buf.insert(m_buf.end(), msg.buf.begin(), msg.buf.end());
-    } else {
-      if (!m_key.empty()) {
-        if (m_encryptor) {
-          m_self->send(m_encryptor, encrypt_atom::value, msg.buf);
-        } else {
-          m_buf.insert(m_buf.end(), msg.buf.begin(), msg.buf.end());
-        }
-      } else if (m_self->valid(m_remote_hdl)) {
-        m_self->write(m_remote_hdl, msg.buf.size(), msg.buf.data());
-        m_self->flush(m_remote_hdl);
+    m_counters.local_recv += msg.buf.size();
+    if (m_pipeline) {
+      if (m_self->valid(m_remote_hdl)) {
+        m_pipeline.encrypt_in_place(msg.buf);
+        relay(m_remote_hdl, msg.buf);
       }
+    } else if (m_encryptor) {
+      m_self->send(m_encryptor, encrypt_atom::value, buffer_pool::local().copy(msg.buf));
+    } else if (m_self->valid(m_remote_hdl)) {
+      relay(m_remote_hdl, msg.buf);
     }
+    m_timer.reset();
   } else {
-    if (!m_key.empty()) {
-      if (m_encryptor) {
-        m_self->send(m_encryptor, decrypt_atom::value, msg.buf);
+    m_counters.remote_recv += msg.buf.size();
+    m_timer.reset();
+    // chunks of the flow reader are pooled, the scribe keeps its own buffer
+    auto& pool = buffer_pool::local();
+    if (!m_key.empty() || m_codec) {
+      if (m_pipeline) {
+        m_pipeline.decrypt_in_place(msg.buf);
+        relay(m_local_hdl, msg.buf);
+      } else if (m_encryptor) {
+        m_self->send(m_encryptor, decrypt_atom::value,
+                     m_remote_reader ? std::move(msg.buf) : pool.copy(msg.buf));
         ++m_decrypting;
+        return;
       } else {
-        m_unpacker.append(msg.buf);
+        m_unpacker.append(m_remote_reader ? std::move(msg.buf) : pool.copy(msg.buf));
       }
     } else {
-      m_self->write(m_local_hdl, msg.buf.size(), msg.buf.data());
-      m_self->flush(m_local_hdl);
+      relay(m_local_hdl, msg.buf);
+    }
+
+    if (m_remote_reader) {
+      pool.release(std::move(msg.buf));
     }
+    read_remote();
   }
 }
 
 void gate_state::handle_conn_closed(const connection_closed_msg& msg) {
   if (msg.handle == m_local_hdl || m_decrypting == 0) {
     m_self->quit(exit_reason::user_shutdown);
+  } else if (m_remote_reader) {
+    // the scribe itself never saw the close
+    m_self->close(m_remote_hdl);
   }
 }
 
-void gate_state::handle_encrypted_data(const std::vector<char>& buf) {
+void gate_state::handle_encrypted_data(std::vector<char>& buf) {
   if (m_self->valid(m_remote_hdl)) {
-    m_self->write(m_remote_hdl, buf.size(), buf.data());
-    m_self->flush(m_remote_hdl);
+    relay(m_remote_hdl, buf);
+    buffer_pool::local().release(std::move(buf));
   }
 }
 
-void gate_state::handle_decrypted_data(const std::vector<char>& buf) {
-  m_self->write(m_local_hdl, buf.size(), buf.data());
-  m_self->flush(m_local_hdl);
+void gate_state::handle_decrypted_data(std::vector<char>& buf) {
+  relay(m_local_hdl, buf);
+  buffer_pool::local().release(std::move(buf));
 
   if (--m_decrypting == 0 && !m_self->valid(m_remote_hdl)) {
     m_self->quit(exit_reason::user_shutdown);
+  } else {
+    read_remote();
   }
 }
 
 void gate_state::handle_connect_succ(connection_handle hdl) {
   m_self->assign_tcp_scribe(hdl);
   m_remote_hdl = hdl;
-  m_self->configure_read(m_remote_hdl, receive_policy::at_most(BUFFER_SIZE));
+  if (m_splice) {
+    if (start_splice()) {
+      return;
+    }
+
+    m_splice = false;
+  }
+  start_remote_reader();
 
   if (m_key.empty()) {
-    if (m_zlib) {
-      m_encryptor = m_self->spawn<linked>(zlib_encryptor_impl, m_encryptor);
+    if (m_codec) {
+      init_cipher(m_cipher, {});
     }
 
-    if (!m_buf.empty()) {
-      if (m_encryptor) {
-        m_self->send(m_encryptor, encrypt_atom::value, std::move(m_buf));
-      } else {
-        auto& wr_buf = m_self->wr_buf(m_remote_hdl);
-        if (wr_buf.empty()) {
-          wr_buf = std::move(m_buf);
-        } else {
-          wr_buf.insert(wr_buf.end(), m_buf.begin(), m_buf.end());
-          m_buf.clear();
-        }
-        m_self->flush(m_remote_hdl);
-      }
-    }
+    m_timer.reset(m_timeouts.idle);
+    start_local_reading();
+  } else if (is_aead_cipher(m_cipher)) {
+    m_timer.reset(m_timeouts.handshake);
+    m_unpacker.expect(aead_header_size, [this] (std::vector<char> buf) {
+      return handle_aead_header(std::move(buf));
+    });
   } else {
+    m_timer.reset(m_timeouts.handshake);
     m_unpacker.expect(4, [this] (std::vector<char> buf) {
-      auto seed = *reinterpret_cast<uint32_t*>(buf.data());
-      std::minstd_rand rd(seed);
-      std::vector<uint8_t> ivec(128 / 8);
-      auto data = reinterpret_cast<uint32_t*>(ivec.data());
-      for (auto i = 0; i < 4; ++i) {
-        data[i] = rd();
-      }
-      m_encryptor = m_self->spawn<linked>(aes_cfb128_encryptor_impl, m_key, ivec);
-
-      if (m_zlib) {
-        m_encryptor = m_self->spawn<linked>(zlib_encryptor_impl, m_encryptor);
-      }
-
-      if (!m_buf.empty()) {
-        m_self->send(m_encryptor, encrypt_atom::value, std::move(m_buf));
-      }
-
-      return true;
+      return handle_seed(std::move(buf));
     });
   }
 }
@@ -148,13 +194,182 @@ void gate_state::handle_connect_fail(const std::string& what) {
   m_self->quit(exit_reason::user_shutdown);
 }
 
+void gate_state::handle_splice_done(const relay_counters& counters) {
+  // the relay moved everything after the connect, the broker nothing
+  m_counters = counters;
+  m_relay.reset();
+  m_self->quit(exit_reason::user_shutdown);
+}
+
+bool gate_state::start_splice() {
+  // the relay works on duplicates, the scribes keep their descriptors
+  // until the broker quits and stay idle until then
+  auto local_fd = dup(static_cast<int>(m_local_hdl.id()));
+  if (local_fd == -1) {
+    log(m_self) << "ERROR: " << strerror(errno) << std::endl;
+    return false;
+  }
+
+  auto remote_fd = dup(static_cast<int>(m_remote_hdl.id()));
+  if (remote_fd == -1) {
+    log(m_self) << "ERROR: " << strerror(errno) << std::endl;
+    close(local_fd);
+    return false;
+  }
+
+  try {
+    m_relay = std::make_shared<splice_relay>(*m_self->parent().backend().pimpl(),
+                                             local_fd, remote_fd,
+                                             m_timeouts.idle, BUFFER_SIZE);
+  } catch (const std::exception& e) {
+    log(m_self) << "ERROR: " << e.what() << std::endl;
+    return false;
+  }
+
+  // the relay tracks idle time itself, data no longer passes the broker
+  m_timer.cancel();
+  m_spliced = true;
+
+  intrusive_ptr<gate_session::broker_base> self = m_self;
+  m_relay->start([self] (const relay_counters& counters) {
+    if (self->exit_reason() == exit_reason::not_exited) {
+      self->send(self, splice_atom::value,
+                 counters.local_recv, counters.local_send,
+                 counters.remote_recv, counters.remote_send);
+    }
+  });
+  return true;
+}
+
+void gate_state::relay(connection_handle hdl, std::vector<char>& buf) {
+  if (hdl == m_local_hdl) {
+    m_counters.local_send += buf.size();
+  } else {
+    m_counters.remote_send += buf.size();
+  }
+
+  relay_buffer(m_self->wr_buf(hdl), buf);
+  m_self->flush(hdl);
+}
+
+void gate_state::handle_drain() {
+  m_draining = false;
+  read_remote();
+}
+
+void gate_state::start_remote_reader() {
+  // the remote scribe only writes, reads go through the flow reader
+  auto fd = dup(static_cast<int>(m_remote_hdl.id()));
+  if (fd == -1) {
+    log(m_self) << "ERROR: " << strerror(errno) << std::endl;
+    m_self->configure_read(m_remote_hdl, receive_policy::at_most(m_remote_sizer.size()));
+    return;
+  }
+
+  try {
+    m_remote_reader = std::make_shared<flow_reader>(*m_self->parent().backend().pimpl(),
+                                                    fd, m_remote_sizer.size());
+  } catch (const std::exception& e) {
+    log(m_self) << "ERROR: " << e.what() << std::endl;
+    close(fd);
+    m_self->configure_read(m_remote_hdl, receive_policy::at_most(m_remote_sizer.size()));
+    return;
+  }
+
+  intrusive_ptr<gate_session::broker_base> self = m_self;
+  auto hdl = m_remote_hdl;
+  m_remote_reader->start([self, hdl] (std::vector<char> buf) {
+    if (self->exit_reason() != exit_reason::not_exited) {
+      return;
+    } else if (buf.empty()) {
+      self->send(self, connection_closed_msg{hdl});
+    } else {
+      self->send(self, new_data_msg{hdl, std::move(buf)});
+    }
+  });
+}
+
+void gate_state::read_remote() {
+  if (!m_remote_reader) {
+    return;
+  }
+
+  if (m_remote_flow.update(m_self->wr_buf(m_local_hdl).size())) {
+    m_remote_reader->read_next();
+  } else if (!m_draining) {
+    m_draining = true;
+    m_self->delayed_send(m_self, DRAIN_CHECK_INTERVAL, drain_atom::value);
+  }
+}
+
+void gate_state::adapt_read_size(connection_handle hdl, size_t len) {
+  auto& sizer = hdl == m_local_hdl ? m_local_sizer : m_remote_sizer;
+  if (!sizer.update(len)) {
+    return;
+  }
+
+  if (hdl == m_remote_hdl && m_remote_reader) {
+    m_remote_reader->set_read_size(sizer.size());
+  } else {
+    m_self->configure_read(hdl, receive_policy::at_most(sizer.size()));
+  }
+}
+
+bool gate_state::handle_seed(std::vector<char> buf) {
+  auto seed = *reinterpret_cast<uint32_t*>(buf.data());
+  std::minstd_rand rd(seed);
+  std::vector<uint8_t> ivec(128 / 8);
+  auto data = reinterpret_cast<uint32_t*>(ivec.data());
+  for (auto i = 0; i < 4; ++i) {
+    data[i] = rd();
+  }
+
+  init_cipher(m_cipher, ivec);
+  m_timer.reset(m_timeouts.idle);
+  start_local_reading();
+  return true;
+}
+
+bool gate_state::handle_aead_header(std::vector<char> buf) {
+  // cipher_type::aead accepts whichever AEAD cipher the remote host picked
+  cipher_type cipher;
+  if (!aead_cipher_from_id(static_cast<uint8_t>(buf[0]), cipher)
+      || (m_cipher != cipher_type::aead && m_cipher != cipher)) {
+    log(m_self) << "ERROR: Cipher mismatch with the remote host" << std::endl;
+    m_self->quit(exit_reason::user_shutdown);
+    return false;
+  }
+
+  init_cipher(cipher, std::vector<uint8_t>(buf.begin() + 1, buf.end()));
+  m_timer.reset(m_timeouts.idle);
+  start_local_reading();
+  return true;
+}
+
+void gate_state::init_cipher(cipher_type cipher, const std::vector<uint8_t>& iv) {
+  if (m_offload) {
+    m_encryptor = m_self->spawn<linked>(pipeline_encryptor_impl, cipher, m_key, iv, false, m_codec);
+  } else {
+    m_pipeline.init(cipher, m_key, iv, false, m_codec);
+  }
+}
+
+void gate_state::start_local_reading() {
+  // until the cipher is set up the local data waits in the kernel, which
+  // pushes back on the client instead of the broker buffering it
+  m_self->configure_read(m_local_hdl, receive_policy::at_most(m_local_sizer.size()));
+}
+
 gate_session::behavior_type
 gate_session_impl(gate_session::stateful_broker_pointer<gate_state> self,
                   connection_handle hdl, const std::string& host, uint16_t port,
-                  const std::vector<uint8_t>& key, bool zlib, int timeout) {
-  self->state.init(hdl, host, port, key, zlib, timeout);
+                  const std::vector<uint8_t>& key, cipher_type cipher,
+                  const codec_spec& codec, bool offload,
+                  const receive_spec& recv, const session_timeouts& timeouts,
+                  bool verbose) {
+  self->state.init(hdl, host, port, key, cipher, codec, offload, recv, timeouts, verbose);
   return {
-    [self] (const new_data_msg& msg) {
+    [self] (new_data_msg& msg) {
       self->state.handle_new_data(msg);
     },
     [self] (const connection_closed_msg& msg) {
@@ -166,11 +381,26 @@ gate_session_impl(gate_session::stateful_broker_pointer<gate_state> self,
     [self] (error_atom, const std::string& what) {
       self->state.handle_connect_fail(what);
     },
-    [self] (encrypt_atom, const std::vector<char>& buf) {
+    [self] (encrypt_atom, std::vector<char>& buf) {
       self->state.handle_encrypted_data(buf);
     },
-    [self] (decrypt_atom, const std::vector<char>& buf) {
+    [self] (decrypt_atom, std::vector<char>& buf) {
       self->state.handle_decrypted_data(buf);
+    },
+    [self] (splice_atom, uint64_t local_recv, uint64_t local_send,
+            uint64_t remote_recv, uint64_t remote_send) {
+      relay_counters counters;
+      counters.local_recv = local_recv;
+      counters.local_send = local_send;
+      counters.remote_recv = remote_recv;
+      counters.remote_send = remote_send;
+      self->state.handle_splice_done(counters);
+    },
+    [self] (drain_atom) {
+      self->state.handle_drain();
+    },
+    [self] (idle_atom) {
+      self->quit(exit_reason::user_shutdown);
     }
   };
 }
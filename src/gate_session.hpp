@@ -18,54 +18,99 @@
 #define RANGER_PROXY_GATE_SESSION_HPP
 
 #include <vector>
-#include "deadline_timer.hpp"
+#include <memory>
+#include "timer_wheel.hpp"
 #include "encryptor.hpp"
+#include "cipher_pipeline.hpp"
+#include "aead_encryptor.hpp"
+#include "codec.hpp"
 #include "unpacker.hpp"
+#include "splice_relay.hpp"
+#include "flow_control.hpp"
+#include "flow_reader.hpp"
+#include "receive_sizer.hpp"
 
 namespace ranger { namespace proxy {
 
+using splice_atom = atom_constant<atom("splice")>;
+
 using gate_session =
   minimal_client::extend<
     reacts_to<ok_atom, connection_handle>,
     reacts_to<error_atom, std::string>,
     reacts_to<encrypt_atom, std::vector<char>>,
-    reacts_to<decrypt_atom, std::vector<char>>
+    reacts_to<decrypt_atom, std::vector<char>>,
+    reacts_to<splice_atom, uint64_t, uint64_t, uint64_t, uint64_t>,
+    reacts_to<drain_atom>,
+    reacts_to<idle_atom>
   >;
 
 class gate_state {
 public:
   gate_state(gate_session::broker_pointer self);
+  ~gate_state();
 
   gate_state(const gate_state&) = delete;
   gate_state& operator = (const gate_state&) = delete;
 
   void init(connection_handle hdl, const std::string& host, uint16_t port,
-            const std::vector<uint8_t>& key, bool zlib, int timeout);
+            const std::vector<uint8_t>& key, cipher_type cipher,
+            const codec_spec& codec, bool offload,
+            const receive_spec& recv, const session_timeouts& timeouts,
+            bool verbose);
 
-  void handle_new_data(const new_data_msg& msg);
+  void handle_new_data(new_data_msg& msg);
   void handle_conn_closed(const connection_closed_msg& msg);
   void handle_connect_succ(connection_handle hdl);
   void handle_connect_fail(const std::string& what);
-  void handle_encrypted_data(const std::vector<char>& buf);
-  void handle_decrypted_data(const std::vector<char>& buf);
+  void handle_encrypted_data(std::vector<char>& buf);
+  void handle_decrypted_data(std::vector<char>& buf);
+  void handle_splice_done(const relay_counters& counters);
+  void handle_drain();
 
 private:
+  bool start_splice();
+  void start_remote_reader();
+  void read_remote();
+  void adapt_read_size(connection_handle hdl, size_t len);
+  bool handle_seed(std::vector<char> buf);
+  bool handle_aead_header(std::vector<char> buf);
+  void init_cipher(cipher_type cipher, const std::vector<uint8_t>& iv);
+  void start_local_reading();
+  void relay(connection_handle hdl, std::vector<char>& buf);
+
   const gate_session::broker_pointer m_self;
-  deadline_timer m_timer;
+  timer_wheel::timer m_timer;
   connection_handle m_local_hdl;
   connection_handle m_remote_hdl;
   std::vector<uint8_t> m_key;
-  bool m_zlib {false};
+  cipher_type m_cipher {cipher_type::aes_cfb128};
+  codec_spec m_codec;
+  bool m_offload {false};
+  session_timeouts m_timeouts;
+  bool m_verbose {false};
+  relay_counters m_counters;
+  bool m_splice {false};
+  bool m_spliced {false};
+  std::shared_ptr<splice_relay> m_relay;
+  receive_sizer m_local_sizer;
+  receive_sizer m_remote_sizer;
+  std::shared_ptr<flow_reader> m_remote_reader;
+  flow_control m_remote_flow {HIGH_WATERMARK, LOW_WATERMARK};
+  bool m_draining {false};
+  cipher_pipeline m_pipeline;
   encryptor m_encryptor;
   size_t m_decrypting {0};
-  std::vector<char> m_buf;
   unpacker<uint8_t> m_unpacker;
 };
 
 gate_session::behavior_type
 gate_session_impl(gate_session::stateful_broker_pointer<gate_state> self,
                   connection_handle hdl, const std::string& host, uint16_t port,
-                  const std::vector<uint8_t>& key, bool zlib, int timeout);
+                  const std::vector<uint8_t>& key, cipher_type cipher,
+                  const codec_spec& codec, bool offload,
+                  const receive_spec& recv, const session_timeouts& timeouts,
+                  bool verbose);
 
 } }
 
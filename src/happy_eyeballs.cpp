@@ -0,0 +1,132 @@
+// ranger_proxy - A SOCKS5 proxy
+// Copyright (C) 2015  RangerUFO <ufownl@gmail.com>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "common.hpp"
+#include "happy_eyeballs.hpp"
+
+namespace ranger { namespace proxy {
+
+happy_eyeballs::happy_eyeballs(boost::asio::io_service& ios,
+                               const std::vector<endpoint>& endpoints,
+                               std::chrono::milliseconds delay)
+  : m_ios(ios)
+  , m_endpoints(interleave(endpoints))
+  , m_timer(ios)
+  , m_delay(delay) {
+  // nop
+}
+
+void happy_eyeballs::start(completion_handler handler) {
+  m_handler = std::move(handler);
+  if (m_endpoints.empty()) {
+    auto self = shared_from_this();
+    m_ios.post([self] {
+      self->finish(boost::asio::error::host_not_found, socket(self->m_ios));
+    });
+    return;
+  }
+
+  attempt_next();
+}
+
+std::vector<happy_eyeballs::endpoint>
+happy_eyeballs::interleave(const std::vector<endpoint>& endpoints) {
+  if (endpoints.empty()) {
+    return {};
+  }
+
+  std::vector<endpoint> first;
+  std::vector<endpoint> second;
+  auto v6 = endpoints.front().address().is_v6();
+  for (auto& ep : endpoints) {
+    (ep.address().is_v6() == v6 ? first : second).push_back(ep);
+  }
+
+  std::vector<endpoint> res;
+  res.reserve(endpoints.size());
+  for (size_t i = 0; i < first.size() || i < second.size(); ++i) {
+    if (i < first.size()) {
+      res.push_back(first[i]);
+    }
+    if (i < second.size()) {
+      res.push_back(second[i]);
+    }
+  }
+  return res;
+}
+
+void happy_eyeballs::attempt_next() {
+  if (m_done || m_sockets.size() == m_endpoints.size()) {
+    return;
+  }
+
+  auto idx = m_sockets.size();
+  m_sockets.emplace_back(new socket(m_ios));
+  auto self = shared_from_this();
+  m_sockets.back()->async_connect(m_endpoints[idx],
+    [self, idx] (const boost::system::error_code& ec) {
+      self->handle_connect(idx, ec);
+    }
+  );
+
+  // the next attempt doesn't wait for this one longer than the delay
+  if (m_sockets.size() < m_endpoints.size()) {
+    m_timer.expires_from_now(m_delay);
+    m_timer.async_wait([self] (const boost::system::error_code& ec) {
+      if (!ec) {
+        self->attempt_next();
+      }
+    });
+  }
+}
+
+void happy_eyeballs::handle_connect(size_t idx, const boost::system::error_code& ec) {
+  if (m_done) {
+    return;
+  }
+
+  auto& sock = m_sockets[idx];
+  if (!ec) {
+    finish(ec, std::move(*sock));
+    return;
+  }
+
+  boost::system::error_code ignored_ec;
+  sock->close(ignored_ec);
+  if (++m_failed == m_endpoints.size()) {
+    finish(ec, socket(m_ios));
+  } else if (m_failed == m_sockets.size()) {
+    // nothing is in flight, so there is no point in waiting
+    attempt_next();
+  }
+}
+
+void happy_eyeballs::finish(const boost::system::error_code& ec, socket sock) {
+  m_done = true;
+  boost::system::error_code ignored_ec;
+  m_timer.cancel(ignored_ec);
+  for (auto& i : m_sockets) {
+    if (i->is_open()) {
+      i->close(ignored_ec);
+    }
+  }
+
+  auto handler = std::move(m_handler);
+  m_handler = nullptr;
+  handler(ec, std::move(sock));
+}
+
+} }
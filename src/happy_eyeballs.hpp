@@ -0,0 +1,68 @@
+// ranger_proxy - A SOCKS5 proxy
+// Copyright (C) 2015  RangerUFO <ufownl@gmail.com>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef RANGER_PROXY_HAPPY_EYEBALLS_HPP
+#define RANGER_PROXY_HAPPY_EYEBALLS_HPP
+
+#include <boost/asio.hpp>
+#include <functional>
+#include <memory>
+#include <chrono>
+#include <vector>
+
+namespace ranger { namespace proxy {
+
+// Races connection attempts to the resolved endpoints of a host as in
+// RFC 8305. The endpoints alternate between address families, starting
+// with the family of the first one. A new attempt starts whenever the
+// previous one fails or `delay` passes without an answer, the first
+// attempt to succeed wins and the others are closed.
+class happy_eyeballs : public std::enable_shared_from_this<happy_eyeballs> {
+public:
+  using socket = boost::asio::ip::tcp::socket;
+  using endpoint = boost::asio::ip::tcp::endpoint;
+  // gets the connected socket, or the error of the last attempt
+  using completion_handler = std::function<void(const boost::system::error_code&, socket)>;
+
+  happy_eyeballs(boost::asio::io_service& ios,
+                 const std::vector<endpoint>& endpoints,
+                 std::chrono::milliseconds delay);
+
+  happy_eyeballs(const happy_eyeballs&) = delete;
+  happy_eyeballs& operator = (const happy_eyeballs&) = delete;
+
+  void start(completion_handler handler);
+
+  static std::vector<endpoint> interleave(const std::vector<endpoint>& endpoints);
+
+private:
+  void attempt_next();
+  void handle_connect(size_t idx, const boost::system::error_code& ec);
+  void finish(const boost::system::error_code& ec, socket sock);
+
+  boost::asio::io_service& m_ios;
+  std::vector<endpoint> m_endpoints;
+  std::vector<std::unique_ptr<socket>> m_sockets;
+  boost::asio::steady_timer m_timer;
+  std::chrono::milliseconds m_delay;
+  size_t m_failed {0};
+  bool m_done {false};
+  completion_handler m_handler;
+};
+
+} }
+
+#endif  // RANGER_PROXY_HAPPY_EYEBALLS_HPP
@@ -0,0 +1,114 @@
+// ranger_proxy - A SOCKS5 proxy
+// Copyright (C) 2015  RangerUFO <ufownl@gmail.com>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "common.hpp"
+#include "lz4_codec.hpp"
+
+#ifdef RANGER_PROXY_HAVE_LZ4
+
+#include <algorithm>
+#include <stdexcept>
+#include <string.h>
+
+namespace ranger { namespace proxy {
+
+lz4_codec::~lz4_codec() {
+  if (m_cctx) {
+    LZ4F_freeCompressionContext(m_cctx);
+  }
+  if (m_dctx) {
+    LZ4F_freeDecompressionContext(m_dctx);
+  }
+}
+
+void lz4_codec::init(int level) {
+  memset(&m_prefs, 0, sizeof(m_prefs));
+  m_prefs.frameInfo.blockMode = LZ4F_blockLinked;
+  m_prefs.compressionLevel = level;
+  m_prefs.autoFlush = 1;
+}
+
+std::vector<char> lz4_codec::encrypt(const std::vector<char>& in) {
+  std::vector<char> out;
+  encrypt_append(in, out);
+  return out;
+}
+
+void lz4_codec::encrypt_append(const std::vector<char>& in, std::vector<char>& out) {
+  if (!m_cctx) {
+    auto err = LZ4F_createCompressionContext(&m_cctx, LZ4F_VERSION);
+    if (LZ4F_isError(err)) {
+      m_cctx = nullptr;
+      throw std::runtime_error(LZ4F_getErrorName(err));
+    }
+  }
+
+  size_t len = out.size();
+  out.resize(len + LZ4F_HEADER_SIZE_MAX + LZ4F_compressBound(in.size(), &m_prefs));
+  if (!m_frame_started) {
+    auto n = LZ4F_compressBegin(m_cctx, out.data() + len, out.size() - len, &m_prefs);
+    if (LZ4F_isError(n)) {
+      throw std::runtime_error(LZ4F_getErrorName(n));
+    }
+    len += n;
+    m_frame_started = true;
+  }
+
+  auto n = LZ4F_compressUpdate(m_cctx, out.data() + len, out.size() - len,
+                               in.data(), in.size(), nullptr);
+  if (LZ4F_isError(n)) {
+    throw std::runtime_error(LZ4F_getErrorName(n));
+  }
+  out.resize(len + n);
+}
+
+std::vector<char> lz4_codec::decrypt(const std::vector<char>& in) {
+  std::vector<char> out;
+  decrypt_append(in.data(), in.size(), out);
+  return out;
+}
+
+void lz4_codec::decrypt_append(const char* data, size_t len, std::vector<char>& out) {
+  if (!m_dctx) {
+    auto err = LZ4F_createDecompressionContext(&m_dctx, LZ4F_VERSION);
+    if (LZ4F_isError(err)) {
+      m_dctx = nullptr;
+      throw std::runtime_error(LZ4F_getErrorName(err));
+    }
+  }
+
+  // keep going while input is left or the last call filled the output
+  auto capacity = std::max<size_t>(len * 2, 64 * 1024);
+  size_t pos = 0;
+  size_t avail = 0;
+  do {
+    auto old_size = out.size();
+    avail = capacity;
+    out.resize(old_size + avail);
+    auto src_size = len - pos;
+    auto err = LZ4F_decompress(m_dctx, out.data() + old_size, &avail,
+                               data + pos, &src_size, nullptr);
+    if (LZ4F_isError(err)) {
+      throw std::runtime_error(LZ4F_getErrorName(err));
+    }
+    pos += src_size;
+    out.resize(old_size + avail);
+  } while (pos < len || avail == capacity);
+}
+
+} }
+
+#endif  // RANGER_PROXY_HAVE_LZ4
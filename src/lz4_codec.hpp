@@ -0,0 +1,56 @@
+// ranger_proxy - A SOCKS5 proxy
+// Copyright (C) 2015  RangerUFO <ufownl@gmail.com>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef RANGER_PROXY_LZ4_CODEC_HPP
+#define RANGER_PROXY_LZ4_CODEC_HPP
+
+#include "cipher_pipeline.hpp"
+
+#ifdef RANGER_PROXY_HAVE_LZ4
+
+#include <lz4frame.h>
+
+namespace ranger { namespace proxy {
+
+// One LZ4 frame per direction, flushed after every chunk. Levels below 3
+// use the fast compressor, 3 and above the high compression one.
+class lz4_codec : public cipher_stage {
+public:
+  lz4_codec() = default;
+  ~lz4_codec();
+
+  lz4_codec(const lz4_codec&) = delete;
+  lz4_codec& operator = (const lz4_codec&) = delete;
+
+  void init(int level = 0);
+
+  std::vector<char> encrypt(const std::vector<char>& in) override;
+  std::vector<char> decrypt(const std::vector<char>& in) override;
+  void encrypt_append(const std::vector<char>& in, std::vector<char>& out) override;
+  void decrypt_append(const char* data, size_t len, std::vector<char>& out) override;
+
+private:
+  LZ4F_preferences_t m_prefs;
+  LZ4F_compressionContext_t m_cctx {nullptr};
+  bool m_frame_started {false};
+  LZ4F_decompressionContext_t m_dctx {nullptr};
+};
+
+} }
+
+#endif  // RANGER_PROXY_HAVE_LZ4
+
+#endif  // RANGER_PROXY_LZ4_CODEC_HPP
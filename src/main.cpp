@@ -22,13 +22,127 @@
 #include <rapidxml.hpp>
 #include <rapidxml_utils.hpp>
 #include <thread>
+#include <vector>
+#include <algorithm>
 #include <unistd.h>
 #include <string.h>
+#include <signal.h>
+#include <sys/wait.h>
+#include <sys/prctl.h>
 
 using namespace ranger;
 using namespace ranger::proxy;
 using namespace ranger::proxy::experimental;
 
+void reload_user_files(int) {
+  user_table::request_reload();
+}
+
+bool watch_user_file(scoped_actor& self, const socks5_service& serv, const std::string& path) {
+  auto ok = false;
+  self->sync_send(serv, user_file_atom::value, path).await(
+    [&] (ok_atom, uint64_t n) {
+      std::cout << "INFO: Load " << n << " users from user file[" << path << "]" << std::endl;
+      // SIGHUP reloads the file at once instead of terminating the proxy
+      signal(SIGHUP, reload_user_files);
+      ok = true;
+    },
+    [] (error_atom, const std::string& what) {
+      std::cerr << "ERROR: " << what << std::endl;
+    }
+  );
+  return ok;
+}
+
+// Forks the reactor processes, each runs its own scheduler and
+// multiplexer, so it has to be called before either is set. Returns -1
+// in a reactor. The calling process supervises them: it forwards SIGHUP,
+// SIGINT and SIGTERM, stops all of them once one exits, and returns the
+// exit code of the group when all are gone.
+int start_reactors(size_t reactors) {
+  sigset_t signals;
+  sigset_t old_mask;
+  sigemptyset(&signals);
+  for (auto sig : {SIGCHLD, SIGHUP, SIGINT, SIGTERM}) {
+    sigaddset(&signals, sig);
+  }
+  sigprocmask(SIG_BLOCK, &signals, &old_mask);
+
+  auto supervisor = getpid();
+  std::vector<pid_t> pids;
+  int ret = 0;
+  for (size_t i = 0; i < reactors; ++i) {
+    auto pid = fork();
+    if (pid == 0) {
+      sigprocmask(SIG_SETMASK, &old_mask, nullptr);
+      // a reactor doesn't outlive its supervisor
+      prctl(PR_SET_PDEATHSIG, SIGTERM);
+      if (getppid() != supervisor) {
+        _exit(1);
+      }
+      return -1;
+    } else if (pid < 0) {
+      std::cerr << "ERROR: Failed in calling fork()" << std::endl;
+      ret = 1;
+      break;
+    }
+    pids.push_back(pid);
+  }
+
+  auto stopping = false;
+  auto stop = [&] {
+    stopping = true;
+    for (auto pid : pids) {
+      kill(pid, SIGTERM);
+    }
+  };
+  if (ret != 0) {
+    stop();
+  }
+
+  while (!pids.empty()) {
+    auto sig = sigwaitinfo(&signals, nullptr);
+    if (sig == SIGHUP) {
+      for (auto pid : pids) {
+        kill(pid, SIGHUP);
+      }
+    } else if (sig == SIGINT || sig == SIGTERM) {
+      stop();
+    } else if (sig == SIGCHLD) {
+      int status = 0;
+      pid_t pid = 0;
+      while ((pid = waitpid(-1, &status, WNOHANG)) > 0) {
+        pids.erase(std::remove(pids.begin(), pids.end(), pid), pids.end());
+        if (!stopping) {
+          // a reactor that failed to start or died takes the others along
+          if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+            std::cerr << "ERROR: Reactor[" << pid << "] exited" << std::endl;
+            ret = 1;
+          }
+          stop();
+        }
+      }
+    }
+  }
+
+  sigprocmask(SIG_SETMASK, &old_mask, nullptr);
+  return ret;
+}
+
+// The reactors share no state. Their services split the limits of all
+// sessions between them, but the connections of a client or a user can
+// go to any reactor, so their limits can't be split.
+bool check_reactor_limits(size_t reactors, const admission_limits& admission,
+                          const rate_spec& user_rate) {
+  if (reactors > 1 && (admission.sessions_per_ip != 0
+                       || admission.handshakes_per_ip != 0
+                       || user_rate.rate != 0)) {
+    std::cerr << "ERROR: Per IP and per user limits need a single reactor" << std::endl;
+    return false;
+  }
+  return true;
+}
+
 int bootstrap_with_config_impl(rapidxml::xml_node<>* root, bool verbose) {
   auto next = root->next_sibling("ranger_proxy");
   if (next) {
@@ -41,10 +155,55 @@ int bootstrap_with_config_impl(rapidxml::xml_node<>* root, bool verbose) {
     }
   }
 
-  int timeout = 300;
+  session_timeouts timeouts;
   auto node = root->first_node("timeout");
   if (node) {
-    timeout = atoi(node->value());
+    timeouts.idle = atoi(node->value());
+  }
+
+  node = root->first_node("handshake_timeout");
+  if (node) {
+    timeouts.handshake = atoi(node->value());
+  }
+
+  node = root->first_node("connect_timeout");
+  if (node) {
+    timeouts.connect = atoi(node->value());
+  }
+
+  rate_spec rate;
+  node = root->first_node("rate_limit");
+  if (node && !parse_rate_spec(node->value(), rate)) {
+    std::cerr << "ERROR: Invalid rate limit[" << node->value() << "]" << std::endl;
+    return 1;
+  }
+
+  rate_spec user_rate;
+  node = root->first_node("user_rate_limit");
+  if (node && !parse_rate_spec(node->value(), user_rate)) {
+    std::cerr << "ERROR: Invalid rate limit[" << node->value() << "]" << std::endl;
+    return 1;
+  }
+
+  admission_limits admission;
+  node = root->first_node("max_sessions");
+  if (node && !parse_connection_limit(node->value(), admission.sessions,
+                                      admission.sessions_per_ip)) {
+    std::cerr << "ERROR: Invalid connection limit[" << node->value() << "]" << std::endl;
+    return 1;
+  }
+
+  node = root->first_node("max_handshakes");
+  if (node && !parse_connection_limit(node->value(), admission.handshakes,
+                                      admission.handshakes_per_ip)) {
+    std::cerr << "ERROR: Invalid connection limit[" << node->value() << "]" << std::endl;
+    return 1;
+  }
+
+  node = root->first_node("accept_rate");
+  if (node && !parse_rate_spec(node->value(), admission.accept_rate)) {
+    std::cerr << "ERROR: Invalid accept rate[" << node->value() << "]" << std::endl;
+    return 1;
   }
 
   std::string log;
@@ -71,6 +230,40 @@ int bootstrap_with_config_impl(rapidxml::xml_node<>* root, bool verbose) {
     throughput = atoi(node->value());
   }
 
+  bool offload = false;
+  node = root->first_node("offload");
+  if (node && atoi(node->value())) {
+    offload = true;
+  }
+
+  std::string recv_size;
+  node = root->first_node("recv_size");
+  if (node) {
+    recv_size = node->value();
+  }
+
+  size_t reactors = 1;
+  node = root->first_node("reactors");
+  if (node) {
+    reactors = atoi(node->value());
+  }
+
+  if (reactors == 0) {
+    std::cerr << "ERROR: Invalid number of reactors" << std::endl;
+    return 1;
+  }
+
+  if (!check_reactor_limits(reactors, admission, user_rate)) {
+    return 1;
+  }
+
+  if (reactors > 1) {
+    auto ret = start_reactors(reactors);
+    if (ret >= 0) {
+      return ret;
+    }
+  }
+
   if (policy == "work_stealing") {
     set_scheduler<policy::work_stealing>(worker, throughput);
   } else if (policy == "work_sharing") {
@@ -85,8 +278,11 @@ int bootstrap_with_config_impl(rapidxml::xml_node<>* root, bool verbose) {
   int ret = 0;
   node = root->first_node("gate");
   if (node && atoi(node->value())) {
-    auto serv = spawn_io(gate_service_impl, timeout, log);
+    auto serv = spawn_io(gate_service_impl, timeouts, offload, verbose, log);
     scoped_actor self;
+    if (reactors > 1) {
+      self->send(serv, reuse_port_atom::value, static_cast<uint32_t>(reactors));
+    }
     for (auto i = root->first_node("remote_host"); i; i = i->next_sibling("remote_host")) {
       std::string addr;
       node = i->first_node("address");
@@ -108,13 +304,24 @@ int bootstrap_with_config_impl(rapidxml::xml_node<>* root, bool verbose) {
                    node->value() + strlen(node->value()));
       }
 
-      bool zlib = false;
+      std::string codec;
       node = i->first_node("zlib");
       if (node && atoi(node->value())) {
-        zlib = true;
+        codec = "zlib";
+      }
+
+      node = i->first_node("codec");
+      if (node) {
+        codec = node->value();
+      }
+
+      std::string cipher;
+      node = i->first_node("cipher");
+      if (node) {
+        cipher = node->value();
       }
 
-      self->send(serv, add_atom::value, addr, port, key, zlib);
+      self->send(serv, add_atom::value, addr, port, key, codec, cipher);
     }
 
     auto ok_hdl = [] (ok_atom, uint16_t) {
@@ -137,10 +344,16 @@ int bootstrap_with_config_impl(rapidxml::xml_node<>* root, bool verbose) {
         port = atoi(node->value());
       }
 
+      std::string recv = recv_size;
+      node = i->first_node("recv_size");
+      if (node) {
+        recv = node->value();
+      }
+
       if (addr.empty()) {
-        self->sync_send(serv, publish_atom::value, port).await(ok_hdl, err_hdl);
+        self->sync_send(serv, publish_atom::value, port, recv).await(ok_hdl, err_hdl);
       } else {
-        self->sync_send(serv, publish_atom::value, addr, port).await(ok_hdl, err_hdl);
+        self->sync_send(serv, publish_atom::value, addr, port, recv).await(ok_hdl, err_hdl);
       }
 
       if (ret) {
@@ -149,8 +362,12 @@ int bootstrap_with_config_impl(rapidxml::xml_node<>* root, bool verbose) {
       }
     }
   } else {
-    auto serv = spawn_io(socks5_service_impl, timeout, verbose, log);
+    auto serv = spawn_io(socks5_service_impl, timeouts, admission, rate, user_rate,
+                         offload, verbose, log);
     scoped_actor self;
+    if (reactors > 1) {
+      self->send(serv, reuse_port_atom::value, static_cast<uint32_t>(reactors));
+    }
     for (auto i = root->first_node("user"); i; i = i->next_sibling("user")) {
       node = i->first_node("username");
       if (node) {
@@ -173,6 +390,12 @@ int bootstrap_with_config_impl(rapidxml::xml_node<>* root, bool verbose) {
       }
     }
 
+    node = root->first_node("user_file");
+    if (node && !watch_user_file(self, serv, node->value())) {
+      anon_send_exit(serv, exit_reason::kill);
+      return 1;
+    }
+
     auto ok_hdl = [] (ok_atom, uint16_t) {
       std::cout << "INFO: ranger_proxy start-up successfully" << std::endl;
     };
@@ -201,18 +424,41 @@ int bootstrap_with_config_impl(rapidxml::xml_node<>* root, bool verbose) {
                    node->value() + strlen(node->value()));
       }
 
-      bool zlib = false;
+      std::string codec;
       node = i->first_node("zlib");
       if (node && atoi(node->value())) {
-        zlib = true;
+        codec = "zlib";
+      }
+
+      node = i->first_node("codec");
+      if (node) {
+        codec = node->value();
+      }
+
+      std::string cipher;
+      node = i->first_node("cipher");
+      if (node) {
+        cipher = node->value();
+      }
+
+      std::string recv = recv_size;
+      node = i->first_node("recv_size");
+      if (node) {
+        recv = node->value();
+      }
+
+      std::string rate_limit;
+      node = i->first_node("rate_limit");
+      if (node) {
+        rate_limit = node->value();
       }
 
       if (addr.empty()) {
         self->sync_send(serv, publish_atom::value, port,
-                        key, zlib).await(ok_hdl, err_hdl);
+                        key, codec, cipher, recv, rate_limit).await(ok_hdl, err_hdl);
       } else {
         self->sync_send(serv, publish_atom::value, addr, port,
-                        key, zlib).await(ok_hdl, err_hdl);
+                        key, codec, cipher, recv, rate_limit).await(ok_hdl, err_hdl);
       }
 
       if (ret) {
@@ -248,12 +494,22 @@ int bootstrap(int argc, char* argv[]) {
   uint16_t port = 1080;
   std::string username;
   std::string password;
+  std::string user_file;
   std::string key_src;
-  int timeout = 300;
+  std::string cipher;
+  std::string codec;
+  std::string recv_size;
+  std::string rate_limit;
+  std::string user_rate_limit;
+  std::string max_sessions;
+  std::string max_handshakes;
+  std::string accept_rate;
+  session_timeouts timeouts;
   std::string log;
   std::string policy = "work_stealing";
   size_t worker = std::thread::hardware_concurrency();
   size_t throughput = std::numeric_limits<size_t>::max();
+  size_t reactors = 1;
   std::string remote_host;
   uint16_t remote_port = 0;
   std::string config;
@@ -263,13 +519,26 @@ int bootstrap(int argc, char* argv[]) {
     {"port,p", "set port (default: 1080)", port},
     {"username", "set username (it will enable username auth method)", username},
     {"password", "set password", password},
+    {"user_file", "load users from a file, reloaded on change or SIGHUP (default: empty)", user_file},
     {"key,k", "set key (default: empty)", key_src},
+    {"cipher", "set cipher: aes-cfb128, aes-128-gcm, chacha20-poly1305 or aead (default: aes-cfb128)", cipher},
     {"zlib,z", "enable zlib compression (default: disable)"},
-    {"timeout,t", "set timeout (default: 300)", timeout},
+    {"codec", "set compression codec: zlib, lz4 or zstd, with an optional :level and +adaptive (default: empty)", codec},
+    {"recv_size", "set receive size: <max> or <min>:<max>, in bytes with an optional k or m (default: 4k:256k)", recv_size},
+    {"rate_limit", "set bandwidth limit of all sessions: <rate> or <rate>:<burst>, in bytes with an optional k or m (default: unlimited)", rate_limit},
+    {"user_rate_limit", "set bandwidth limit of each user, in the form of rate_limit (default: unlimited)", user_rate_limit},
+    {"max_sessions", "set max sessions: <total> or <total>:<per IP> (default: unlimited)", max_sessions},
+    {"max_handshakes", "set max sessions still in handshake, in the form of max_sessions (default: unlimited)", max_handshakes},
+    {"accept_rate", "set connections accepted per second: <rate> or <rate>:<burst> (default: unlimited)", accept_rate},
+    {"timeout,t", "set idle timeout, traffic in either direction resets it (default: 300)", timeouts.idle},
+    {"handshake_timeout", "set handshake timeout (default: 10)", timeouts.handshake},
+    {"connect_timeout", "set connect timeout (default: 10)", timeouts.connect},
     {"log", "set log file path (default: empty)", log},
     {"policy", "set scheduler policy (default: work_stealing)", policy},
     {"worker", "set number of workers (default: hardware_concurrency)", worker},
     {"throughput", "set max throughput of actor (default: unlimited)", throughput},
+    {"reactors", "set number of I/O reactors, processes with their own event loops that share the ports (default: 1)", reactors},
+    {"offload", "run ciphers in separate actors (default: disable)"},
     {"gate,G", "run in gate mode"},
     {"remote_host", "set remote host (only used in gate mode)", remote_host},
     {"remote_port", "set remote port (only used in gate mode)", remote_port},
@@ -298,9 +567,27 @@ int bootstrap(int argc, char* argv[]) {
     }
   }
 
+  if (codec.empty() && res.opts.count("zlib") > 0) {
+    codec = "zlib";
+  }
+
   if (res.opts.count("config") > 0) {
     return bootstrap_with_config(config, res.opts.count("verbose") > 0);
-  } else if (res.opts.count("gate") > 0) {
+  }
+
+  if (reactors == 0) {
+    std::cerr << "ERROR: Invalid number of reactors" << std::endl;
+    return 1;
+  }
+
+  if (res.opts.count("gate") > 0) {
+    if (reactors > 1) {
+      auto ret = start_reactors(reactors);
+      if (ret >= 0) {
+        return ret;
+      }
+    }
+
     if (policy == "work_stealing") {
       set_scheduler<policy::work_stealing>(worker, throughput);
     } else if (policy == "work_sharing") {
@@ -314,10 +601,15 @@ int bootstrap(int argc, char* argv[]) {
 
     int ret = 0;
     scoped_actor self;
-    auto serv = spawn_io(gate_service_impl, timeout, log);
+    auto serv = spawn_io(gate_service_impl, timeouts,
+                         res.opts.count("offload") > 0,
+                         res.opts.count("verbose") > 0, log);
+    if (reactors > 1) {
+      self->send(serv, reuse_port_atom::value, static_cast<uint32_t>(reactors));
+    }
     std::vector<uint8_t> key(key_src.begin(), key_src.end());
     self->send(serv, add_atom::value, remote_host, remote_port,
-               key, res.opts.count("zlib") > 0);
+               key, codec, cipher);
     auto ok_hdl = [] (ok_atom, uint16_t) {
       std::cout << "INFO: ranger_proxy(gate mode) start-up successfully" << std::endl;
     };
@@ -326,9 +618,9 @@ int bootstrap(int argc, char* argv[]) {
       ret = 1;
     };
     if (host.empty()) {
-      self->sync_send(serv, publish_atom::value, port).await(ok_hdl, err_hdl);
+      self->sync_send(serv, publish_atom::value, port, recv_size).await(ok_hdl, err_hdl);
     } else {
-      self->sync_send(serv, publish_atom::value, host, port).await(ok_hdl, err_hdl);
+      self->sync_send(serv, publish_atom::value, host, port, recv_size).await(ok_hdl, err_hdl);
     }
 
     if (ret) {
@@ -337,6 +629,47 @@ int bootstrap(int argc, char* argv[]) {
 
     return ret;
   } else {
+    rate_spec rate;
+    if (!parse_rate_spec(rate_limit, rate)) {
+      std::cerr << "ERROR: Invalid rate limit[" << rate_limit << "]" << std::endl;
+      return 1;
+    }
+
+    rate_spec user_rate;
+    if (!parse_rate_spec(user_rate_limit, user_rate)) {
+      std::cerr << "ERROR: Invalid rate limit[" << user_rate_limit << "]" << std::endl;
+      return 1;
+    }
+
+    admission_limits admission;
+    if (!parse_connection_limit(max_sessions, admission.sessions,
+                                admission.sessions_per_ip)) {
+      std::cerr << "ERROR: Invalid connection limit[" << max_sessions << "]" << std::endl;
+      return 1;
+    }
+
+    if (!parse_connection_limit(max_handshakes, admission.handshakes,
+                                admission.handshakes_per_ip)) {
+      std::cerr << "ERROR: Invalid connection limit[" << max_handshakes << "]" << std::endl;
+      return 1;
+    }
+
+    if (!parse_rate_spec(accept_rate, admission.accept_rate)) {
+      std::cerr << "ERROR: Invalid accept rate[" << accept_rate << "]" << std::endl;
+      return 1;
+    }
+
+    if (!check_reactor_limits(reactors, admission, user_rate)) {
+      return 1;
+    }
+
+    if (reactors > 1) {
+      auto ret = start_reactors(reactors);
+      if (ret >= 0) {
+        return ret;
+      }
+    }
+
     if (policy == "work_stealing") {
       set_scheduler<policy::work_stealing>(worker, throughput);
     } else if (policy == "work_sharing") {
@@ -349,8 +682,13 @@ int bootstrap(int argc, char* argv[]) {
     set_middleman<network::asio_multiplexer>();
 
     int ret = 0;
-    auto serv = spawn_io(socks5_service_impl, timeout, res.opts.count("verbose") > 0, log);
+    auto serv = spawn_io(socks5_service_impl, timeouts, admission, rate, user_rate,
+                         res.opts.count("offload") > 0,
+                         res.opts.count("verbose") > 0, log);
     scoped_actor self;
+    if (reactors > 1) {
+      self->send(serv, reuse_port_atom::value, static_cast<uint32_t>(reactors));
+    }
     if (!username.empty()) {
       self->sync_send(serv, add_atom::value, username, password).await(
         [] (bool result, const std::string& username) {
@@ -362,6 +700,12 @@ int bootstrap(int argc, char* argv[]) {
         }
       );
     }
+
+    if (!user_file.empty() && !watch_user_file(self, serv, user_file)) {
+      anon_send_exit(serv, exit_reason::kill);
+      return 1;
+    }
+
     std::vector<uint8_t> key(key_src.begin(), key_src.end());
     auto ok_hdl = [] (ok_atom, uint16_t) {
       std::cout << "INFO: ranger_proxy start-up successfully" << std::endl;
@@ -372,10 +716,10 @@ int bootstrap(int argc, char* argv[]) {
     };
     if (host.empty()) {
       self->sync_send(serv, publish_atom::value, port,
-                      key, res.opts.count("zlib") > 0).await(ok_hdl, err_hdl);
+                      key, codec, cipher, recv_size).await(ok_hdl, err_hdl);
     } else {
       self->sync_send(serv, publish_atom::value, host, port,
-                      key, res.opts.count("zlib") > 0).await(ok_hdl, err_hdl);
+                      key, codec, cipher, recv_size).await(ok_hdl, err_hdl);
     }
 
     if (ret) {
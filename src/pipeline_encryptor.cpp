@@ -0,0 +1,82 @@
+// ranger_proxy - A SOCKS5 proxy
+// Copyright (C) 2015  RangerUFO <ufownl@gmail.com>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "common.hpp"
+#include "pipeline_encryptor.hpp"
+#include "aead_encryptor.hpp"
+#include "codec.hpp"
+#include "logger_ostream.hpp"
+#include <stdexcept>
+
+namespace ranger { namespace proxy {
+
+pipeline_state::pipeline_state(encryptor::pointer self)
+  : m_self(self) {
+  // nop
+}
+
+void pipeline_state::init(cipher_type cipher,
+                          const std::vector<uint8_t>& key,
+                          const std::vector<uint8_t>& iv,
+                          bool server,
+                          const codec_spec& codec) {
+  try {
+    m_pipeline.init(cipher, key, iv, server, codec);
+  } catch (const std::runtime_error& e) {
+    log(m_self) << "ERROR: " << e.what() << std::endl;
+    throw;
+  }
+}
+
+void pipeline_state::encrypt(std::vector<char>& buf) {
+  try {
+    m_pipeline.encrypt_in_place(buf);
+  } catch (const std::runtime_error& e) {
+    log(m_self) << "ERROR: " << e.what() << std::endl;
+    throw;
+  }
+}
+
+void pipeline_state::decrypt(std::vector<char>& buf) {
+  try {
+    m_pipeline.decrypt_in_place(buf);
+  } catch (const std::runtime_error& e) {
+    log(m_self) << "ERROR: " << e.what() << std::endl;
+    throw;
+  }
+}
+
+encryptor::behavior_type
+pipeline_encryptor_impl(encryptor::stateful_pointer<pipeline_state> self,
+                        cipher_type cipher,
+                        const std::vector<uint8_t>& key,
+                        const std::vector<uint8_t>& iv,
+                        bool server,
+                        const codec_spec& codec) {
+  self->state.init(cipher, key, iv, server, codec);
+  return {
+    [self] (encrypt_atom, std::vector<char>& data) {
+      self->state.encrypt(data);
+      return std::make_tuple(encrypt_atom::value, std::move(data));
+    },
+    [self] (decrypt_atom, std::vector<char>& data) {
+      self->state.decrypt(data);
+      return std::make_tuple(decrypt_atom::value, std::move(data));
+    }
+  };
+}
+
+} }
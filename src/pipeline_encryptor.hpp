@@ -0,0 +1,60 @@
+// ranger_proxy - A SOCKS5 proxy
+// Copyright (C) 2015  RangerUFO <ufownl@gmail.com>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef RANGER_PROXY_PIPELINE_ENCRYPTOR_HPP
+#define RANGER_PROXY_PIPELINE_ENCRYPTOR_HPP
+
+#include "encryptor.hpp"
+#include "cipher_pipeline.hpp"
+
+namespace ranger { namespace proxy {
+
+// Runs a whole cipher pipeline in one actor for offloaded sessions, so a
+// chunk is compressed and encrypted within a single message and the
+// replies keep the order of the requests.
+class pipeline_state {
+public:
+  pipeline_state(encryptor::pointer self);
+
+  pipeline_state(const pipeline_state&) = delete;
+  pipeline_state& operator = (const pipeline_state&) = delete;
+
+  void init(cipher_type cipher,
+            const std::vector<uint8_t>& key,
+            const std::vector<uint8_t>& iv,
+            bool server,
+            const codec_spec& codec);
+
+  // the requests own their buffers, so chunks are processed in place
+  void encrypt(std::vector<char>& buf);
+  void decrypt(std::vector<char>& buf);
+
+private:
+  encryptor::pointer m_self;
+  cipher_pipeline m_pipeline;
+};
+
+encryptor::behavior_type
+pipeline_encryptor_impl(encryptor::stateful_pointer<pipeline_state> self,
+                        cipher_type cipher,
+                        const std::vector<uint8_t>& key,
+                        const std::vector<uint8_t>& iv,
+                        bool server,
+                        const codec_spec& codec);
+
+} }
+
+#endif  // RANGER_PROXY_PIPELINE_ENCRYPTOR_HPP
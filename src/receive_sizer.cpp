@@ -0,0 +1,109 @@
+// ranger_proxy - A SOCKS5 proxy
+// Copyright (C) 2015  RangerUFO <ufownl@gmail.com>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "common.hpp"
+#include "receive_sizer.hpp"
+#include <algorithm>
+#include <stdlib.h>
+
+namespace ranger { namespace proxy {
+
+namespace {
+
+// consecutive short reads before the size halves
+const size_t shrink_after = 8;
+
+}
+
+bool parse_size(const std::string& str, size_t& size) {
+  auto begin = str.c_str();
+  char* end = nullptr;
+  auto n = strtoul(begin, &end, 10);
+  if (end == begin) {
+    return false;
+  }
+
+  if (*end == 'k' || *end == 'K') {
+    n *= 1024;
+    ++end;
+  } else if (*end == 'm' || *end == 'M') {
+    n *= 1024 * 1024;
+    ++end;
+  }
+
+  if (*end != '\0' || n == 0) {
+    return false;
+  }
+  size = n;
+  return true;
+}
+
+receive_spec::receive_spec()
+  : min_size(MIN_RECEIVE_SIZE)
+  , max_size(BUFFER_SIZE) {
+  // nop
+}
+
+bool parse_receive_spec(const std::string& str, receive_spec& spec) {
+  if (str.empty()) {
+    spec = receive_spec();
+    return true;
+  }
+
+  receive_spec res;
+  auto pos = str.find(':');
+  if (pos == std::string::npos) {
+    if (!parse_size(str, res.max_size)) {
+      return false;
+    }
+    res.min_size = res.max_size;
+  } else if (!parse_size(str.substr(0, pos), res.min_size)
+             || !parse_size(str.substr(pos + 1), res.max_size)
+             || res.min_size > res.max_size) {
+    return false;
+  }
+
+  spec = res;
+  return true;
+}
+
+receive_sizer::receive_sizer(const receive_spec& spec)
+  : m_min(spec.min_size)
+  , m_max(spec.max_size)
+  , m_size(spec.min_size) {
+  // nop
+}
+
+bool receive_sizer::update(size_t len) {
+  if (len >= m_size) {
+    m_short_reads = 0;
+    if (m_size < m_max) {
+      m_size = std::min(m_size * 2, m_max);
+      return true;
+    }
+  } else if (len * 4 <= m_size && m_size > m_min) {
+    if (++m_short_reads >= shrink_after) {
+      m_short_reads = 0;
+      m_size = std::max(m_size / 2, m_min);
+      return true;
+    }
+  } else {
+    m_short_reads = 0;
+  }
+  return false;
+}
+
+} }
@@ -0,0 +1,69 @@
+// ranger_proxy - A SOCKS5 proxy
+// Copyright (C) 2015  RangerUFO <ufownl@gmail.com>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef RANGER_PROXY_RECEIVE_SIZER_HPP
+#define RANGER_PROXY_RECEIVE_SIZER_HPP
+
+#include <string>
+#include <stddef.h>
+
+namespace ranger { namespace proxy {
+
+struct receive_spec {
+  receive_spec();
+  receive_spec(size_t min, size_t max)
+    : min_size(min)
+    , max_size(max) {
+    // nop
+  }
+
+  size_t min_size;
+  size_t max_size;
+};
+
+// a byte count with an optional "k" or "m" suffix, not zero
+bool parse_size(const std::string& str, size_t& size);
+
+// Accepts "<max>" for a fixed size or "<min>:<max>", each in bytes with
+// an optional "k" or "m" suffix. An empty string selects the default,
+// MIN_RECEIVE_SIZE up to BUFFER_SIZE.
+bool parse_receive_spec(const std::string& str, receive_spec& spec);
+
+// Picks the read size of a connection. It starts at the minimum, doubles
+// whenever a read fills the whole size and halves after a run of reads
+// that use at most a quarter of it, so interactive flows keep small
+// buffers while bulk transfers grow towards the maximum.
+class receive_sizer {
+public:
+  explicit receive_sizer(const receive_spec& spec = receive_spec());
+
+  size_t size() const {
+    return m_size;
+  }
+
+  // Feeds the length of the last read, returns whether the size changed.
+  bool update(size_t len);
+
+private:
+  size_t m_min;
+  size_t m_max;
+  size_t m_size;
+  size_t m_short_reads {0};
+};
+
+} }
+
+#endif  // RANGER_PROXY_RECEIVE_SIZER_HPP
@@ -14,21 +14,29 @@
 // You should have received a copy of the GNU General Public License
 // along with this program.  If not, see <http://www.gnu.org/licenses/>.
 
-#include "common.hpp"
-#include "deadline_timer.hpp"
+#ifndef RANGER_PROXY_RELAY_BUFFER_HPP
+#define RANGER_PROXY_RELAY_BUFFER_HPP
+
+#include <vector>
+#include <stddef.h>
 
 namespace ranger { namespace proxy {
 
-deadline_timer::behavior_type
-deadline_timer_impl(deadline_timer::pointer self, int timeout) {
-  return {
-    [] (reset_atom) {
-      // nop
-    },
-    after(std::chrono::seconds(timeout)) >> [self] {
-      self->quit(exit_reason::user_shutdown);
-    }
-  };
+// Hands the content of buf over to wr_buf. While wr_buf is drained the
+// two buffers are swapped, so nothing is copied and buf gets the spare
+// capacity of the outbound buffer back. Returns the number of bytes copied.
+inline size_t relay_buffer(std::vector<char>& wr_buf, std::vector<char>& buf) {
+  size_t copied = 0;
+  if (wr_buf.empty()) {
+    wr_buf.swap(buf);
+  } else {
+    wr_buf.insert(wr_buf.end(), buf.begin(), buf.end());
+    copied = buf.size();
+  }
+  buf.clear();
+  return copied;
 }
 
 } }
+
+#endif  // RANGER_PROXY_RELAY_BUFFER_HPP
@@ -0,0 +1,91 @@
+// ranger_proxy - A SOCKS5 proxy
+// Copyright (C) 2015  RangerUFO <ufownl@gmail.com>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#include "common.hpp"
+#include "reuse_port_acceptor.hpp"
+#include <memory>
+#include <string>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netdb.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+
+namespace ranger { namespace proxy {
+
+namespace {
+
+int open_acceptor(const addrinfo* ai, bool dual_stack) {
+  auto fd = socket(ai->ai_family, ai->ai_socktype | SOCK_CLOEXEC, ai->ai_protocol);
+  if (fd == -1) {
+    return -1;
+  }
+
+  int on = 1;
+  int off = 0;
+  if (setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on)) == -1
+      || setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &on, sizeof(on)) == -1
+      || (dual_stack && ai->ai_family == AF_INET6
+          && setsockopt(fd, IPPROTO_IPV6, IPV6_V6ONLY, &off, sizeof(off)) == -1)
+      || bind(fd, ai->ai_addr, ai->ai_addrlen) == -1
+      || listen(fd, SOMAXCONN) == -1) {
+    auto err = errno;
+    close(fd);
+    errno = err;
+    return -1;
+  }
+  return fd;
+}
+
+}
+
+int new_reuse_port_acceptor(const char* host, uint16_t port) {
+  std::string name = host ? host : "*";
+  addrinfo hints;
+  memset(&hints, 0, sizeof(hints));
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+  hints.ai_flags = AI_PASSIVE | AI_NUMERICSERV;
+  addrinfo* res = nullptr;
+  auto err = getaddrinfo(host, std::to_string(port).c_str(), &hints, &res);
+  if (err != 0) {
+    throw network_error("Fail in resolving host[" + name + "]: " + gai_strerror(err));
+  }
+  std::unique_ptr<addrinfo, void (*)(addrinfo*)> guard(res, freeaddrinfo);
+
+  // the IPv6 wildcard takes IPv4 connections as well, so it goes first
+  std::string what = "No address to listen on";
+  for (auto family : {AF_INET6, AF_INET}) {
+    for (auto ai = res; ai; ai = ai->ai_next) {
+      if (ai->ai_family != family) {
+        continue;
+      }
+
+      auto fd = open_acceptor(ai, host == nullptr);
+      if (fd != -1) {
+        return fd;
+      }
+      what = strerror(errno);
+    }
+  }
+  throw network_error("Fail in listening on [" + name + ":"
+                      + std::to_string(port) + "]: " + what);
+}
+
+} }
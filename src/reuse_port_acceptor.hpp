@@ -14,18 +14,19 @@
 // You should have received a copy of the GNU General Public License
 // along with this program.  If not, see <http://www.gnu.org/licenses/>.
 
-#ifndef RANGER_PROXY_DEADLINE_TIMER_HPP
-#define RANGER_PROXY_DEADLINE_TIMER_HPP
 
-namespace ranger { namespace proxy {
+#ifndef RANGER_PROXY_REUSE_PORT_ACCEPTOR_HPP
+#define RANGER_PROXY_REUSE_PORT_ACCEPTOR_HPP
 
-using reset_atom = atom_constant<atom("reset")>;
+#include <stdint.h>
 
-using deadline_timer = typed_actor<reacts_to<reset_atom>>;
+namespace ranger { namespace proxy {
 
-deadline_timer::behavior_type
-deadline_timer_impl(deadline_timer::pointer self, int timeout);
+// Opens a listening socket with SO_REUSEPORT, so every reactor process
+// can listen on the same port and the kernel spreads the connections
+// among them. A null host listens on all addresses. Throws network_error.
+int new_reuse_port_acceptor(const char* host, uint16_t port);
 
 } }
 
-#endif  // RANGER_PROXY_DEADLINE_TIMER_HPP
+#endif  // RANGER_PROXY_REUSE_PORT_ACCEPTOR_HPP
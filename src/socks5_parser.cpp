@@ -0,0 +1,225 @@
+// ranger_proxy - A SOCKS5 proxy
+// Copyright (C) 2015  RangerUFO <ufownl@gmail.com>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "socks5_parser.hpp"
+#include <algorithm>
+#include <string.h>
+
+namespace ranger { namespace proxy {
+
+socks5_parser::event socks5_parser::parse(const char* data, size_t len, size_t& used) {
+  auto begin = data;
+  auto end = data + len;
+  auto ev = need_more;
+  while (ev == need_more && data != end
+         && m_state != method_selection && m_state != finished && m_state != failed) {
+    switch (m_state) {
+    case greeting_version:
+      if (static_cast<uint8_t>(*data++) != 0x05) {
+        ev = fail(version_mismatch);
+      } else {
+        m_state = greeting_nmethods;
+      }
+      break;
+    case greeting_nmethods:
+      m_method_count = static_cast<uint8_t>(*data++);
+      if (m_method_count == 0) {
+        ev = fail(no_methods);
+      } else {
+        m_state = greeting_methods;
+      }
+      break;
+    case greeting_methods:
+      if (fill(reinterpret_cast<char*>(m_methods), m_method_count, data, end)) {
+        m_state = method_selection;
+        ev = greeting;
+      }
+      break;
+    case auth_version:
+      if (static_cast<uint8_t>(*data++) != 0x01) {
+        ev = fail(version_mismatch);
+      } else {
+        m_state = auth_ulen;
+      }
+      break;
+    case auth_ulen:
+      m_username_size = static_cast<uint8_t>(*data++);
+      if (m_username_size == 0) {
+        ev = fail(empty_username);
+      } else {
+        m_state = auth_username;
+      }
+      break;
+    case auth_username:
+      if (fill(m_username, m_username_size, data, end)) {
+        m_state = auth_plen;
+      }
+      break;
+    case auth_plen:
+      // an empty password is allowed
+      m_password_size = static_cast<uint8_t>(*data++);
+      if (m_password_size == 0) {
+        m_state = request_version;
+        ev = auth;
+      } else {
+        m_state = auth_password;
+      }
+      break;
+    case auth_password:
+      if (fill(m_password, m_password_size, data, end)) {
+        m_state = request_version;
+        ev = auth;
+      }
+      break;
+    case request_version:
+      if (static_cast<uint8_t>(*data++) != 0x05) {
+        ev = fail(version_mismatch);
+      } else {
+        m_state = request_command;
+      }
+      break;
+    case request_command:
+      // CONNECT, BIND or UDP ASSOCIATE
+      m_command = static_cast<uint8_t>(*data++);
+      if (m_command < 0x01 || m_command > 0x03) {
+        ev = fail(command_not_supported);
+      } else {
+        m_state = request_reserved;
+      }
+      break;
+    case request_reserved:
+      ++data;
+      m_state = request_address_type;
+      break;
+    case request_address_type:
+      m_address_type = static_cast<uint8_t>(*data++);
+      if (m_address_type == 0x01) {  // IPV4
+        m_address_size = 4;
+        m_state = request_address;
+      } else if (m_address_type == 0x03) {  // DOMAINNAME
+        m_state = request_address_size;
+      } else if (m_address_type == 0x04) {  // IPV6
+        m_address_size = 16;
+        m_state = request_address;
+      } else {
+        ev = fail(address_type_not_supported);
+      }
+      break;
+    case request_address_size:
+      m_address_size = static_cast<uint8_t>(*data++);
+      m_state = request_address;
+      break;
+    case request_address:
+      if (fill(m_address, m_address_size, data, end)) {
+        m_state = request_port;
+      }
+      break;
+    case request_port:
+      if (fill(m_port, sizeof(m_port), data, end)) {
+        m_state = finished;
+        ev = request;
+      }
+      break;
+    default:
+      break;
+    }
+  }
+
+  used = static_cast<size_t>(data - begin);
+  return ev;
+}
+
+void socks5_parser::select_method(uint8_t method) {
+  m_state = method == 0x02 ? auth_version : request_version;
+}
+
+bool socks5_parser::done() const {
+  return m_state == finished || m_state == failed;
+}
+
+socks5_parser::error_code socks5_parser::reason() const {
+  return m_error;
+}
+
+uint8_t socks5_parser::method_count() const {
+  return m_method_count;
+}
+
+const uint8_t* socks5_parser::methods() const {
+  return m_methods;
+}
+
+bool socks5_parser::offers(uint8_t method) const {
+  return std::find(m_methods, m_methods + m_method_count, method) != m_methods + m_method_count;
+}
+
+const char* socks5_parser::username() const {
+  return m_username;
+}
+
+uint8_t socks5_parser::username_size() const {
+  return m_username_size;
+}
+
+const char* socks5_parser::password() const {
+  return m_password;
+}
+
+uint8_t socks5_parser::password_size() const {
+  return m_password_size;
+}
+
+uint8_t socks5_parser::command() const {
+  return m_command;
+}
+
+uint8_t socks5_parser::address_type() const {
+  return m_address_type;
+}
+
+const char* socks5_parser::address() const {
+  return m_address;
+}
+
+uint8_t socks5_parser::address_size() const {
+  return m_address_size;
+}
+
+uint16_t socks5_parser::port() const {
+  return static_cast<uint16_t>((static_cast<uint8_t>(m_port[0]) << 8)
+                               | static_cast<uint8_t>(m_port[1]));
+}
+
+bool socks5_parser::fill(char* field, size_t size, const char*& data, const char* end) {
+  auto len = std::min(size - m_filled, static_cast<size_t>(end - data));
+  memcpy(field + m_filled, data, len);
+  m_filled += len;
+  data += len;
+  if (m_filled < size) {
+    return false;
+  }
+
+  m_filled = 0;
+  return true;
+}
+
+socks5_parser::event socks5_parser::fail(error_code code) {
+  m_state = failed;
+  m_error = code;
+  return error;
+}
+
+} }
@@ -0,0 +1,127 @@
+// ranger_proxy - A SOCKS5 proxy
+// Copyright (C) 2015  RangerUFO <ufownl@gmail.com>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef RANGER_PROXY_SOCKS5_PARSER_HPP
+#define RANGER_PROXY_SOCKS5_PARSER_HPP
+
+#include <stddef.h>
+#include <stdint.h>
+
+namespace ranger { namespace proxy {
+
+// Parses the client's half of a SOCKS5 handshake: the method selection
+// (RFC 1928), the username/password negotiation (RFC 1929) and the
+// request. It works on the receive buffers as they come in, a message
+// may be split across any number of them, and keeps the fields in fixed
+// buffers of its own, so parsing never allocates.
+class socks5_parser {
+public:
+  enum event {
+    need_more,  // all bytes used, the message isn't complete yet
+    greeting,   // the methods are known, select_method() has to follow
+    auth,       // username and password are known
+    request,    // the request is known, the handshake is done
+    error       // see reason()
+  };
+
+  enum error_code {
+    no_error,
+    version_mismatch,
+    no_methods,
+    empty_username,
+    command_not_supported,
+    address_type_not_supported
+  };
+
+  socks5_parser() = default;
+
+  socks5_parser(const socks5_parser&) = delete;
+  socks5_parser& operator = (const socks5_parser&) = delete;
+
+  // Parses until the next event or the end of the data, and reports the
+  // number of bytes used. Nothing is used after the request or an error.
+  event parse(const char* data, size_t len, size_t& used);
+
+  // the method picked for the client, USERNAME/PASSWORD (0x02) has the
+  // negotiation follow, any other the request
+  void select_method(uint8_t method);
+
+  bool done() const;
+  error_code reason() const;
+
+  uint8_t method_count() const;
+  const uint8_t* methods() const;
+  bool offers(uint8_t method) const;
+
+  const char* username() const;
+  uint8_t username_size() const;
+  const char* password() const;
+  uint8_t password_size() const;
+
+  uint8_t command() const;
+  uint8_t address_type() const;
+  // 4 or 16 bytes of an address, or the characters of a domain name
+  const char* address() const;
+  uint8_t address_size() const;
+  // in host byte order
+  uint16_t port() const;
+
+private:
+  enum state {
+    greeting_version,
+    greeting_nmethods,
+    greeting_methods,
+    method_selection,
+    auth_version,
+    auth_ulen,
+    auth_username,
+    auth_plen,
+    auth_password,
+    request_version,
+    request_command,
+    request_reserved,
+    request_address_type,
+    request_address_size,
+    request_address,
+    request_port,
+    finished,
+    failed
+  };
+
+  // copies the rest of a field, returns whether it's complete
+  bool fill(char* field, size_t size, const char*& data, const char* end);
+  event fail(error_code code);
+
+  state m_state {greeting_version};
+  error_code m_error {no_error};
+  size_t m_filled {0};
+
+  uint8_t m_method_count {0};
+  uint8_t m_methods[255];
+  char m_username[255];
+  uint8_t m_username_size {0};
+  char m_password[255];
+  uint8_t m_password_size {0};
+  uint8_t m_command {0};
+  uint8_t m_address_type {0};
+  char m_address[255];
+  uint8_t m_address_size {0};
+  char m_port[2];
+};
+
+} }
+
+#endif  // RANGER_PROXY_SOCKS5_PARSER_HPP
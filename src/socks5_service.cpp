@@ -18,40 +18,142 @@
 #include "socks5_service.hpp"
 #include "socks5_session.hpp"
 #include "logger_ostream.hpp"
+#include "reuse_port_acceptor.hpp"
 #include <random>
 
 namespace ranger { namespace proxy {
 
-void socks5_service_state::set_user_table(const user_table& tbl) {
-  m_user_tbl = tbl;
+void socks5_service_state::set_user_table(std::shared_ptr<user_table> tbl) {
+  m_user_tbl = std::move(tbl);
 }
 
-const user_table& socks5_service_state::get_user_table() const {
+const std::shared_ptr<user_table>& socks5_service_state::get_user_table() const {
   return m_user_tbl;
 }
 
+void socks5_service_state::set_admission_control(std::shared_ptr<admission_control> ctrl) {
+  m_admission = std::move(ctrl);
+}
+
+const std::shared_ptr<admission_control>&
+socks5_service_state::get_admission_control() const {
+  return m_admission;
+}
+
+void socks5_service_state::set_rate_limits(const rate_spec& rate,
+                                           const rate_spec& user_rate) {
+  if (rate.rate > 0) {
+    m_bucket = std::make_shared<token_bucket>(rate);
+  }
+  if (user_rate.rate > 0) {
+    m_user_buckets = std::make_shared<token_bucket_map>(user_rate);
+  }
+}
+
+rate_limiter socks5_service_state::make_rate_limiter(const doorman_info& info) const {
+  rate_limiter limiter;
+  limiter.add(m_bucket);
+  limiter.add(info.bucket);
+  limiter.set_users(m_user_buckets);
+  return limiter;
+}
+
 void socks5_service_state::add_doorman_info(accept_handle hdl,
                                             const std::vector<uint8_t>& key,
-                                            bool zlib) {
+                                            const codec_spec& codec,
+                                            cipher_type cipher,
+                                            const receive_spec& recv,
+                                            const rate_spec& rate) {
   auto& info = m_info_map[hdl];
-  info.first = key;
-  info.second = zlib;
+  info.key = key;
+  info.codec = codec;
+  info.cipher = cipher;
+  info.recv = recv;
+  if (rate.rate > 0) {
+    info.bucket = std::make_shared<token_bucket>(rate);
+  }
 }
 
 socks5_service_state::doorman_info
 socks5_service_state::get_doorman_info(accept_handle hdl) const {
   auto it = m_info_map.find(hdl);
   if (it == m_info_map.end()) {
-    return {{}, false};
+    return {};
   } else {
     return it->second;
   }
 }
 
+void socks5_service_state::set_reactors(uint32_t reactors) {
+  m_reactors = reactors;
+}
+
+uint32_t socks5_service_state::get_reactors() const {
+  return m_reactors;
+}
+
+namespace {
+
+either<ok_atom, uint16_t>::or_else<error_atom, std::string>
+publish(socks5_service::stateful_broker_pointer<socks5_service_state> self,
+        const char* host, uint16_t port, const std::vector<uint8_t>& key,
+        const std::string& codec_name, const std::string& cipher_name,
+        const std::string& recv_name, const std::string& rate_name) {
+  codec_spec codec;
+  if (!parse_codec(codec_name, codec) || !codec_supported(codec.type)) {
+    return {error_atom::value, "Unsupported codec[" + codec_name + "]"};
+  }
+
+  cipher_type cipher;
+  if (!parse_cipher_type(cipher_name, cipher)) {
+    return {error_atom::value, "Unsupported cipher[" + cipher_name + "]"};
+  } else if (cipher == cipher_type::aead) {
+    cipher = select_aead_cipher();
+  }
+
+  receive_spec recv;
+  if (!parse_receive_spec(recv_name, recv)) {
+    return {error_atom::value, "Invalid receive size[" + recv_name + "]"};
+  }
+
+  rate_spec rate;
+  if (!parse_rate_spec(rate_name, rate)) {
+    return {error_atom::value, "Invalid rate limit[" + rate_name + "]"};
+  }
+
+  auto reactors = self->state.get_reactors();
+  if (reactors != 0) {
+    rate = share_rate_spec(rate, reactors);
+  }
+
+  if (reactors != 0 && port == 0) {
+    return {error_atom::value, "Reactors can't share an ephemeral port"};
+  }
+
+  try {
+    std::pair<accept_handle, uint16_t> doorman;
+    if (reactors != 0) {
+      doorman = {self->add_tcp_doorman(new_reuse_port_acceptor(host, port)), port};
+    } else {
+      doorman = self->add_tcp_doorman(port, host, true);
+    }
+    self->state.add_doorman_info(doorman.first, key, codec, cipher, recv, rate);
+    return {ok_atom::value, doorman.second};
+  } catch (const std::exception& e) {
+    return {error_atom::value, e.what()};
+  }
+}
+
+}
+
 socks5_service::behavior_type
 socks5_service_impl(socks5_service::stateful_broker_pointer<socks5_service_state> self,
-                    int timeout, bool verbose, const std::string& log) {
+                    const session_timeouts& timeouts, const admission_limits& admission,
+                    const rate_spec& rate, const rate_spec& user_rate,
+                    bool offload, bool verbose, const std::string& log) {
   self->trap_exit(true);
+  self->state.set_admission_control(std::make_shared<admission_control>(admission));
+  self->state.set_rate_limits(rate, user_rate);
 
   if (!log.empty()) {
     logger_ostream::redirect(self->spawn<linked>(logger_impl, log));
@@ -60,10 +162,23 @@ socks5_service_impl(socks5_service::stateful_broker_pointer<socks5_service_state
   std::random_device dev;
   std::minstd_rand rd(dev());
   return {
-    [rd, self, timeout, verbose] (const new_connection_msg& msg) mutable {
+    [rd, self, timeouts, offload, verbose] (const new_connection_msg& msg) mutable {
+      // turned away before anything is sent or allocated for it
+      auto ticket = self->state.get_admission_control()->admit(self->remote_addr(msg.handle));
+      if (!ticket) {
+        if (verbose) {
+          ranger::proxy::log(self) << "INFO: Connection rejected ["
+            << self->remote_addr(msg.handle) << ":"
+            << self->remote_port(msg.handle) << "]" << std::endl;
+        }
+        self->close(msg.handle);
+        return;
+      }
+
       auto info = self->state.get_doorman_info(msg.source);
       uint32_t seed = 0;
-      if (!info.first.empty()) {
+      // AEAD sessions send their own salt instead of the seed
+      if (!info.key.empty() && !is_aead_cipher(info.cipher)) {
         seed = rd();
         if (verbose) {
           ranger::proxy::log(self) << "INFO: Initialization vector seed[" << seed << "]" << std::endl;
@@ -74,45 +189,94 @@ socks5_service_impl(socks5_service::stateful_broker_pointer<socks5_service_state
       }
 
       auto forked =
-        self->fork(socks5_session_impl, msg.handle,
+        self->fork(socks5_session_impl, msg.handle, ticket,
                    self->state.get_user_table(),
-                   info.first, seed, info.second,
-                   timeout, verbose);
+                   info.key, info.cipher, seed, info.codec, offload,
+                   info.recv, timeouts, self->state.make_rate_limiter(info), verbose);
       self->link_to(forked);
     },
     [] (const new_data_msg&) {},
     [] (const connection_closed_msg&) {},
     [] (const acceptor_closed_msg&) {},
     [self] (publish_atom, uint16_t port,
-            const std::vector<uint8_t>& key, bool zlib)
+            const std::vector<uint8_t>& key, const std::string& codec_name,
+            const std::string& cipher_name)
       -> either<ok_atom, uint16_t>::or_else<error_atom, std::string> {
-      try {
-        auto doorman = self->add_tcp_doorman(port, nullptr, true);
-        self->state.add_doorman_info(doorman.first, key, zlib);
-        return {ok_atom::value, doorman.second};
-      } catch (const std::exception& e) {
-        return {error_atom::value, e.what()};
-      }
+      return publish(self, nullptr, port, key, codec_name, cipher_name, std::string(), std::string());
     },
     [self] (publish_atom, const std::string& host, uint16_t port,
-            const std::vector<uint8_t>& key, bool zlib)
+            const std::vector<uint8_t>& key, const std::string& codec_name,
+            const std::string& cipher_name)
       -> either<ok_atom, uint16_t>::or_else<error_atom, std::string> {
-      try {
-        auto doorman = self->add_tcp_doorman(port, host.c_str(), true);
-        self->state.add_doorman_info(doorman.first, key, zlib);
-        return {ok_atom::value, doorman.second};
-      } catch (const std::exception& e) {
-        return {error_atom::value, e.what()};
-      }
+      return publish(self, host.c_str(), port, key, codec_name, cipher_name, std::string(), std::string());
+    },
+    [self] (publish_atom, uint16_t port,
+            const std::vector<uint8_t>& key, const std::string& codec_name,
+            const std::string& cipher_name, const std::string& recv_name)
+      -> either<ok_atom, uint16_t>::or_else<error_atom, std::string> {
+      return publish(self, nullptr, port, key, codec_name, cipher_name, recv_name, std::string());
+    },
+    [self] (publish_atom, const std::string& host, uint16_t port,
+            const std::vector<uint8_t>& key, const std::string& codec_name,
+            const std::string& cipher_name, const std::string& recv_name)
+      -> either<ok_atom, uint16_t>::or_else<error_atom, std::string> {
+      return publish(self, host.c_str(), port, key, codec_name, cipher_name, recv_name, std::string());
+    },
+    [self] (publish_atom, uint16_t port,
+            const std::vector<uint8_t>& key, const std::string& codec_name,
+            const std::string& cipher_name, const std::string& recv_name,
+            const std::string& rate_name)
+      -> either<ok_atom, uint16_t>::or_else<error_atom, std::string> {
+      return publish(self, nullptr, port, key, codec_name, cipher_name, recv_name, rate_name);
+    },
+    [self] (publish_atom, const std::string& host, uint16_t port,
+            const std::vector<uint8_t>& key, const std::string& codec_name,
+            const std::string& cipher_name, const std::string& recv_name,
+            const std::string& rate_name)
+      -> either<ok_atom, uint16_t>::or_else<error_atom, std::string> {
+      return publish(self, host.c_str(), port, key, codec_name, cipher_name, recv_name, rate_name);
     },
     [self] (add_atom, const std::string& username, const std::string& password) {
-      auto tbl = self->state.get_user_table();
-      if (!tbl) {
-        tbl = self->spawn<linked>(user_table_impl);
-        self->state.set_user_table(tbl);
+      if (!self->state.get_user_table()) {
+        self->state.set_user_table(std::make_shared<user_table>());
       }
 
-      return self->delegate(tbl, add_atom::value, username, password);
+      auto added = self->state.get_user_table()->add(username, password);
+      return std::make_tuple(added, username);
+    },
+    [self] (user_file_atom, const std::string& path)
+      -> either<ok_atom, uint64_t>::or_else<error_atom, std::string> {
+      if (!self->state.get_user_table()) {
+        self->state.set_user_table(std::make_shared<user_table>());
+      }
+
+      try {
+        // reloads run on the table's own thread, not an actor's
+        auto n = self->state.get_user_table()->watch(
+          path, USER_FILE_CHECK_INTERVAL,
+          [] (bool ok, const std::string& what) {
+            scoped_actor tmp;
+            ranger::proxy::log(tmp) << (ok ? "INFO: " : "ERROR: ") << what << std::endl;
+          }
+        );
+        return {ok_atom::value, static_cast<uint64_t>(n)};
+      } catch (const std::runtime_error& e) {
+        return {error_atom::value, e.what()};
+      }
+    },
+    [self, admission, rate, user_rate] (reuse_port_atom, uint32_t reactors) {
+      // each reactor takes its share of the limits of all sessions
+      self->state.set_reactors(reactors);
+      self->state.set_admission_control(std::make_shared<admission_control>(
+        share_admission_limits(admission, reactors)));
+      self->state.set_rate_limits(share_rate_spec(rate, reactors), user_rate);
+    },
+    [self] (get_atom, admission_atom) {
+      auto stats = self->state.get_admission_control()->stats();
+      return std::make_tuple(stats.accepted, stats.rejected_sessions,
+                             stats.rejected_handshakes, stats.rejected_rate,
+                             static_cast<uint64_t>(stats.sessions),
+                             static_cast<uint64_t>(stats.handshakes));
     },
     [self] (const exit_msg& msg) {
       if (msg.reason != exit_reason::normal
@@ -22,45 +22,105 @@
 #include <unordered_map>
 #include "user_table.hpp"
 #include "encryptor.hpp"
+#include "aead_encryptor.hpp"
+#include "codec.hpp"
+#include "receive_sizer.hpp"
+#include "token_bucket.hpp"
+#include "admission_control.hpp"
 
 namespace ranger { namespace proxy {
 
+// loads a user file and reloads it while it changes
+using user_file_atom = atom_constant<atom("user_file")>;
+
+// the counters of admission control: accepted connections, those
+// rejected over a session limit, a handshake limit and the accept rate,
+// then open sessions and handshakes in progress
+using admission_atom = atom_constant<atom("admission")>;
+
 using socks5_service =
   minimal_server::extend<
-    replies_to<publish_atom, uint16_t, std::vector<uint8_t>, bool>
+    replies_to<publish_atom, uint16_t, std::vector<uint8_t>, std::string, std::string>
+      ::with_either<ok_atom, uint16_t>
+      ::or_else<error_atom, std::string>,
+    replies_to<publish_atom, std::string, uint16_t,
+               std::vector<uint8_t>, std::string, std::string>
+      ::with_either<ok_atom, uint16_t>
+      ::or_else<error_atom, std::string>,
+    replies_to<publish_atom, uint16_t,
+               std::vector<uint8_t>, std::string, std::string, std::string>
+      ::with_either<ok_atom, uint16_t>
+      ::or_else<error_atom, std::string>,
+    replies_to<publish_atom, std::string, uint16_t,
+               std::vector<uint8_t>, std::string, std::string, std::string>
+      ::with_either<ok_atom, uint16_t>
+      ::or_else<error_atom, std::string>,
+    replies_to<publish_atom, uint16_t, std::vector<uint8_t>,
+               std::string, std::string, std::string, std::string>
       ::with_either<ok_atom, uint16_t>
       ::or_else<error_atom, std::string>,
-    replies_to<publish_atom, std::string, uint16_t, std::vector<uint8_t>, bool>
+    replies_to<publish_atom, std::string, uint16_t, std::vector<uint8_t>,
+               std::string, std::string, std::string, std::string>
       ::with_either<ok_atom, uint16_t>
       ::or_else<error_atom, std::string>,
-    replies_to<add_atom, std::string, std::string>::with<bool, std::string>
+    replies_to<add_atom, std::string, std::string>::with<bool, std::string>,
+    replies_to<user_file_atom, std::string>
+      ::with_either<ok_atom, uint64_t>
+      ::or_else<error_atom, std::string>,
+    replies_to<get_atom, admission_atom>
+      ::with<uint64_t, uint64_t, uint64_t, uint64_t, uint64_t, uint64_t>,
+    reacts_to<reuse_port_atom, uint32_t>
   >;
 
 class socks5_service_state {
 public:
-  using doorman_info = std::pair<std::vector<uint8_t>, bool>;
+  struct doorman_info {
+    std::vector<uint8_t> key;
+    codec_spec codec;
+    cipher_type cipher {cipher_type::aes_cfb128};
+    receive_spec recv;
+    std::shared_ptr<token_bucket> bucket;
+  };
 
   socks5_service_state() = default;
 
   socks5_service_state(const socks5_service_state&) = delete;
   socks5_service_state& operator = (const socks5_service_state&) = delete;
 
-  void set_user_table(const user_table& tbl);
-  const user_table& get_user_table() const;
+  void set_user_table(std::shared_ptr<user_table> tbl);
+  const std::shared_ptr<user_table>& get_user_table() const;
+
+  void set_admission_control(std::shared_ptr<admission_control> ctrl);
+  const std::shared_ptr<admission_control>& get_admission_control() const;
+
+  // the limits shared by all sessions, and the one of each user
+  void set_rate_limits(const rate_spec& rate, const rate_spec& user_rate);
+  rate_limiter make_rate_limiter(const doorman_info& info) const;
 
   void add_doorman_info(accept_handle hdl,
                         const std::vector<uint8_t>& key,
-                        bool zlib);
+                        const codec_spec& codec, cipher_type cipher,
+                        const receive_spec& recv, const rate_spec& rate);
   doorman_info get_doorman_info(accept_handle hdl) const;
 
+  // the number of reactors that share the ports, 0 if they aren't shared
+  void set_reactors(uint32_t reactors);
+  uint32_t get_reactors() const;
+
 private:
-  user_table m_user_tbl;
+  std::shared_ptr<user_table> m_user_tbl;
+  std::shared_ptr<admission_control> m_admission;
+  std::shared_ptr<token_bucket> m_bucket;
+  std::shared_ptr<token_bucket_map> m_user_buckets;
   std::unordered_map<accept_handle, doorman_info> m_info_map;
+  uint32_t m_reactors {0};
 };
 
 socks5_service::behavior_type
 socks5_service_impl(socks5_service::stateful_broker_pointer<socks5_service_state> self,
-                    int timeout, bool verbose, const std::string& log);
+                    const session_timeouts& timeouts, const admission_limits& admission,
+                    const rate_spec& rate, const rate_spec& user_rate,
+                    bool offload, bool verbose, const std::string& log);
 
 } }
 
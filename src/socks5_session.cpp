@@ -16,21 +16,62 @@
 
 #include "common.hpp"
 #include "socks5_session.hpp"
-#include "aes_cfb128_encryptor.hpp"
-#include "zlib_encryptor.hpp"
+#include "pipeline_encryptor.hpp"
 #include "async_connect.hpp"
+#include "relay_buffer.hpp"
+#include "buffer_pool.hpp"
+#include <openssl/rand.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
 #include <arpa/inet.h>
 #include <chrono>
+#include <stdexcept>
 #include <string.h>
+#include <unistd.h>
+#include <errno.h>
 
 namespace ranger { namespace proxy {
 
+namespace {
+
+// the local or the peer end of a connection
+boost::asio::ip::tcp::endpoint socket_endpoint(int fd, bool peer) {
+  sockaddr_storage ss;
+  socklen_t len = sizeof(ss);
+  auto addr = reinterpret_cast<sockaddr*>(&ss);
+  if ((peer ? getpeername(fd, addr, &len) : getsockname(fd, addr, &len)) != 0) {
+    throw std::runtime_error(strerror(errno));
+  }
+
+  boost::asio::ip::tcp::endpoint ep;
+  memcpy(ep.data(), &ss, len);
+  ep.resize(len);
+  return ep;
+}
+
+// IPv4-mapped addresses of a dual-stack listener in their IPv4 form
+boost::asio::ip::address unmapped(const boost::asio::ip::address& addr) {
+  if (addr.is_v6() && addr.to_v6().is_v4_mapped()) {
+    return addr.to_v6().to_v4();
+  }
+  return addr;
+}
+
+}
+
 socks5_state::socks5_state(socks5_session::broker_pointer self)
   : m_self(self) {
   // nop
 }
 
 socks5_state::~socks5_state() {
+  if (m_remote_reader) {
+    m_remote_reader->stop();
+  }
+  if (m_udp_relay) {
+    m_udp_relay->stop();
+  }
+
   if (m_verbose) {
     try {
       log(m_self) << "INFO: SOCKS5 session destroyed"
@@ -39,6 +80,42 @@ socks5_state::~socks5_state() {
         << " [local send: " << m_local_send_bytes << "]"
         << " [remote send: " << m_remote_send_bytes << "]"
         << std::endl;
+      if (m_udp_relay) {
+        auto& udp = m_udp_relay->stats();
+        log(m_self) << "INFO: SOCKS5 session UDP relay"
+          << " [client recv: " << udp.client_recv << "]"
+          << " [remote recv: " << udp.remote_recv << "]"
+          << " [client send: " << udp.client_send << "]"
+          << " [remote send: " << udp.remote_send << "]"
+          << " [dropped: " << udp.dropped << "]"
+          << " [batches: " << udp.batches << "]"
+          << std::endl;
+      }
+      if (auto codec = m_pipeline.codec()) {
+        auto& stats = codec->stats();
+        log(m_self) << "INFO: SOCKS5 session compression"
+          << " [saved: " << stats.saved_bytes() << "]"
+          << " [stored: " << stats.stored_bytes << "]"
+          << " [cpu: " << std::chrono::duration_cast<std::chrono::microseconds>(stats.cpu_time).count() << "us]"
+          << std::endl;
+      }
+      auto& pool = buffer_pool::local().stats();
+      log(m_self) << "INFO: Buffer pool of this thread"
+        << " [hits: " << pool.hits << "]"
+        << " [misses: " << pool.misses << "]"
+        << " [peak: " << pool.peak_bytes << "]"
+        << std::endl;
+      auto dns = dns_resolver::instance().stats();
+      auto lookups = std::max<uint64_t>(dns.lookups, 1);
+      log(m_self) << "INFO: DNS resolver"
+        << " [hits: " << dns.hits << "]"
+        << " [negative hits: " << dns.negative_hits << "]"
+        << " [misses: " << dns.misses << "]"
+        << " [coalesced: " << dns.coalesced << "]"
+        << " [failures: " << dns.failures << "]"
+        << " [avg latency: " << std::chrono::duration_cast<std::chrono::microseconds>(dns.total_latency).count() / lookups << "us]"
+        << " [max latency: " << std::chrono::duration_cast<std::chrono::microseconds>(dns.max_latency).count() << "us]"
+        << std::endl;
     } catch (...) {
       // ignore all exceptions
     }
@@ -46,38 +123,63 @@ socks5_state::~socks5_state() {
 }
 
 void socks5_state::init(connection_handle hdl,
-                        const user_table& tbl,
-                        const std::vector<uint8_t>& key,
-                        uint32_t seed, bool zlib,
-                        int timeout, bool verbose) {
-  m_timer = m_self->spawn<linked>(deadline_timer_impl, timeout);
+                        std::shared_ptr<admission_control::ticket> ticket,
+                        std::shared_ptr<user_table> tbl,
+                        const std::vector<uint8_t>& key, cipher_type cipher,
+                        uint32_t seed, const codec_spec& codec, bool offload,
+                        const receive_spec& recv, const session_timeouts& timeouts,
+                        const rate_limiter& limiter, bool verbose) {
   m_local_hdl = hdl;
-  m_self->configure_read(m_local_hdl, receive_policy::at_most(BUFFER_SIZE));
-  m_user_tbl = tbl;
-  if (!key.empty()) {
+  m_ticket = std::move(ticket);
+  m_timeouts = timeouts;
+  m_limiter = limiter;
+  // the wheel ticks once a second, the handshake has to finish before
+  // the first timeout whatever the client sends
+  arm_timer(m_timeouts.handshake);
+  m_local_sizer = receive_sizer(recv);
+  m_remote_sizer = receive_sizer(recv);
+  m_self->configure_read(m_local_hdl, receive_policy::at_most(m_local_sizer.size()));
+  m_user_tbl = std::move(tbl);
+  bool aead = !key.empty() && is_aead_cipher(cipher);
+  std::vector<uint8_t> ivec;
+  std::vector<uint8_t> salt;
+  if (aead) {
+    // the header goes out in the clear before any record
+    salt.resize(aead_salt_size);
+    if (RAND_bytes(salt.data(), static_cast<int>(salt.size())) != 1) {
+      throw std::runtime_error("RAND_bytes failed");
+    }
+    std::vector<char> header(aead_header_size);
+    header[0] = static_cast<char>(aead_cipher_id(cipher));
+    memcpy(header.data() + 1, salt.data(), salt.size());
+    m_self->write(m_local_hdl, header.size(), header.data());
+    m_self->flush(m_local_hdl);
+  } else if (!key.empty()) {
     std::minstd_rand rd(seed);
-    std::vector<uint8_t> ivec(128 / 8);
+    ivec.resize(128 / 8);
     auto data = reinterpret_cast<uint32_t*>(ivec.data());
     for (auto i = 0; i < 4; ++i) {
       data[i] = rd();
     }
-    m_encryptor = m_self->spawn<linked>(aes_cfb128_encryptor_impl, key, ivec);
   }
-  if (zlib) {
-    m_encryptor = m_self->spawn<linked>(zlib_encryptor_impl, m_encryptor);
+  const auto& iv = aead ? salt : ivec;
+  m_key = key;
+  m_cipher = cipher;
+  m_iv = iv;
+  if (!offload) {
+    m_pipeline.init(cipher, key, iv, true, codec);
+  } else if (!key.empty() || codec) {
+    m_encryptor = m_self->spawn<linked>(pipeline_encryptor_impl, cipher, key, iv, true, codec);
   }
   m_verbose = verbose;
   m_valid = true;
-  m_unpacker.expect(2, [this] (std::vector<char> buf) {
-    return handle_select_method(std::move(buf));
-  });
 
   if (m_verbose) {
     log(m_self) << "INFO: SOCKS5 session initialized" << std::endl;
   }
 }
 
-void socks5_state::handle_new_data(const new_data_msg& msg) {
+void socks5_state::handle_new_data(new_data_msg& msg) {
   if (!m_valid) {
     log(m_self) << "ERROR: Current state is invalid ["
       << m_self->remote_addr(m_local_hdl) << ":"
@@ -86,24 +188,47 @@ void socks5_state::handle_new_data(const new_data_msg& msg) {
       << m_self->remote_port(m_remote_hdl) << "]" << std::endl;
     m_self->quit(exit_reason::user_shutdown);
   } else if (msg.handle == m_local_hdl) {
+    adapt_read_size(m_local_hdl, msg.buf.size());
     m_local_recv_bytes += msg.buf.size();
-    m_self->send(m_timer, reset_atom::value);
+    if (m_udp_relay) {
+      // the connection only keeps the association alive from now on
+      return;
+    }
+    if (!m_remote_hdl.invalid()) {
+      m_timer.reset();
+    }
     if (m_encryptor) {
-      m_self->send(m_encryptor, decrypt_atom::value, msg.buf);
+      m_self->send(m_encryptor, decrypt_atom::value, buffer_pool::local().copy(msg.buf));
     } else {
+      if (m_pipeline) {
+        m_pipeline.decrypt_in_place(msg.buf);
+      }
+
       if (m_remote_hdl.invalid()) {
-        m_unpacker.append(msg.buf);
+        handle_handshake(msg.buf.data(), msg.buf.size());
       } else if (m_self->valid(m_remote_hdl)) {
-        write_raw(m_remote_hdl, msg.buf);
+        relay(m_remote_hdl, msg.buf);
       }
     }
   } else {
+    // chunks of the flow reader are pooled, the scribe keeps its own buffer
+    adapt_read_size(m_remote_hdl, msg.buf.size());
     m_remote_recv_bytes += msg.buf.size();
+    m_limiter.consume(msg.buf.size());
+    m_timer.reset();
     if (m_encryptor) {
-      m_self->send(m_encryptor, encrypt_atom::value, msg.buf);
+      m_self->send(m_encryptor, encrypt_atom::value,
+                   m_remote_reader ? std::move(msg.buf) : buffer_pool::local().copy(msg.buf));
       ++m_encrypting;
     } else {
-      write_raw(m_local_hdl, msg.buf);
+      if (m_pipeline) {
+        m_pipeline.encrypt_in_place(msg.buf);
+      }
+      relay(m_local_hdl, msg.buf);
+      if (m_remote_reader) {
+        buffer_pool::local().release(std::move(msg.buf));
+      }
+      read_remote();
     }
   }
 }
@@ -124,6 +249,56 @@ void socks5_state::handle_conn_closed(const connection_closed_msg& msg) {
   }
 }
 
+void socks5_state::handle_new_connection(const new_connection_msg& msg) {
+  boost::asio::ip::tcp::endpoint peer;
+  try {
+    peer = socket_endpoint(static_cast<int>(msg.handle.id()), true);
+  } catch (const std::exception& e) {
+    log(m_self) << "ERROR: " << e.what() << std::endl;
+    m_self->close(msg.handle);
+    return;
+  }
+
+  if (!m_remote_hdl.invalid()
+      || (!m_bind_peer.is_unspecified() && unmapped(peer.address()) != m_bind_peer)) {
+    log(m_self) << "ERROR: Unexpected inbound connection from " << peer << " ["
+      << m_self->remote_addr(m_local_hdl) << ":"
+      << m_self->remote_port(m_local_hdl) << "]" << std::endl;
+    m_self->close(msg.handle);
+    return;
+  }
+
+  // a BIND takes one connection
+  m_self->close(m_bind_hdl);
+  m_remote_hdl = msg.handle;
+  m_timer.reset(m_timeouts.idle);
+
+  if (m_verbose) {
+    log(m_self) << "INFO: " << peer << " connected ["
+      << m_self->remote_addr(m_local_hdl) << ":"
+      << m_self->remote_port(m_local_hdl) << " <- "
+      << m_self->remote_addr(m_remote_hdl) << ":"
+      << m_self->remote_port(m_remote_hdl) << "]" << std::endl;
+  }
+
+  // the second reply names the host that connected
+  write_reply(0x00, peer.data());
+
+  start_remote_reader();
+}
+
+void socks5_state::handle_acceptor_closed(const acceptor_closed_msg& msg) {
+  if (msg.handle != m_bind_hdl || !m_remote_hdl.invalid()) {
+    return;
+  }
+
+  log(m_self) << "ERROR: Listener of BIND closed ["
+    << m_self->remote_addr(m_local_hdl) << ":"
+    << m_self->remote_port(m_local_hdl) << "]" << std::endl;
+  m_valid = false;
+  write_reply(0x01);
+}
+
 void socks5_state::handle_connect_succ(connection_handle hdl) {
   if (m_conn_succ_handler) {
     m_conn_succ_handler(hdl);
@@ -136,72 +311,208 @@ void socks5_state::handle_connect_fail(const std::string& what) {
   }
 }
 
-void socks5_state::handle_encrypted_data(const std::vector<char>& buf) {
+void socks5_state::handle_encrypted_data(std::vector<char>& buf) {
   --m_encrypting;
-  write_raw(m_local_hdl, buf);
+  relay(m_local_hdl, buf);
+  buffer_pool::local().release(std::move(buf));
+  read_remote();
 }
 
-void socks5_state::handle_decrypted_data(const std::vector<char>& buf) {
-  if (m_remote_hdl.invalid()) {
-    m_unpacker.append(buf);
+void socks5_state::handle_decrypted_data(std::vector<char>& buf) {
+  if (m_udp_relay) {
+    // the connection only keeps the association alive
+  } else if (m_remote_hdl.invalid()) {
+    handle_handshake(buf.data(), buf.size());
   } else if (m_self->valid(m_remote_hdl)) {
-    write_raw(m_remote_hdl, buf);
+    relay(m_remote_hdl, buf);
   }
+  buffer_pool::local().release(std::move(buf));
 }
 
-void socks5_state::handle_auth_result(bool result) {
-  if (result) {
-    if (m_verbose) {
-      log(m_self) << "INFO: Auth successfully ["
-        << m_self->remote_addr(m_local_hdl) << ":"
-        << m_self->remote_port(m_local_hdl) << "]" << std::endl;
+void socks5_state::handle_idle() {
+  // datagrams don't reset the timer one by one, the association is
+  // idle once a whole timeout passes without any
+  if (m_udp_relay) {
+    auto& stats = m_udp_relay->stats();
+    auto datagrams = stats.client_recv + stats.remote_recv;
+    if (datagrams != m_udp_datagrams) {
+      m_udp_datagrams = datagrams;
+      arm_timer(m_timeouts.idle);
+      return;
     }
-
-    write_to_local({0x01, 0x00});
-    m_unpacker.expect(4, [this] (std::vector<char> buf) {
-      return handle_request_header(std::move(buf));
-    });
-  } else {
-    log(m_self) << "ERROR: Username or password error ["
-      << m_self->remote_addr(m_local_hdl) << ":"
-      << m_self->remote_port(m_local_hdl) << "]" << std::endl;
-    m_valid = false;
-    write_to_local({0x01, static_cast<char>(0xFF)});
   }
-}
 
-void socks5_state::handle_user_shutdown(const actor_addr& source) {
-  if (m_verbose && m_timer == source) {
+  if (m_verbose) {
     log(m_self) << "INFO: Session timeout ["
       << m_self->remote_addr(m_local_hdl) << ":"
       << m_self->remote_port(m_local_hdl) << " -> "
       << m_self->remote_addr(m_remote_hdl) << ":"
       << m_self->remote_port(m_remote_hdl) << "]" << std::endl;
   }
+  m_self->quit(exit_reason::user_shutdown);
+}
+
+void socks5_state::handle_drain() {
+  m_draining = false;
+  read_remote();
+}
+
+void socks5_state::handle_shape() {
+  read_remote();
+}
+
+void socks5_state::arm_timer(int timeout) {
+  intrusive_ptr<socks5_session::broker_base> self = m_self;
+  auto wheel = timer_wheel::local(*m_self->parent().backend().pimpl());
+  wheel->arm(m_timer, timeout, [self] {
+    if (self->exit_reason() == exit_reason::not_exited) {
+      self->send(self, idle_atom::value);
+    }
+  });
+}
+
+void socks5_state::arm_shape_timer(token_bucket::clock::duration wait) {
+  intrusive_ptr<socks5_session::broker_base> self = m_self;
+  auto wheel = timer_wheel::local_fine(*m_self->parent().backend().pimpl());
+  auto tick = std::chrono::duration_cast<token_bucket::clock::duration>(wheel->tick());
+  // whole ticks, rounded up
+  auto ticks = (wait + tick - token_bucket::clock::duration(1)) / tick;
+  wheel->arm(m_shape_timer, static_cast<uint64_t>(ticks), [self] {
+    if (self->exit_reason() == exit_reason::not_exited) {
+      self->send(self, shape_atom::value);
+    }
+  });
+}
+
+void socks5_state::start_remote_reader() {
+  // the remote scribe only writes, reads go through the flow reader
+  auto fd = dup(static_cast<int>(m_remote_hdl.id()));
+  if (fd == -1) {
+    log(m_self) << "ERROR: " << strerror(errno) << std::endl;
+    m_self->configure_read(m_remote_hdl, receive_policy::at_most(m_remote_sizer.size()));
+    return;
+  }
+
+  try {
+    m_remote_reader = std::make_shared<flow_reader>(*m_self->parent().backend().pimpl(),
+                                                    fd, m_limiter.read_size(m_remote_sizer.size()));
+  } catch (const std::exception& e) {
+    log(m_self) << "ERROR: " << e.what() << std::endl;
+    close(fd);
+    m_self->configure_read(m_remote_hdl, receive_policy::at_most(m_remote_sizer.size()));
+    return;
+  }
+
+  intrusive_ptr<socks5_session::broker_base> self = m_self;
+  auto hdl = m_remote_hdl;
+  m_remote_reader->start([self, hdl] (std::vector<char> buf) {
+    if (self->exit_reason() != exit_reason::not_exited) {
+      return;
+    } else if (buf.empty()) {
+      self->send(self, connection_closed_msg{hdl});
+    } else {
+      self->send(self, new_data_msg{hdl, std::move(buf)});
+    }
+  });
 }
 
-void socks5_state::write_to_local(std::vector<char> buf) {
+void socks5_state::read_remote() {
+  if (!m_remote_reader) {
+    return;
+  }
+
+  if (!m_remote_flow.update(m_self->wr_buf(m_local_hdl).size())) {
+    if (!m_draining) {
+      m_draining = true;
+      m_self->delayed_send(m_self, DRAIN_CHECK_INTERVAL, drain_atom::value);
+    }
+    return;
+  }
+
+  // a limit that ran out stops reading until its bucket refilled
+  if (!m_limiter.empty()) {
+    auto wait = m_limiter.wait(token_bucket::clock::now());
+    if (wait > token_bucket::clock::duration::zero()) {
+      if (!m_shape_timer.armed()) {
+        arm_shape_timer(wait);
+      }
+      return;
+    }
+  }
+  m_remote_reader->read_next();
+}
+
+void socks5_state::adapt_read_size(connection_handle hdl, size_t len) {
+  auto& sizer = hdl == m_local_hdl ? m_local_sizer : m_remote_sizer;
+  if (!sizer.update(len)) {
+    return;
+  }
+
+  if (hdl == m_remote_hdl && m_remote_reader) {
+    m_remote_reader->set_read_size(m_limiter.read_size(sizer.size()));
+  } else {
+    m_self->configure_read(hdl, receive_policy::at_most(sizer.size()));
+  }
+}
+
+void socks5_state::write_to_local(std::initializer_list<char> data) {
+  write_to_local(data.begin(), data.size());
+}
+
+void socks5_state::write_to_local(const char* data, size_t len) {
+  auto buf = buffer_pool::local().acquire(len);
+  buf.assign(data, data + len);
   if (m_encryptor) {
     m_self->send(m_encryptor, encrypt_atom::value, std::move(buf));
     ++m_encrypting;
   } else {
-    write_raw(m_local_hdl, std::move(buf));
+    if (m_pipeline) {
+      m_pipeline.encrypt_in_place(buf);
+    }
+    relay(m_local_hdl, buf);
+    buffer_pool::local().release(std::move(buf));
+  }
+}
+
+void socks5_state::write_reply(uint8_t rep) {
+  // BND.ADDR and BND.PORT are the local end of the remote connection, or
+  // zeros in IPv4 form when there is none
+  sockaddr_storage ss;
+  socklen_t ss_len = sizeof(ss);
+  if (!m_remote_hdl.invalid()
+      && getsockname(static_cast<int>(m_remote_hdl.id()),
+                     reinterpret_cast<sockaddr*>(&ss), &ss_len) == 0) {
+    write_reply(rep, reinterpret_cast<const sockaddr*>(&ss));
+  } else {
+    write_reply(rep, nullptr);
+  }
+}
+
+void socks5_state::write_reply(uint8_t rep, const sockaddr* bnd) {
+  char reply[22] = {0x05, static_cast<char>(rep), 0x00, 0x01};
+  size_t len = 10;
+  if (bnd && bnd->sa_family == AF_INET) {
+    auto sin = reinterpret_cast<const sockaddr_in*>(bnd);
+    memcpy(reply + 4, &sin->sin_addr, sizeof(sin->sin_addr));
+    memcpy(reply + 8, &sin->sin_port, sizeof(sin->sin_port));
+  } else if (bnd && bnd->sa_family == AF_INET6) {
+    auto sin6 = reinterpret_cast<const sockaddr_in6*>(bnd);
+    reply[3] = 0x04;
+    memcpy(reply + 4, &sin6->sin6_addr, sizeof(sin6->sin6_addr));
+    memcpy(reply + 20, &sin6->sin6_port, sizeof(sin6->sin6_port));
+    len = 22;
   }
+  write_to_local(reply, len);
 }
 
-void socks5_state::write_raw(connection_handle hdl, std::vector<char> buf) {
+void socks5_state::relay(connection_handle hdl, std::vector<char>& buf) {
   if (hdl == m_local_hdl) {
     m_local_send_bytes += buf.size();
   } else {
     m_remote_send_bytes += buf.size();
   }
 
-  auto& wr_buf = m_self->wr_buf(hdl);
-  if (wr_buf.empty()) {
-    wr_buf = std::move(buf);
-  } else {
-    wr_buf.insert(wr_buf.end(), buf.begin(), buf.end());
-  }
+  relay_buffer(m_self->wr_buf(hdl), buf);
   m_self->flush(hdl);
 
   if (!m_valid && m_encrypting == 0) {
@@ -209,96 +520,136 @@ void socks5_state::write_raw(connection_handle hdl, std::vector<char> buf) {
   }
 }
 
-bool socks5_state::handle_select_method(std::vector<char> buf) {
-  if (static_cast<uint8_t>(buf[0]) != 0x05) {
+void socks5_state::handle_handshake(const char* data, size_t len) {
+  // the parser stops at each message the session has to answer, what
+  // follows the request is dropped
+  while (len > 0 && !m_parser.done()) {
+    size_t used = 0;
+    auto ev = m_parser.parse(data, len, used);
+    data += used;
+    len -= used;
+    switch (ev) {
+    case socks5_parser::greeting:
+      if (!handle_select_method()) {
+        return;
+      }
+      break;
+    case socks5_parser::auth:
+      if (!handle_username_auth()) {
+        return;
+      }
+      break;
+    case socks5_parser::request:
+      handle_request();
+      break;
+    case socks5_parser::error:
+      handle_handshake_error();
+      return;
+    case socks5_parser::need_more:
+      break;
+    }
+  }
+}
+
+void socks5_state::handle_handshake_error() {
+  switch (m_parser.reason()) {
+  case socks5_parser::version_mismatch:
     log(m_self) << "ERROR: Protocol version mismatch ["
       << m_self->remote_addr(m_local_hdl) << ":"
       << m_self->remote_port(m_local_hdl) << "]" << std::endl;
     m_self->quit(exit_reason::user_shutdown);
-    return false;
-  }
-
-  uint8_t nmethods = buf[1];
-  if (nmethods == 0) {
+    break;
+  case socks5_parser::no_methods:
     log(m_self) << "ERROR: NO ACCEPTABLE METHODS ["
       << m_self->remote_addr(m_local_hdl) << ":"
       << m_self->remote_port(m_local_hdl) << "]" << std::endl;
     m_valid = false;
     write_to_local({0x05, static_cast<char>(0xFF)});
-    return false;
+    break;
+  case socks5_parser::empty_username:
+    log(m_self) << "ERROR: Username is empty ["
+      << m_self->remote_addr(m_local_hdl) << ":"
+      << m_self->remote_port(m_local_hdl) << "]" << std::endl;
+    m_valid = false;
+    write_to_local({0x01, static_cast<char>(0xFF)});
+    break;
+  case socks5_parser::command_not_supported:
+    log(m_self) << "ERROR: Command not supported ["
+      << m_self->remote_addr(m_local_hdl) << ":"
+      << m_self->remote_port(m_local_hdl) << "]" << std::endl;
+    m_valid = false;
+    write_reply(0x07);
+    break;
+  case socks5_parser::address_type_not_supported:
+    log(m_self) << "ERROR: Address type not supported ["
+      << m_self->remote_addr(m_local_hdl) << ":"
+      << m_self->remote_port(m_local_hdl) << "]" << std::endl;
+    m_valid = false;
+    write_reply(0x08);
+    break;
+  case socks5_parser::no_error:
+    break;
   }
+}
 
+bool socks5_state::handle_select_method() {
   if (m_verbose) {
-    log(m_self) << "INFO: recv select method header"
-      << " (nmethods == " << nmethods << ") ["
+    log(m_self) << "INFO: recv select method"
+      << " (nmethods == " << static_cast<unsigned int>(m_parser.method_count()) << ") ["
       << m_self->remote_addr(m_local_hdl) << ":"
       << m_self->remote_port(m_local_hdl) << "]" << std::endl;
-  }
-
-  m_unpacker.expect(nmethods, [this] (std::vector<char> buf) {
-    if (m_verbose) {
-      log(m_self) << "INFO: recv select method data ["
-        << m_self->remote_addr(m_local_hdl) << ":"
-        << m_self->remote_port(m_local_hdl) << "]" << std::endl;
-      for (auto i = 0; i < buf.size(); ++i) {
-        log(m_self) << "INFO: method[" << i << "] = "
-          << static_cast<unsigned int>(buf[i]) << std::endl;
-      }
-    }
-
-    uint8_t method = 0x00;
-    if (m_user_tbl) {
-      method = 0x02;
+    for (auto i = 0; i < m_parser.method_count(); ++i) {
+      log(m_self) << "INFO: method[" << i << "] = "
+        << static_cast<unsigned int>(m_parser.methods()[i]) << std::endl;
     }
+  }
 
-    if (std::find(buf.begin(), buf.end(), method) != buf.end()) {
-      write_to_local({0x05, static_cast<char>(method)});
-      if (method == 0x00) {
-        if (m_verbose) {
-          log(m_self) << "INFO: Select method [NO AUTHENTICATION REQUIRED] ["
-            << m_self->remote_addr(m_local_hdl) << ":"
-            << m_self->remote_port(m_local_hdl) << "]" << std::endl;
-        }
-        m_unpacker.expect(4, [this] (std::vector<char> buf) {
-          return handle_request_header(std::move(buf));
-        });
-      } else {
-        if (m_verbose) {
-          log(m_self) << "INFO: Select method [USERNAME/PASSWORD] ["
-            << m_self->remote_addr(m_local_hdl) << ":"
-            << m_self->remote_port(m_local_hdl) << "]" << std::endl;
-        }
-        m_unpacker.expect(2, [this] (std::vector<char> buf) {
-          return handle_username_auth(std::move(buf));
-        });
-      }
-    } else {
-      log(m_self) << "ERROR: NO ACCEPTABLE METHODS ["
-        << m_self->remote_addr(m_local_hdl) << ":"
-        << m_self->remote_port(m_local_hdl) << "]" << std::endl;
-      m_valid = false;
-      write_to_local({0x05, static_cast<char>(0xFF)});
-      return false;
-    }
+  uint8_t method = 0x00;
+  if (m_user_tbl) {
+    method = 0x02;
+  }
 
-    return true;
-  });
+  if (!m_parser.offers(method)) {
+    log(m_self) << "ERROR: NO ACCEPTABLE METHODS ["
+      << m_self->remote_addr(m_local_hdl) << ":"
+      << m_self->remote_port(m_local_hdl) << "]" << std::endl;
+    m_valid = false;
+    write_to_local({0x05, static_cast<char>(0xFF)});
+    return false;
+  }
 
+  write_to_local({0x05, static_cast<char>(method)});
+  m_parser.select_method(method);
+  if (m_verbose) {
+    log(m_self) << "INFO: Select method ["
+      << (method == 0x00 ? "NO AUTHENTICATION REQUIRED" : "USERNAME/PASSWORD") << "] ["
+      << m_self->remote_addr(m_local_hdl) << ":"
+      << m_self->remote_port(m_local_hdl) << "]" << std::endl;
+  }
   return true;
 }
 
-bool socks5_state::handle_username_auth(std::vector<char> buf) {
-  if (static_cast<uint8_t>(buf[0]) != 0x01) {
-    log(m_self) << "ERROR: Protocol version mismatch ["
+bool socks5_state::handle_username_auth() {
+  std::string username(m_parser.username(), m_parser.username_size());
+  std::string password(m_parser.password(), m_parser.password_size());
+  if (m_verbose) {
+    log(m_self) << "INFO: Auth [" << username << " & "
+      << (password.empty() ? "[empty]" : password) << "] ["
       << m_self->remote_addr(m_local_hdl) << ":"
       << m_self->remote_port(m_local_hdl) << "]" << std::endl;
-    m_self->quit(exit_reason::user_shutdown);
+  }
+
+  if (!handle_auth_result(m_user_tbl->auth(username, password))) {
     return false;
   }
 
-  uint8_t len = buf[1];
-  if (len == 0) {
-    log(m_self) << "ERROR: Username is empty ["
+  m_limiter.add_user(username);
+  return true;
+}
+
+bool socks5_state::handle_auth_result(bool result) {
+  if (!result) {
+    log(m_self) << "ERROR: Username or password error ["
       << m_self->remote_addr(m_local_hdl) << ":"
       << m_self->remote_port(m_local_hdl) << "]" << std::endl;
     m_valid = false;
@@ -306,219 +657,322 @@ bool socks5_state::handle_username_auth(std::vector<char> buf) {
     return false;
   }
 
-  m_unpacker.expect(len + 1, [this] (std::vector<char> buf) {
-    uint8_t len = buf.back();
-    std::string username(buf.begin(), buf.begin() + buf.size() - 1);
-    if (len > 0) {
-      m_unpacker.expect(len, [this, username] (std::vector<char> buf) {
-        std::string password(buf.begin(), buf.end());
-        if (m_verbose) {
-          log(m_self) << "INFO: Auth [" << username << " & " << password << "] ["
-            << m_self->remote_addr(m_local_hdl) << ":"
-            << m_self->remote_port(m_local_hdl) << "]" << std::endl;
-        }
-
-        m_self->send(m_user_tbl, auth_atom::value, username, password);
-        return true;
-      });
-    } else {
-      if (m_verbose) {
-        log(m_self) << "INFO: Auth [" << username << " & [empty]] ["
-          << m_self->remote_addr(m_local_hdl) << ":"
-          << m_self->remote_port(m_local_hdl) << "]" << std::endl;
-      }
-
-      m_self->send(m_user_tbl, auth_atom::value, username, std::string());
-    }
-
-    return true;
-  });
+  if (m_verbose) {
+    log(m_self) << "INFO: Auth successfully ["
+      << m_self->remote_addr(m_local_hdl) << ":"
+      << m_self->remote_port(m_local_hdl) << "]" << std::endl;
+  }
 
+  write_to_local({0x01, 0x00});
   return true;
 }
 
-bool socks5_state::handle_request_header(std::vector<char> buf) {
-  if (static_cast<uint8_t>(buf[0]) != 0x05) {
-    log(m_self) << "ERROR: Protocol version mismatch ["
-      << m_self->remote_addr(m_local_hdl) << ":"
-      << m_self->remote_port(m_local_hdl) << "]" << std::endl;
-    m_self->quit(exit_reason::user_shutdown);
-    return false;
+void socks5_state::handle_request() {
+  if (m_ticket) {
+    m_ticket->handshake_done();
   }
 
   if (m_verbose) {
-    log(m_self) << "INFO: recv request header ["
+    auto cmd = m_parser.command();
+    auto atyp = m_parser.address_type();
+    log(m_self) << "INFO: CMD["
+      << (cmd == 0x01 ? "connect" : cmd == 0x02 ? "bind" : "udp associate") << "] ADDR["
+      << (atyp == 0x01 ? "ipv4" : atyp == 0x03 ? "domainname" : "ipv6") << "] ["
       << m_self->remote_addr(m_local_hdl) << ":"
       << m_self->remote_port(m_local_hdl) << "]" << std::endl;
   }
 
-  if (static_cast<uint8_t>(buf[1]) != 0x01) {
-    log(m_self) << "ERROR: Command not supported ["
+  switch (m_parser.address_type()) {
+  case 0x01: {  // IPV4
+    in_addr addr;
+    memcpy(&addr, m_parser.address(), sizeof(addr));
+    handle_ipv4_request(addr, m_parser.port());
+    break;
+  }
+  case 0x03:  // DOMAINNAME
+    handle_domainname_request(std::string(m_parser.address(), m_parser.address_size()),
+                              m_parser.port());
+    break;
+  case 0x04: {  // IPV6
+    in6_addr addr;
+    memcpy(&addr, m_parser.address(), sizeof(addr));
+    handle_ipv6_request(addr, m_parser.port());
+    break;
+  }
+  }
+}
+
+void socks5_state::handle_ipv4_request(const in_addr& addr, uint16_t port) {
+  if (m_parser.command() == 0x02) {
+    start_bind(boost::asio::ip::address_v4(ntohl(addr.s_addr)));
+    return;
+  } else if (m_parser.command() == 0x03) {
+    start_udp_associate(boost::asio::ip::address_v4(ntohl(addr.s_addr)), port);
+    return;
+  }
+
+  if (m_verbose) {
+    log(m_self) << "INFO: connect to " << inet_ntoa(addr) << ":" << port << " ["
       << m_self->remote_addr(m_local_hdl) << ":"
       << m_self->remote_port(m_local_hdl) << "]" << std::endl;
-    m_valid = false;
-    write_to_local({0x05, 0x07, 0x00, 0x01});
-    return false;
   }
 
-  switch (static_cast<uint8_t>(buf[3])) {
-  case 0x01:  // IPV4
-    if (m_verbose) {
-      log(m_self) << "INFO: CMD[connect] ADDR[ipv4] ["
-        << m_self->remote_addr(m_local_hdl) << ":"
-        << m_self->remote_port(m_local_hdl) << "]" << std::endl;
-    }
-    m_unpacker.expect(6, [this] (std::vector<char> buf) {
-      return handle_ipv4_request(std::move(buf));
-    });
-    return true;
-  case 0x03:  // DOMAINNAME
+  async_connect<socks5_session::broker_base>(m_self, addr, port);
+  m_timer.reset(m_timeouts.connect);
+  m_valid = false;
+
+  m_conn_succ_handler = [this, addr, port] (connection_handle remote_hdl) {
+    m_self->assign_tcp_scribe(remote_hdl);
+    m_remote_hdl = remote_hdl;
+    m_valid = true;
+    m_timer.reset(m_timeouts.idle);
+
     if (m_verbose) {
-      log(m_self) << "INFO: CMD[connect] ADDR[domainname] ["
+      log(m_self) << "INFO: " << inet_ntoa(addr) << ":" << port << " connected ["
         << m_self->remote_addr(m_local_hdl) << ":"
-        << m_self->remote_port(m_local_hdl) << "]" << std::endl;
+        << m_self->remote_port(m_local_hdl) << " -> "
+        << m_self->remote_addr(m_remote_hdl) << ":"
+        << m_self->remote_port(m_remote_hdl) << "]" << std::endl;
     }
-    m_unpacker.expect(1, [this] (std::vector<char> buf) {
-      return handle_domainname_request(std::move(buf));
-    });
-    return true;
-  }
+    
+    write_reply(0x00);
 
-  log(m_self) << "ERROR: Address type not supported ["
-    << m_self->remote_addr(m_local_hdl) << ":"
-    << m_self->remote_port(m_local_hdl) << "]" << std::endl;
-  m_valid = false;
-  write_to_local({0x05, 0x08, 0x00, 0x01});
-  return false;
+    start_remote_reader();
+  };
+
+  m_conn_fail_handler = [this, addr, port] (const std::string& what) {
+    log(m_self) << "ERROR: " << what << " ["
+      << m_self->remote_addr(m_local_hdl) << ":"
+      << m_self->remote_port(m_local_hdl) << "]" << std::endl;
+    write_reply(0x05);
+  };
 }
 
-bool socks5_state::handle_ipv4_request(std::vector<char> buf) {
-  in_addr addr;
-  memcpy(&addr, &buf[0], sizeof(addr));
-  uint16_t port;
-  memcpy(&port, &buf[4], sizeof(port));
+void socks5_state::handle_ipv6_request(const in6_addr& addr, uint16_t port) {
+  if (m_parser.command() != 0x01) {
+    boost::asio::ip::address_v6::bytes_type bytes;
+    memcpy(bytes.data(), &addr, bytes.size());
+    if (m_parser.command() == 0x02) {
+      start_bind(boost::asio::ip::address_v6(bytes));
+    } else {
+      start_udp_associate(boost::asio::ip::address_v6(bytes), port);
+    }
+    return;
+  }
+
+  char addr_str[INET6_ADDRSTRLEN];
+  std::string host = inet_ntop(AF_INET6, &addr, addr_str, sizeof(addr_str));
 
   if (m_verbose) {
-    log(m_self) << "INFO: connect to " << inet_ntoa(addr) << ":" << ntohs(port) << " ["
+    log(m_self) << "INFO: connect to [" << host << "]:" << port << " ["
       << m_self->remote_addr(m_local_hdl) << ":"
       << m_self->remote_port(m_local_hdl) << "]" << std::endl;
   }
 
-  async_connect<socks5_session::broker_base>(m_self, addr, ntohs(port));
+  async_connect<socks5_session::broker_base>(m_self, addr, port);
+  m_timer.reset(m_timeouts.connect);
   m_valid = false;
 
-  m_conn_succ_handler = [this, addr, port] (connection_handle remote_hdl) {
+  m_conn_succ_handler = [this, host, port] (connection_handle remote_hdl) {
     m_self->assign_tcp_scribe(remote_hdl);
     m_remote_hdl = remote_hdl;
     m_valid = true;
+    m_timer.reset(m_timeouts.idle);
 
     if (m_verbose) {
-      log(m_self) << "INFO: " << inet_ntoa(addr) << ":" << ntohs(port) << " connected ["
+      log(m_self) << "INFO: [" << host << "]:" << port << " connected ["
         << m_self->remote_addr(m_local_hdl) << ":"
         << m_self->remote_port(m_local_hdl) << " -> "
         << m_self->remote_addr(m_remote_hdl) << ":"
         << m_self->remote_port(m_remote_hdl) << "]" << std::endl;
     }
-    
-    write_to_local({0x05, 0x00, 0x00, 0x01, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00});
 
-    m_self->configure_read(m_remote_hdl, receive_policy::at_most(BUFFER_SIZE));
+    write_reply(0x00);
+
+    start_remote_reader();
   };
 
-  m_conn_fail_handler = [this, addr, port] (const std::string& what) {
+  m_conn_fail_handler = [this] (const std::string& what) {
     log(m_self) << "ERROR: " << what << " ["
       << m_self->remote_addr(m_local_hdl) << ":"
       << m_self->remote_port(m_local_hdl) << "]" << std::endl;
-    write_to_local({0x05, 0x05, 0x00, 0x01, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00});
+    write_reply(0x05);
   };
-
-  return true;
 }
 
-bool socks5_state::handle_domainname_request(std::vector<char> buf) {
-  m_unpacker.expect(static_cast<uint8_t>(buf[0]) + 2, [this] (std::vector<char> buf) {
-    std::string host(buf.begin(), buf.begin() + buf.size() - 2);
-    uint16_t port;
-    memcpy(&port, &buf[buf.size() - 2], sizeof(port));
+void socks5_state::handle_domainname_request(const std::string& host, uint16_t port) {
+  if (m_parser.command() == 0x02) {
+    // a name isn't resolved to check the host that connects
+    start_bind(boost::asio::ip::address());
+    return;
+  } else if (m_parser.command() == 0x03) {
+    // a name can't tell where the client sends from
+    start_udp_associate(boost::asio::ip::address(), port);
+    return;
+  }
+
+  if (m_verbose) {
+    log(m_self) << "INFO: connect to " << host << ":" << port << " ["
+      << m_self->remote_addr(m_local_hdl) << ":"
+      << m_self->remote_port(m_local_hdl) << "]" << std::endl;
+  }
+
+  async_connect<socks5_session::broker_base>(m_self, host, port);
+  m_timer.reset(m_timeouts.connect);
+  m_valid = false;
+
+  m_conn_succ_handler = [this, host, port] (connection_handle remote_hdl) {
+    m_self->assign_tcp_scribe(remote_hdl);
+    m_remote_hdl = remote_hdl;
+    m_valid = true;
+    m_timer.reset(m_timeouts.idle);
 
     if (m_verbose) {
-      log(m_self) << "INFO: connect to " << host << ":" << ntohs(port) << " ["
+      log(m_self) << "INFO: " << host << ":" << port << " connected ["
         << m_self->remote_addr(m_local_hdl) << ":"
-        << m_self->remote_port(m_local_hdl) << "]" << std::endl;
+        << m_self->remote_port(m_local_hdl) << " -> "
+        << m_self->remote_addr(m_remote_hdl) << ":"
+        << m_self->remote_port(m_remote_hdl) << "]" << std::endl;
     }
 
-    async_connect<socks5_session::broker_base>(m_self, host, ntohs(port));
-    m_valid = false;
+    write_reply(0x00);
 
-    m_conn_succ_handler = [this, host, port] (connection_handle remote_hdl) {
-      m_self->assign_tcp_scribe(remote_hdl);
-      m_remote_hdl = remote_hdl;
-      m_valid = true;
-
-      if (m_verbose) {
-        log(m_self) << "INFO: " << host << ":" << ntohs(port) << " connected ["
-          << m_self->remote_addr(m_local_hdl) << ":"
-          << m_self->remote_port(m_local_hdl) << " -> "
-          << m_self->remote_addr(m_remote_hdl) << ":"
-          << m_self->remote_port(m_remote_hdl) << "]" << std::endl;
-      }
+    start_remote_reader();
+  };
 
-      write_to_local({0x05, 0x00, 0x00, 0x01, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00});
+  m_conn_fail_handler = [this, host, port] (const std::string& what) {
+    log(m_self) << "ERROR: " << what << " ["
+      << m_self->remote_addr(m_local_hdl) << ":"
+      << m_self->remote_port(m_local_hdl) << "]" << std::endl;
+    write_reply(0x05);
+  };
+}
 
-      m_self->configure_read(m_remote_hdl, receive_policy::at_most(BUFFER_SIZE));
-    };
+void socks5_state::start_bind(const boost::asio::ip::address& addr) {
+  // The listener is opened on the address the client reached the proxy
+  // at. The first reply tells where it listens, the second one which
+  // host connected. Only the host named in the request may connect.
+  boost::asio::ip::tcp::endpoint ep;
+  try {
+    ep = socket_endpoint(static_cast<int>(m_local_hdl.id()), false);
+    auto doorman = m_self->add_tcp_doorman(0, ep.address().to_string().c_str(), true);
+    m_bind_hdl = doorman.first;
+    ep.port(doorman.second);
+  } catch (const std::exception& e) {
+    log(m_self) << "ERROR: " << e.what() << " ["
+      << m_self->remote_addr(m_local_hdl) << ":"
+      << m_self->remote_port(m_local_hdl) << "]" << std::endl;
+    m_valid = false;
+    write_reply(0x01);
+    return;
+  }
+  m_bind_peer = unmapped(addr);
 
-    m_conn_fail_handler = [this, host, port] (const std::string& what) {
-      log(m_self) << "ERROR: " << what << " ["
-        << m_self->remote_addr(m_local_hdl) << ":"
-        << m_self->remote_port(m_local_hdl) << "]" << std::endl;
-      write_to_local({0x05, 0x05, 0x00, 0x01, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00});
-    };
+  if (m_verbose) {
+    log(m_self) << "INFO: BIND listens on " << ep << " ["
+      << m_self->remote_addr(m_local_hdl) << ":"
+      << m_self->remote_port(m_local_hdl) << "]" << std::endl;
+  }
 
-    return true;
-  });
+  // the peer is told to connect by the client's own protocol, which
+  // may take a while
+  m_timer.reset(m_timeouts.idle);
+  write_reply(0x00, ep.data());
+}
 
-  return true;
+void socks5_state::start_udp_associate(const boost::asio::ip::address& addr,
+                                       uint16_t port) {
+  // The relay is bound to the address the client reached the proxy at
+  // and only takes datagrams from the client's address. A client behind
+  // a NAT doesn't know the port it sends from, so the requested port is
+  // only used along with the client's own address.
+  try {
+    auto fd = static_cast<int>(m_local_hdl.id());
+    auto client_addr = socket_endpoint(fd, true).address();
+    m_udp_relay = std::make_shared<udp_relay>(*m_self->parent().backend().pimpl(),
+                                              socket_endpoint(fd, false).address(), client_addr,
+                                              addr == client_addr ? port : 0);
+    if (!m_key.empty()) {
+      // the tunnel's key seals the datagrams, those of an AES-CFB128
+      // tunnel with AES-128-GCM
+      std::unique_ptr<aead_datagram> cipher(new aead_datagram);
+      cipher->init(is_aead_cipher(m_cipher) ? m_cipher : cipher_type::aes_128_gcm,
+                   m_key, m_iv, true);
+      m_udp_relay->set_cipher(std::move(cipher));
+    }
+    m_udp_relay->start();
+  } catch (const std::exception& e) {
+    log(m_self) << "ERROR: " << e.what() << " ["
+      << m_self->remote_addr(m_local_hdl) << ":"
+      << m_self->remote_port(m_local_hdl) << "]" << std::endl;
+    if (m_udp_relay) {
+      m_udp_relay->stop();
+      m_udp_relay.reset();
+    }
+    m_valid = false;
+    write_reply(0x01);
+    return;
+  }
+
+  auto ep = m_udp_relay->local_endpoint();
+  if (m_verbose) {
+    log(m_self) << "INFO: UDP relay on " << ep << " ["
+      << m_self->remote_addr(m_local_hdl) << ":"
+      << m_self->remote_port(m_local_hdl) << "]" << std::endl;
+  }
+
+  m_timer.reset(m_timeouts.idle);
+  write_reply(0x00, ep.data());
 }
 
 socks5_session::behavior_type
 socks5_session_impl(socks5_session::stateful_broker_pointer<socks5_state> self,
-                    connection_handle hdl, user_table tbl, const std::vector<uint8_t>& key,
-                    uint32_t seed, bool zlib, int timeout, bool verbose) {
+                    connection_handle hdl, std::shared_ptr<admission_control::ticket> ticket,
+                    std::shared_ptr<user_table> tbl, const std::vector<uint8_t>& key,
+                    cipher_type cipher, uint32_t seed, const codec_spec& codec, bool offload,
+                    const receive_spec& recv, const session_timeouts& timeouts,
+                    const rate_limiter& limiter, bool verbose) {
   self->trap_exit(true);
-  self->state.init(hdl, tbl, key, seed, zlib, timeout, verbose);
+  self->state.init(hdl, std::move(ticket), tbl, key, cipher, seed, codec, offload, recv, timeouts, limiter, verbose);
   return {
-    [self] (const new_data_msg& msg) {
+    [self] (new_data_msg& msg) {
       self->state.handle_new_data(msg);
     },
     [self] (const connection_closed_msg& msg) {
       self->state.handle_conn_closed(msg);
     },
+    [self] (const new_connection_msg& msg) {
+      self->state.handle_new_connection(msg);
+    },
+    [self] (const acceptor_closed_msg& msg) {
+      self->state.handle_acceptor_closed(msg);
+    },
     [self] (ok_atom, connection_handle hdl) {
       self->state.handle_connect_succ(hdl);
     },
     [self] (error_atom, const std::string& what) {
       self->state.handle_connect_fail(what);
     },
-    [self] (encrypt_atom, const std::vector<char>& buf) {
+    [self] (encrypt_atom, std::vector<char>& buf) {
       self->state.handle_encrypted_data(buf);
     },
-    [self] (decrypt_atom, const std::vector<char>& buf) {
+    [self] (decrypt_atom, std::vector<char>& buf) {
       self->state.handle_decrypted_data(buf);
     },
-    [self] (auth_atom, bool result) {
-      self->state.handle_auth_result(result);
+    [self] (drain_atom) {
+      self->state.handle_drain();
+    },
+    [self] (shape_atom) {
+      self->state.handle_shape();
+    },
+    [self] (idle_atom) {
+      self->state.handle_idle();
     },
     [self, hdl] (const exit_msg& msg) {
-      switch (msg.reason) {
-      case exit_reason::unhandled_exception:
+      if (msg.reason == exit_reason::unhandled_exception) {
         log(self) << "ERROR: Unhandled exception ["
           << self->remote_addr(hdl) << ":"
           << self->remote_port(hdl) << "]" << std::endl;
-        break;
-      case exit_reason::user_shutdown:
-        self->state.handle_user_shutdown(msg.source);
-        break;
       }
 
       if (msg.reason != exit_reason::normal) {
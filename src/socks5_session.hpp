@@ -20,20 +20,36 @@
 #include <string>
 #include <vector>
 #include <functional>
-#include "deadline_timer.hpp"
+#include <initializer_list>
+#include "timer_wheel.hpp"
 #include "user_table.hpp"
 #include "encryptor.hpp"
-#include "unpacker.hpp"
+#include "cipher_pipeline.hpp"
+#include "aead_encryptor.hpp"
+#include "codec.hpp"
+#include "socks5_parser.hpp"
+#include "flow_control.hpp"
+#include "token_bucket.hpp"
+#include "admission_control.hpp"
+#include "flow_reader.hpp"
+#include "receive_sizer.hpp"
+#include "udp_relay.hpp"
+#include <sys/socket.h>
+#include <netinet/in.h>
 
 namespace ranger { namespace proxy {
 
 using socks5_session =
   minimal_client::extend<
+    reacts_to<new_connection_msg>,
+    reacts_to<acceptor_closed_msg>,
     reacts_to<ok_atom, connection_handle>,
     reacts_to<error_atom, std::string>,
     reacts_to<encrypt_atom, std::vector<char>>,
     reacts_to<decrypt_atom, std::vector<char>>,
-    reacts_to<auth_atom, bool>
+    reacts_to<drain_atom>,
+    reacts_to<shape_atom>,
+    reacts_to<idle_atom>
   >;
 
 class socks5_state {
@@ -45,52 +61,92 @@ public:
   socks5_state& operator = (const socks5_state&) = delete;
 
   void init(connection_handle hdl,
-            const user_table& tbl,
-            const std::vector<uint8_t>& key,
-            uint32_t seed, bool zlib,
-            int timeout, bool verbose);
+            std::shared_ptr<admission_control::ticket> ticket,
+            std::shared_ptr<user_table> tbl,
+            const std::vector<uint8_t>& key, cipher_type cipher,
+            uint32_t seed, const codec_spec& codec, bool offload,
+            const receive_spec& recv, const session_timeouts& timeouts,
+            const rate_limiter& limiter, bool verbose);
 
-  void handle_new_data(const new_data_msg& msg);
+  void handle_new_data(new_data_msg& msg);
   void handle_conn_closed(const connection_closed_msg& msg);
+  void handle_new_connection(const new_connection_msg& msg);
+  void handle_acceptor_closed(const acceptor_closed_msg& msg);
   void handle_connect_succ(connection_handle hdl);
   void handle_connect_fail(const std::string& what);
-  void handle_encrypted_data(const std::vector<char>& buf);
-  void handle_decrypted_data(const std::vector<char>& buf);
-  void handle_auth_result(bool result);
-  void handle_user_shutdown(const actor_addr& source);
+  void handle_encrypted_data(std::vector<char>& buf);
+  void handle_decrypted_data(std::vector<char>& buf);
+  void handle_idle();
+  void handle_drain();
+  void handle_shape();
 
 private:
-  void write_to_local(std::vector<char> buf);
-  void write_raw(connection_handle hdl, std::vector<char> buf);
+  void arm_timer(int timeout);
+  void arm_shape_timer(token_bucket::clock::duration wait);
+  void start_remote_reader();
+  void read_remote();
+  void adapt_read_size(connection_handle hdl, size_t len);
 
-  bool handle_select_method(std::vector<char> buf);
-  bool handle_username_auth(std::vector<char> buf);
-  bool handle_request_header(std::vector<char> buf);
-  bool handle_ipv4_request(std::vector<char> buf);
-  bool handle_domainname_request(std::vector<char> buf);
+  void write_to_local(std::initializer_list<char> data);
+  void write_to_local(const char* data, size_t len);
+  void write_reply(uint8_t rep);
+  void write_reply(uint8_t rep, const sockaddr* bnd);
+  void relay(connection_handle hdl, std::vector<char>& buf);
+
+  void handle_handshake(const char* data, size_t len);
+  void handle_handshake_error();
+  bool handle_select_method();
+  bool handle_username_auth();
+  bool handle_auth_result(bool result);
+  void handle_request();
+  void handle_ipv4_request(const in_addr& addr, uint16_t port);
+  void handle_ipv6_request(const in6_addr& addr, uint16_t port);
+  void handle_domainname_request(const std::string& host, uint16_t port);
+  void start_bind(const boost::asio::ip::address& addr);
+  void start_udp_associate(const boost::asio::ip::address& addr, uint16_t port);
 
   const socks5_session::broker_pointer m_self;
-  deadline_timer m_timer;
+  timer_wheel::timer m_timer;
+  session_timeouts m_timeouts;
   connection_handle m_local_hdl;
+  std::shared_ptr<admission_control::ticket> m_ticket;
   size_t m_local_recv_bytes {0};
   size_t m_local_send_bytes {0};
   connection_handle m_remote_hdl;
   size_t m_remote_recv_bytes {0};
   size_t m_remote_send_bytes {0};
-  user_table m_user_tbl;
+  receive_sizer m_local_sizer;
+  receive_sizer m_remote_sizer;
+  std::shared_ptr<flow_reader> m_remote_reader;
+  flow_control m_remote_flow {HIGH_WATERMARK, LOW_WATERMARK};
+  bool m_draining {false};
+  rate_limiter m_limiter;
+  timer_wheel::timer m_shape_timer;
+  std::shared_ptr<user_table> m_user_tbl;
+  std::vector<uint8_t> m_key;
+  cipher_type m_cipher {cipher_type::aes_cfb128};
+  std::vector<uint8_t> m_iv;
+  cipher_pipeline m_pipeline;
   encryptor m_encryptor;
   size_t m_encrypting {0};
   bool m_verbose {false};
   bool m_valid {false};
-  unpacker<uint8_t> m_unpacker;
+  socks5_parser m_parser;
+  accept_handle m_bind_hdl;
+  boost::asio::ip::address m_bind_peer;
+  std::shared_ptr<udp_relay> m_udp_relay;
+  uint64_t m_udp_datagrams {0};
   std::function<void(connection_handle)> m_conn_succ_handler;
   std::function<void(const std::string&)> m_conn_fail_handler;
 };
 
 socks5_session::behavior_type
 socks5_session_impl(socks5_session::stateful_broker_pointer<socks5_state> self,
-                    connection_handle hdl, user_table tbl, const std::vector<uint8_t>& key,
-                    uint32_t seed, bool zlib, int timeout, bool verbose);
+                    connection_handle hdl, std::shared_ptr<admission_control::ticket> ticket,
+                    std::shared_ptr<user_table> tbl, const std::vector<uint8_t>& key,
+                    cipher_type cipher, uint32_t seed, const codec_spec& codec, bool offload,
+                    const receive_spec& recv, const session_timeouts& timeouts,
+                    const rate_limiter& limiter, bool verbose);
 
 } }
 
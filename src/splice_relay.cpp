@@ -0,0 +1,207 @@
+// ranger_proxy - A SOCKS5 proxy
+// Copyright (C) 2015  RangerUFO <ufownl@gmail.com>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "common.hpp"
+#include "splice_relay.hpp"
+#include <stdexcept>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+
+namespace ranger { namespace proxy {
+
+namespace {
+
+// upper bound of splice calls per wake-up, keeps one busy direction
+// from starving the other sessions on the I/O thread
+const int max_rounds = 16;
+
+void close_pipe(int (&fds)[2]) {
+  for (auto& fd : fds) {
+    if (fd != -1) {
+      ::close(fd);
+      fd = -1;
+    }
+  }
+}
+
+}
+
+bool splice_relay::supported() {
+#ifdef __linux__
+  return true;
+#else
+  return false;
+#endif
+}
+
+splice_relay::splice_relay(boost::asio::io_service& ios, int local_fd, int remote_fd,
+                           int timeout, size_t pipe_size)
+  : m_ios(ios)
+  , m_local(ios, local_fd)
+  , m_remote(ios, remote_fd)
+  , m_timer(ios)
+  , m_timeout(timeout)
+  , m_last_active(std::chrono::steady_clock::now())
+  , m_pipe_size(pipe_size) {
+  m_upstream.src = &m_local;
+  m_upstream.dst = &m_remote;
+  m_upstream.recv_bytes = &m_counters.local_recv;
+  m_upstream.send_bytes = &m_counters.remote_send;
+  m_downstream.src = &m_remote;
+  m_downstream.dst = &m_local;
+  m_downstream.recv_bytes = &m_counters.remote_recv;
+  m_downstream.send_bytes = &m_counters.local_send;
+
+#ifdef __linux__
+  for (auto ch : {&m_upstream, &m_downstream}) {
+    if (pipe2(ch->pipe_fds, O_NONBLOCK | O_CLOEXEC) != 0) {
+      close_pipe(m_upstream.pipe_fds);
+      close_pipe(m_downstream.pipe_fds);
+      throw std::runtime_error(strerror(errno));
+    }
+    // best effort, the default pipe capacity works as well
+    fcntl(ch->pipe_fds[1], F_SETPIPE_SZ, static_cast<int>(m_pipe_size));
+  }
+#else
+  throw std::runtime_error("splice(2) is not supported on this platform");
+#endif
+
+  m_local.non_blocking(true);
+  m_remote.non_blocking(true);
+}
+
+splice_relay::~splice_relay() {
+  close_pipe(m_upstream.pipe_fds);
+  close_pipe(m_downstream.pipe_fds);
+}
+
+void splice_relay::start(completion_handler handler) {
+  m_handler = std::move(handler);
+  m_last_active = std::chrono::steady_clock::now();
+  wait_timeout();
+  pump(m_upstream);
+  pump(m_downstream);
+}
+
+void splice_relay::stop() {
+  auto self = shared_from_this();
+  m_ios.post([self] {
+    self->finish();
+  });
+}
+
+void splice_relay::pump(channel& ch) {
+#ifdef __linux__
+  auto self = shared_from_this();
+  for (auto i = 0; i < max_rounds && !m_finished; ++i) {
+    if (ch.pending > 0) {
+      auto n = splice(ch.pipe_fds[0], nullptr, ch.dst->native_handle(), nullptr,
+                      ch.pending, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+      if (n > 0) {
+        ch.pending -= n;
+        *ch.send_bytes += n;
+      } else if (n < 0 && errno == EAGAIN) {
+        ch.dst->async_write_some(boost::asio::null_buffers(),
+          [self, &ch] (const boost::system::error_code& ec, size_t) {
+            if (ec) {
+              self->finish();
+            } else {
+              self->pump(ch);
+            }
+          }
+        );
+        return;
+      } else if (n < 0 && errno == EINTR) {
+        continue;
+      } else {
+        finish();
+        return;
+      }
+    } else {
+      auto n = splice(ch.src->native_handle(), nullptr, ch.pipe_fds[1], nullptr,
+                      m_pipe_size, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+      if (n > 0) {
+        ch.pending += n;
+        *ch.recv_bytes += n;
+        m_last_active = std::chrono::steady_clock::now();
+      } else if (n < 0 && errno == EAGAIN) {
+        ch.src->async_read_some(boost::asio::null_buffers(),
+          [self, &ch] (const boost::system::error_code& ec, size_t) {
+            if (ec) {
+              self->finish();
+            } else {
+              self->pump(ch);
+            }
+          }
+        );
+        return;
+      } else if (n < 0 && errno == EINTR) {
+        continue;
+      } else {
+        // EOF or error, nothing is left in the pipe at this point
+        finish();
+        return;
+      }
+    }
+  }
+
+  if (!m_finished) {
+    m_ios.post([self, &ch] {
+      self->pump(ch);
+    });
+  }
+#endif
+}
+
+void splice_relay::wait_timeout() {
+  auto self = shared_from_this();
+  m_timer.expires_at(m_last_active + m_timeout);
+  m_timer.async_wait([self] (const boost::system::error_code& ec) {
+    if (ec || self->m_finished) {
+      return;
+    }
+
+    if (std::chrono::steady_clock::now() - self->m_last_active >= self->m_timeout) {
+      self->finish();
+    } else {
+      self->wait_timeout();
+    }
+  });
+}
+
+void splice_relay::finish() {
+  if (m_finished) {
+    return;
+  }
+
+  m_finished = true;
+  boost::system::error_code ignored_ec;
+  m_timer.cancel(ignored_ec);
+  m_local.close(ignored_ec);
+  m_remote.close(ignored_ec);
+  close_pipe(m_upstream.pipe_fds);
+  close_pipe(m_downstream.pipe_fds);
+
+  if (m_handler) {
+    auto handler = std::move(m_handler);
+    m_handler = nullptr;
+    handler(m_counters);
+  }
+}
+
+} }
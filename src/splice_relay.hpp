@@ -0,0 +1,87 @@
+// ranger_proxy - A SOCKS5 proxy
+// Copyright (C) 2015  RangerUFO <ufownl@gmail.com>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef RANGER_PROXY_SPLICE_RELAY_HPP
+#define RANGER_PROXY_SPLICE_RELAY_HPP
+
+#include <boost/asio.hpp>
+#include <functional>
+#include <memory>
+#include <chrono>
+#include <stdint.h>
+
+namespace ranger { namespace proxy {
+
+struct relay_counters {
+  uint64_t local_recv {0};
+  uint64_t local_send {0};
+  uint64_t remote_recv {0};
+  uint64_t remote_send {0};
+};
+
+// Moves bytes between two connected sockets inside the kernel with
+// splice(2), one pipe per direction. The relay owns both descriptors and
+// finishes on EOF, on any error, after `timeout` seconds without traffic
+// in either direction, or when stop() is called.
+class splice_relay : public std::enable_shared_from_this<splice_relay> {
+public:
+  using completion_handler = std::function<void(const relay_counters&)>;
+
+  static bool supported();
+
+  splice_relay(boost::asio::io_service& ios, int local_fd, int remote_fd,
+               int timeout, size_t pipe_size);
+  ~splice_relay();
+
+  splice_relay(const splice_relay&) = delete;
+  splice_relay& operator = (const splice_relay&) = delete;
+
+  void start(completion_handler handler);
+  void stop();
+
+private:
+  using descriptor = boost::asio::posix::stream_descriptor;
+
+  struct channel {
+    descriptor* src;
+    descriptor* dst;
+    int pipe_fds[2] {-1, -1};
+    size_t pending {0};
+    uint64_t* recv_bytes;
+    uint64_t* send_bytes;
+  };
+
+  void pump(channel& ch);
+  void wait_timeout();
+  void finish();
+
+  boost::asio::io_service& m_ios;
+  descriptor m_local;
+  descriptor m_remote;
+  channel m_upstream;
+  channel m_downstream;
+  boost::asio::steady_timer m_timer;
+  std::chrono::seconds m_timeout;
+  std::chrono::steady_clock::time_point m_last_active;
+  size_t m_pipe_size;
+  relay_counters m_counters;
+  completion_handler m_handler;
+  bool m_finished {false};
+};
+
+} }
+
+#endif  // RANGER_PROXY_SPLICE_RELAY_HPP
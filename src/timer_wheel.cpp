@@ -0,0 +1,199 @@
+// ranger_proxy - A SOCKS5 proxy
+// Copyright (C) 2015  RangerUFO <ufownl@gmail.com>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "common.hpp"
+#include "timer_wheel.hpp"
+#include <algorithm>
+
+namespace ranger { namespace proxy {
+
+namespace {
+
+const std::chrono::seconds local_tick(1);
+const size_t local_slots = 512;
+const std::chrono::milliseconds fine_tick(10);
+const size_t fine_slots = 256;
+
+}
+
+timer_wheel::timer::~timer() {
+  cancel();
+}
+
+void timer_wheel::timer::reset() {
+  if (m_wheel) {
+    m_deadline = m_wheel->m_now + m_timeout;
+  }
+}
+
+void timer_wheel::timer::reset(uint64_t timeout) {
+  if (!m_wheel) {
+    return;
+  }
+
+  // a later deadline is picked up lazily, an earlier one may come before
+  // the current slot does
+  auto deadline = m_wheel->m_now + std::max<uint64_t>(timeout, 1);
+  m_timeout = deadline - m_wheel->m_now;
+  if (deadline < m_deadline) {
+    m_wheel->unlink(*this);
+    m_deadline = deadline;
+    m_wheel->link(*this);
+  } else {
+    m_deadline = deadline;
+  }
+}
+
+void timer_wheel::timer::cancel() {
+  if (m_wheel) {
+    auto wheel = std::move(m_wheel);
+    wheel->unlink(*this);
+    m_callback = nullptr;
+  }
+}
+
+bool timer_wheel::timer::armed() const {
+  return m_wheel != nullptr;
+}
+
+timer_wheel::timer_wheel(boost::asio::io_service& ios,
+                         std::chrono::milliseconds tick, size_t slots)
+  : m_ios(ios)
+  , m_timer(ios)
+  , m_tick(tick)
+  , m_slots(slots, nullptr) {
+  // nop
+}
+
+void timer_wheel::arm(timer& t, uint64_t timeout, callback cb) {
+  t.cancel();
+  t.m_wheel = shared_from_this();
+  t.m_callback = std::move(cb);
+  t.m_timeout = std::max<uint64_t>(timeout, 1);
+  t.m_deadline = m_now + t.m_timeout;
+  link(t);
+  schedule();
+}
+
+void timer_wheel::advance() {
+  ++m_now;
+  auto& slot = m_slots[m_now % m_slots.size()];
+  auto t = slot;
+  slot = nullptr;
+
+  // timers that were reset move on to the slot of their new deadline,
+  // the callbacks run once the wheel is consistent again
+  std::vector<callback> expired;
+  while (t) {
+    auto next = t->m_next;
+    --m_size;
+    t->m_prev = nullptr;
+    t->m_next = nullptr;
+    if (t->m_deadline <= m_now) {
+      expired.emplace_back(std::move(t->m_callback));
+      t->m_callback = nullptr;
+      t->m_wheel.reset();
+    } else {
+      link(*t);
+    }
+    t = next;
+  }
+
+  for (auto& cb : expired) {
+    cb();
+  }
+}
+
+size_t timer_wheel::size() const {
+  return m_size;
+}
+
+std::shared_ptr<timer_wheel> timer_wheel::local(boost::asio::io_service& ios) {
+  static thread_local std::weak_ptr<timer_wheel> cache;
+  auto wheel = cache.lock();
+  if (!wheel || &wheel->m_ios != &ios) {
+    wheel = std::make_shared<timer_wheel>(ios, local_tick, local_slots);
+    cache = wheel;
+  }
+  return wheel;
+}
+
+std::shared_ptr<timer_wheel> timer_wheel::local_fine(boost::asio::io_service& ios) {
+  static thread_local std::weak_ptr<timer_wheel> cache;
+  auto wheel = cache.lock();
+  if (!wheel || &wheel->m_ios != &ios) {
+    wheel = std::make_shared<timer_wheel>(ios, fine_tick, fine_slots);
+    cache = wheel;
+  }
+  return wheel;
+}
+
+void timer_wheel::link(timer& t) {
+  t.m_slot = t.m_deadline % m_slots.size();
+  auto& head = m_slots[t.m_slot];
+  t.m_prev = nullptr;
+  t.m_next = head;
+  if (head) {
+    head->m_prev = &t;
+  }
+  head = &t;
+  ++m_size;
+}
+
+void timer_wheel::unlink(timer& t) {
+  if (t.m_prev) {
+    t.m_prev->m_next = t.m_next;
+  } else if (m_slots[t.m_slot] == &t) {
+    m_slots[t.m_slot] = t.m_next;
+  } else {
+    return;
+  }
+
+  if (t.m_next) {
+    t.m_next->m_prev = t.m_prev;
+  }
+  t.m_prev = nullptr;
+  t.m_next = nullptr;
+  --m_size;
+}
+
+void timer_wheel::schedule() {
+  if (m_scheduled || m_size == 0) {
+    return;
+  }
+
+  // an idle wheel picks up where it stopped, deadlines are in ticks
+  m_scheduled = true;
+  m_next_tick = std::chrono::steady_clock::now() + m_tick;
+  m_timer.expires_at(m_next_tick);
+  auto self = shared_from_this();
+  m_timer.async_wait([self] (const boost::system::error_code& ec) {
+    self->m_scheduled = false;
+    if (ec) {
+      return;
+    }
+
+    // catch up on ticks missed by a busy thread
+    auto now = std::chrono::steady_clock::now();
+    do {
+      self->advance();
+      self->m_next_tick += self->m_tick;
+    } while (self->m_next_tick <= now && self->m_size > 0);
+    self->schedule();
+  });
+}
+
+} }
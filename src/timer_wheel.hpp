@@ -0,0 +1,107 @@
+// ranger_proxy - A SOCKS5 proxy
+// Copyright (C) 2015  RangerUFO <ufownl@gmail.com>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef RANGER_PROXY_TIMER_WHEEL_HPP
+#define RANGER_PROXY_TIMER_WHEEL_HPP
+
+#include <boost/asio.hpp>
+#include <functional>
+#include <memory>
+#include <chrono>
+#include <vector>
+#include <stdint.h>
+
+namespace ranger { namespace proxy {
+
+// Idle timeouts of all sessions on an I/O thread. Timers hash into one
+// slot per tick by their deadline. A reset only moves the deadline, the
+// timer moves to the right slot when its old slot comes up, so arming,
+// resetting and cancelling are O(1). Each tick expires the timers of one
+// slot at once, and the wheel stops ticking while no timer is armed.
+class timer_wheel : public std::enable_shared_from_this<timer_wheel> {
+public:
+  using callback = std::function<void()>;
+
+  // A timer is owned by its user and cancelled when destroyed.
+  class timer {
+  public:
+    timer() = default;
+    ~timer();
+
+    timer(const timer&) = delete;
+    timer& operator = (const timer&) = delete;
+
+    // pushes the deadline one timeout past the current tick
+    void reset();
+    // switches to another timeout and resets
+    void reset(uint64_t timeout);
+    void cancel();
+    bool armed() const;
+
+  private:
+    friend class timer_wheel;
+
+    std::shared_ptr<timer_wheel> m_wheel;
+    callback m_callback;
+    uint64_t m_timeout {0};
+    uint64_t m_deadline {0};
+    size_t m_slot {0};
+    timer* m_prev {nullptr};
+    timer* m_next {nullptr};
+  };
+
+  timer_wheel(boost::asio::io_service& ios,
+              std::chrono::milliseconds tick, size_t slots);
+
+  timer_wheel(const timer_wheel&) = delete;
+  timer_wheel& operator = (const timer_wheel&) = delete;
+
+  // The callback runs on the I/O thread after `timeout` ticks without a
+  // reset, the timer is disarmed by then.
+  void arm(timer& t, uint64_t timeout, callback cb);
+  // Expires the timers of the next slot, the I/O thread calls it once
+  // per tick.
+  void advance();
+  size_t size() const;
+
+  std::chrono::milliseconds tick() const {
+    return m_tick;
+  }
+
+  // the wheel of the calling thread, one tick per second
+  static std::shared_ptr<timer_wheel> local(boost::asio::io_service& ios);
+  // the wheel of the calling thread for waits mostly shorter than a
+  // second, ten milliseconds a tick
+  static std::shared_ptr<timer_wheel> local_fine(boost::asio::io_service& ios);
+
+private:
+  void link(timer& t);
+  void unlink(timer& t);
+  void schedule();
+
+  boost::asio::io_service& m_ios;
+  boost::asio::steady_timer m_timer;
+  std::chrono::milliseconds m_tick;
+  std::chrono::steady_clock::time_point m_next_tick;
+  std::vector<timer*> m_slots;
+  uint64_t m_now {0};
+  size_t m_size {0};
+  bool m_scheduled {false};
+};
+
+} }
+
+#endif  // RANGER_PROXY_TIMER_WHEEL_HPP
@@ -0,0 +1,197 @@
+// ranger_proxy - A SOCKS5 proxy
+// Copyright (C) 2015  RangerUFO <ufownl@gmail.com>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "common.hpp"
+#include "token_bucket.hpp"
+#include "receive_sizer.hpp"
+#include <algorithm>
+
+namespace ranger { namespace proxy {
+
+namespace {
+
+int64_t since_epoch(token_bucket::clock::time_point t) {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(t.time_since_epoch()).count();
+}
+
+}
+
+bool parse_rate_spec(const std::string& str, rate_spec& spec) {
+  if (str.empty()) {
+    spec = rate_spec();
+    return true;
+  }
+
+  size_t rate = 0;
+  size_t burst = 0;
+  auto pos = str.find(':');
+  if (pos == std::string::npos) {
+    if (!parse_size(str, rate)) {
+      return false;
+    }
+    burst = rate;
+  } else if (!parse_size(str.substr(0, pos), rate)
+             || !parse_size(str.substr(pos + 1), burst)) {
+    return false;
+  }
+
+  // a bucket that can't hold a token would stall its sessions for good
+  if (rate != 0 && burst == 0) {
+    return false;
+  }
+
+  spec.rate = rate;
+  spec.burst = burst;
+  return true;
+}
+
+rate_spec share_rate_spec(const rate_spec& spec, size_t shares) {
+  if (shares == 0) {
+    return spec;
+  }
+  rate_spec share;
+  share.rate = (spec.rate + shares - 1) / shares;
+  share.burst = (spec.burst + shares - 1) / shares;
+  return share;
+}
+
+token_bucket::token_bucket(const rate_spec& spec, clock::time_point now)
+  : m_rate(static_cast<double>(spec.rate))
+  , m_burst(static_cast<int64_t>(spec.burst))
+  , m_tokens(static_cast<int64_t>(spec.burst))
+  , m_refilled(since_epoch(now)) {
+  // nop
+}
+
+token_bucket::clock::duration token_bucket::wait(clock::time_point now) {
+  refill(now);
+  auto tokens = m_tokens.load(std::memory_order_relaxed);
+  if (tokens > 0) {
+    return clock::duration::zero();
+  }
+
+  auto ns = static_cast<int64_t>((1 - tokens) * 1e9 / m_rate) + 1;
+  return std::chrono::duration_cast<clock::duration>(std::chrono::nanoseconds(ns));
+}
+
+void token_bucket::refill(clock::time_point now) {
+  auto t = since_epoch(now);
+  auto last = m_refilled.load(std::memory_order_relaxed);
+  if (t <= last) {
+    return;
+  }
+
+  // whole bytes only, the time of the fraction left over counts towards
+  // the next refill
+  auto add = static_cast<int64_t>((t - last) * m_rate / 1e9);
+  if (add <= 0) {
+    return;
+  }
+
+  // more than the debt and a full burst would be capped anyway
+  auto tokens = m_tokens.load(std::memory_order_relaxed);
+  auto room = m_burst - std::min<int64_t>(tokens, 0);
+  auto next = t;
+  if (add < room) {
+    next = last + static_cast<int64_t>(add * 1e9 / m_rate);
+  } else {
+    add = room;
+  }
+
+  // whoever moves the time forward adds the tokens
+  if (!m_refilled.compare_exchange_strong(last, next, std::memory_order_relaxed)) {
+    return;
+  }
+
+  tokens = m_tokens.fetch_add(add, std::memory_order_relaxed) + add;
+  while (tokens > m_burst
+         && !m_tokens.compare_exchange_weak(tokens, m_burst, std::memory_order_relaxed)) {
+    // tokens was reloaded
+  }
+}
+
+token_bucket_map::token_bucket_map(const rate_spec& spec) : m_spec(spec) {
+  // nop
+}
+
+std::shared_ptr<token_bucket> token_bucket_map::get(const std::string& name) {
+  std::lock_guard<std::mutex> lock(m_mtx);
+  auto& entry = m_buckets[name];
+  auto bucket = entry.lock();
+  if (bucket) {
+    return bucket;
+  }
+
+  bucket = std::make_shared<token_bucket>(m_spec);
+  entry = bucket;
+  // buckets of users without sessions go once the map doubled
+  if (m_buckets.size() >= m_sweep_at) {
+    for (auto i = m_buckets.begin(); i != m_buckets.end(); ) {
+      if (i->second.expired()) {
+        i = m_buckets.erase(i);
+      } else {
+        ++i;
+      }
+    }
+    m_sweep_at = std::max<size_t>(m_buckets.size() * 2, 64);
+  }
+  return bucket;
+}
+
+size_t token_bucket_map::size() const {
+  std::lock_guard<std::mutex> lock(m_mtx);
+  return m_buckets.size();
+}
+
+void rate_limiter::add(std::shared_ptr<token_bucket> bucket) {
+  if (bucket) {
+    m_buckets.emplace_back(std::move(bucket));
+  }
+}
+
+void rate_limiter::set_users(std::shared_ptr<token_bucket_map> users) {
+  m_users = std::move(users);
+}
+
+void rate_limiter::add_user(const std::string& username) {
+  if (m_users) {
+    add(m_users->get(username));
+  }
+}
+
+void rate_limiter::consume(size_t len) {
+  for (auto& bucket : m_buckets) {
+    bucket->consume(len);
+  }
+}
+
+token_bucket::clock::duration
+rate_limiter::wait(token_bucket::clock::time_point now) const {
+  auto res = token_bucket::clock::duration::zero();
+  for (auto& bucket : m_buckets) {
+    res = std::max(res, bucket->wait(now));
+  }
+  return res;
+}
+
+size_t rate_limiter::read_size(size_t size) const {
+  for (auto& bucket : m_buckets) {
+    size = std::min<size_t>(size, bucket->burst());
+  }
+  return size;
+}
+
+} }
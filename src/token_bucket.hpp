@@ -0,0 +1,128 @@
+// ranger_proxy - A SOCKS5 proxy
+// Copyright (C) 2015  RangerUFO <ufownl@gmail.com>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef RANGER_PROXY_TOKEN_BUCKET_HPP
+#define RANGER_PROXY_TOKEN_BUCKET_HPP
+
+#include <unordered_map>
+#include <chrono>
+#include <string>
+#include <vector>
+#include <memory>
+#include <atomic>
+#include <mutex>
+#include <stdint.h>
+
+namespace ranger { namespace proxy {
+
+struct rate_spec {
+  uint64_t rate {0};   // bytes per second, 0 is unlimited
+  uint64_t burst {0};  // bytes
+};
+
+// Accepts "<rate>" or "<rate>:<burst>", in bytes per second and bytes
+// with an optional "k" or "m" suffix. The burst defaults to one second
+// of the rate, an empty string means unlimited.
+bool parse_rate_spec(const std::string& str, rate_spec& spec);
+
+// One of `shares` equal parts of a limit, rounded up so that no part is
+// unlimited. Processes that share a port take one part each.
+rate_spec share_rate_spec(const rate_spec& spec, size_t shares);
+
+// Bytes a group of sessions may read. Any thread may take tokens and
+// refill, both are a few atomic operations. A read takes what it got
+// after the fact, so the bucket goes into debt by up to one read and
+// readers wait until it is paid back. Refills add the tokens of the time
+// since the last one, readers do it when they check whether to wait.
+class token_bucket {
+public:
+  using clock = std::chrono::steady_clock;
+
+  explicit token_bucket(const rate_spec& spec, clock::time_point now = clock::now());
+
+  token_bucket(const token_bucket&) = delete;
+  token_bucket& operator = (const token_bucket&) = delete;
+
+  void consume(size_t len) {
+    m_tokens.fetch_sub(static_cast<int64_t>(len), std::memory_order_relaxed);
+  }
+
+  // refills and returns how long until there are tokens, zero if there are
+  clock::duration wait(clock::time_point now);
+
+  uint64_t burst() const {
+    return static_cast<uint64_t>(m_burst);
+  }
+
+private:
+  void refill(clock::time_point now);
+
+  const double m_rate;
+  const int64_t m_burst;
+  std::atomic<int64_t> m_tokens;
+  std::atomic<int64_t> m_refilled;  // the time tokens were added up to
+};
+
+// Buckets by name, one per user, that live as long as a session uses
+// them. Looked up once per session, so a mutex does.
+class token_bucket_map {
+public:
+  explicit token_bucket_map(const rate_spec& spec);
+
+  token_bucket_map(const token_bucket_map&) = delete;
+  token_bucket_map& operator = (const token_bucket_map&) = delete;
+
+  std::shared_ptr<token_bucket> get(const std::string& name);
+  size_t size() const;
+
+private:
+  const rate_spec m_spec;
+  mutable std::mutex m_mtx;
+  std::unordered_map<std::string, std::weak_ptr<token_bucket>> m_buckets;
+  size_t m_sweep_at {64};
+};
+
+// The buckets a session reads from: the global one, its listener's and
+// its user's, each only if it has a limit.
+class rate_limiter {
+public:
+  rate_limiter() = default;
+
+  // a nullptr is ignored
+  void add(std::shared_ptr<token_bucket> bucket);
+  void set_users(std::shared_ptr<token_bucket_map> users);
+  // adds the bucket of an authenticated user
+  void add_user(const std::string& username);
+
+  bool empty() const {
+    return m_buckets.empty();
+  }
+
+  void consume(size_t len);
+  // the longest wait of all buckets
+  token_bucket::clock::duration wait(token_bucket::clock::time_point now) const;
+  // caps a read size at the smallest burst, so one read never has to
+  // wait for more than a burst
+  size_t read_size(size_t size) const;
+
+private:
+  std::vector<std::shared_ptr<token_bucket>> m_buckets;
+  std::shared_ptr<token_bucket_map> m_users;
+};
+
+} }
+
+#endif  // RANGER_PROXY_TOKEN_BUCKET_HPP
@@ -0,0 +1,482 @@
+// ranger_proxy - A SOCKS5 proxy
+// Copyright (C) 2015  RangerUFO <ufownl@gmail.com>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "common.hpp"
+#include "udp_relay.hpp"
+#include "dns_resolver.hpp"
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <string.h>
+#include <errno.h>
+
+namespace ranger { namespace proxy {
+
+namespace {
+
+// upper bound of batched receive calls per wake-up, keeps a busy association
+// from starving the other sessions on the I/O thread
+const int max_batches = 16;
+
+// RSV, FRAG, ATYP, an IPv6 address and the port
+const size_t max_header_size = 4 + 16 + 2;
+
+#ifdef __APPLE__
+// one datagram per system call where the batched calls are missing
+struct mmsghdr {
+  msghdr msg_hdr;
+  unsigned int msg_len;
+};
+
+int recvmmsg(int fd, mmsghdr* msgs, unsigned int count, int flags, void*) {
+  for (unsigned int i = 0; i < count; ++i) {
+    auto n = recvmsg(fd, &msgs[i].msg_hdr, flags);
+    if (n < 0) {
+      return i > 0 ? static_cast<int>(i) : -1;
+    }
+    msgs[i].msg_len = static_cast<unsigned int>(n);
+  }
+  return static_cast<int>(count);
+}
+
+int sendmmsg(int fd, mmsghdr* msgs, unsigned int count, int flags) {
+  for (unsigned int i = 0; i < count; ++i) {
+    auto n = sendmsg(fd, &msgs[i].msg_hdr, flags);
+    if (n < 0) {
+      return i > 0 ? static_cast<int>(i) : -1;
+    }
+    msgs[i].msg_len = static_cast<unsigned int>(n);
+  }
+  return static_cast<int>(count);
+}
+#endif
+
+boost::asio::ip::udp::endpoint to_endpoint(const sockaddr_storage& ss, socklen_t len) {
+  boost::asio::ip::udp::endpoint ep;
+  memcpy(ep.data(), &ss, len);
+  ep.resize(len);
+  return ep;
+}
+
+void set_name(msghdr& hdr, sockaddr_storage& ss, const boost::asio::ip::udp::endpoint& ep) {
+  memcpy(&ss, ep.data(), ep.size());
+  hdr.msg_name = &ss;
+  hdr.msg_namelen = static_cast<socklen_t>(ep.size());
+}
+
+// Returns the number of datagrams sent. A datagram the kernel refuses is
+// skipped, the rest of the batch is dropped once the send buffer is full.
+int send_all(int fd, mmsghdr* msgs, int count) {
+  int pos = 0;
+  int sent = 0;
+  while (pos < count) {
+    auto n = sendmmsg(fd, msgs + pos, static_cast<unsigned int>(count - pos), MSG_DONTWAIT);
+    if (n > 0) {
+      pos += n;
+      sent += n;
+    } else if (n < 0 && errno == EINTR) {
+      continue;
+    } else if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+      break;
+    } else {
+      ++pos;
+    }
+  }
+  return sent;
+}
+
+}
+
+// The received datagrams, and those to send with their headers and the
+// payloads the cipher opened or sealed. Nothing in here outlives one
+// call of handle_client() or handle_remote().
+struct udp_relay::batch {
+  mmsghdr in[UDP_BATCH_SIZE];
+  iovec in_iov[UDP_BATCH_SIZE];
+  sockaddr_storage in_addr[UDP_BATCH_SIZE];
+  char in_data[UDP_BATCH_SIZE][UDP_DATAGRAM_SIZE];
+
+  mmsghdr out[UDP_BATCH_SIZE];
+  iovec out_iov[UDP_BATCH_SIZE][2];
+  sockaddr_storage out_addr[UDP_BATCH_SIZE];
+  char out_header[UDP_BATCH_SIZE][max_header_size];
+  char out_data[UDP_BATCH_SIZE][max_header_size + UDP_DATAGRAM_SIZE + aead_datagram::overhead];
+};
+
+udp_relay::udp_relay(boost::asio::io_service& ios,
+                     const boost::asio::ip::address& local_addr,
+                     const boost::asio::ip::address& client_addr,
+                     uint16_t client_port)
+  : m_ios(ios)
+  , m_client(ios, udp::endpoint(local_addr, 0))
+  , m_client_ep(client_addr, client_port)
+  , m_client_known(client_port != 0)
+  , m_remote_v4(ios)
+  , m_remote_v6(ios) {
+  m_client.non_blocking(true);
+}
+
+void udp_relay::set_cipher(std::unique_ptr<aead_datagram> cipher) {
+  m_cipher = std::move(cipher);
+}
+
+udp_relay::udp::endpoint udp_relay::local_endpoint() const {
+  return m_client.local_endpoint();
+}
+
+void udp_relay::start() {
+  wait(m_client);
+}
+
+void udp_relay::stop() {
+  m_stopped = true;
+  boost::system::error_code ignored_ec;
+  m_client.close(ignored_ec);
+  m_remote_v4.close(ignored_ec);
+  m_remote_v6.close(ignored_ec);
+}
+
+const udp_relay_stats& udp_relay::stats() const {
+  return m_stats;
+}
+
+udp_relay::batch& udp_relay::local_batch() {
+  // allocated on first use, most threads never relay a datagram
+  static thread_local std::unique_ptr<batch> b;
+  if (!b) {
+    b.reset(new batch);
+  }
+  return *b;
+}
+
+void udp_relay::wait(udp::socket& sock) {
+  auto self = shared_from_this();
+  sock.async_receive(boost::asio::null_buffers(),
+    [self, &sock] (const boost::system::error_code& ec, size_t) {
+      if (!ec && !self->m_stopped) {
+        self->receive(sock);
+      }
+    }
+  );
+}
+
+void udp_relay::receive(udp::socket& sock) {
+  for (auto i = 0; i < max_batches && !m_stopped; ++i) {
+    auto& b = local_batch();
+    for (size_t j = 0; j < UDP_BATCH_SIZE; ++j) {
+      b.in_iov[j].iov_base = b.in_data[j];
+      b.in_iov[j].iov_len = UDP_DATAGRAM_SIZE;
+      memset(&b.in[j], 0, sizeof(b.in[j]));
+      b.in[j].msg_hdr.msg_name = &b.in_addr[j];
+      b.in[j].msg_hdr.msg_namelen = sizeof(b.in_addr[j]);
+      b.in[j].msg_hdr.msg_iov = &b.in_iov[j];
+      b.in[j].msg_hdr.msg_iovlen = 1;
+    }
+
+    auto n = recvmmsg(sock.native_handle(), b.in, UDP_BATCH_SIZE, MSG_DONTWAIT, nullptr);
+    if (n > 0) {
+      ++m_stats.batches;
+      if (&sock == &m_client) {
+        handle_client(b, n);
+      } else {
+        handle_remote(b, n);
+      }
+    } else if (n < 0 && errno == EINTR) {
+      continue;
+    } else {
+      // an unconnected socket has no errors to report but EAGAIN
+      wait(sock);
+      return;
+    }
+  }
+
+  if (!m_stopped) {
+    auto self = shared_from_this();
+    m_ios.post([self, &sock] {
+      if (!self->m_stopped) {
+        self->receive(sock);
+      }
+    });
+  }
+}
+
+void udp_relay::handle_client(batch& b, int count) {
+  int out = 0;
+  for (auto i = 0; i < count; ++i) {
+    auto& hdr = b.in[i].msg_hdr;
+    ++m_stats.client_recv;
+    if ((hdr.msg_flags & MSG_TRUNC)
+        || !accept_client(to_endpoint(b.in_addr[i], hdr.msg_namelen))) {
+      ++m_stats.dropped;
+      continue;
+    }
+
+    const char* data = b.in_data[i];
+    size_t len = b.in[i].msg_len;
+    if (m_cipher) {
+      auto n = m_cipher->open(data, len, b.out_data[out]);
+      if (n < 0) {
+        ++m_stats.dropped;
+        continue;
+      }
+      data = b.out_data[out];
+      len = static_cast<size_t>(n);
+    }
+
+    // +----+------+------+----------+----------+----------+
+    // |RSV | FRAG | ATYP | DST.ADDR | DST.PORT |   DATA   |
+    // +----+------+------+----------+----------+----------+
+    if (len < 4 || data[2] != 0) {
+      ++m_stats.dropped;
+      continue;
+    }
+
+    udp::endpoint to;
+    size_t header_len = 0;
+    uint16_t port;
+    switch (static_cast<uint8_t>(data[3])) {
+    case 0x01: {  // IPV4
+      header_len = 4 + 4 + 2;
+      if (len < header_len) {
+        break;
+      }
+      boost::asio::ip::address_v4::bytes_type addr;
+      memcpy(addr.data(), data + 4, addr.size());
+      memcpy(&port, data + 8, sizeof(port));
+      to = udp::endpoint(boost::asio::ip::address_v4(addr), ntohs(port));
+      break;
+    }
+    case 0x04: {  // IPV6
+      header_len = 4 + 16 + 2;
+      if (len < header_len) {
+        break;
+      }
+      boost::asio::ip::address_v6::bytes_type addr;
+      memcpy(addr.data(), data + 4, addr.size());
+      memcpy(&port, data + 20, sizeof(port));
+      to = udp::endpoint(boost::asio::ip::address_v6(addr), ntohs(port));
+      break;
+    }
+    case 0x03: {  // DOMAINNAME
+      if (len < 5) {
+        break;
+      }
+      uint8_t host_len = data[4];
+      header_len = 5 + host_len + 2;
+      if (host_len == 0 || len < header_len) {
+        break;
+      }
+      memcpy(&port, data + 5 + host_len, sizeof(port));
+      send_resolved(std::string(data + 5, host_len), ntohs(port),
+                    std::vector<char>(data + header_len, data + len));
+      continue;
+    }
+    }
+
+    if (to.port() == 0 || len < header_len) {
+      ++m_stats.dropped;
+      continue;
+    }
+
+    if (!remote_socket(to) || !track(to)) {
+      ++m_stats.dropped;
+      continue;
+    }
+
+    auto& msg = b.out[out];
+    memset(&msg, 0, sizeof(msg));
+    set_name(msg.msg_hdr, b.out_addr[out], to);
+    b.out_iov[out][0].iov_base = const_cast<char*>(data + header_len);
+    b.out_iov[out][0].iov_len = len - header_len;
+    msg.msg_hdr.msg_iov = b.out_iov[out];
+    msg.msg_hdr.msg_iovlen = 1;
+    ++out;
+  }
+
+  // one call for each run of targets of the same family
+  for (auto first = 0; first < out;) {
+    auto family = b.out_addr[first].ss_family;
+    auto last = first + 1;
+    while (last < out && b.out_addr[last].ss_family == family) {
+      ++last;
+    }
+    auto& sock = family == AF_INET ? m_remote_v4 : m_remote_v6;
+    auto sent = send_all(sock.native_handle(), b.out + first, last - first);
+    m_stats.remote_send += sent;
+    m_stats.dropped += last - first - sent;
+    first = last;
+  }
+}
+
+void udp_relay::handle_remote(batch& b, int count) {
+  int out = 0;
+  for (auto i = 0; i < count; ++i) {
+    auto& hdr = b.in[i].msg_hdr;
+    ++m_stats.remote_recv;
+    auto from = to_endpoint(b.in_addr[i], hdr.msg_namelen);
+    if ((hdr.msg_flags & MSG_TRUNC) || !tracked(from)) {
+      ++m_stats.dropped;
+      continue;
+    }
+
+    auto header = b.out_header[out];
+    size_t header_len;
+    uint16_t port = htons(from.port());
+    header[0] = header[1] = header[2] = 0;
+    if (from.address().is_v4()) {
+      auto addr = from.address().to_v4().to_bytes();
+      header[3] = 0x01;
+      memcpy(header + 4, addr.data(), addr.size());
+      memcpy(header + 8, &port, sizeof(port));
+      header_len = 4 + 4 + 2;
+    } else {
+      auto addr = from.address().to_v6().to_bytes();
+      header[3] = 0x04;
+      memcpy(header + 4, addr.data(), addr.size());
+      memcpy(header + 20, &port, sizeof(port));
+      header_len = 4 + 16 + 2;
+    }
+
+    auto& msg = b.out[out];
+    memset(&msg, 0, sizeof(msg));
+    set_name(msg.msg_hdr, b.out_addr[out], m_client_ep);
+    if (m_cipher) {
+      auto n = m_cipher->seal(header, header_len, b.in_data[i], b.in[i].msg_len, b.out_data[out]);
+      b.out_iov[out][0].iov_base = b.out_data[out];
+      b.out_iov[out][0].iov_len = n;
+      msg.msg_hdr.msg_iovlen = 1;
+    } else {
+      // the payload goes out from where it was received
+      b.out_iov[out][0].iov_base = header;
+      b.out_iov[out][0].iov_len = header_len;
+      b.out_iov[out][1].iov_base = b.in_data[i];
+      b.out_iov[out][1].iov_len = b.in[i].msg_len;
+      msg.msg_hdr.msg_iovlen = 2;
+    }
+    msg.msg_hdr.msg_iov = b.out_iov[out];
+    ++out;
+  }
+
+  auto sent = send_all(m_client.native_handle(), b.out, out);
+  m_stats.client_send += sent;
+  m_stats.dropped += out - sent;
+}
+
+void udp_relay::send_resolved(const std::string& host, uint16_t port,
+                              std::vector<char> payload) {
+  auto self = shared_from_this();
+  dns_resolver::instance().resolve(m_ios, host,
+    [self, port, payload] (const boost::system::error_code& ec,
+                           const dns_resolver::address_list& addrs) {
+      if (self->m_stopped) {
+        return;
+      }
+
+      // the first address of a family the relay can send to
+      udp::socket* sock = nullptr;
+      udp::endpoint to;
+      for (auto i = addrs.begin(); !ec && !sock && i != addrs.end(); ++i) {
+        to = udp::endpoint(*i, port);
+        sock = self->remote_socket(to);
+      }
+
+      boost::system::error_code send_ec;
+      if (sock && self->track(to)) {
+        sock->send_to(boost::asio::buffer(payload), to, 0, send_ec);
+        if (!send_ec) {
+          ++self->m_stats.remote_send;
+          return;
+        }
+      }
+      ++self->m_stats.dropped;
+    }
+  );
+}
+
+bool udp_relay::accept_client(const udp::endpoint& from) {
+  if (from.address() != m_client_ep.address()) {
+    return false;
+  }
+
+  if (!m_client_known) {
+    m_client_ep.port(from.port());
+    m_client_known = true;
+    return true;
+  }
+  return from.port() == m_client_ep.port();
+}
+
+udp_relay::udp::socket* udp_relay::remote_socket(const udp::endpoint& to) {
+  auto& sock = to.address().is_v4() ? m_remote_v4 : m_remote_v6;
+  if (!sock.is_open()) {
+    boost::system::error_code ec;
+    sock.open(to.protocol(), ec);
+    if (!ec) {
+      sock.bind(udp::endpoint(to.protocol(), 0), ec);
+    }
+    if (!ec) {
+      sock.non_blocking(true, ec);
+    }
+    if (ec) {
+      boost::system::error_code ignored_ec;
+      sock.close(ignored_ec);
+      return nullptr;
+    }
+    wait(sock);
+  }
+  return &sock;
+}
+
+bool udp_relay::track(const udp::endpoint& to) {
+  auto now = std::chrono::steady_clock::now();
+  auto i = m_nat.find(to);
+  if (i != m_nat.end()) {
+    i->second = now;
+    return true;
+  }
+
+  if (m_nat.size() >= UDP_NAT_ENTRIES) {
+    for (i = m_nat.begin(); i != m_nat.end();) {
+      if (now - i->second >= UDP_NAT_TIMEOUT) {
+        i = m_nat.erase(i);
+      } else {
+        ++i;
+      }
+    }
+    if (m_nat.size() >= UDP_NAT_ENTRIES) {
+      return false;
+    }
+  }
+
+  m_nat.emplace(to, now);
+  return true;
+}
+
+bool udp_relay::tracked(const udp::endpoint& from) {
+  auto i = m_nat.find(from);
+  if (i == m_nat.end()) {
+    return false;
+  }
+
+  auto now = std::chrono::steady_clock::now();
+  if (now - i->second >= UDP_NAT_TIMEOUT) {
+    m_nat.erase(i);
+    return false;
+  }
+  i->second = now;
+  return true;
+}
+
+} }
@@ -0,0 +1,102 @@
+// ranger_proxy - A SOCKS5 proxy
+// Copyright (C) 2015  RangerUFO <ufownl@gmail.com>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef RANGER_PROXY_UDP_RELAY_HPP
+#define RANGER_PROXY_UDP_RELAY_HPP
+
+#include "aead_encryptor.hpp"
+#include <boost/asio.hpp>
+#include <chrono>
+#include <memory>
+#include <string>
+#include <vector>
+#include <map>
+#include <stdint.h>
+
+namespace ranger { namespace proxy {
+
+struct udp_relay_stats {
+  uint64_t client_recv {0};  // datagrams from the client
+  uint64_t client_send {0};
+  uint64_t remote_recv {0};  // datagrams from the targets
+  uint64_t remote_send {0};
+  uint64_t dropped {0};      // malformed, unsolicited or not sent
+  uint64_t batches {0};      // receive calls that returned datagrams
+};
+
+// Relays the datagrams of a SOCKS5 UDP ASSOCIATE (RFC 1928, section 7).
+// Datagrams are received and sent up to UDP_BATCH_SIZE at a time with
+// recvmmsg(2) and sendmmsg(2). The client socket only accepts datagrams
+// from the client's address, and from the first port it sends from
+// unless the port is known in advance. A target may only reply after
+// the client has sent to it within UDP_NAT_TIMEOUT. Fragmented
+// datagrams are dropped.
+class udp_relay : public std::enable_shared_from_this<udp_relay> {
+public:
+  using udp = boost::asio::ip::udp;
+
+  // binds the client socket to an ephemeral port of local_addr, a zero
+  // client_port accepts the first port the client sends from
+  udp_relay(boost::asio::io_service& ios,
+            const boost::asio::ip::address& local_addr,
+            const boost::asio::ip::address& client_addr,
+            uint16_t client_port);
+
+  udp_relay(const udp_relay&) = delete;
+  udp_relay& operator = (const udp_relay&) = delete;
+
+  // seals the datagrams of the client leg, must be set before start()
+  void set_cipher(std::unique_ptr<aead_datagram> cipher);
+
+  udp::endpoint local_endpoint() const;
+  void start();
+  void stop();
+
+  const udp_relay_stats& stats() const;
+
+private:
+  struct batch;
+
+  // scratch space of the calling thread
+  static batch& local_batch();
+
+  void wait(udp::socket& sock);
+  void receive(udp::socket& sock);
+  void handle_client(batch& b, int count);
+  void handle_remote(batch& b, int count);
+  void send_resolved(const std::string& host, uint16_t port,
+                     std::vector<char> payload);
+
+  bool accept_client(const udp::endpoint& from);
+  udp::socket* remote_socket(const udp::endpoint& to);
+  bool track(const udp::endpoint& to);
+  bool tracked(const udp::endpoint& from);
+
+  boost::asio::io_service& m_ios;
+  udp::socket m_client;
+  udp::endpoint m_client_ep;
+  bool m_client_known;
+  udp::socket m_remote_v4;
+  udp::socket m_remote_v6;
+  std::map<udp::endpoint, std::chrono::steady_clock::time_point> m_nat;
+  std::unique_ptr<aead_datagram> m_cipher;
+  udp_relay_stats m_stats;
+  bool m_stopped {false};
+};
+
+} }
+
+#endif  // RANGER_PROXY_UDP_RELAY_HPP
@@ -20,6 +20,7 @@
 #include <vector>
 #include <queue>
 #include "scope_guard.hpp"
+#include "buffer_pool.hpp"
 
 namespace ranger { namespace proxy {
 
@@ -56,7 +57,9 @@ private:
     scope_guard consuming_guard([this] { m_consuming = false; });
 
     while (m_expected_len > 0 && m_current_len - m_offset >= m_expected_len) {
-      std::vector<char> expected_buf;
+      // consumed buffers go back to the pool the fragments come from
+      auto& pool = buffer_pool::local();
+      auto expected_buf = pool.acquire(m_expected_len);
       do {
         if (m_offset + m_expected_len < m_buffers.front().size()) {
           expected_buf.insert(expected_buf.end(),
@@ -71,6 +74,7 @@ private:
           m_current_len -= m_buffers.front().size();
           m_expected_len -= m_buffers.front().size() - m_offset;
           m_offset = 0;
+          pool.release(std::move(m_buffers.front()));
           m_buffers.pop();
         }
       } while (m_expected_len > 0);
@@ -0,0 +1,188 @@
+// ranger_proxy - A SOCKS5 proxy
+// Copyright (C) 2015  RangerUFO <ufownl@gmail.com>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "common.hpp"
+#include "user_db.hpp"
+#include <openssl/crypto.h>
+#include <openssl/hmac.h>
+#include <openssl/rand.h>
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+#include <string.h>
+
+namespace ranger { namespace proxy {
+
+namespace {
+
+const size_t max_field_size = 255;
+
+// salts are drawn for this many users at a time while parsing, one
+// RAND_bytes call per user would take as long as hashing
+const size_t salt_batch = 1024;
+
+void hash_password(const uint8_t* salt, const std::string& password, uint8_t* out) {
+  unsigned int len = user_credential::hash_size;
+  HMAC(EVP_sha256(), salt, user_credential::salt_size,
+       reinterpret_cast<const uint8_t*>(password.data()), password.size(), out, &len);
+}
+
+// FNV-1a, the slots only need the bits spread
+uint64_t hash_username(const char* username, size_t len) {
+  uint64_t h = 14695981039346656037ULL;
+  for (size_t i = 0; i < len; ++i) {
+    h ^= static_cast<uint8_t>(username[i]);
+    h *= 1099511628211ULL;
+  }
+  return h;
+}
+
+}  // namespace
+
+constexpr size_t user_credential::salt_size;
+constexpr size_t user_credential::hash_size;
+
+user_credential user_credential::make(const std::string& password) {
+  user_credential cred;
+  if (RAND_bytes(cred.salt, salt_size) != 1) {
+    throw std::runtime_error("Fail in generating salt");
+  }
+  hash_password(cred.salt, password, cred.hash);
+  return cred;
+}
+
+user_credential user_credential::make(const std::string& password, const uint8_t* salt) {
+  user_credential cred;
+  memcpy(cred.salt, salt, salt_size);
+  hash_password(cred.salt, password, cred.hash);
+  return cred;
+}
+
+bool user_credential::check(const std::string& password) const {
+  uint8_t out[hash_size];
+  hash_password(salt, password, out);
+  return CRYPTO_memcmp(out, hash, hash_size) == 0;
+}
+
+std::shared_ptr<const user_db> user_db::load(const std::string& path) {
+  std::ifstream fin(path, std::ios::binary);
+  std::ostringstream content;
+  if (!fin || !(content << fin.rdbuf())) {
+    throw std::runtime_error("Fail in reading user file[" + path + "]");
+  }
+  auto data = content.str();
+  return parse(data.data(), data.size(), path);
+}
+
+std::shared_ptr<const user_db> user_db::parse(const char* data, size_t len,
+                                              const std::string& name) {
+  auto db = std::make_shared<user_db>();
+  auto end = data + len;
+  // at most half the slots are used, so every probe ends at an empty one
+  size_t lines = std::count(data, end, '\n') + 1;
+  size_t slots = 8;
+  while (slots < lines * 2) {
+    slots <<= 1;
+  }
+  db->m_slots.assign(slots, slot{0, 0});
+  db->m_records.reserve(lines);
+
+  std::vector<uint8_t> salts(salt_batch * user_credential::salt_size);
+  size_t salts_left = 0;
+  size_t line_no = 0;
+  while (data < end) {
+    ++line_no;
+    auto eol = static_cast<const char*>(memchr(data, '\n', end - data));
+    if (!eol) {
+      eol = end;
+    }
+    auto line_end = eol;
+    if (line_end > data && line_end[-1] == '\r') {
+      --line_end;
+    }
+
+    if (line_end > data && *data != '#') {
+      auto colon = static_cast<const char*>(memchr(data, ':', line_end - data));
+      if (!colon || colon == data
+          || static_cast<size_t>(colon - data) > max_field_size
+          || static_cast<size_t>(line_end - colon - 1) > max_field_size) {
+        throw std::runtime_error("Malformed user in user file[" + name
+                                 + "] at line " + std::to_string(line_no));
+      }
+
+      if (salts_left == 0) {
+        if (RAND_bytes(salts.data(), salts.size()) != 1) {
+          throw std::runtime_error("Fail in generating salt");
+        }
+        salts_left = salt_batch;
+      }
+      auto salt = salts.data() + --salts_left * user_credential::salt_size;
+      auto cred = user_credential::make(std::string(colon + 1, line_end), salt);
+      if (!db->insert(data, colon - data, cred)) {
+        throw std::runtime_error("Duplicate user in user file[" + name
+                                 + "] at line " + std::to_string(line_no));
+      }
+    }
+    data = eol + 1;
+  }
+  return db;
+}
+
+const user_credential* user_db::find(const char* username, size_t len) const {
+  if (m_slots.empty()) {
+    return nullptr;
+  }
+
+  auto h = hash_username(username, len);
+  auto tag = static_cast<uint32_t>(h >> 32);
+  auto mask = m_slots.size() - 1;
+  for (auto i = h & mask; ; i = (i + 1) & mask) {
+    auto& s = m_slots[i];
+    if (s.index == 0) {
+      return nullptr;
+    }
+
+    if (s.tag == tag) {
+      auto& r = m_records[s.index - 1];
+      if (r.name_size == len && memcmp(m_names.data() + r.name_offset, username, len) == 0) {
+        return &r.cred;
+      }
+    }
+  }
+}
+
+bool user_db::insert(const char* username, size_t len, const user_credential& cred) {
+  auto h = hash_username(username, len);
+  auto tag = static_cast<uint32_t>(h >> 32);
+  auto mask = m_slots.size() - 1;
+  auto i = h & mask;
+  for (; m_slots[i].index != 0; i = (i + 1) & mask) {
+    auto& r = m_records[m_slots[i].index - 1];
+    if (m_slots[i].tag == tag && r.name_size == len
+        && memcmp(m_names.data() + r.name_offset, username, len) == 0) {
+      return false;
+    }
+  }
+
+  m_records.push_back(record{static_cast<uint32_t>(m_names.size()),
+                             static_cast<uint32_t>(len), cred});
+  m_names.append(username, len);
+  m_slots[i] = slot{tag, static_cast<uint32_t>(m_records.size())};
+  return true;
+}
+
+} }
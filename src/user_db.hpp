@@ -0,0 +1,91 @@
+// ranger_proxy - A SOCKS5 proxy
+// Copyright (C) 2015  RangerUFO <ufownl@gmail.com>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef RANGER_PROXY_USER_DB_HPP
+#define RANGER_PROXY_USER_DB_HPP
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <stdint.h>
+
+namespace ranger { namespace proxy {
+
+// a password as HMAC-SHA256 keyed with a random per-user salt
+struct user_credential {
+  static constexpr size_t salt_size = 16;
+  static constexpr size_t hash_size = 32;
+
+  uint8_t salt[salt_size];
+  uint8_t hash[hash_size];
+
+  static user_credential make(const std::string& password);
+  static user_credential make(const std::string& password, const uint8_t* salt);
+
+  // compares in constant time
+  bool check(const std::string& password) const;
+};
+
+// The users of a user file, built once and never changed. Usernames sit
+// back to back in one string and the credentials in one array, indexed
+// by an open addressing table, so a million users take a few flat
+// allocations and a lookup touches two or three cache lines.
+//
+// The file has one "username:password" per line, the password runs to
+// the end of the line. Empty lines and lines starting with '#' are
+// skipped. Both fields are limited to 255 bytes like in SOCKS5.
+class user_db {
+public:
+  user_db() = default;
+
+  user_db(const user_db&) = delete;
+  user_db& operator = (const user_db&) = delete;
+
+  // throws std::runtime_error naming the file, and the line if it is
+  // malformed or repeats a username
+  static std::shared_ptr<const user_db> load(const std::string& path);
+  static std::shared_ptr<const user_db> parse(const char* data, size_t len,
+                                              const std::string& name);
+
+  // nullptr if there is no such user
+  const user_credential* find(const char* username, size_t len) const;
+
+  size_t size() const {
+    return m_records.size();
+  }
+
+private:
+  struct slot {
+    uint32_t tag;    // the upper half of the username's hash
+    uint32_t index;  // record + 1, 0 if the slot is empty
+  };
+
+  struct record {
+    uint32_t name_offset;
+    uint32_t name_size;
+    user_credential cred;
+  };
+
+  bool insert(const char* username, size_t len, const user_credential& cred);
+
+  std::vector<slot> m_slots;
+  std::vector<record> m_records;
+  std::string m_names;
+};
+
+} }
+
+#endif  // RANGER_PROXY_USER_DB_HPP
@@ -16,30 +16,181 @@
 
 #include "common.hpp"
 #include "user_table.hpp"
-#include <unordered_map>
-#include <memory>
+#include <sys/stat.h>
+#include <stdexcept>
 
 namespace ranger { namespace proxy {
 
-user_table::behavior_type user_table_impl(user_table::pointer self) {
-  auto tbl = std::make_shared<std::unordered_map<std::string, std::string>>();
-  return {
-    [=] (add_atom, const std::string& username, const std::string& password) {
-      return std::make_tuple(tbl->emplace(username, password).second, username);
-    },
-    [=] (auth_atom, const std::string& username, const std::string& password) {
-      auto it = tbl->find(username);
-      if (it == tbl->end()) {
-        return std::make_tuple(auth_atom::value, false);
-      }
+namespace {
 
-      if (it->second != password) {
-        return std::make_tuple(auth_atom::value, false);
-      }
+// versions are unique across all tables, so a thread's cached snapshot
+// can never be mistaken for one of another table
+std::atomic<uint64_t> next_version(0);
 
-      return std::make_tuple(auth_atom::value, true);
-    }
+// bumped by request_reload(), each watching thread remembers the last
+// value it acted on
+std::atomic<uint64_t> reload_requests(0);
+
+}  // namespace
+
+user_table::user_table() : m_version(0) {
+  publish(std::make_shared<snapshot>());
+}
+
+user_table::~user_table() {
+  stop_watching();
+}
+
+bool user_table::add(const std::string& username, const std::string& password) {
+  auto cred = user_credential::make(password);
+
+  std::lock_guard<std::mutex> lock(m_mutex);
+  if (m_snapshot->users.find(username) != m_snapshot->users.end()
+      || (m_snapshot->db && m_snapshot->db->find(username.data(), username.size()))) {
+    return false;
+  }
+  auto snap = std::make_shared<snapshot>(*m_snapshot);
+  snap->users.emplace(username, cred);
+  publish(std::move(snap));
+  return true;
+}
+
+bool user_table::auth(const std::string& username, const std::string& password) const {
+  // unknown users are checked against a credential nobody has
+  static const user_credential dummy = user_credential::make(std::string());
+
+  auto& snap = current();
+  const user_credential* cred = nullptr;
+  auto it = snap.users.find(username);
+  if (it != snap.users.end()) {
+    cred = &it->second;
+  } else if (snap.db) {
+    cred = snap.db->find(username.data(), username.size());
+  }
+
+  if (!cred) {
+    dummy.check(password);
+    return false;
+  }
+  return cred->check(password);
+}
+
+size_t user_table::size() const {
+  auto& snap = current();
+  return snap.users.size() + (snap.db ? snap.db->size() : 0);
+}
+
+size_t user_table::load(const std::string& path) {
+  auto db = user_db::load(path);
+  auto n = db->size();
+  replace(std::move(db));
+  return n;
+}
+
+size_t user_table::watch(const std::string& path, std::chrono::milliseconds interval,
+                         report_function report) {
+  stop_watching();
+  file_stamp stamp;
+  stat_file(path, stamp);
+  auto n = load(path);
+  m_watch_stopped = false;
+  m_watch_thread = std::thread(&user_table::watch_loop, this,
+                               path, stamp, interval, std::move(report));
+  return n;
+}
+
+void user_table::request_reload() {
+  reload_requests.fetch_add(1, std::memory_order_relaxed);
+}
+
+bool user_table::file_stamp::operator == (const file_stamp& other) const {
+  return dev == other.dev && ino == other.ino
+    && size == other.size && mtime == other.mtime;
+}
+
+bool user_table::stat_file(const std::string& path, file_stamp& stamp) {
+  struct stat st;
+  if (stat(path.c_str(), &st) != 0) {
+    return false;
+  }
+
+  stamp.dev = st.st_dev;
+  stamp.ino = st.st_ino;
+  stamp.size = st.st_size;
+#ifdef __APPLE__
+  stamp.mtime = st.st_mtimespec.tv_sec * 1000000000ULL + st.st_mtimespec.tv_nsec;
+#else
+  stamp.mtime = st.st_mtim.tv_sec * 1000000000ULL + st.st_mtim.tv_nsec;
+#endif
+  return true;
+}
+
+const user_table::snapshot& user_table::current() const {
+  struct cache {
+    uint64_t version {0};
+    std::shared_ptr<const snapshot> snap;
   };
+  static thread_local cache local;
+
+  if (local.version != m_version.load(std::memory_order_acquire)) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    local.snap = m_snapshot;
+    local.version = m_version.load(std::memory_order_relaxed);
+  }
+  return *local.snap;
+}
+
+void user_table::publish(std::shared_ptr<const snapshot> snap) {
+  // called with m_mutex held, or from the constructor
+  m_snapshot = std::move(snap);
+  m_version.store(++next_version, std::memory_order_release);
+}
+
+void user_table::replace(std::shared_ptr<const user_db> db) {
+  std::lock_guard<std::mutex> lock(m_mutex);
+  auto snap = std::make_shared<snapshot>(*m_snapshot);
+  snap->db = std::move(db);
+  publish(std::move(snap));
+}
+
+void user_table::watch_loop(std::string path, file_stamp loaded,
+                            std::chrono::milliseconds interval, report_function report) {
+  auto seen = loaded;
+  auto requests = reload_requests.load(std::memory_order_relaxed);
+  std::unique_lock<std::mutex> lock(m_watch_mtx);
+  while (!m_watch_cv.wait_for(lock, interval, [this] { return m_watch_stopped; })) {
+    lock.unlock();
+    file_stamp stamp;
+    auto exists = stat_file(path, stamp);
+    auto requested = reload_requests.load(std::memory_order_relaxed);
+    if (requested != requests
+        || (exists && !(stamp == loaded) && stamp == seen)) {
+      requests = requested;
+      // a file that fails stays failed until it changes again
+      loaded = stamp;
+      try {
+        auto n = load(path);
+        report(true, "Reload " + std::to_string(n) + " users from user file[" + path + "]");
+      } catch (const std::exception& e) {
+        report(false, e.what());
+      }
+    }
+    seen = stamp;
+    lock.lock();
+  }
+}
+
+void user_table::stop_watching() {
+  if (!m_watch_thread.joinable()) {
+    return;
+  }
+
+  {
+    std::lock_guard<std::mutex> lock(m_watch_mtx);
+    m_watch_stopped = true;
+  }
+  m_watch_cv.notify_all();
+  m_watch_thread.join();
 }
 
 } }
@@ -17,18 +17,97 @@
 #ifndef RANGER_PROXY_USER_TABLE_HPP
 #define RANGER_PROXY_USER_TABLE_HPP
 
+#include "user_db.hpp"
+#include <condition_variable>
+#include <unordered_map>
+#include <functional>
+#include <chrono>
 #include <string>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <stdint.h>
 
 namespace ranger { namespace proxy {
 
-using auth_atom = atom_constant<atom("auth")>;
+// Usernames and salted password hashes, checked by the sessions
+// themselves. Readers work on an immutable snapshot: every thread keeps
+// the one it used last and only takes the lock after a writer published
+// a newer one. Writers copy the snapshot, change the copy and publish it.
+//
+// Users come from add(), at startup, and from a user file that can be
+// replaced while the proxy runs. A user added with add() shadows the one
+// of the same name in the file.
+class user_table {
+public:
+  // called on the watching thread after each reload, ok is false if the
+  // file couldn't be loaded and the users loaded before were kept
+  using report_function = std::function<void(bool ok, const std::string& what)>;
+
+  user_table();
+  ~user_table();
+
+  user_table(const user_table&) = delete;
+  user_table& operator = (const user_table&) = delete;
+
+  // false if the user exists already
+  bool add(const std::string& username, const std::string& password);
+
+  // takes about as long for unknown users as for wrong passwords
+  bool auth(const std::string& username, const std::string& password) const;
+
+  // the users of add() and of the file, one shadowing the other counts twice
+  size_t size() const;
+
+  // Replaces the users of the file loaded before, returns how many the
+  // file has. Throws std::runtime_error and keeps the old users if the
+  // file can't be loaded.
+  size_t load(const std::string& path);
+
+  // Loads the file and checks it every interval on a thread of its own.
+  // It is loaded again once it changed and then stayed the same for an
+  // interval, so a file that is still being written isn't picked up, or
+  // at the next check after request_reload().
+  size_t watch(const std::string& path, std::chrono::milliseconds interval,
+               report_function report);
+
+  // async-signal-safe, for a SIGHUP handler
+  static void request_reload();
+
+private:
+  struct snapshot {
+    std::unordered_map<std::string, user_credential> users;
+    std::shared_ptr<const user_db> db;
+  };
+
+  struct file_stamp {
+    uint64_t dev {0};
+    uint64_t ino {0};
+    uint64_t size {0};
+    uint64_t mtime {0};
+
+    bool operator == (const file_stamp& other) const;
+  };
+
+  static bool stat_file(const std::string& path, file_stamp& stamp);
+
+  const snapshot& current() const;
+  void publish(std::shared_ptr<const snapshot> snap);
+  void replace(std::shared_ptr<const user_db> db);
+  void watch_loop(std::string path, file_stamp loaded,
+                  std::chrono::milliseconds interval, report_function report);
+  void stop_watching();
 
-using user_table = typed_actor<
-  replies_to<add_atom, std::string, std::string>::with<bool, std::string>,
-  replies_to<auth_atom, std::string, std::string>::with<auth_atom, bool>
->;
+  mutable std::mutex m_mutex;
+  std::shared_ptr<const snapshot> m_snapshot;
+  std::atomic<uint64_t> m_version;
 
-user_table::behavior_type user_table_impl(user_table::pointer self);
+  std::mutex m_watch_mtx;
+  std::condition_variable m_watch_cv;
+  bool m_watch_stopped {false};
+  std::thread m_watch_thread;
+};
 
 } }
 
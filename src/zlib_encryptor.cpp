@@ -16,128 +16,153 @@
 
 #include "common.hpp"
 #include "zlib_encryptor.hpp"
-#include "logger_ostream.hpp"
+#include <algorithm>
 #include <stdexcept>
 #include <new>
 
 namespace ranger { namespace proxy {
 
-zlib_state::zlib_state(encryptor::pointer self)
-  : m_self(self) {
-  // nop
+namespace {
+
+const size_t max_spare_size = 2 * BUFFER_SIZE;
+
+// decompressed data one call may hold, zlib expands by up to about 1000
+// times and a peer's small chunk must not grow into an unbounded buffer
+const size_t max_output_size = 16 * BUFFER_SIZE;
+
+// resize() may allocate up to twice the size asked for, which would
+// overshoot max_output_size
+void grow(std::vector<char>& buf, size_t size) {
+  buf.reserve(size);
+  buf.resize(size);
 }
 
-zlib_state::~zlib_state() {
-  deflateEnd(&m_deflate_strm);
-  inflateEnd(&m_inflate_strm);
 }
 
-void zlib_state::init(const encryptor& enc) {
-  m_encryptor = enc;
-  
-  auto err_code = deflateInit(&m_deflate_strm, Z_BEST_COMPRESSION);
-  if (err_code == Z_MEM_ERROR) {
-    throw std::bad_alloc();
-  } else if (err_code != Z_OK) {
-    log(m_self) << "ERROR: " << m_deflate_strm.msg << std::endl;
-    throw std::runtime_error(m_deflate_strm.msg);
+zlib_codec::~zlib_codec() {
+  if (m_deflate_ready) {
+    deflateEnd(&m_deflate_strm);
   }
-
-  err_code = inflateInit(&m_inflate_strm);
-  if (err_code == Z_MEM_ERROR) {
-    throw std::bad_alloc();
-  } else if (err_code != Z_OK) {
-    log(m_self) << "ERROR: " << m_inflate_strm.msg << std::endl;
-    throw std::runtime_error(m_inflate_strm.msg);
+  if (m_inflate_ready) {
+    inflateEnd(&m_inflate_strm);
   }
 }
 
-zlib_state::encrypt_promise_type zlib_state::encrypt(const std::vector<char>& in) {
-  encrypt_promise_type promise = m_self->make_response_promise();
-  if (m_encryptor) {
-    m_self->sync_send(m_encryptor, encrypt_atom::value, compress(in)).then(
-      [promise] (encrypt_atom, const std::vector<char>& buf) {
-        promise.deliver(encrypt_atom::value, buf);
-      }
-    );
-  } else {
-    promise.deliver(encrypt_atom::value, compress(in));
-  }
+void zlib_codec::init(int level) {
+  m_level = level;
+}
 
-  return promise;
+std::vector<char> zlib_codec::encrypt(const std::vector<char>& in) {
+  std::vector<char> out;
+  compress(in, out);
+  return out;
 }
 
-zlib_state::decrypt_promise_type zlib_state::decrypt(const std::vector<char>& in) {
-  decrypt_promise_type promise = m_self->make_response_promise();
-  if (m_encryptor) {
-    m_self->sync_send(m_encryptor, decrypt_atom::value, in).then(
-      [this, promise] (decrypt_atom, const std::vector<char>& buf) {
-        promise.deliver(decrypt_atom::value, uncompress(buf));
-      }
-    );
-  } else {
-    promise.deliver(decrypt_atom::value, uncompress(in));
-  }
+std::vector<char> zlib_codec::decrypt(const std::vector<char>& in) {
+  std::vector<char> out;
+  uncompress(in.data(), in.size(), out);
+  return out;
+}
 
-  return promise;
+void zlib_codec::encrypt_in_place(std::vector<char>& buf) {
+  compress(buf, m_spare);
+  buf.swap(m_spare);
+  recycle(m_spare);
 }
 
-std::vector<char> zlib_state::compress(const std::vector<char>& in) {
-  std::vector<char> out;
-  std::vector<Bytef> in_buf(in.begin(), in.end());
-  m_deflate_strm.next_in = in_buf.data();
-  m_deflate_strm.avail_in = in_buf.size();
-  do {
-    Bytef buf[BUFFER_SIZE];
-    m_deflate_strm.next_out = buf;
-    m_deflate_strm.avail_out = sizeof(buf);
-    deflate(&m_deflate_strm, Z_SYNC_FLUSH);
-    size_t len = sizeof(buf) - m_deflate_strm.avail_out;
-    if (len > 0) {
-      out.insert(out.end(), buf, buf + len);
+void zlib_codec::decrypt_in_place(std::vector<char>& buf) {
+  uncompress(buf.data(), buf.size(), m_spare);
+  buf.swap(m_spare);
+  recycle(m_spare);
+}
+
+void zlib_codec::encrypt_append(const std::vector<char>& in, std::vector<char>& out) {
+  compress(in, out);
+}
+
+void zlib_codec::decrypt_append(const char* data, size_t len, std::vector<char>& out) {
+  uncompress(data, len, out);
+}
+
+void zlib_codec::compress(const std::vector<char>& in, std::vector<char>& out) {
+  if (!m_deflate_ready) {
+    auto err_code = deflateInit(&m_deflate_strm, m_level);
+    if (err_code == Z_MEM_ERROR) {
+      throw std::bad_alloc();
+    } else if (err_code != Z_OK) {
+      throw std::runtime_error(m_deflate_strm.msg ? m_deflate_strm.msg : "deflateInit failed");
     }
-  } while (m_deflate_strm.avail_out == 0);
+    m_deflate_ready = true;
+  }
 
-  return out;
+  // output goes after what `out` holds, deflateBound assumes Z_FINISH
+  // and the sync flush marker needs a few bytes more
+  size_t len = out.size();
+  out.resize(len + deflateBound(&m_deflate_strm, in.size()) + 16);
+  m_deflate_strm.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(in.data()));
+  m_deflate_strm.avail_in = in.size();
+  for (;;) {
+    m_deflate_strm.next_out = reinterpret_cast<Bytef*>(out.data() + len);
+    m_deflate_strm.avail_out = out.size() - len;
+    deflate(&m_deflate_strm, Z_SYNC_FLUSH);
+    len = out.size() - m_deflate_strm.avail_out;
+    if (m_deflate_strm.avail_out > 0) {
+      break;
+    }
+    out.resize(out.size() * 2);
+  }
+  out.resize(len);
 }
 
-std::vector<char> zlib_state::uncompress(const std::vector<char>& in) {
-  std::vector<char> out;
-  std::vector<Bytef> in_buf(in.begin(), in.end());
-  m_inflate_strm.next_in = in_buf.data();
-  m_inflate_strm.avail_in = in_buf.size();
-  do {
-    Bytef buf[BUFFER_SIZE];
-    m_inflate_strm.next_out = buf;
-    m_inflate_strm.avail_out = sizeof(buf);
+void zlib_codec::uncompress(const char* data, size_t size, std::vector<char>& out) {
+  if (!m_inflate_ready) {
+    auto err_code = inflateInit(&m_inflate_strm);
+    if (err_code == Z_MEM_ERROR) {
+      throw std::bad_alloc();
+    } else if (err_code != Z_OK) {
+      throw std::runtime_error(m_inflate_strm.msg ? m_inflate_strm.msg : "inflateInit failed");
+    }
+    m_inflate_ready = true;
+  }
+
+  // output goes after what `out` holds, into whatever capacity it
+  // already has, and doubles on demand up to max_output_size
+  size_t len = out.size();
+  if (len >= max_output_size) {
+    throw std::runtime_error("Decompressed data is too large");
+  }
+  grow(out, std::min(max_output_size,
+                     std::max(out.capacity(), len + std::max<size_t>(size * 4, 16 * 1024))));
+  m_inflate_strm.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(data));
+  m_inflate_strm.avail_in = size;
+  for (;;) {
+    m_inflate_strm.next_out = reinterpret_cast<Bytef*>(out.data() + len);
+    m_inflate_strm.avail_out = out.size() - len;
     auto err = inflate(&m_inflate_strm, Z_SYNC_FLUSH);
     if (err == Z_MEM_ERROR) {
       throw std::bad_alloc();
     } else if (err == Z_NEED_DICT || err == Z_DATA_ERROR) {
-      log(m_self) << "ERROR: " << m_inflate_strm.msg << std::endl;
-      throw std::runtime_error(m_inflate_strm.msg);
+      throw std::runtime_error(m_inflate_strm.msg ? m_inflate_strm.msg : "inflate failed");
     }
 
-    size_t len = sizeof(buf) - m_inflate_strm.avail_out;
-    if (len > 0) {
-      out.insert(out.end(), buf, buf + len);
+    len = out.size() - m_inflate_strm.avail_out;
+    if (m_inflate_strm.avail_out > 0) {
+      break;
+    } else if (out.size() >= max_output_size) {
+      throw std::runtime_error("Decompressed data is too large");
     }
-  } while (m_inflate_strm.avail_out == 0);
-
-  return out;
+    grow(out, std::min(out.size() * 2, max_output_size));
+  }
+  out.resize(len);
 }
 
-encryptor::behavior_type
-zlib_encryptor_impl(encryptor::stateful_pointer<zlib_state> self, encryptor enc) {
-  self->state.init(enc);
-  return {
-    [self] (encrypt_atom, const std::vector<char>& data) {
-      return self->state.encrypt(data);
-    },
-    [self] (decrypt_atom, const std::vector<char>& data) {
-      return self->state.decrypt(data);
-    }
-  };
+void zlib_codec::recycle(std::vector<char>& buf) {
+  // a burst of highly compressible data must not pin its buffer
+  if (buf.capacity() > max_spare_size) {
+    std::vector<char>().swap(buf);
+  } else {
+    buf.clear();
+  }
 }
 
 } }
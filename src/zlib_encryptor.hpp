@@ -17,44 +17,52 @@
 #ifndef RANGER_PROXY_ZLIB_ENCRYPTOR_HPP
 #define RANGER_PROXY_ZLIB_ENCRYPTOR_HPP
 
-#include "encryptor.hpp"
+#include "cipher_pipeline.hpp"
 #include <vector>
 #include <zlib.h>
 
 namespace ranger { namespace proxy {
 
-class zlib_state {
+// The deflate and inflate streams are set up on first use, a codec that
+// only ever decompresses does not pay for the deflate window.
+//
+// Both directions read straight from the caller's buffer. The in-place
+// calls write into a per-codec output buffer and swap it with the
+// caller's, so a session reuses the same two buffers chunk after chunk.
+// A codec holds at most about 256 KB of deflate state, 40 KB of inflate
+// state and a spare buffer of up to twice BUFFER_SIZE between calls.
+// Decompression throws rather than let the output of a call grow past
+// 16 times BUFFER_SIZE.
+class zlib_codec : public cipher_stage {
 public:
-  using encrypt_promise_type =
-    typed_response_promise<encrypt_atom, std::vector<char>>;
-
-  using decrypt_promise_type =
-    typed_response_promise<decrypt_atom, std::vector<char>>;
+  zlib_codec() = default;
+  ~zlib_codec();
 
-  zlib_state(encryptor::pointer self);
-  ~zlib_state();
+  zlib_codec(const zlib_codec&) = delete;
+  zlib_codec& operator = (const zlib_codec&) = delete;
 
-  zlib_state(const zlib_state&) = delete;
-  zlib_state& operator = (const zlib_state&) = delete;
+  void init(int level = Z_BEST_COMPRESSION);
 
-  void init(const encryptor& enc);
-
-  encrypt_promise_type encrypt(const std::vector<char>& in);
-  decrypt_promise_type decrypt(const std::vector<char>& in);
+  std::vector<char> encrypt(const std::vector<char>& in) override;
+  std::vector<char> decrypt(const std::vector<char>& in) override;
+  void encrypt_in_place(std::vector<char>& buf) override;
+  void decrypt_in_place(std::vector<char>& buf) override;
+  void encrypt_append(const std::vector<char>& in, std::vector<char>& out) override;
+  void decrypt_append(const char* data, size_t len, std::vector<char>& out) override;
 
 private:
-  std::vector<char> compress(const std::vector<char>& in);
-  std::vector<char> uncompress(const std::vector<char>& in);
+  void compress(const std::vector<char>& in, std::vector<char>& out);
+  void uncompress(const char* data, size_t len, std::vector<char>& out);
+  void recycle(std::vector<char>& buf);
 
-  encryptor::pointer m_self;
-  encryptor m_encryptor;
+  int m_level {Z_BEST_COMPRESSION};
+  bool m_deflate_ready {false};
   z_stream m_deflate_strm {0};
+  bool m_inflate_ready {false};
   z_stream m_inflate_strm {0};
+  std::vector<char> m_spare;
 };
 
-encryptor::behavior_type
-zlib_encryptor_impl(encryptor::stateful_pointer<zlib_state> self, encryptor enc);
-
 } }
 
 #endif  // RANGER_PROXY_ZLIB_ENCRYPTOR_HPP
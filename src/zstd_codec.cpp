@@ -0,0 +1,100 @@
+// ranger_proxy - A SOCKS5 proxy
+// Copyright (C) 2015  RangerUFO <ufownl@gmail.com>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "common.hpp"
+#include "zstd_codec.hpp"
+
+#ifdef RANGER_PROXY_HAVE_ZSTD
+
+#include <stdexcept>
+#include <new>
+
+namespace ranger { namespace proxy {
+
+zstd_codec::~zstd_codec() {
+  ZSTD_freeCCtx(m_cctx);
+  ZSTD_freeDCtx(m_dctx);
+}
+
+void zstd_codec::init(int level) {
+  m_level = level;
+}
+
+std::vector<char> zstd_codec::encrypt(const std::vector<char>& in) {
+  std::vector<char> out;
+  encrypt_append(in, out);
+  return out;
+}
+
+void zstd_codec::encrypt_append(const std::vector<char>& in, std::vector<char>& out) {
+  if (!m_cctx) {
+    m_cctx = ZSTD_createCCtx();
+    if (!m_cctx) {
+      throw std::bad_alloc();
+    }
+    ZSTD_CCtx_setParameter(m_cctx, ZSTD_c_compressionLevel, m_level);
+  }
+
+  auto len = out.size();
+  out.resize(len + ZSTD_compressBound(in.size()));
+  ZSTD_inBuffer src = {in.data(), in.size(), 0};
+  ZSTD_outBuffer dst = {out.data(), out.size(), len};
+  for (;;) {
+    auto left = ZSTD_compressStream2(m_cctx, &dst, &src, ZSTD_e_flush);
+    if (ZSTD_isError(left)) {
+      throw std::runtime_error(ZSTD_getErrorName(left));
+    } else if (left == 0) {
+      break;
+    }
+
+    out.resize(out.size() + left);
+    dst.dst = out.data();
+    dst.size = out.size();
+  }
+  out.resize(dst.pos);
+}
+
+std::vector<char> zstd_codec::decrypt(const std::vector<char>& in) {
+  std::vector<char> out;
+  decrypt_append(in.data(), in.size(), out);
+  return out;
+}
+
+void zstd_codec::decrypt_append(const char* data, size_t len, std::vector<char>& out) {
+  if (!m_dctx) {
+    m_dctx = ZSTD_createDCtx();
+    if (!m_dctx) {
+      throw std::bad_alloc();
+    }
+  }
+
+  ZSTD_inBuffer src = {data, len, 0};
+  ZSTD_outBuffer dst = {nullptr, 0, out.size()};
+  do {
+    out.resize(out.size() + ZSTD_DStreamOutSize());
+    dst.dst = out.data();
+    dst.size = out.size();
+    auto ret = ZSTD_decompressStream(m_dctx, &dst, &src);
+    if (ZSTD_isError(ret)) {
+      throw std::runtime_error(ZSTD_getErrorName(ret));
+    }
+  } while (src.pos < src.size || dst.pos == dst.size);
+  out.resize(dst.pos);
+}
+
+} }
+
+#endif  // RANGER_PROXY_HAVE_ZSTD
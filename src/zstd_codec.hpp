@@ -0,0 +1,54 @@
+// ranger_proxy - A SOCKS5 proxy
+// Copyright (C) 2015  RangerUFO <ufownl@gmail.com>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef RANGER_PROXY_ZSTD_CODEC_HPP
+#define RANGER_PROXY_ZSTD_CODEC_HPP
+
+#include "cipher_pipeline.hpp"
+
+#ifdef RANGER_PROXY_HAVE_ZSTD
+
+#include <zstd.h>
+
+namespace ranger { namespace proxy {
+
+// One Zstd frame per direction, flushed after every chunk.
+class zstd_codec : public cipher_stage {
+public:
+  zstd_codec() = default;
+  ~zstd_codec();
+
+  zstd_codec(const zstd_codec&) = delete;
+  zstd_codec& operator = (const zstd_codec&) = delete;
+
+  void init(int level = ZSTD_CLEVEL_DEFAULT);
+
+  std::vector<char> encrypt(const std::vector<char>& in) override;
+  std::vector<char> decrypt(const std::vector<char>& in) override;
+  void encrypt_append(const std::vector<char>& in, std::vector<char>& out) override;
+  void decrypt_append(const char* data, size_t len, std::vector<char>& out) override;
+
+private:
+  int m_level {ZSTD_CLEVEL_DEFAULT};
+  ZSTD_CCtx* m_cctx {nullptr};
+  ZSTD_DCtx* m_dctx {nullptr};
+};
+
+} }
+
+#endif  // RANGER_PROXY_HAVE_ZSTD
+
+#endif  // RANGER_PROXY_ZSTD_CODEC_HPP
@@ -0,0 +1,156 @@
+// ranger_proxy - A SOCKS5 proxy
+// Copyright (C) 2015  RangerUFO <ufownl@gmail.com>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+#include <gtest/gtest.h>
+#include "admission_control.cpp"
+#include "token_bucket.cpp"
+#include "receive_sizer.cpp"
+#include <chrono>
+#include <iostream>
+#include <vector>
+
+using namespace ranger::proxy;
+
+TEST(admission_control, parse) {
+  size_t total = 1;
+  size_t per_ip = 1;
+  EXPECT_TRUE(parse_connection_limit("", total, per_ip));
+  EXPECT_EQ(0u, total);
+  EXPECT_EQ(0u, per_ip);
+  EXPECT_TRUE(parse_connection_limit("1000", total, per_ip));
+  EXPECT_EQ(1000u, total);
+  EXPECT_EQ(0u, per_ip);
+  EXPECT_TRUE(parse_connection_limit("1000:10", total, per_ip));
+  EXPECT_EQ(1000u, total);
+  EXPECT_EQ(10u, per_ip);
+  EXPECT_TRUE(parse_connection_limit("0:10", total, per_ip));
+  EXPECT_EQ(0u, total);
+  EXPECT_EQ(10u, per_ip);
+
+  EXPECT_FALSE(parse_connection_limit("many", total, per_ip));
+  EXPECT_FALSE(parse_connection_limit("10:", total, per_ip));
+  EXPECT_FALSE(parse_connection_limit("10k", total, per_ip));
+}
+
+TEST(admission_control, share) {
+  admission_limits limits;
+  limits.sessions = 1000;
+  limits.sessions_per_ip = 10;
+  limits.handshakes = 1;
+  limits.accept_rate.rate = 100;
+  limits.accept_rate.burst = 100;
+  auto share = share_admission_limits(limits, 3);
+  EXPECT_EQ(334u, share.sessions);
+  EXPECT_EQ(10u, share.sessions_per_ip);
+  EXPECT_EQ(1u, share.handshakes);
+  EXPECT_EQ(0u, share.handshakes_per_ip);
+  EXPECT_EQ(34u, share.accept_rate.rate);
+  EXPECT_EQ(34u, share.accept_rate.burst);
+}
+
+TEST(admission_control, sessions) {
+  admission_limits limits;
+  limits.sessions = 3;
+  limits.sessions_per_ip = 2;
+  auto ctrl = std::make_shared<admission_control>(limits);
+  auto a1 = ctrl->admit("10.0.0.1");
+  auto a2 = ctrl->admit("10.0.0.1");
+  ASSERT_NE(nullptr, a1);
+  ASSERT_NE(nullptr, a2);
+  EXPECT_EQ(nullptr, ctrl->admit("10.0.0.1"));
+  auto b1 = ctrl->admit("10.0.0.2");
+  ASSERT_NE(nullptr, b1);
+  EXPECT_EQ(nullptr, ctrl->admit("10.0.0.3"));
+
+  // a closed session frees its slots
+  a1.reset();
+  EXPECT_NE(nullptr, ctrl->admit("10.0.0.1"));
+  auto stats = ctrl->stats();
+  EXPECT_EQ(4u, stats.accepted);
+  EXPECT_EQ(2u, stats.rejected_sessions);
+  EXPECT_EQ(2u, stats.sessions);
+}
+
+TEST(admission_control, handshakes) {
+  admission_limits limits;
+  limits.handshakes = 2;
+  limits.handshakes_per_ip = 1;
+  auto ctrl = std::make_shared<admission_control>(limits);
+  auto a = ctrl->admit("10.0.0.1");
+  ASSERT_NE(nullptr, a);
+  EXPECT_EQ(nullptr, ctrl->admit("10.0.0.1"));
+  auto b = ctrl->admit("10.0.0.2");
+  ASSERT_NE(nullptr, b);
+  EXPECT_EQ(nullptr, ctrl->admit("10.0.0.3"));
+
+  // a session past its handshake only counts as a session
+  a->handshake_done();
+  a->handshake_done();
+  auto a2 = ctrl->admit("10.0.0.1");
+  ASSERT_NE(nullptr, a2);
+  auto stats = ctrl->stats();
+  EXPECT_EQ(3u, stats.sessions);
+  EXPECT_EQ(2u, stats.handshakes);
+  EXPECT_EQ(2u, stats.rejected_handshakes);
+
+  a.reset();
+  b.reset();
+  a2.reset();
+  stats = ctrl->stats();
+  EXPECT_EQ(0u, stats.sessions);
+  EXPECT_EQ(0u, stats.handshakes);
+}
+
+TEST(admission_control, accept_rate) {
+  admission_limits limits;
+  limits.accept_rate.rate = 10;
+  limits.accept_rate.burst = 5;
+  auto ctrl = std::make_shared<admission_control>(limits);
+  std::vector<std::shared_ptr<admission_control::ticket>> tickets;
+  for (auto i = 0; i < 20; ++i) {
+    auto t = ctrl->admit("10.0.0.1");
+    if (t) {
+      tickets.push_back(t);
+    }
+  }
+  // the burst, and maybe one more token that came in meanwhile
+  EXPECT_GE(tickets.size(), 5u);
+  EXPECT_LE(tickets.size(), 6u);
+  EXPECT_EQ(20u - tickets.size(), ctrl->stats().rejected_rate);
+}
+
+TEST(admission_control, bench) {
+  admission_limits limits;
+  limits.sessions = 100000;
+  limits.sessions_per_ip = 100;
+  limits.handshakes = 10000;
+  limits.handshakes_per_ip = 10;
+  auto ctrl = std::make_shared<admission_control>(limits);
+  // a flood from a few addresses, mostly turned away
+  const size_t attempts = 1000000;
+  std::vector<std::shared_ptr<admission_control::ticket>> tickets;
+  auto begin = std::chrono::steady_clock::now();
+  for (size_t i = 0; i < attempts; ++i) {
+    auto t = ctrl->admit("192.168.0." + std::to_string(i % 64));
+    if (t) {
+      tickets.push_back(std::move(t));
+    }
+  }
+  auto elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin);
+  EXPECT_EQ(640u, tickets.size());
+  EXPECT_EQ(attempts - 640, ctrl->stats().rejected_handshakes);
+  std::cout << "[admission_control bench] "
+    << static_cast<uint64_t>(attempts / elapsed.count()) << " decisions/s" << std::endl;
+}
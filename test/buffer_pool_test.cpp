@@ -0,0 +1,140 @@
+// ranger_proxy - A SOCKS5 proxy
+// Copyright (C) 2015  RangerUFO <ufownl@gmail.com>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include <gtest/gtest.h>
+#include "buffer_pool.cpp"
+#include <chrono>
+#include <iostream>
+#include <random>
+#include <thread>
+
+TEST(buffer_pool, size_classes) {
+  ranger::proxy::buffer_pool pool(4096, 64 * 1024);
+  auto buf = pool.acquire(600);
+  EXPECT_TRUE(buf.empty());
+  EXPECT_GE(buf.capacity(), 1024u);
+  EXPECT_EQ(1u, pool.stats().misses);
+
+  pool.release(std::move(buf));
+  EXPECT_EQ(1024u, pool.stats().cached_bytes);
+  // any request of the class reuses it, larger ones don't
+  buf = pool.acquire(1000);
+  EXPECT_EQ(1u, pool.stats().hits);
+  EXPECT_EQ(0u, pool.stats().cached_bytes);
+  pool.release(std::move(buf));
+  pool.acquire(1025);
+  EXPECT_EQ(2u, pool.stats().misses);
+  EXPECT_EQ(1024u, pool.stats().peak_bytes);
+}
+
+TEST(buffer_pool, release_clears) {
+  ranger::proxy::buffer_pool pool(4096, 64 * 1024);
+  std::vector<char> buf(700, 'a');
+  pool.release(std::move(buf));
+  buf = pool.acquire(512);
+  EXPECT_TRUE(buf.empty());
+  EXPECT_GE(buf.capacity(), 700u);
+  EXPECT_EQ(1u, pool.stats().hits);
+}
+
+TEST(buffer_pool, drop_unfit_buffers) {
+  ranger::proxy::buffer_pool pool(4096, 8192);
+  std::vector<char> small(100);
+  pool.release(std::move(small));
+  std::vector<char> large(16 * 1024);
+  pool.release(std::move(large));
+  EXPECT_EQ(0u, pool.stats().cached_bytes);
+
+  // oversized requests are served but never cached
+  auto buf = pool.acquire(10000);
+  EXPECT_GE(buf.capacity(), 10000u);
+  EXPECT_EQ(1u, pool.stats().misses);
+
+  // a class holds at most max_class_bytes
+  for (auto i = 0; i < 3; ++i) {
+    std::vector<char> b;
+    b.reserve(4096);
+    pool.release(std::move(b));
+  }
+  EXPECT_EQ(8192u, pool.stats().cached_bytes);
+  EXPECT_EQ(8192u, pool.stats().peak_bytes);
+}
+
+TEST(buffer_pool, copy) {
+  ranger::proxy::buffer_pool pool(4096, 64 * 1024);
+  std::vector<char> src = {'a', 'b', 'c'};
+  pool.release(std::vector<char>(512));
+  EXPECT_EQ(src, pool.copy(src));
+  EXPECT_EQ(1u, pool.stats().hits);
+}
+
+TEST(buffer_pool, local) {
+  auto& pool = ranger::proxy::buffer_pool::local();
+  EXPECT_EQ(&pool, &ranger::proxy::buffer_pool::local());
+  ranger::proxy::buffer_pool* other = nullptr;
+  std::thread([&other] { other = &ranger::proxy::buffer_pool::local(); }).join();
+  EXPECT_NE(&pool, other);
+
+  pool.release(pool.acquire(ranger::proxy::BUFFER_SIZE));
+  auto hits = pool.stats().hits;
+  pool.acquire(ranger::proxy::BUFFER_SIZE);
+  EXPECT_EQ(hits + 1, pool.stats().hits);
+}
+
+namespace {
+
+// Each thread keeps a window of chunks in flight like a set of sessions
+// and replaces the oldest one per step, with or without its pool.
+double churn(size_t threads, bool pooled) {
+  const size_t steps = 200000;
+  const size_t window = 64;
+  auto begin = std::chrono::steady_clock::now();
+  std::vector<std::thread> workers;
+  for (size_t i = 0; i < threads; ++i) {
+    workers.emplace_back([i, pooled, steps, window] {
+      auto& pool = ranger::proxy::buffer_pool::local();
+      std::minstd_rand rd(i + 1);
+      std::vector<std::vector<char>> chunks(window);
+      for (size_t n = 0; n < steps; ++n) {
+        auto size = 512 + rd() % (64 * 1024);
+        auto& slot = chunks[n % window];
+        if (pooled) {
+          pool.release(std::move(slot));
+          slot = pool.acquire(size);
+        } else {
+          slot = std::vector<char>();
+          slot.reserve(size);
+        }
+        slot.push_back(static_cast<char>(n));
+      }
+    });
+  }
+  for (auto& w : workers) {
+    w.join();
+  }
+  auto seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+  return seconds * 1e9 / (steps * threads);
+}
+
+}
+
+TEST(buffer_pool, bench) {
+  for (size_t threads : {1, 4, 16}) {
+    std::cout << "[buffer_pool bench] " << threads << " thread(s): "
+      << "malloc " << churn(threads, false) << " ns/chunk, "
+      << "pooled " << churn(threads, true) << " ns/chunk" << std::endl;
+  }
+}
@@ -0,0 +1,278 @@
+// ranger_proxy - A SOCKS5 proxy
+// Copyright (C) 2015  RangerUFO <ufownl@gmail.com>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include <gtest/gtest.h>
+#include "codec.cpp"
+#include "zlib_encryptor.cpp"
+#include "lz4_codec.cpp"
+#include "zstd_codec.cpp"
+#include <chrono>
+#include <random>
+#include <iostream>
+#include <sstream>
+#include <string.h>
+
+namespace {
+
+const size_t chunk_size = 64 * 1024;
+const size_t payload_size = 4 * 1024 * 1024;
+
+std::vector<ranger::proxy::codec_spec> supported_codecs() {
+  std::vector<ranger::proxy::codec_spec> res;
+  for (auto name : {"zlib:1", "zlib:6", "zlib:9", "lz4", "lz4:9", "zstd:1", "zstd:3", "zstd:9",
+                    "zlib:6+adaptive", "lz4+adaptive", "zstd:3+adaptive"}) {
+    ranger::proxy::codec_spec spec;
+    if (ranger::proxy::parse_codec(name, spec)
+        && ranger::proxy::codec_supported(spec.type)) {
+      res.push_back(spec);
+    }
+  }
+  return res;
+}
+
+std::string spec_name(const ranger::proxy::codec_spec& spec) {
+  std::ostringstream oss;
+  oss << ranger::proxy::codec_name(spec.type) << ":" << spec.level;
+  if (spec.adaptive) {
+    oss << "+adaptive";
+  }
+  return oss.str();
+}
+
+// HTML-like markup built from a small vocabulary
+std::vector<char> text_payload(size_t size) {
+  static const char* words[] = {
+    "<div class=\"item\">", "</div>", "<a href=\"/index.html\">", "</a>",
+    "proxy", "session", "tunnel", "the", "of", "and", "remote", "local",
+    "connection", "ranger", "<span>", "</span>", "\n", "  "
+  };
+  std::minstd_rand rd(1);
+  std::vector<char> buf;
+  buf.reserve(size);
+  while (buf.size() < size) {
+    auto word = words[rd() % (sizeof(words) / sizeof(words[0]))];
+    buf.insert(buf.end(), word, word + strlen(word));
+    buf.push_back(' ');
+  }
+  buf.resize(size);
+  return buf;
+}
+
+// JSON records with random numeric fields
+std::vector<char> json_payload(size_t size) {
+  std::minstd_rand rd(2);
+  std::vector<char> buf;
+  buf.reserve(size);
+  while (buf.size() < size) {
+    std::ostringstream oss;
+    oss << "{\"id\":" << rd() << ",\"user\":\"u" << rd() % 1000
+        << "\",\"bytes\":" << rd() % 65536 << ",\"ok\":true},";
+    auto str = oss.str();
+    buf.insert(buf.end(), str.begin(), str.end());
+  }
+  buf.resize(size);
+  return buf;
+}
+
+// stands in for TLS records and media
+std::vector<char> random_payload(size_t size) {
+  std::minstd_rand rd(3);
+  std::vector<char> buf(size);
+  for (auto& c : buf) {
+    c = static_cast<char>(rd());
+  }
+  return buf;
+}
+
+std::vector<char> round_trip(const ranger::proxy::codec_spec& spec,
+                             const std::vector<char>& plain,
+                             size_t piece_size) {
+  ranger::proxy::codec_stage local;
+  local.init(spec);
+  ranger::proxy::codec_stage remote;
+  remote.init(ranger::proxy::codec_spec(ranger::proxy::codec_type::zlib));
+
+  std::vector<char> compressed;
+  for (size_t pos = 0; pos < plain.size(); pos += chunk_size) {
+    std::vector<char> chunk(plain.begin() + pos,
+                            plain.begin() + std::min(pos + chunk_size, plain.size()));
+    auto out = local.encrypt(chunk);
+    compressed.insert(compressed.end(), out.begin(), out.end());
+  }
+
+  // the remote side decodes whatever it detects, regardless of its own codec
+  std::vector<char> res;
+  for (size_t pos = 0; pos < compressed.size(); pos += piece_size) {
+    std::vector<char> piece(compressed.begin() + pos,
+                            compressed.begin() + std::min(pos + piece_size, compressed.size()));
+    auto out = remote.decrypt(piece);
+    res.insert(res.end(), out.begin(), out.end());
+  }
+  return res;
+}
+
+}
+
+TEST(codec, parse) {
+  ranger::proxy::codec_spec spec;
+  ASSERT_TRUE(ranger::proxy::parse_codec("", spec));
+  EXPECT_FALSE(spec);
+  ASSERT_TRUE(ranger::proxy::parse_codec("zlib", spec));
+  EXPECT_EQ(ranger::proxy::codec_type::zlib, spec.type);
+  EXPECT_EQ(Z_BEST_COMPRESSION, spec.level);
+  ASSERT_TRUE(ranger::proxy::parse_codec("zstd:7", spec));
+  EXPECT_EQ(ranger::proxy::codec_type::zstd, spec.type);
+  EXPECT_EQ(7, spec.level);
+  EXPECT_FALSE(spec.adaptive);
+  ASSERT_TRUE(ranger::proxy::parse_codec("zlib:1+adaptive", spec));
+  EXPECT_EQ(ranger::proxy::codec_type::zlib, spec.type);
+  EXPECT_EQ(1, spec.level);
+  EXPECT_TRUE(spec.adaptive);
+  ASSERT_TRUE(ranger::proxy::parse_codec("zlib+adaptive", spec));
+  EXPECT_EQ(Z_BEST_COMPRESSION, spec.level);
+  EXPECT_TRUE(spec.adaptive);
+  EXPECT_FALSE(ranger::proxy::parse_codec("+adaptive", spec));
+  EXPECT_FALSE(ranger::proxy::parse_codec("zlib:", spec));
+  EXPECT_FALSE(ranger::proxy::parse_codec("zlib:x", spec));
+  EXPECT_FALSE(ranger::proxy::parse_codec(":1", spec));
+  EXPECT_FALSE(ranger::proxy::parse_codec("brotli", spec));
+}
+
+TEST(codec, round_trip) {
+  auto plain = text_payload(3 * chunk_size + 123);
+  for (auto& spec : supported_codecs()) {
+    SCOPED_TRACE(spec_name(spec));
+    EXPECT_EQ(plain, round_trip(spec, plain, 1000));
+    EXPECT_EQ(plain, round_trip(spec, plain, 1));
+  }
+}
+
+TEST(codec, legacy_zlib_stream) {
+  // peers that predate the codec layer send a bare zlib stream
+  ranger::proxy::zlib_codec legacy;
+  legacy.init();
+  ranger::proxy::codec_stage stage;
+  stage.init(ranger::proxy::codec_spec(ranger::proxy::codec_type::zlib));
+
+  auto plain = json_payload(10000);
+  EXPECT_EQ(plain, stage.decrypt(legacy.encrypt(plain)));
+}
+
+TEST(codec, reject_unknown_stream) {
+  ranger::proxy::codec_stage stage;
+  stage.init(ranger::proxy::codec_spec(ranger::proxy::codec_type::zlib));
+  EXPECT_THROW(stage.decrypt({'\x01', '\x02'}), std::runtime_error);
+}
+
+TEST(codec, adaptive_switching) {
+  ranger::proxy::codec_spec spec(ranger::proxy::codec_type::zlib, 6, true);
+  ranger::proxy::codec_stage local;
+  local.init(spec);
+  ranger::proxy::codec_stage remote;
+  remote.init(spec);
+
+  auto send = [&] (const std::vector<char>& chunk) {
+    auto out = local.encrypt(chunk);
+    EXPECT_EQ(chunk, remote.decrypt(out));
+    return out.size();
+  };
+
+  auto text = text_payload(chunk_size);
+  EXPECT_LT(send(text), chunk_size / 2);
+
+  auto random = random_payload(128 * chunk_size);
+  for (size_t pos = 0; pos < random.size(); pos += chunk_size) {
+    send(std::vector<char>(random.begin() + pos, random.begin() + pos + chunk_size));
+  }
+  auto& stats = local.stats();
+  // all but the first few chunks and the probes go out stored
+  EXPECT_GE(stats.stored_bytes, 112 * chunk_size);
+  EXPECT_LT(stats.stored_bytes, random.size());
+
+  // compressible data is picked up again within one probe interval
+  size_t chunks = 1;
+  while (send(text) >= chunk_size / 2) {
+    ASSERT_LE(++chunks, 64u);
+  }
+  EXPECT_GT(stats.saved_bytes(), 0);
+  EXPECT_EQ(stats.plain_bytes, (129 + chunks) * chunk_size);
+}
+
+TEST(codec, adaptive_fragmented) {
+  auto random = random_payload(16 * chunk_size);
+  auto text = text_payload(4 * chunk_size);
+  std::vector<char> plain(random);
+  plain.insert(plain.end(), text.begin(), text.end());
+  for (auto& spec : supported_codecs()) {
+    if (!spec.adaptive) {
+      continue;
+    }
+    SCOPED_TRACE(spec_name(spec));
+    EXPECT_EQ(plain, round_trip(spec, plain, 1000));
+    EXPECT_EQ(plain, round_trip(spec, plain, 3));
+  }
+}
+
+TEST(codec, reject_malformed_frame) {
+  ranger::proxy::codec_stage stage;
+  stage.init(ranger::proxy::codec_spec(ranger::proxy::codec_type::zlib));
+  EXPECT_EQ(std::vector<char>({'a'}), stage.decrypt({'\xC0', 0, 0, 0, 1, 'a'}));
+  EXPECT_THROW(stage.decrypt({'\x01', 0, 0, 0, 1, 'a'}), std::runtime_error);
+}
+
+TEST(codec, bench) {
+  struct payload {
+    const char* name;
+    std::vector<char> data;
+  };
+  std::vector<payload> payloads = {
+    {"text", text_payload(payload_size)},
+    {"json", json_payload(payload_size)},
+    {"random", random_payload(payload_size)}
+  };
+
+  for (auto& spec : supported_codecs()) {
+    for (auto& p : payloads) {
+      ranger::proxy::codec_stage local;
+      local.init(spec);
+      ranger::proxy::codec_stage remote;
+      remote.init(spec);
+
+      std::vector<std::vector<char>> chunks;
+      size_t compressed_size = 0;
+      auto begin = std::chrono::steady_clock::now();
+      for (size_t pos = 0; pos < p.data.size(); pos += chunk_size) {
+        std::vector<char> chunk(p.data.begin() + pos, p.data.begin() + pos + chunk_size);
+        chunks.emplace_back(local.encrypt(chunk));
+        compressed_size += chunks.back().size();
+      }
+      auto middle = std::chrono::steady_clock::now();
+      size_t plain_size = 0;
+      for (auto& chunk : chunks) {
+        plain_size += remote.decrypt(chunk).size();
+      }
+      auto end = std::chrono::steady_clock::now();
+      EXPECT_EQ(p.data.size(), plain_size);
+
+      auto mb = static_cast<double>(p.data.size()) / (1024 * 1024);
+      std::cout << "[codec bench] " << spec_name(spec) << " " << p.name
+        << ": ratio " << static_cast<double>(compressed_size) / p.data.size()
+        << ", compress " << mb / std::chrono::duration<double>(middle - begin).count() << " MB/s"
+        << ", decompress " << mb / std::chrono::duration<double>(end - middle).count() << " MB/s"
+        << std::endl;
+    }
+  }
+}
@@ -0,0 +1,205 @@
+// ranger_proxy - A SOCKS5 proxy
+// Copyright (C) 2015  RangerUFO <ufownl@gmail.com>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include <gtest/gtest.h>
+#include "dns_resolver.cpp"
+#include <atomic>
+#include <iostream>
+
+namespace {
+
+using ranger::proxy::dns_resolver;
+
+// answers every name but "missing" with one address after a delay
+struct fake_lookup {
+  std::shared_ptr<std::atomic<int>> calls {std::make_shared<std::atomic<int>>(0)};
+  std::chrono::milliseconds delay {0};
+
+  boost::system::error_code operator () (const std::string& host,
+                                         dns_resolver::address_list& addrs) const {
+    ++*calls;
+    std::this_thread::sleep_for(delay);
+    if (host == "missing") {
+      return boost::asio::error::host_not_found;
+    } else if (host == "flaky") {
+      return boost::asio::error::host_not_found_try_again;
+    }
+    addrs.push_back(boost::asio::ip::address::from_string("192.0.2.1"));
+    return {};
+  }
+};
+
+struct result {
+  boost::system::error_code ec;
+  dns_resolver::address_list addrs;
+};
+
+result resolve(dns_resolver& resolver, const std::string& host) {
+  // the lookup runs on a worker, the io_service waits for its answer
+  boost::asio::io_service ios;
+  boost::asio::io_service::work work(ios);
+  result res;
+  resolver.resolve(ios, host, [&] (const boost::system::error_code& ec,
+                                   const dns_resolver::address_list& addrs) {
+    res.ec = ec;
+    res.addrs = addrs;
+    ios.stop();
+  });
+  ios.run();
+  return res;
+}
+
+}
+
+TEST(dns_resolver, positive_cache) {
+  fake_lookup lookup;
+  dns_resolver resolver(2, std::chrono::seconds(60), std::chrono::seconds(10), 16, lookup);
+  for (auto i = 0; i < 3; ++i) {
+    auto res = resolve(resolver, "example.com");
+    EXPECT_FALSE(res.ec);
+    ASSERT_EQ(1u, res.addrs.size());
+    EXPECT_EQ("192.0.2.1", res.addrs.front().to_string());
+  }
+  EXPECT_EQ(1, *lookup.calls);
+  auto stats = resolver.stats();
+  EXPECT_EQ(2u, stats.hits);
+  EXPECT_EQ(1u, stats.misses);
+  EXPECT_EQ(1u, stats.entries);
+}
+
+TEST(dns_resolver, negative_cache) {
+  fake_lookup lookup;
+  dns_resolver resolver(2, std::chrono::seconds(60), std::chrono::seconds(10), 16, lookup);
+  EXPECT_EQ(boost::asio::error::host_not_found, resolve(resolver, "missing").ec);
+  EXPECT_EQ(boost::asio::error::host_not_found, resolve(resolver, "missing").ec);
+  EXPECT_EQ(1, *lookup.calls);
+  EXPECT_EQ(1u, resolver.stats().negative_hits);
+
+  // temporary failures are not cached
+  EXPECT_EQ(boost::asio::error::host_not_found_try_again, resolve(resolver, "flaky").ec);
+  EXPECT_EQ(boost::asio::error::host_not_found_try_again, resolve(resolver, "flaky").ec);
+  EXPECT_EQ(3, *lookup.calls);
+  EXPECT_EQ(3u, resolver.stats().failures);
+}
+
+TEST(dns_resolver, expiry) {
+  fake_lookup lookup;
+  dns_resolver resolver(1, std::chrono::milliseconds(50), std::chrono::milliseconds(50),
+                        16, lookup);
+  resolve(resolver, "example.com");
+  resolve(resolver, "missing");
+  std::this_thread::sleep_for(std::chrono::milliseconds(100));
+  resolve(resolver, "example.com");
+  resolve(resolver, "missing");
+  EXPECT_EQ(4, *lookup.calls);
+  EXPECT_EQ(0u, resolver.stats().hits);
+}
+
+TEST(dns_resolver, eviction) {
+  fake_lookup lookup;
+  dns_resolver resolver(1, std::chrono::seconds(60), std::chrono::seconds(10), 4, lookup);
+  for (auto i = 0; i < 10; ++i) {
+    resolve(resolver, "host" + std::to_string(i));
+  }
+  EXPECT_EQ(4u, resolver.stats().entries);
+}
+
+TEST(dns_resolver, coalesce) {
+  fake_lookup lookup;
+  lookup.delay = std::chrono::milliseconds(50);
+  dns_resolver resolver(4, std::chrono::seconds(60), std::chrono::seconds(10), 16, lookup);
+  boost::asio::io_service ios;
+  boost::asio::io_service::work work(ios);
+  auto done = 0;
+  auto callback = [&] (const boost::system::error_code& ec,
+                       const dns_resolver::address_list& addrs) {
+    EXPECT_FALSE(ec);
+    EXPECT_EQ(1u, addrs.size());
+    if (++done == 10) {
+      ios.stop();
+    }
+  };
+  for (auto i = 0; i < 10; ++i) {
+    resolver.resolve(ios, "example.com", callback);
+  }
+  ios.run();
+  EXPECT_EQ(1, *lookup.calls);
+  EXPECT_EQ(9u, resolver.stats().coalesced);
+}
+
+TEST(dns_resolver, parallel) {
+  // a slow name doesn't hold up the others
+  fake_lookup lookup;
+  lookup.delay = std::chrono::milliseconds(200);
+  dns_resolver resolver(4, std::chrono::seconds(60), std::chrono::seconds(10), 16, lookup);
+  boost::asio::io_service ios;
+  boost::asio::io_service::work work(ios);
+  auto done = 0;
+  auto begin = std::chrono::steady_clock::now();
+  for (auto i = 0; i < 4; ++i) {
+    resolver.resolve(ios, "host" + std::to_string(i),
+      [&] (const boost::system::error_code&, const dns_resolver::address_list&) {
+        if (++done == 4) {
+          ios.stop();
+        }
+      }
+    );
+  }
+  ios.run();
+  EXPECT_LT(std::chrono::steady_clock::now() - begin, std::chrono::milliseconds(700));
+  auto stats = resolver.stats();
+  EXPECT_EQ(4u, stats.lookups);
+  EXPECT_GE(stats.max_latency, std::chrono::milliseconds(200));
+}
+
+TEST(dns_resolver, system_lookup) {
+  dns_resolver::address_list addrs;
+  EXPECT_FALSE(dns_resolver::system_lookup("127.0.0.1", addrs));
+  ASSERT_EQ(1u, addrs.size());
+  EXPECT_EQ("127.0.0.1", addrs.front().to_string());
+}
+
+TEST(dns_resolver, bench) {
+  fake_lookup lookup;
+  lookup.delay = std::chrono::milliseconds(20);
+  dns_resolver resolver(4, std::chrono::seconds(60), std::chrono::seconds(10), 64, lookup);
+  boost::asio::io_service ios;
+  boost::asio::io_service::work work(ios);
+  // a handful of names make up most of the requests
+  const size_t requests = 10000;
+  size_t done = 0;
+  auto callback = [&] (const boost::system::error_code&, const dns_resolver::address_list&) {
+    if (++done == requests) {
+      ios.stop();
+    }
+  };
+  auto begin = std::chrono::steady_clock::now();
+  for (size_t i = 0; i < requests; ++i) {
+    resolver.resolve(ios, "host" + std::to_string(i % 8), callback);
+    if (i % 100 == 99) {
+      ios.poll();
+    }
+  }
+  ios.run();
+  auto elapsed = std::chrono::steady_clock::now() - begin;
+  auto stats = resolver.stats();
+  EXPECT_EQ(8, *lookup.calls);
+  std::cout << "[dns_resolver bench] " << requests << " requests for 8 names: "
+    << stats.hits << " hits, " << stats.coalesced << " coalesced, "
+    << stats.misses << " lookups, "
+    << std::chrono::duration<double, std::milli>(elapsed).count() << " ms"
+    << " (uncached: " << requests * lookup.delay.count() << " ms)" << std::endl;
+}
@@ -17,17 +17,32 @@
 #include "test_util.hpp"
 #include "gate_service.cpp"
 #include "gate_session.cpp"
-#include "deadline_timer.cpp"
+#include "timer_wheel.cpp"
+#include "dns_resolver.cpp"
+#include "happy_eyeballs.cpp"
 #include "aes_cfb128_encryptor.cpp"
 #include "zlib_encryptor.cpp"
+#include "codec.cpp"
+#include "lz4_codec.cpp"
+#include "zstd_codec.cpp"
+#include "cipher_pipeline.cpp"
+#include "pipeline_encryptor.cpp"
+#include "aead_encryptor.cpp"
+#include "buffer_pool.cpp"
+#include "splice_relay.cpp"
+#include "flow_reader.cpp"
+#include "receive_sizer.cpp"
+#include "reuse_port_acceptor.cpp"
 #include "logger_ostream.cpp"
 #include "logger.cpp"
 #include <sys/socket.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
+#include <thread>
 
 TEST_F(echo_test, gate_echo) {
-  auto gate = caf::io::spawn_io(ranger::proxy::gate_service_impl, 300, std::string());
+  auto gate = caf::io::spawn_io(ranger::proxy::gate_service_impl,
+                                ranger::proxy::session_timeouts(), false, false, std::string());
   scope_guard guard_gate([gate] {
     caf::anon_send_exit(gate, caf::exit_reason::kill);
   });
@@ -36,7 +51,7 @@ TEST_F(echo_test, gate_echo) {
   {
     std::vector<uint8_t> key;
     caf::scoped_actor self;
-    self->send(gate, caf::add_atom::value, "127.0.0.1", m_port, key, false);
+    self->send(gate, caf::add_atom::value, "127.0.0.1", m_port, key, std::string(), std::string());
     self->sync_send(gate, caf::publish_atom::value, port).await(
       [&port] (caf::ok_atom, uint16_t gate_port) {
         port = gate_port;
@@ -66,7 +81,8 @@ TEST_F(echo_test, gate_echo) {
 }
 
 TEST_F(echo_test, gate_chain_echo) {
-  auto gate = caf::io::spawn_io(ranger::proxy::gate_service_impl, 300, std::string());
+  auto gate = caf::io::spawn_io(ranger::proxy::gate_service_impl,
+                                ranger::proxy::session_timeouts(), false, false, std::string());
   scope_guard guard_gate([gate] {
     caf::anon_send_exit(gate, caf::exit_reason::kill);
   });
@@ -75,7 +91,7 @@ TEST_F(echo_test, gate_chain_echo) {
   {
     std::vector<uint8_t> key;
     caf::scoped_actor self;
-    self->send(gate, caf::add_atom::value, "127.0.0.1", m_port, key, false);
+    self->send(gate, caf::add_atom::value, "127.0.0.1", m_port, key, std::string(), std::string());
     self->sync_send(gate, caf::publish_atom::value, static_cast<uint16_t>(0)).await(
       [&port] (caf::ok_atom, uint16_t gate_port) {
         port = gate_port;
@@ -87,7 +103,8 @@ TEST_F(echo_test, gate_chain_echo) {
   }
   ASSERT_NE(0, port);
 
-  auto gate2 = caf::io::spawn_io(ranger::proxy::gate_service_impl, 300, std::string());
+  auto gate2 = caf::io::spawn_io(ranger::proxy::gate_service_impl,
+                                 ranger::proxy::session_timeouts(), false, false, std::string());
   scope_guard guard_gate2([gate2] {
     caf::anon_send_exit(gate2, caf::exit_reason::kill);
   });
@@ -95,7 +112,7 @@ TEST_F(echo_test, gate_chain_echo) {
   {
     std::vector<uint8_t> key;
     caf::scoped_actor self;
-    self->send(gate2, caf::add_atom::value, "127.0.0.1", port, key, false);
+    self->send(gate2, caf::add_atom::value, "127.0.0.1", port, key, std::string(), std::string());
     self->sync_send(gate2, caf::publish_atom::value, static_cast<uint16_t>(0)).await(
       [&port] (caf::ok_atom, uint16_t gate_port) {
         port = gate_port;
@@ -124,8 +141,59 @@ TEST_F(echo_test, gate_chain_echo) {
   EXPECT_STREQ("Hello, world!", buf);
 }
 
+TEST_F(echo_test, gate_receive_size) {
+  auto gate = caf::io::spawn_io(ranger::proxy::gate_service_impl,
+                                ranger::proxy::session_timeouts(), false, false, std::string());
+  scope_guard guard_gate([gate] {
+    caf::anon_send_exit(gate, caf::exit_reason::kill);
+  });
+
+  uint16_t port = 0;
+  {
+    std::vector<uint8_t> key;
+    caf::scoped_actor self;
+    self->send(gate, caf::add_atom::value, "127.0.0.1", m_port, key, std::string(), std::string());
+    self->sync_send(gate, caf::publish_atom::value, static_cast<uint16_t>(0),
+                    std::string("8k:4k")).await(
+      [] (caf::ok_atom, uint16_t) {
+        ADD_FAILURE() << "published with an invalid receive size";
+      },
+      [] (caf::error_atom, const std::string&) {
+        // nop
+      }
+    );
+    self->sync_send(gate, caf::publish_atom::value, static_cast<uint16_t>(0),
+                    std::string("1k:64k")).await(
+      [&port] (caf::ok_atom, uint16_t gate_port) {
+        port = gate_port;
+      },
+      [] (caf::error_atom, const std::string& what) {
+        std::cout << "ERROR: " << what << std::endl;
+      }
+    );
+  }
+  ASSERT_NE(0, port);
+
+  int fd = socket(AF_INET, SOCK_STREAM, 0);
+  ASSERT_NE(-1, fd);
+  scope_guard guard_fd([fd] { close(fd); });
+
+  sockaddr_in sin = {0};
+  sin.sin_family = AF_INET;
+  sin.sin_addr.s_addr = inet_addr("127.0.0.1");
+  sin.sin_port = htons(port);
+  ASSERT_EQ(0, connect(fd, reinterpret_cast<sockaddr*>(&sin), sizeof(sin)));
+
+  char buf[] = "Hello, world!";
+  ASSERT_EQ(sizeof(buf), send(fd, buf, sizeof(buf), 0));
+  memset(buf, 0, sizeof(buf));
+  ASSERT_EQ(sizeof(buf), recv(fd, buf, sizeof(buf), 0));
+  EXPECT_STREQ("Hello, world!", buf);
+}
+
 TEST_F(ranger_proxy_test, gate_null) {
-  auto gate = caf::io::spawn_io(ranger::proxy::gate_service_impl, 300, std::string());
+  auto gate = caf::io::spawn_io(ranger::proxy::gate_service_impl,
+                                ranger::proxy::session_timeouts(), false, false, std::string());
   scope_guard guard_gate([gate] {
     caf::anon_send_exit(gate, caf::exit_reason::kill);
   });
@@ -134,7 +202,7 @@ TEST_F(ranger_proxy_test, gate_null) {
   {
     std::vector<uint8_t> key;
     caf::scoped_actor self;
-    self->send(gate, caf::add_atom::value, "127.0.0.1", static_cast<uint16_t>(0x7FFF), key, false);
+    self->send(gate, caf::add_atom::value, "127.0.0.1", static_cast<uint16_t>(0x7FFF), key, std::string(), std::string());
     self->sync_send(gate, caf::publish_atom::value, port).await(
       [&port] (caf::ok_atom, uint16_t gate_port) {
         port = gate_port;
@@ -160,3 +228,56 @@ TEST_F(ranger_proxy_test, gate_null) {
 
   caf::detail::singletons::get_actor_registry()->await_running_count_equal(1);
 }
+
+TEST_F(ranger_proxy_test, splice_relay) {
+  if (!ranger::proxy::splice_relay::supported()) {
+    return;
+  }
+
+  int local[2];
+  ASSERT_EQ(0, socketpair(AF_UNIX, SOCK_STREAM, 0, local));
+  scope_guard guard_local([&local] { close(local[0]); });
+  int remote[2];
+  ASSERT_EQ(0, socketpair(AF_UNIX, SOCK_STREAM, 0, remote));
+  scope_guard guard_remote([&remote] { close(remote[0]); });
+
+  boost::asio::io_service ios;
+  auto relay =
+    std::make_shared<ranger::proxy::splice_relay>(ios, local[1], remote[1],
+                                                  300, 64 * 1024);
+  ranger::proxy::relay_counters counters;
+  bool finished = false;
+  relay->start([&] (const ranger::proxy::relay_counters& result) {
+    counters = result;
+    finished = true;
+  });
+
+  std::vector<char> plain(1024 * 1024, 'a');
+  std::thread client([&] {
+    char reply[] = "Hello, world!";
+    ASSERT_EQ(sizeof(reply), send(remote[0], reply, sizeof(reply), 0));
+    memset(reply, 0, sizeof(reply));
+    ASSERT_EQ(sizeof(reply), recv(local[0], reply, sizeof(reply), MSG_WAITALL));
+    EXPECT_STREQ("Hello, world!", reply);
+
+    ASSERT_EQ(plain.size(), send(local[0], plain.data(), plain.size(), 0));
+    shutdown(local[0], SHUT_WR);
+  });
+
+  std::vector<char> received(plain.size());
+  std::thread server([&] {
+    ASSERT_EQ(received.size(),
+              recv(remote[0], received.data(), received.size(), MSG_WAITALL));
+  });
+
+  ios.run();
+  client.join();
+  server.join();
+
+  EXPECT_TRUE(finished);
+  EXPECT_EQ(plain, received);
+  EXPECT_EQ(plain.size(), counters.local_recv);
+  EXPECT_EQ(plain.size(), counters.remote_send);
+  EXPECT_EQ(sizeof("Hello, world!"), counters.remote_recv);
+  EXPECT_EQ(sizeof("Hello, world!"), counters.local_send);
+}
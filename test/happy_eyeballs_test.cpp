@@ -0,0 +1,167 @@
+// ranger_proxy - A SOCKS5 proxy
+// Copyright (C) 2015  RangerUFO <ufownl@gmail.com>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include <gtest/gtest.h>
+#include "happy_eyeballs.cpp"
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+
+namespace {
+
+using ranger::proxy::happy_eyeballs;
+using boost::asio::ip::tcp;
+using boost::asio::ip::address;
+
+tcp::endpoint make_endpoint(const char* addr, uint16_t port) {
+  return tcp::endpoint(address::from_string(addr), port);
+}
+
+// a listener whose accept queue is full drops further SYNs, so connects
+// to it hang like those to a dead host
+struct dead_listener {
+  dead_listener() {
+    fd = socket(AF_INET, SOCK_STREAM, 0);
+    sockaddr_in sin = {0};
+    sin.sin_family = AF_INET;
+    sin.sin_addr.s_addr = inet_addr("127.0.0.1");
+    bind(fd, reinterpret_cast<sockaddr*>(&sin), sizeof(sin));
+    listen(fd, 0);
+    socklen_t len = sizeof(sin);
+    getsockname(fd, reinterpret_cast<sockaddr*>(&sin), &len);
+    port = ntohs(sin.sin_port);
+    for (auto& c : clients) {
+      c = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+      connect(c, reinterpret_cast<sockaddr*>(&sin), sizeof(sin));
+    }
+  }
+
+  ~dead_listener() {
+    for (auto c : clients) {
+      close(c);
+    }
+    close(fd);
+  }
+
+  int fd;
+  int clients[4];
+  uint16_t port;
+};
+
+struct result {
+  boost::system::error_code ec;
+  tcp::endpoint remote;
+  std::chrono::steady_clock::duration elapsed;
+};
+
+result race(const std::vector<tcp::endpoint>& eps, std::chrono::milliseconds delay) {
+  boost::asio::io_service ios;
+  result res;
+  auto begin = std::chrono::steady_clock::now();
+  std::make_shared<happy_eyeballs>(ios, eps, delay)->start(
+    [&] (const boost::system::error_code& ec, tcp::socket sock) {
+      res.ec = ec;
+      res.elapsed = std::chrono::steady_clock::now() - begin;
+      if (!ec) {
+        res.remote = sock.remote_endpoint();
+      }
+    }
+  );
+  ios.run();
+  return res;
+}
+
+}
+
+TEST(happy_eyeballs, interleave) {
+  auto res = happy_eyeballs::interleave({
+    make_endpoint("2001:db8::1", 80),
+    make_endpoint("2001:db8::2", 80),
+    make_endpoint("2001:db8::3", 80),
+    make_endpoint("192.0.2.1", 80),
+  });
+  ASSERT_EQ(4u, res.size());
+  EXPECT_EQ(make_endpoint("2001:db8::1", 80), res[0]);
+  EXPECT_EQ(make_endpoint("192.0.2.1", 80), res[1]);
+  EXPECT_EQ(make_endpoint("2001:db8::2", 80), res[2]);
+  EXPECT_EQ(make_endpoint("2001:db8::3", 80), res[3]);
+
+  res = happy_eyeballs::interleave({
+    make_endpoint("192.0.2.1", 80),
+    make_endpoint("192.0.2.2", 80),
+    make_endpoint("2001:db8::1", 80),
+  });
+  EXPECT_EQ(make_endpoint("192.0.2.1", 80), res[0]);
+  EXPECT_EQ(make_endpoint("2001:db8::1", 80), res[1]);
+  EXPECT_EQ(make_endpoint("192.0.2.2", 80), res[2]);
+  EXPECT_TRUE(happy_eyeballs::interleave({}).empty());
+}
+
+TEST(happy_eyeballs, connect) {
+  boost::asio::io_service ios;
+  tcp::acceptor acceptor(ios, make_endpoint("127.0.0.1", 0));
+  auto res = race({acceptor.local_endpoint()}, std::chrono::milliseconds(250));
+  EXPECT_FALSE(res.ec);
+  EXPECT_EQ(acceptor.local_endpoint(), res.remote);
+}
+
+TEST(happy_eyeballs, skip_dead_endpoint) {
+  boost::asio::io_service ios;
+  tcp::acceptor acceptor(ios, make_endpoint("127.0.0.1", 0));
+  dead_listener dead;
+  auto res = race({make_endpoint("127.0.0.1", dead.port), acceptor.local_endpoint()},
+                  std::chrono::milliseconds(100));
+  EXPECT_FALSE(res.ec);
+  EXPECT_EQ(acceptor.local_endpoint(), res.remote);
+  // the dead endpoint costs one delay instead of the connect timeout
+  EXPECT_GE(res.elapsed, std::chrono::milliseconds(100));
+  EXPECT_LT(res.elapsed, std::chrono::seconds(1));
+}
+
+TEST(happy_eyeballs, skip_refused_endpoint) {
+  uint16_t closed_port = 0;
+  {
+    boost::asio::io_service ios;
+    tcp::acceptor acceptor(ios, make_endpoint("127.0.0.1", 0));
+    closed_port = acceptor.local_endpoint().port();
+  }
+
+  boost::asio::io_service ios;
+  tcp::acceptor acceptor(ios, make_endpoint("127.0.0.1", 0));
+  auto res = race({make_endpoint("127.0.0.1", closed_port), acceptor.local_endpoint()},
+                  std::chrono::seconds(10));
+  EXPECT_FALSE(res.ec);
+  EXPECT_EQ(acceptor.local_endpoint(), res.remote);
+  // a refused attempt starts the next one right away
+  EXPECT_LT(res.elapsed, std::chrono::seconds(1));
+}
+
+TEST(happy_eyeballs, all_failed) {
+  uint16_t closed_port = 0;
+  {
+    boost::asio::io_service ios;
+    tcp::acceptor acceptor(ios, make_endpoint("127.0.0.1", 0));
+    closed_port = acceptor.local_endpoint().port();
+  }
+
+  auto res = race({make_endpoint("127.0.0.1", closed_port),
+                   make_endpoint("127.0.0.1", closed_port)},
+                  std::chrono::milliseconds(250));
+  EXPECT_EQ(boost::asio::error::connection_refused, res.ec);
+  EXPECT_EQ(boost::asio::error::host_not_found,
+            race({}, std::chrono::milliseconds(250)).ec);
+}
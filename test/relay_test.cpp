@@ -0,0 +1,172 @@
+// ranger_proxy - A SOCKS5 proxy
+// Copyright (C) 2015  RangerUFO <ufownl@gmail.com>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include <gtest/gtest.h>
+#include "relay_buffer.hpp"
+#include "flow_control.hpp"
+#include "receive_sizer.cpp"
+#include <chrono>
+#include <iostream>
+#include <string.h>
+
+namespace {
+
+const size_t chunk_size = 16 * 1024;
+const size_t total_size = 64 * 1024 * 1024;
+
+struct relay_result {
+  size_t relayed {0};
+  size_t copied {0};
+  double seconds {0};
+};
+
+// Simulates a scribe read loop feeding a peer that drains its write buffer
+// every drain_interval chunks. The Relay functor moves one chunk into the
+// peer's write buffer and returns the number of bytes it copied.
+template <class Relay>
+relay_result simulate_relay(size_t drain_interval, Relay relay) {
+  relay_result res;
+  std::vector<char> rd_buf;
+  std::vector<char> wr_buf;
+  std::vector<char> wr_offline_buf;
+  auto begin = std::chrono::steady_clock::now();
+  for (size_t i = 0; res.relayed < total_size; ++i) {
+    rd_buf.resize(chunk_size);
+    memset(rd_buf.data(), static_cast<int>(i), rd_buf.size());
+    res.relayed += rd_buf.size();
+    res.copied += relay(wr_buf, rd_buf);
+    if ((i + 1) % drain_interval == 0) {
+      wr_offline_buf.swap(wr_buf);
+      wr_offline_buf.clear();
+    }
+  }
+  auto end = std::chrono::steady_clock::now();
+  res.seconds = std::chrono::duration<double>(end - begin).count();
+  return res;
+}
+
+// The previous relay path: new_data_msg::buf passed by value into
+// write_raw, then moved or appended into the write buffer.
+size_t copy_relay(std::vector<char>& wr_buf, std::vector<char>& rd_buf) {
+  std::vector<char> buf = rd_buf;
+  size_t copied = buf.size();
+  if (wr_buf.empty()) {
+    wr_buf = std::move(buf);
+  } else {
+    wr_buf.insert(wr_buf.end(), buf.begin(), buf.end());
+    copied += buf.size();
+  }
+  return copied;
+}
+
+void report(const char* name, size_t drain_interval, const relay_result& res) {
+  std::cout << "[relay bench] " << name
+    << " (drain every " << drain_interval << " chunk(s)): "
+    << static_cast<double>(res.copied) / res.relayed << " bytes copied per relayed byte, "
+    << res.relayed / res.seconds / (1024 * 1024) << " MB/s" << std::endl;
+}
+
+}
+
+TEST(relay_buffer, swap_into_drained_buffer) {
+  std::vector<char> wr_buf;
+  wr_buf.reserve(64);
+  auto capacity = wr_buf.capacity();
+  std::vector<char> buf = {'a', 'b', 'c'};
+  EXPECT_EQ(0, ranger::proxy::relay_buffer(wr_buf, buf));
+  EXPECT_EQ(std::vector<char>({'a', 'b', 'c'}), wr_buf);
+  EXPECT_TRUE(buf.empty());
+  EXPECT_EQ(capacity, buf.capacity());
+}
+
+TEST(relay_buffer, append_to_pending_buffer) {
+  std::vector<char> wr_buf = {'a'};
+  std::vector<char> buf = {'b', 'c'};
+  EXPECT_EQ(2, ranger::proxy::relay_buffer(wr_buf, buf));
+  EXPECT_EQ(std::vector<char>({'a', 'b', 'c'}), wr_buf);
+  EXPECT_TRUE(buf.empty());
+}
+
+TEST(flow_control, watermarks) {
+  ranger::proxy::flow_control flow(100, 10);
+  EXPECT_TRUE(flow.update(0));
+  EXPECT_TRUE(flow.update(100));
+  EXPECT_FALSE(flow.update(101));
+  EXPECT_TRUE(flow.paused());
+  // stays paused until the queue drained to the low watermark
+  EXPECT_FALSE(flow.update(50));
+  EXPECT_FALSE(flow.update(11));
+  EXPECT_TRUE(flow.update(10));
+  EXPECT_FALSE(flow.paused());
+  EXPECT_TRUE(flow.update(50));
+}
+
+TEST(receive_sizer, parse) {
+  ranger::proxy::receive_spec spec;
+  ASSERT_TRUE(ranger::proxy::parse_receive_spec("", spec));
+  EXPECT_EQ(ranger::proxy::MIN_RECEIVE_SIZE, spec.min_size);
+  EXPECT_EQ(ranger::proxy::BUFFER_SIZE, spec.max_size);
+  ASSERT_TRUE(ranger::proxy::parse_receive_spec("2k:1m", spec));
+  EXPECT_EQ(2048u, spec.min_size);
+  EXPECT_EQ(1024u * 1024, spec.max_size);
+  ASSERT_TRUE(ranger::proxy::parse_receive_spec("16384", spec));
+  EXPECT_EQ(16384u, spec.min_size);
+  EXPECT_EQ(16384u, spec.max_size);
+  EXPECT_FALSE(ranger::proxy::parse_receive_spec("8k:4k", spec));
+  EXPECT_FALSE(ranger::proxy::parse_receive_spec("0", spec));
+  EXPECT_FALSE(ranger::proxy::parse_receive_spec("4x", spec));
+  EXPECT_FALSE(ranger::proxy::parse_receive_spec(":4k", spec));
+}
+
+TEST(receive_sizer, grow_and_shrink) {
+  ranger::proxy::receive_sizer sizer({1024, 8192});
+  EXPECT_EQ(1024u, sizer.size());
+  // full reads double the size up to the maximum
+  EXPECT_TRUE(sizer.update(1024));
+  EXPECT_TRUE(sizer.update(2048));
+  EXPECT_TRUE(sizer.update(4096));
+  EXPECT_FALSE(sizer.update(8192));
+  EXPECT_EQ(8192u, sizer.size());
+
+  // a run of short reads halves it, a longer read breaks the run
+  for (auto i = 0; i < 7; ++i) {
+    EXPECT_FALSE(sizer.update(100));
+  }
+  EXPECT_FALSE(sizer.update(5000));
+  for (auto i = 0; i < 7; ++i) {
+    EXPECT_FALSE(sizer.update(100));
+  }
+  EXPECT_TRUE(sizer.update(100));
+  EXPECT_EQ(4096u, sizer.size());
+
+  for (auto i = 0; i < 100; ++i) {
+    sizer.update(0);
+  }
+  EXPECT_EQ(1024u, sizer.size());
+}
+
+TEST(relay_buffer, bench) {
+  for (size_t drain_interval : {1, 4}) {
+    auto copy_res = simulate_relay(drain_interval, copy_relay);
+    report("copy", drain_interval, copy_res);
+    auto swap_res = simulate_relay(drain_interval, ranger::proxy::relay_buffer);
+    report("swap", drain_interval, swap_res);
+    EXPECT_LT(swap_res.copied, copy_res.copied);
+    if (drain_interval == 1) {
+      EXPECT_EQ(0, swap_res.copied);
+    }
+  }
+}
@@ -0,0 +1,88 @@
+// ranger_proxy - A SOCKS5 proxy
+// Copyright (C) 2015  RangerUFO <ufownl@gmail.com>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+#include <gtest/gtest.h>
+#include "reuse_port_acceptor.cpp"
+#include <arpa/inet.h>
+#include <poll.h>
+
+using namespace ranger::proxy;
+
+namespace {
+
+uint16_t local_port(int fd) {
+  sockaddr_storage ss;
+  socklen_t len = sizeof(ss);
+  getsockname(fd, reinterpret_cast<sockaddr*>(&ss), &len);
+  if (ss.ss_family == AF_INET6) {
+    return ntohs(reinterpret_cast<sockaddr_in6*>(&ss)->sin6_port);
+  }
+  return ntohs(reinterpret_cast<sockaddr_in*>(&ss)->sin_port);
+}
+
+}
+
+TEST(reuse_port_acceptor, share_port) {
+  auto fd1 = new_reuse_port_acceptor("127.0.0.1", 0);
+  auto port = local_port(fd1);
+  ASSERT_NE(0, port);
+  auto fd2 = new_reuse_port_acceptor("127.0.0.1", port);
+  EXPECT_EQ(port, local_port(fd2));
+
+  // every connection goes to one of the two listeners
+  const int count = 32;
+  std::vector<int> clients;
+  for (auto i = 0; i < count; ++i) {
+    auto fd = socket(AF_INET, SOCK_STREAM, 0);
+    ASSERT_NE(-1, fd);
+    clients.push_back(fd);
+    sockaddr_in sin = {0};
+    sin.sin_family = AF_INET;
+    sin.sin_addr.s_addr = inet_addr("127.0.0.1");
+    sin.sin_port = htons(port);
+    ASSERT_EQ(0, connect(fd, reinterpret_cast<sockaddr*>(&sin), sizeof(sin)));
+  }
+
+  auto accepted = 0;
+  pollfd fds[] = {{fd1, POLLIN, 0}, {fd2, POLLIN, 0}};
+  while (accepted < count && poll(fds, 2, 1000) > 0) {
+    for (auto& i : fds) {
+      if (i.revents & POLLIN) {
+        auto fd = accept(i.fd, nullptr, nullptr);
+        ASSERT_NE(-1, fd);
+        close(fd);
+        ++accepted;
+      }
+    }
+  }
+  EXPECT_EQ(count, accepted);
+
+  for (auto fd : clients) {
+    close(fd);
+  }
+  close(fd1);
+  close(fd2);
+}
+
+TEST(reuse_port_acceptor, any_address) {
+  auto fd = new_reuse_port_acceptor(nullptr, 0);
+  EXPECT_NE(0, local_port(fd));
+  close(fd);
+}
+
+TEST(reuse_port_acceptor, invalid_host) {
+  EXPECT_THROW(new_reuse_port_acceptor("no.such.host.invalid", 1080), network_error);
+  EXPECT_THROW(new_reuse_port_acceptor("256.0.0.1", 1080), network_error);
+}
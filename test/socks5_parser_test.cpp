@@ -0,0 +1,265 @@
+// ranger_proxy - A SOCKS5 proxy
+// Copyright (C) 2015  RangerUFO <ufownl@gmail.com>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include <gtest/gtest.h>
+#include "socks5_parser.cpp"
+#include "unpacker.hpp"
+#include "buffer_pool.cpp"
+#include <chrono>
+#include <functional>
+#include <iostream>
+#include <random>
+#include <string>
+
+namespace {
+
+using ranger::proxy::socks5_parser;
+
+// what a parser reported, to compare runs over differently split input
+struct outcome {
+  std::vector<socks5_parser::event> events;
+  socks5_parser::error_code reason {socks5_parser::no_error};
+  std::string username;
+  std::string password;
+  uint8_t command {0};
+  uint8_t address_type {0};
+  std::string address;
+  uint16_t port {0};
+  size_t used {0};
+
+  bool operator == (const outcome& other) const {
+    return events == other.events && reason == other.reason
+      && username == other.username && password == other.password
+      && command == other.command && address_type == other.address_type
+      && address == other.address && port == other.port && used == other.used;
+  }
+};
+
+// feeds the input in pieces of the given sizes, the server picks
+// USERNAME/PASSWORD if the client offers it
+outcome run(const std::string& input, const std::vector<size_t>& pieces) {
+  socks5_parser parser;
+  outcome res;
+  size_t pos = 0;
+  for (size_t i = 0; pos < input.size() && !parser.done(); ++i) {
+    auto len = std::min(pieces[i % pieces.size()], input.size() - pos);
+    auto data = input.data() + pos;
+    pos += len;
+    while (len > 0 && !parser.done()) {
+      size_t used = 0;
+      auto ev = parser.parse(data, len, used);
+      EXPECT_LE(used, len);
+      res.used += used;
+      data += used;
+      len -= used;
+      if (ev == socks5_parser::need_more) {
+        EXPECT_EQ(0, len);
+        continue;
+      }
+
+      res.events.push_back(ev);
+      if (ev == socks5_parser::greeting) {
+        parser.select_method(parser.offers(0x02) ? 0x02 : 0x00);
+      } else if (ev == socks5_parser::auth) {
+        res.username.assign(parser.username(), parser.username_size());
+        res.password.assign(parser.password(), parser.password_size());
+      } else if (ev == socks5_parser::request) {
+        res.command = parser.command();
+        res.address_type = parser.address_type();
+        res.address.assign(parser.address(), parser.address_size());
+        res.port = parser.port();
+      }
+    }
+  }
+  res.reason = parser.reason();
+  return res;
+}
+
+const std::string connect_ipv4 =
+  std::string("\x05\x01\x00", 3) + std::string("\x05\x01\x00\x01\x7F\x00\x00\x01\x1F\x90", 10);
+
+const std::string auth_connect_domainname =
+  std::string("\x05\x02\x00\x02", 4)
+  + std::string("\x01\x06", 2) + "ranger" + std::string("\x05", 1) + "proxy"
+  + std::string("\x05\x01\x00\x03\x0B", 5) + "example.com" + std::string("\x00\x50", 2);
+}
+
+TEST(socks5_parser, connect_ipv4) {
+  auto res = run(connect_ipv4, {connect_ipv4.size()});
+  std::vector<socks5_parser::event> events = {socks5_parser::greeting, socks5_parser::request};
+  EXPECT_EQ(events, res.events);
+  EXPECT_EQ(0x01, res.command);
+  EXPECT_EQ(0x01, res.address_type);
+  EXPECT_EQ(std::string("\x7F\x00\x00\x01", 4), res.address);
+  EXPECT_EQ(8080, res.port);
+  EXPECT_EQ(connect_ipv4.size(), res.used);
+}
+
+TEST(socks5_parser, auth_connect_domainname) {
+  auto res = run(auth_connect_domainname, {auth_connect_domainname.size()});
+  std::vector<socks5_parser::event> events = {
+    socks5_parser::greeting, socks5_parser::auth, socks5_parser::request
+  };
+  EXPECT_EQ(events, res.events);
+  EXPECT_EQ("ranger", res.username);
+  EXPECT_EQ("proxy", res.password);
+  EXPECT_EQ(0x03, res.address_type);
+  EXPECT_EQ("example.com", res.address);
+  EXPECT_EQ(80, res.port);
+}
+
+TEST(socks5_parser, empty_password_ipv6) {
+  auto input = std::string("\x05\x01\x02\x01\x01u\x00", 7)
+    + std::string("\x05\x03\x00\x04", 4) + std::string(15, '\x00') + std::string("\x01\x00\x35", 3);
+  auto res = run(input, {input.size()});
+  EXPECT_EQ(3, res.events.size());
+  EXPECT_EQ("u", res.username);
+  EXPECT_EQ("", res.password);
+  EXPECT_EQ(0x03, res.command);
+  EXPECT_EQ(0x04, res.address_type);
+  EXPECT_EQ(16, res.address.size());
+  EXPECT_EQ(53, res.port);
+}
+
+TEST(socks5_parser, split) {
+  // every split into two pieces, and byte by byte
+  for (auto& input : {connect_ipv4, auth_connect_domainname}) {
+    auto whole = run(input, {input.size()});
+    for (size_t i = 1; i < input.size(); ++i) {
+      EXPECT_EQ(whole, run(input, {i, input.size()}));
+    }
+    EXPECT_EQ(whole, run(input, {1}));
+  }
+}
+
+TEST(socks5_parser, errors) {
+  EXPECT_EQ(socks5_parser::version_mismatch, run(std::string("\x04\x01\x00", 3), {3}).reason);
+  EXPECT_EQ(socks5_parser::no_methods, run(std::string("\x05\x00", 2), {2}).reason);
+  EXPECT_EQ(socks5_parser::version_mismatch,
+            run(std::string("\x05\x01\x02\x05\x01u\x00", 7), {7}).reason);
+  EXPECT_EQ(socks5_parser::empty_username,
+            run(std::string("\x05\x01\x02\x01\x00", 5), {5}).reason);
+  EXPECT_EQ(socks5_parser::command_not_supported,
+            run(std::string("\x05\x01\x00\x05\x04\x00\x01", 7), {7}).reason);
+  EXPECT_EQ(socks5_parser::address_type_not_supported,
+            run(std::string("\x05\x01\x00\x05\x01\x00\x02", 7), {7}).reason);
+
+  // nothing is used past the failing byte
+  auto res = run(std::string("\x05\x00\x05\x01", 4), {4});
+  EXPECT_EQ(2, res.used);
+}
+
+TEST(socks5_parser, fuzz) {
+  // mutated and random handshakes fed in random pieces parse the same
+  // as in one piece, never read past the input and stop at the request
+  std::minstd_rand rd(20160301);
+  const std::string seeds[] = {connect_ipv4, auth_connect_domainname};
+  for (auto i = 0; i < 20000; ++i) {
+    std::string input;
+    if (i % 4 == 0) {
+      input.resize(rd() % 64);
+      for (auto& c : input) {
+        c = static_cast<char>(rd());
+      }
+    } else {
+      input = seeds[i % 2];
+      for (auto n = rd() % 4; n > 0; --n) {
+        input[rd() % input.size()] = static_cast<char>(rd());
+      }
+      input.resize(rd() % (input.size() + 8), '\x01');
+    }
+
+    std::vector<size_t> pieces;
+    for (auto n = rd() % 8 + 1; n > 0; --n) {
+      pieces.push_back(rd() % 7 + 1);
+    }
+    auto whole = run(input, {std::max<size_t>(input.size(), 1)});
+    ASSERT_EQ(whole, run(input, pieces));
+    ASSERT_LE(whole.used, input.size());
+  }
+}
+
+TEST(socks5_parser, bench) {
+  // the handshake of a client with credentials, as the session saw it
+  // before with an unpacker and a callback per field
+  const size_t handshakes = 200000;
+  auto input = auth_connect_domainname;
+  size_t requests = 0;
+  auto begin = std::chrono::steady_clock::now();
+  for (size_t i = 0; i < handshakes; ++i) {
+    socks5_parser parser;
+    auto data = input.data();
+    auto len = input.size();
+    while (len > 0 && !parser.done()) {
+      size_t used = 0;
+      auto ev = parser.parse(data, len, used);
+      data += used;
+      len -= used;
+      if (ev == socks5_parser::greeting) {
+        parser.select_method(0x02);
+      } else if (ev == socks5_parser::request) {
+        ++requests;
+      }
+    }
+  }
+  auto parser_elapsed = std::chrono::steady_clock::now() - begin;
+  EXPECT_EQ(handshakes, requests);
+
+  requests = 0;
+  begin = std::chrono::steady_clock::now();
+  for (size_t i = 0; i < handshakes; ++i) {
+    ranger::proxy::unpacker<uint8_t> unpacker;
+    std::function<bool(std::vector<char>)> request = [&] (std::vector<char>) {
+      unpacker.expect(1, [&] (std::vector<char> buf) {
+        unpacker.expect(static_cast<uint8_t>(buf[0]) + 2, [&] (std::vector<char> buf) {
+          std::string host(buf.begin(), buf.end() - 2);
+          ++requests;
+          return true;
+        });
+        return true;
+      });
+      return true;
+    };
+    unpacker.expect(2, [&] (std::vector<char> buf) {
+      unpacker.expect(buf[1], [&] (std::vector<char>) {
+        unpacker.expect(2, [&] (std::vector<char> buf) {
+          unpacker.expect(buf[1] + 1, [&] (std::vector<char> buf) {
+            std::string username(buf.begin(), buf.end() - 1);
+            unpacker.expect(buf.back(), [&, username] (std::vector<char> buf) {
+              std::string password(buf.begin(), buf.end());
+              unpacker.expect(4, request);
+              return true;
+            });
+            return true;
+          });
+          return true;
+        });
+        return true;
+      });
+      return true;
+    });
+    unpacker.append(std::vector<char>(input.begin(), input.end()));
+  }
+  auto unpacker_elapsed = std::chrono::steady_clock::now() - begin;
+  EXPECT_EQ(handshakes, requests);
+
+  auto rate = [] (size_t n, std::chrono::steady_clock::duration d) {
+    return static_cast<uint64_t>(n / std::chrono::duration<double>(d).count());
+  };
+  std::cout << "[socks5_parser bench] " << handshakes << " handshakes with credentials: parser "
+    << rate(handshakes, parser_elapsed) << "/s, unpacker "
+    << rate(handshakes, unpacker_elapsed) << "/s" << std::endl;
+}
@@ -17,22 +17,45 @@
 #include "test_util.hpp"
 #include "socks5_service.cpp"
 #include "socks5_session.cpp"
+#include "socks5_parser.cpp"
 #include "gate_service.cpp"
 #include "gate_session.cpp"
-#include "deadline_timer.cpp"
+#include "timer_wheel.cpp"
+#include "dns_resolver.cpp"
+#include "happy_eyeballs.cpp"
 #include "user_table.cpp"
+#include "user_db.cpp"
 #include "aes_cfb128_encryptor.cpp"
 #include "zlib_encryptor.cpp"
+#include "codec.cpp"
+#include "lz4_codec.cpp"
+#include "zstd_codec.cpp"
+#include "cipher_pipeline.cpp"
+#include "pipeline_encryptor.cpp"
+#include "aead_encryptor.cpp"
+#include "buffer_pool.cpp"
+#include "splice_relay.cpp"
+#include "flow_reader.cpp"
+#include "receive_sizer.cpp"
+#include "token_bucket.cpp"
+#include "admission_control.cpp"
+#include "reuse_port_acceptor.cpp"
+#include "udp_relay.cpp"
 #include "logger_ostream.cpp"
 #include "logger.cpp"
 #include <sys/socket.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
 #include <thread>
+#include <chrono>
 #include <string.h>
 
 TEST_F(echo_test, socks5_no_auth_conn_ipv4) {
-  auto socks5 = caf::io::spawn_io(ranger::proxy::socks5_service_impl, 300, false, std::string());
+  auto socks5 = caf::io::spawn_io(ranger::proxy::socks5_service_impl,
+                                  ranger::proxy::session_timeouts(),
+                                  ranger::proxy::admission_limits(),
+                                  ranger::proxy::rate_spec(), ranger::proxy::rate_spec(),
+                                  false, false, std::string());
   scope_guard guard_socks5([socks5] {
     caf::anon_send_exit(socks5, caf::exit_reason::kill);
   });
@@ -41,7 +64,7 @@ TEST_F(echo_test, socks5_no_auth_conn_ipv4) {
   {
     caf::scoped_actor self;
     self->sync_send(socks5, caf::publish_atom::value, port,
-                    std::vector<uint8_t>(), false).await(
+                    std::vector<uint8_t>(), std::string(), std::string()).await(
       [&port] (caf::ok_atom, uint16_t socks5_port) {
         port = socks5_port;
       },
@@ -110,7 +133,11 @@ TEST_F(echo_test, socks5_no_auth_conn_ipv4) {
 }
 
 TEST_F(echo_test, socks5_no_auth_conn_domainname) {
-  auto socks5 = caf::io::spawn_io(ranger::proxy::socks5_service_impl, 300, false, std::string());
+  auto socks5 = caf::io::spawn_io(ranger::proxy::socks5_service_impl,
+                                  ranger::proxy::session_timeouts(),
+                                  ranger::proxy::admission_limits(),
+                                  ranger::proxy::rate_spec(), ranger::proxy::rate_spec(),
+                                  false, false, std::string());
   scope_guard guard_socks5([socks5] {
     caf::anon_send_exit(socks5, caf::exit_reason::kill);
   });
@@ -119,7 +146,7 @@ TEST_F(echo_test, socks5_no_auth_conn_domainname) {
   {
     caf::scoped_actor self;
     self->sync_send(socks5, caf::publish_atom::value, port,
-                    std::vector<uint8_t>(), false).await(
+                    std::vector<uint8_t>(), std::string(), std::string()).await(
       [&port] (caf::ok_atom, uint16_t socks5_port) {
         port = socks5_port;
       },
@@ -190,7 +217,11 @@ TEST_F(echo_test, socks5_no_auth_conn_domainname) {
 }
 
 TEST_F(ranger_proxy_test, socks5_no_auth_conn_ipv4_null) {
-  auto socks5 = caf::io::spawn_io(ranger::proxy::socks5_service_impl, 300, false, std::string());
+  auto socks5 = caf::io::spawn_io(ranger::proxy::socks5_service_impl,
+                                  ranger::proxy::session_timeouts(),
+                                  ranger::proxy::admission_limits(),
+                                  ranger::proxy::rate_spec(), ranger::proxy::rate_spec(),
+                                  false, false, std::string());
   scope_guard guard_socks5([socks5] {
     caf::anon_send_exit(socks5, caf::exit_reason::kill);
   });
@@ -199,7 +230,7 @@ TEST_F(ranger_proxy_test, socks5_no_auth_conn_ipv4_null) {
   {
     caf::scoped_actor self;
     self->sync_send(socks5, caf::publish_atom::value, port,
-                    std::vector<uint8_t>(), false).await(
+                    std::vector<uint8_t>(), std::string(), std::string()).await(
       [&port] (caf::ok_atom, uint16_t socks5_port) {
         port = socks5_port;
       },
@@ -261,7 +292,11 @@ TEST_F(ranger_proxy_test, socks5_no_auth_conn_ipv4_null) {
 }
 
 TEST_F(ranger_proxy_test, socks5_no_auth_conn_domainname_null) {
-  auto socks5 = caf::io::spawn_io(ranger::proxy::socks5_service_impl, 300, false, std::string());
+  auto socks5 = caf::io::spawn_io(ranger::proxy::socks5_service_impl,
+                                  ranger::proxy::session_timeouts(),
+                                  ranger::proxy::admission_limits(),
+                                  ranger::proxy::rate_spec(), ranger::proxy::rate_spec(),
+                                  false, false, std::string());
   scope_guard guard_socks5([socks5] {
     caf::anon_send_exit(socks5, caf::exit_reason::kill);
   });
@@ -270,7 +305,7 @@ TEST_F(ranger_proxy_test, socks5_no_auth_conn_domainname_null) {
   {
     caf::scoped_actor self;
     self->sync_send(socks5, caf::publish_atom::value, port,
-                    std::vector<uint8_t>(), false).await(
+                    std::vector<uint8_t>(), std::string(), std::string()).await(
       [&port] (caf::ok_atom, uint16_t socks5_port) {
         port = socks5_port;
       },
@@ -338,12 +373,17 @@ TEST_F(echo_test, encrypted_socks5_no_auth_conn_ipv4) {
   std::string str = "ABCDEFGHIJKLMNOPQRSTUVWXYZABCDEF";
   std::vector<uint8_t> key(str.begin(), str.end());
 
-  auto socks5 = caf::io::spawn_io(ranger::proxy::socks5_service_impl, 300, false, std::string());
+  auto socks5 = caf::io::spawn_io(ranger::proxy::socks5_service_impl,
+                                  ranger::proxy::session_timeouts(),
+                                  ranger::proxy::admission_limits(),
+                                  ranger::proxy::rate_spec(), ranger::proxy::rate_spec(),
+                                  false, false, std::string());
   scope_guard guard_socks5([socks5] {
     caf::anon_send_exit(socks5, caf::exit_reason::kill);
   });
 
-  auto gate = caf::io::spawn_io(ranger::proxy::gate_service_impl, 300, std::string());
+  auto gate = caf::io::spawn_io(ranger::proxy::gate_service_impl,
+                                ranger::proxy::session_timeouts(), false, false, std::string());
   scope_guard guard_gate([gate] {
     caf::anon_send_exit(gate, caf::exit_reason::kill);
   });
@@ -352,7 +392,7 @@ TEST_F(echo_test, encrypted_socks5_no_auth_conn_ipv4) {
   {
     caf::scoped_actor self;
     self->sync_send(socks5, caf::publish_atom::value, static_cast<uint16_t>(0),
-                    key, false).await(
+                    key, std::string(), std::string()).await(
       [&port] (caf::ok_atom, uint16_t socks5_port) {
         port = socks5_port;
       },
@@ -365,7 +405,217 @@ TEST_F(echo_test, encrypted_socks5_no_auth_conn_ipv4) {
 
   {
     caf::scoped_actor self;
-    self->send(gate, caf::add_atom::value, "127.0.0.1", port, key, false);
+    self->send(gate, caf::add_atom::value, "127.0.0.1", port, key, std::string(), std::string());
+    self->sync_send(gate, caf::publish_atom::value, static_cast<uint16_t>(0)).await(
+      [&port] (caf::ok_atom, uint16_t gate_port) {
+        port = gate_port;
+      },
+      [] (caf::error_atom, const std::string& what) {
+        std::cout << "ERROR: " << what << std::endl;
+      }
+    );
+  }
+  ASSERT_NE(0, port);
+
+  int fd = socket(AF_INET, SOCK_STREAM, 0);
+  ASSERT_NE(-1, fd);
+  scope_guard guard_fd([fd] { close(fd); });
+
+  sockaddr_in sin = {0};
+  sin.sin_family = AF_INET;
+  sin.sin_addr.s_addr = inet_addr("127.0.0.1");
+  sin.sin_port = htons(port);
+  ASSERT_EQ(0, connect(fd, reinterpret_cast<sockaddr*>(&sin), sizeof(sin)));
+
+  {
+    // version identifier/method selection message
+    uint8_t buf[] = {0x05, 0x01, 0x00};
+    ASSERT_EQ(sizeof(buf), send(fd, buf, sizeof(buf), 0));
+  }
+
+  {
+    // method selection message
+    uint8_t buf[2];
+    ASSERT_EQ(sizeof(buf), recv(fd, buf, sizeof(buf), 0));
+    ASSERT_EQ(0x05, buf[0]);
+    ASSERT_EQ(0x00, buf[1]);
+  }
+
+  {
+    // request
+    uint8_t buf[] = {0x05, 0x01, 0x00, 0x01};
+    ASSERT_EQ(sizeof(buf), send(fd, buf, sizeof(buf), 0));
+    ASSERT_EQ(sizeof(sin.sin_addr), send(fd, &sin.sin_addr, sizeof(sin.sin_addr), 0));
+    uint16_t remote_port = htons(m_port);
+    ASSERT_EQ(sizeof(remote_port), send(fd, &remote_port, sizeof(remote_port), 0));
+  }
+
+  {
+    // reply
+    uint8_t buf[4];
+    ASSERT_EQ(sizeof(buf), recv(fd, buf, sizeof(buf), 0));
+    ASSERT_EQ(0x05, buf[0]);
+    ASSERT_EQ(0x00, buf[1]);
+    ASSERT_EQ(0x00, buf[2]);
+    ASSERT_EQ(0x01, buf[3]);
+    uint32_t reply_addr;
+    ASSERT_EQ(sizeof(reply_addr), recv(fd, &reply_addr, sizeof(reply_addr), 0));
+    uint16_t reply_port;
+    ASSERT_EQ(sizeof(reply_port), recv(fd, &reply_port, sizeof(reply_port), 0));
+  }
+
+  {
+    // test data
+    char buf[] = "Hello, world!";
+    ASSERT_EQ(sizeof(buf), send(fd, buf, sizeof(buf), 0));
+    memset(buf, 0, sizeof(buf));
+    ASSERT_EQ(sizeof(buf), recv(fd, buf, sizeof(buf), 0));
+    EXPECT_STREQ("Hello, world!", buf);
+  }
+}
+
+TEST_F(echo_test, encrypted_socks5_offload_conn_ipv4) {
+  std::string str = "ABCDEFGHIJKLMNOPQRSTUVWXYZABCDEF";
+  std::vector<uint8_t> key(str.begin(), str.end());
+
+  auto socks5 = caf::io::spawn_io(ranger::proxy::socks5_service_impl,
+                                  ranger::proxy::session_timeouts(),
+                                  ranger::proxy::admission_limits(),
+                                  ranger::proxy::rate_spec(), ranger::proxy::rate_spec(),
+                                  true, false, std::string());
+  scope_guard guard_socks5([socks5] {
+    caf::anon_send_exit(socks5, caf::exit_reason::kill);
+  });
+
+  auto gate = caf::io::spawn_io(ranger::proxy::gate_service_impl,
+                                ranger::proxy::session_timeouts(), true, false, std::string());
+  scope_guard guard_gate([gate] {
+    caf::anon_send_exit(gate, caf::exit_reason::kill);
+  });
+
+  uint16_t port = 0;
+  {
+    caf::scoped_actor self;
+    self->sync_send(socks5, caf::publish_atom::value, static_cast<uint16_t>(0),
+                    key, std::string("zlib"), std::string()).await(
+      [&port] (caf::ok_atom, uint16_t socks5_port) {
+        port = socks5_port;
+      },
+      [] (caf::error_atom, const std::string& what) {
+        std::cout << "ERROR: " << what << std::endl;
+      }
+    );
+  }
+  ASSERT_NE(0, port);
+
+  {
+    caf::scoped_actor self;
+    self->send(gate, caf::add_atom::value, "127.0.0.1", port, key, std::string("zlib"), std::string());
+    self->sync_send(gate, caf::publish_atom::value, static_cast<uint16_t>(0)).await(
+      [&port] (caf::ok_atom, uint16_t gate_port) {
+        port = gate_port;
+      },
+      [] (caf::error_atom, const std::string& what) {
+        std::cout << "ERROR: " << what << std::endl;
+      }
+    );
+  }
+  ASSERT_NE(0, port);
+
+  int fd = socket(AF_INET, SOCK_STREAM, 0);
+  ASSERT_NE(-1, fd);
+  scope_guard guard_fd([fd] { close(fd); });
+
+  sockaddr_in sin = {0};
+  sin.sin_family = AF_INET;
+  sin.sin_addr.s_addr = inet_addr("127.0.0.1");
+  sin.sin_port = htons(port);
+  ASSERT_EQ(0, connect(fd, reinterpret_cast<sockaddr*>(&sin), sizeof(sin)));
+
+  {
+    // version identifier/method selection message
+    uint8_t buf[] = {0x05, 0x01, 0x00};
+    ASSERT_EQ(sizeof(buf), send(fd, buf, sizeof(buf), 0));
+  }
+
+  {
+    // method selection message
+    uint8_t buf[2];
+    ASSERT_EQ(sizeof(buf), recv(fd, buf, sizeof(buf), 0));
+    ASSERT_EQ(0x05, buf[0]);
+    ASSERT_EQ(0x00, buf[1]);
+  }
+
+  {
+    // request
+    uint8_t buf[] = {0x05, 0x01, 0x00, 0x01};
+    ASSERT_EQ(sizeof(buf), send(fd, buf, sizeof(buf), 0));
+    ASSERT_EQ(sizeof(sin.sin_addr), send(fd, &sin.sin_addr, sizeof(sin.sin_addr), 0));
+    uint16_t remote_port = htons(m_port);
+    ASSERT_EQ(sizeof(remote_port), send(fd, &remote_port, sizeof(remote_port), 0));
+  }
+
+  {
+    // reply
+    uint8_t buf[4];
+    ASSERT_EQ(sizeof(buf), recv(fd, buf, sizeof(buf), 0));
+    ASSERT_EQ(0x05, buf[0]);
+    ASSERT_EQ(0x00, buf[1]);
+    ASSERT_EQ(0x00, buf[2]);
+    ASSERT_EQ(0x01, buf[3]);
+    uint32_t reply_addr;
+    ASSERT_EQ(sizeof(reply_addr), recv(fd, &reply_addr, sizeof(reply_addr), 0));
+    uint16_t reply_port;
+    ASSERT_EQ(sizeof(reply_port), recv(fd, &reply_port, sizeof(reply_port), 0));
+  }
+
+  {
+    // test data
+    char buf[] = "Hello, world!";
+    ASSERT_EQ(sizeof(buf), send(fd, buf, sizeof(buf), 0));
+    memset(buf, 0, sizeof(buf));
+    ASSERT_EQ(sizeof(buf), recv(fd, buf, sizeof(buf), 0));
+    EXPECT_STREQ("Hello, world!", buf);
+  }
+}
+
+TEST_F(echo_test, aead_socks5_no_auth_conn_ipv4) {
+  std::string str = "ABCDEFGHIJKLMNOPQRSTUVWXYZABCDEF";
+  std::vector<uint8_t> key(str.begin(), str.end());
+
+  auto socks5 = caf::io::spawn_io(ranger::proxy::socks5_service_impl,
+                                  ranger::proxy::session_timeouts(),
+                                  ranger::proxy::admission_limits(),
+                                  ranger::proxy::rate_spec(), ranger::proxy::rate_spec(),
+                                  false, false, std::string());
+  scope_guard guard_socks5([socks5] {
+    caf::anon_send_exit(socks5, caf::exit_reason::kill);
+  });
+
+  auto gate = caf::io::spawn_io(ranger::proxy::gate_service_impl,
+                                ranger::proxy::session_timeouts(), false, false, std::string());
+  scope_guard guard_gate([gate] {
+    caf::anon_send_exit(gate, caf::exit_reason::kill);
+  });
+
+  uint16_t port = 0;
+  {
+    caf::scoped_actor self;
+    self->sync_send(socks5, caf::publish_atom::value, static_cast<uint16_t>(0),
+                    key, std::string("zlib"), std::string("aead")).await(
+      [&port] (caf::ok_atom, uint16_t socks5_port) {
+        port = socks5_port;
+      },
+      [] (caf::error_atom, const std::string& what) {
+        std::cout << "ERROR: " << what << std::endl;
+      }
+    );
+  }
+  ASSERT_NE(0, port);
+
+  {
+    caf::scoped_actor self;
+    self->send(gate, caf::add_atom::value, "127.0.0.1", port, key, std::string("zlib:1"), std::string("aead"));
     self->sync_send(gate, caf::publish_atom::value, static_cast<uint16_t>(0)).await(
       [&port] (caf::ok_atom, uint16_t gate_port) {
         port = gate_port;
@@ -438,12 +688,17 @@ TEST_F(ranger_proxy_test, encrypt_socks5_no_auth_conn_ipv4_null) {
   std::string str = "ABCDEFGHIJKLMNOPQRSTUVWXYZABCDEF";
   std::vector<uint8_t> key(str.begin(), str.end());
 
-  auto socks5 = caf::io::spawn_io(ranger::proxy::socks5_service_impl, 300, false, std::string());
+  auto socks5 = caf::io::spawn_io(ranger::proxy::socks5_service_impl,
+                                  ranger::proxy::session_timeouts(),
+                                  ranger::proxy::admission_limits(),
+                                  ranger::proxy::rate_spec(), ranger::proxy::rate_spec(),
+                                  false, false, std::string());
   scope_guard guard_socks5([socks5] {
     caf::anon_send_exit(socks5, caf::exit_reason::kill);
   });
 
-  auto gate = caf::io::spawn_io(ranger::proxy::gate_service_impl, 300, std::string());
+  auto gate = caf::io::spawn_io(ranger::proxy::gate_service_impl,
+                                ranger::proxy::session_timeouts(), false, false, std::string());
   scope_guard guard_gate([gate] {
     caf::anon_send_exit(gate, caf::exit_reason::kill);
   });
@@ -452,7 +707,7 @@ TEST_F(ranger_proxy_test, encrypt_socks5_no_auth_conn_ipv4_null) {
   {
     caf::scoped_actor self;
     self->sync_send(socks5, caf::publish_atom::value, static_cast<uint16_t>(0),
-                    key, false).await(
+                    key, std::string(), std::string()).await(
       [&port] (caf::ok_atom, uint16_t socks5_port) {
         port = socks5_port;
       },
@@ -465,7 +720,7 @@ TEST_F(ranger_proxy_test, encrypt_socks5_no_auth_conn_ipv4_null) {
 
   {
     caf::scoped_actor self;
-    self->send(gate, caf::add_atom::value, "127.0.0.1", port, key, false);
+    self->send(gate, caf::add_atom::value, "127.0.0.1", port, key, std::string(), std::string());
     self->sync_send(gate, caf::publish_atom::value, static_cast<uint16_t>(0)).await(
       [&port] (caf::ok_atom, uint16_t gate_port) {
         port = gate_port;
@@ -533,12 +788,17 @@ TEST_F(ranger_proxy_test, encrypt_socks5_no_auth_conn_domainname_null) {
   std::string str = "ABCDEFGHIJKLMNOPQRSTUVWXYZABCDEF";
   std::vector<uint8_t> key(str.begin(), str.end());
 
-  auto socks5 = caf::io::spawn_io(ranger::proxy::socks5_service_impl, 300, false, std::string());
+  auto socks5 = caf::io::spawn_io(ranger::proxy::socks5_service_impl,
+                                  ranger::proxy::session_timeouts(),
+                                  ranger::proxy::admission_limits(),
+                                  ranger::proxy::rate_spec(), ranger::proxy::rate_spec(),
+                                  false, false, std::string());
   scope_guard guard_socks5([socks5] {
     caf::anon_send_exit(socks5, caf::exit_reason::kill);
   });
 
-  auto gate = caf::io::spawn_io(ranger::proxy::gate_service_impl, 300, std::string());
+  auto gate = caf::io::spawn_io(ranger::proxy::gate_service_impl,
+                                ranger::proxy::session_timeouts(), false, false, std::string());
   scope_guard guard_gate([gate] {
     caf::anon_send_exit(gate, caf::exit_reason::kill);
   });
@@ -547,7 +807,7 @@ TEST_F(ranger_proxy_test, encrypt_socks5_no_auth_conn_domainname_null) {
   {
     caf::scoped_actor self;
     self->sync_send(socks5, caf::publish_atom::value, static_cast<uint16_t>(0),
-                    key, false).await(
+                    key, std::string(), std::string()).await(
       [&port] (caf::ok_atom, uint16_t socks5_port) {
         port = socks5_port;
       },
@@ -560,7 +820,7 @@ TEST_F(ranger_proxy_test, encrypt_socks5_no_auth_conn_domainname_null) {
 
   {
     caf::scoped_actor self;
-    self->send(gate, caf::add_atom::value, "127.0.0.1", port, key, false);
+    self->send(gate, caf::add_atom::value, "127.0.0.1", port, key, std::string(), std::string());
     self->sync_send(gate, caf::publish_atom::value, static_cast<uint16_t>(0)).await(
       [&port] (caf::ok_atom, uint16_t gate_port) {
         port = gate_port;
@@ -628,7 +888,11 @@ TEST_F(ranger_proxy_test, encrypt_socks5_no_auth_conn_domainname_null) {
 }
 
 TEST_F(echo_test, socks5_username_auth_conn_ipv4) {
-  auto socks5 = caf::io::spawn_io(ranger::proxy::socks5_service_impl, 300, false, std::string());
+  auto socks5 = caf::io::spawn_io(ranger::proxy::socks5_service_impl,
+                                  ranger::proxy::session_timeouts(),
+                                  ranger::proxy::admission_limits(),
+                                  ranger::proxy::rate_spec(), ranger::proxy::rate_spec(),
+                                  false, false, std::string());
   scope_guard guard_socks5([socks5] {
     caf::anon_send_exit(socks5, caf::exit_reason::kill);
   });
@@ -638,7 +902,7 @@ TEST_F(echo_test, socks5_username_auth_conn_ipv4) {
     caf::scoped_actor self;
     self->send(socks5, caf::add_atom::value, "test", "Hello, world!");
     self->sync_send(socks5, caf::publish_atom::value, port,
-                    std::vector<uint8_t>(), false).await(
+                    std::vector<uint8_t>(), std::string(), std::string()).await(
       [&port] (caf::ok_atom, uint16_t socks5_port) {
         port = socks5_port;
       },
@@ -729,7 +993,11 @@ TEST_F(echo_test, socks5_username_auth_conn_ipv4) {
 }
 
 TEST_F(echo_test, socks5_username_auth_empty_passwd_conn_ipv4) {
-  auto socks5 = caf::io::spawn_io(ranger::proxy::socks5_service_impl, 300, false, std::string());
+  auto socks5 = caf::io::spawn_io(ranger::proxy::socks5_service_impl,
+                                  ranger::proxy::session_timeouts(),
+                                  ranger::proxy::admission_limits(),
+                                  ranger::proxy::rate_spec(), ranger::proxy::rate_spec(),
+                                  false, false, std::string());
   scope_guard guard_socks5([socks5] {
     caf::anon_send_exit(socks5, caf::exit_reason::kill);
   });
@@ -739,7 +1007,7 @@ TEST_F(echo_test, socks5_username_auth_empty_passwd_conn_ipv4) {
     caf::scoped_actor self;
     self->send(socks5, caf::add_atom::value, "test", std::string());
     self->sync_send(socks5, caf::publish_atom::value, port,
-                    std::vector<uint8_t>(), false).await(
+                    std::vector<uint8_t>(), std::string(), std::string()).await(
       [&port] (caf::ok_atom, uint16_t socks5_port) {
         port = socks5_port;
       },
@@ -828,7 +1096,11 @@ TEST_F(echo_test, socks5_username_auth_empty_passwd_conn_ipv4) {
 }
 
 TEST_F(echo_test, socks5_username_auth_conn_domainname) {
-  auto socks5 = caf::io::spawn_io(ranger::proxy::socks5_service_impl, 300, false, std::string());
+  auto socks5 = caf::io::spawn_io(ranger::proxy::socks5_service_impl,
+                                  ranger::proxy::session_timeouts(),
+                                  ranger::proxy::admission_limits(),
+                                  ranger::proxy::rate_spec(), ranger::proxy::rate_spec(),
+                                  false, false, std::string());
   scope_guard guard_socks5([socks5] {
     caf::anon_send_exit(socks5, caf::exit_reason::kill);
   });
@@ -838,7 +1110,7 @@ TEST_F(echo_test, socks5_username_auth_conn_domainname) {
     caf::scoped_actor self;
     self->send(socks5, caf::add_atom::value, "test", "Hello, world!");
     self->sync_send(socks5, caf::publish_atom::value, port,
-                    std::vector<uint8_t>(), false).await(
+                    std::vector<uint8_t>(), std::string(), std::string()).await(
       [&port] (caf::ok_atom, uint16_t socks5_port) {
         port = socks5_port;
       },
@@ -931,7 +1203,11 @@ TEST_F(echo_test, socks5_username_auth_conn_domainname) {
 }
 
 TEST_F(ranger_proxy_test, socks5_username_auth_failed) {
-  auto socks5 = caf::io::spawn_io(ranger::proxy::socks5_service_impl, 300, false, std::string());
+  auto socks5 = caf::io::spawn_io(ranger::proxy::socks5_service_impl,
+                                  ranger::proxy::session_timeouts(),
+                                  ranger::proxy::admission_limits(),
+                                  ranger::proxy::rate_spec(), ranger::proxy::rate_spec(),
+                                  false, false, std::string());
   scope_guard guard_socks5([socks5] {
     caf::anon_send_exit(socks5, caf::exit_reason::kill);
   });
@@ -941,7 +1217,7 @@ TEST_F(ranger_proxy_test, socks5_username_auth_failed) {
     caf::scoped_actor self;
     self->send(socks5, caf::add_atom::value, "auth_failed", "auth_failed");
     self->sync_send(socks5, caf::publish_atom::value, port,
-                    std::vector<uint8_t>(), false).await(
+                    std::vector<uint8_t>(), std::string(), std::string()).await(
       [&port] (caf::ok_atom, uint16_t socks5_port) {
         port = socks5_port;
       },
@@ -1002,3 +1278,611 @@ TEST_F(ranger_proxy_test, socks5_username_auth_failed) {
     std::this_thread::sleep_for(std::chrono::milliseconds(10));
   }
 }
+
+TEST_F(ranger_proxy_test, socks5_handshake_timeout) {
+  ranger::proxy::session_timeouts timeouts;
+  timeouts.handshake = 1;
+  auto socks5 = caf::io::spawn_io(ranger::proxy::socks5_service_impl,
+                                  timeouts,
+                                  ranger::proxy::rate_spec(), ranger::proxy::rate_spec(),
+                                  false, false, std::string());
+  scope_guard guard_socks5([socks5] {
+    caf::anon_send_exit(socks5, caf::exit_reason::kill);
+  });
+
+  uint16_t port = 0;
+  {
+    caf::scoped_actor self;
+    self->sync_send(socks5, caf::publish_atom::value, port,
+                    std::vector<uint8_t>(), std::string(), std::string()).await(
+      [&port] (caf::ok_atom, uint16_t socks5_port) {
+        port = socks5_port;
+      },
+      [] (caf::error_atom, const std::string& what) {
+        std::cout << "ERROR: " << what << std::endl;
+      }
+    );
+  }
+  ASSERT_NE(0, port);
+
+  int fd = socket(AF_INET, SOCK_STREAM, 0);
+  ASSERT_NE(-1, fd);
+  scope_guard guard_fd([fd] { close(fd); });
+
+  sockaddr_in sin = {0};
+  sin.sin_family = AF_INET;
+  sin.sin_addr.s_addr = inet_addr("127.0.0.1");
+  sin.sin_port = htons(port);
+  ASSERT_EQ(0, connect(fd, reinterpret_cast<sockaddr*>(&sin), sizeof(sin)));
+
+  // the client keeps sending a byte at a time and never finishes the
+  // method selection, the session closes after the handshake timeout
+  auto begin = std::chrono::steady_clock::now();
+  uint8_t buf[] = {0x05, 0xFF};
+  ASSERT_EQ(2, send(fd, buf, sizeof(buf), 0));
+  timeval tv = {0, 100 * 1000};
+  setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+  for (;;) {
+    uint8_t method = 0;
+    send(fd, &method, sizeof(method), MSG_NOSIGNAL);
+    if (recv(fd, buf, sizeof(buf), 0) == 0) {
+      break;
+    }
+    ASSERT_LT(std::chrono::steady_clock::now() - begin, std::chrono::seconds(10));
+  }
+}
+
+TEST_F(echo_test, socks5_no_auth_conn_ipv6) {
+  auto socks5 = caf::io::spawn_io(ranger::proxy::socks5_service_impl,
+                                  ranger::proxy::session_timeouts(),
+                                  ranger::proxy::admission_limits(),
+                                  ranger::proxy::rate_spec(), ranger::proxy::rate_spec(),
+                                  false, false, std::string());
+  scope_guard guard_socks5([socks5] {
+    caf::anon_send_exit(socks5, caf::exit_reason::kill);
+  });
+
+  uint16_t port = 0;
+  {
+    caf::scoped_actor self;
+    self->sync_send(socks5, caf::publish_atom::value, std::string("::1"), port,
+                    std::vector<uint8_t>(), std::string(), std::string()).await(
+      [&port] (caf::ok_atom, uint16_t socks5_port) {
+        port = socks5_port;
+      },
+      [] (caf::error_atom, const std::string& what) {
+        std::cout << "ERROR: " << what << std::endl;
+      }
+    );
+  }
+  ASSERT_NE(0, port);
+
+  int fd = socket(AF_INET6, SOCK_STREAM, 0);
+  ASSERT_NE(-1, fd);
+  scope_guard guard_fd([fd] { close(fd); });
+
+  sockaddr_in6 sin6;
+  memset(&sin6, 0, sizeof(sin6));
+  sin6.sin6_family = AF_INET6;
+  sin6.sin6_addr = in6addr_loopback;
+  sin6.sin6_port = htons(port);
+  ASSERT_EQ(0, connect(fd, reinterpret_cast<sockaddr*>(&sin6), sizeof(sin6)));
+
+  {
+    // version identifier/method selection message
+    uint8_t buf[] = {0x05, 0x01, 0x00};
+    ASSERT_EQ(sizeof(buf), send(fd, buf, sizeof(buf), 0));
+  }
+
+  {
+    // method selection message
+    uint8_t buf[2];
+    ASSERT_EQ(sizeof(buf), recv(fd, buf, sizeof(buf), 0));
+    ASSERT_EQ(0x05, buf[0]);
+    ASSERT_EQ(0x00, buf[1]);
+  }
+
+  {
+    // request, the echo service listens on IPv4 only and is reached
+    // through its IPv4-mapped address
+    uint8_t buf[] = {0x05, 0x01, 0x00, 0x04};
+    ASSERT_EQ(sizeof(buf), send(fd, buf, sizeof(buf), 0));
+    in6_addr addr;
+    ASSERT_EQ(1, inet_pton(AF_INET6, "::ffff:127.0.0.1", &addr));
+    ASSERT_EQ(sizeof(addr), send(fd, &addr, sizeof(addr), 0));
+    uint16_t remote_port = htons(m_port);
+    ASSERT_EQ(sizeof(remote_port), send(fd, &remote_port, sizeof(remote_port), 0));
+  }
+
+  {
+    // reply, BND.ADDR is the proxy's end of the IPv6 connection
+    uint8_t buf[4];
+    ASSERT_EQ(sizeof(buf), recv(fd, buf, sizeof(buf), 0));
+    ASSERT_EQ(0x05, buf[0]);
+    ASSERT_EQ(0x00, buf[1]);
+    ASSERT_EQ(0x00, buf[2]);
+    ASSERT_EQ(0x04, buf[3]);
+    in6_addr reply_addr;
+    ASSERT_EQ(sizeof(reply_addr), recv(fd, &reply_addr, sizeof(reply_addr), 0));
+    char reply_str[INET6_ADDRSTRLEN];
+    EXPECT_STREQ("::ffff:127.0.0.1",
+                 inet_ntop(AF_INET6, &reply_addr, reply_str, sizeof(reply_str)));
+    uint16_t reply_port;
+    ASSERT_EQ(sizeof(reply_port), recv(fd, &reply_port, sizeof(reply_port), 0));
+    EXPECT_NE(0, reply_port);
+  }
+
+  {
+    // test data
+    char buf[] = "Hello, world!";
+    ASSERT_EQ(sizeof(buf), send(fd, buf, sizeof(buf), 0));
+    memset(buf, 0, sizeof(buf));
+    ASSERT_EQ(sizeof(buf), recv(fd, buf, sizeof(buf), 0));
+    EXPECT_STREQ("Hello, world!", buf);
+  }
+}
+
+TEST_F(ranger_proxy_test, socks5_no_auth_udp_associate) {
+  auto socks5 = caf::io::spawn_io(ranger::proxy::socks5_service_impl,
+                                  ranger::proxy::session_timeouts(),
+                                  ranger::proxy::admission_limits(),
+                                  ranger::proxy::rate_spec(), ranger::proxy::rate_spec(),
+                                  false, false, std::string());
+  scope_guard guard_socks5([socks5] {
+    caf::anon_send_exit(socks5, caf::exit_reason::kill);
+  });
+
+  uint16_t port = 0;
+  {
+    caf::scoped_actor self;
+    self->sync_send(socks5, caf::publish_atom::value, port,
+                    std::vector<uint8_t>(), std::string(), std::string()).await(
+      [&port] (caf::ok_atom, uint16_t socks5_port) {
+        port = socks5_port;
+      },
+      [] (caf::error_atom, const std::string& what) {
+        std::cout << "ERROR: " << what << std::endl;
+      }
+    );
+  }
+  ASSERT_NE(0, port);
+
+  int fd = socket(AF_INET, SOCK_STREAM, 0);
+  ASSERT_NE(-1, fd);
+  scope_guard guard_fd([fd] { close(fd); });
+
+  sockaddr_in sin = {0};
+  sin.sin_family = AF_INET;
+  sin.sin_addr.s_addr = inet_addr("127.0.0.1");
+  sin.sin_port = htons(port);
+  ASSERT_EQ(0, connect(fd, reinterpret_cast<sockaddr*>(&sin), sizeof(sin)));
+
+  {
+    // version identifier/method selection message
+    uint8_t buf[] = {0x05, 0x01, 0x00};
+    ASSERT_EQ(sizeof(buf), send(fd, buf, sizeof(buf), 0));
+  }
+
+  {
+    // method selection message
+    uint8_t buf[2];
+    ASSERT_EQ(sizeof(buf), recv(fd, buf, sizeof(buf), 0));
+    ASSERT_EQ(0x05, buf[0]);
+    ASSERT_EQ(0x00, buf[1]);
+  }
+
+  {
+    // request, the client doesn't know where it will send from yet
+    uint8_t buf[] = {0x05, 0x03, 0x00, 0x01, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00};
+    ASSERT_EQ(sizeof(buf), send(fd, buf, sizeof(buf), 0));
+  }
+
+  sockaddr_in relay_sin = {0};
+  relay_sin.sin_family = AF_INET;
+  {
+    // reply, BND.ADDR and BND.PORT are where the datagrams go
+    uint8_t buf[4];
+    ASSERT_EQ(sizeof(buf), recv(fd, buf, sizeof(buf), 0));
+    ASSERT_EQ(0x05, buf[0]);
+    ASSERT_EQ(0x00, buf[1]);
+    ASSERT_EQ(0x00, buf[2]);
+    ASSERT_EQ(0x01, buf[3]);
+    ASSERT_EQ(sizeof(relay_sin.sin_addr),
+              recv(fd, &relay_sin.sin_addr, sizeof(relay_sin.sin_addr), 0));
+    EXPECT_EQ(sin.sin_addr.s_addr, relay_sin.sin_addr.s_addr);
+    ASSERT_EQ(sizeof(relay_sin.sin_port),
+              recv(fd, &relay_sin.sin_port, sizeof(relay_sin.sin_port), 0));
+    ASSERT_NE(0, relay_sin.sin_port);
+  }
+
+  // the client and the target
+  int udp_fds[2];
+  sockaddr_in udp_sins[2];
+  for (auto i = 0; i < 2; ++i) {
+    udp_fds[i] = socket(AF_INET, SOCK_DGRAM, 0);
+    ASSERT_NE(-1, udp_fds[i]);
+    udp_sins[i] = sin;
+    udp_sins[i].sin_port = 0;
+    ASSERT_EQ(0, bind(udp_fds[i], reinterpret_cast<sockaddr*>(&udp_sins[i]), sizeof(udp_sins[i])));
+    socklen_t len = sizeof(udp_sins[i]);
+    ASSERT_EQ(0, getsockname(udp_fds[i], reinterpret_cast<sockaddr*>(&udp_sins[i]), &len));
+    timeval tv = {5, 0};
+    setsockopt(udp_fds[i], SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+  }
+  scope_guard guard_udp_fds([udp_fds] {
+    close(udp_fds[0]);
+    close(udp_fds[1]);
+  });
+
+  // RSV, FRAG, ATYP, DST.ADDR and DST.PORT of the target
+  uint8_t header[10] = {0x00, 0x00, 0x00, 0x01};
+  memcpy(header + 4, &udp_sins[1].sin_addr, sizeof(udp_sins[1].sin_addr));
+  memcpy(header + 8, &udp_sins[1].sin_port, sizeof(udp_sins[1].sin_port));
+
+  {
+    // test data
+    char buf[sizeof(header) + 14];
+    memcpy(buf, header, sizeof(header));
+    memcpy(buf + sizeof(header), "Hello, world!", 14);
+    ASSERT_EQ(sizeof(buf), sendto(udp_fds[0], buf, sizeof(buf), 0,
+                                  reinterpret_cast<sockaddr*>(&relay_sin), sizeof(relay_sin)));
+  }
+
+  {
+    // the target answers the relay
+    char buf[64] = {0};
+    sockaddr_in from;
+    socklen_t len = sizeof(from);
+    ASSERT_EQ(14, recvfrom(udp_fds[1], buf, sizeof(buf), 0,
+                           reinterpret_cast<sockaddr*>(&from), &len));
+    EXPECT_STREQ("Hello, world!", buf);
+    ASSERT_EQ(14, sendto(udp_fds[1], buf, 14, 0, reinterpret_cast<sockaddr*>(&from), len));
+  }
+
+  {
+    // the reply comes with the target's address
+    char buf[64] = {0};
+    ASSERT_EQ(sizeof(header) + 14, recv(udp_fds[0], buf, sizeof(buf), 0));
+    EXPECT_EQ(0, memcmp(header, buf, sizeof(header)));
+    EXPECT_STREQ("Hello, world!", buf + sizeof(header));
+  }
+}
+
+TEST_F(ranger_proxy_test, socks5_no_auth_bind) {
+  auto socks5 = caf::io::spawn_io(ranger::proxy::socks5_service_impl,
+                                  ranger::proxy::session_timeouts(),
+                                  ranger::proxy::admission_limits(),
+                                  ranger::proxy::rate_spec(), ranger::proxy::rate_spec(),
+                                  false, false, std::string());
+  scope_guard guard_socks5([socks5] {
+    caf::anon_send_exit(socks5, caf::exit_reason::kill);
+  });
+
+  uint16_t port = 0;
+  {
+    caf::scoped_actor self;
+    self->sync_send(socks5, caf::publish_atom::value, port,
+                    std::vector<uint8_t>(), std::string(), std::string()).await(
+      [&port] (caf::ok_atom, uint16_t socks5_port) {
+        port = socks5_port;
+      },
+      [] (caf::error_atom, const std::string& what) {
+        std::cout << "ERROR: " << what << std::endl;
+      }
+    );
+  }
+  ASSERT_NE(0, port);
+
+  int fd = socket(AF_INET, SOCK_STREAM, 0);
+  ASSERT_NE(-1, fd);
+  scope_guard guard_fd([fd] { close(fd); });
+
+  sockaddr_in sin = {0};
+  sin.sin_family = AF_INET;
+  sin.sin_addr.s_addr = inet_addr("127.0.0.1");
+  sin.sin_port = htons(port);
+  ASSERT_EQ(0, connect(fd, reinterpret_cast<sockaddr*>(&sin), sizeof(sin)));
+
+  {
+    // version identifier/method selection message
+    uint8_t buf[] = {0x05, 0x01, 0x00};
+    ASSERT_EQ(sizeof(buf), send(fd, buf, sizeof(buf), 0));
+  }
+
+  {
+    // method selection message
+    uint8_t buf[2];
+    ASSERT_EQ(sizeof(buf), recv(fd, buf, sizeof(buf), 0));
+    ASSERT_EQ(0x05, buf[0]);
+    ASSERT_EQ(0x00, buf[1]);
+  }
+
+  {
+    // request, only the loopback host may connect
+    uint8_t buf[] = {0x05, 0x02, 0x00, 0x01};
+    ASSERT_EQ(sizeof(buf), send(fd, buf, sizeof(buf), 0));
+    ASSERT_EQ(sizeof(sin.sin_addr), send(fd, &sin.sin_addr, sizeof(sin.sin_addr), 0));
+    uint16_t remote_port = 0;
+    ASSERT_EQ(sizeof(remote_port), send(fd, &remote_port, sizeof(remote_port), 0));
+  }
+
+  sockaddr_in bind_sin = {0};
+  bind_sin.sin_family = AF_INET;
+  {
+    // first reply, where the proxy listens
+    uint8_t buf[4];
+    ASSERT_EQ(sizeof(buf), recv(fd, buf, sizeof(buf), 0));
+    ASSERT_EQ(0x05, buf[0]);
+    ASSERT_EQ(0x00, buf[1]);
+    ASSERT_EQ(0x00, buf[2]);
+    ASSERT_EQ(0x01, buf[3]);
+    ASSERT_EQ(sizeof(bind_sin.sin_addr),
+              recv(fd, &bind_sin.sin_addr, sizeof(bind_sin.sin_addr), 0));
+    EXPECT_EQ(sin.sin_addr.s_addr, bind_sin.sin_addr.s_addr);
+    ASSERT_EQ(sizeof(bind_sin.sin_port),
+              recv(fd, &bind_sin.sin_port, sizeof(bind_sin.sin_port), 0));
+    ASSERT_NE(0, bind_sin.sin_port);
+  }
+
+  // the peer the client told to connect back
+  int peer_fd = socket(AF_INET, SOCK_STREAM, 0);
+  ASSERT_NE(-1, peer_fd);
+  scope_guard guard_peer_fd([peer_fd] { close(peer_fd); });
+  ASSERT_EQ(0, connect(peer_fd, reinterpret_cast<sockaddr*>(&bind_sin), sizeof(bind_sin)));
+  sockaddr_in peer_sin;
+  socklen_t peer_len = sizeof(peer_sin);
+  ASSERT_EQ(0, getsockname(peer_fd, reinterpret_cast<sockaddr*>(&peer_sin), &peer_len));
+
+  {
+    // second reply, who connected
+    uint8_t buf[4];
+    ASSERT_EQ(sizeof(buf), recv(fd, buf, sizeof(buf), 0));
+    ASSERT_EQ(0x05, buf[0]);
+    ASSERT_EQ(0x00, buf[1]);
+    ASSERT_EQ(0x00, buf[2]);
+    ASSERT_EQ(0x01, buf[3]);
+    uint32_t reply_addr;
+    ASSERT_EQ(sizeof(reply_addr), recv(fd, &reply_addr, sizeof(reply_addr), 0));
+    EXPECT_EQ(peer_sin.sin_addr.s_addr, reply_addr);
+    uint16_t reply_port;
+    ASSERT_EQ(sizeof(reply_port), recv(fd, &reply_port, sizeof(reply_port), 0));
+    EXPECT_EQ(peer_sin.sin_port, reply_port);
+  }
+
+  {
+    // test data in both directions
+    char buf[] = "Hello, world!";
+    ASSERT_EQ(sizeof(buf), send(peer_fd, buf, sizeof(buf), 0));
+    memset(buf, 0, sizeof(buf));
+    ASSERT_EQ(sizeof(buf), recv(fd, buf, sizeof(buf), MSG_WAITALL));
+    EXPECT_STREQ("Hello, world!", buf);
+    ASSERT_EQ(sizeof(buf), send(fd, buf, sizeof(buf), 0));
+    memset(buf, 0, sizeof(buf));
+    ASSERT_EQ(sizeof(buf), recv(peer_fd, buf, sizeof(buf), MSG_WAITALL));
+    EXPECT_STREQ("Hello, world!", buf);
+  }
+}
+
+TEST_F(echo_test, socks5_rate_limit) {
+  ranger::proxy::rate_spec rate;
+  ASSERT_TRUE(ranger::proxy::parse_rate_spec("64k:16k", rate));
+  auto socks5 = caf::io::spawn_io(ranger::proxy::socks5_service_impl,
+                                  ranger::proxy::session_timeouts(),
+                                  ranger::proxy::admission_limits(),
+                                  rate, ranger::proxy::rate_spec(),
+                                  false, false, std::string());
+  scope_guard guard_socks5([socks5] {
+    caf::anon_send_exit(socks5, caf::exit_reason::kill);
+  });
+
+  uint16_t port = 0;
+  {
+    caf::scoped_actor self;
+    self->sync_send(socks5, caf::publish_atom::value, port,
+                    std::vector<uint8_t>(), std::string(), std::string()).await(
+      [&port] (caf::ok_atom, uint16_t socks5_port) {
+        port = socks5_port;
+      },
+      [] (caf::error_atom, const std::string& what) {
+        std::cout << "ERROR: " << what << std::endl;
+      }
+    );
+  }
+  ASSERT_NE(0, port);
+
+  int fd = socket(AF_INET, SOCK_STREAM, 0);
+  ASSERT_NE(-1, fd);
+  scope_guard guard_fd([fd] { close(fd); });
+
+  sockaddr_in sin = {0};
+  sin.sin_family = AF_INET;
+  sin.sin_addr.s_addr = inet_addr("127.0.0.1");
+  sin.sin_port = htons(port);
+  ASSERT_EQ(0, connect(fd, reinterpret_cast<sockaddr*>(&sin), sizeof(sin)));
+
+  {
+    // version identifier/method selection message and request
+    uint8_t buf[] = {0x05, 0x01, 0x00, 0x05, 0x01, 0x00, 0x01, 0, 0, 0, 0, 0, 0};
+    memcpy(buf + 7, &sin.sin_addr, sizeof(sin.sin_addr));
+    uint16_t remote_port = htons(m_port);
+    memcpy(buf + 11, &remote_port, sizeof(remote_port));
+    ASSERT_EQ(sizeof(buf), send(fd, buf, sizeof(buf), 0));
+  }
+
+  {
+    // method selection message and reply
+    uint8_t buf[12];
+    ASSERT_EQ(sizeof(buf), recv(fd, buf, sizeof(buf), MSG_WAITALL));
+    ASSERT_EQ(0x00, buf[1]);
+    ASSERT_EQ(0x00, buf[3]);
+  }
+
+  {
+    // the echo comes back at 64k a second after a burst of 16k
+    std::vector<char> data(128 * 1024, 'a');
+    auto begin = std::chrono::steady_clock::now();
+    std::thread sender([fd, &data] {
+      send(fd, data.data(), data.size(), 0);
+    });
+    std::vector<char> buf(data.size());
+    auto len = recv(fd, buf.data(), buf.size(), MSG_WAITALL);
+    sender.join();
+    auto elapsed = std::chrono::steady_clock::now() - begin;
+    ASSERT_EQ(static_cast<ssize_t>(data.size()), len);
+    EXPECT_EQ(data, buf);
+    EXPECT_GE(elapsed, std::chrono::milliseconds(1500));
+    EXPECT_LT(elapsed, std::chrono::milliseconds(5000));
+  }
+}
+
+TEST_F(echo_test, socks5_max_sessions) {
+  ranger::proxy::admission_limits admission;
+  ASSERT_TRUE(ranger::proxy::parse_connection_limit("1", admission.sessions,
+                                                    admission.sessions_per_ip));
+  auto socks5 = caf::io::spawn_io(ranger::proxy::socks5_service_impl,
+                                  ranger::proxy::session_timeouts(),
+                                  admission,
+                                  ranger::proxy::rate_spec(), ranger::proxy::rate_spec(),
+                                  false, false, std::string());
+  scope_guard guard_socks5([socks5] {
+    caf::anon_send_exit(socks5, caf::exit_reason::kill);
+  });
+
+  uint16_t port = 0;
+  {
+    caf::scoped_actor self;
+    self->sync_send(socks5, caf::publish_atom::value, port,
+                    std::vector<uint8_t>(), std::string(), std::string()).await(
+      [&port] (caf::ok_atom, uint16_t socks5_port) {
+        port = socks5_port;
+      },
+      [] (caf::error_atom, const std::string& what) {
+        std::cout << "ERROR: " << what << std::endl;
+      }
+    );
+  }
+  ASSERT_NE(0, port);
+
+  sockaddr_in sin = {0};
+  sin.sin_family = AF_INET;
+  sin.sin_addr.s_addr = inet_addr("127.0.0.1");
+  sin.sin_port = htons(port);
+
+  int fd = socket(AF_INET, SOCK_STREAM, 0);
+  ASSERT_NE(-1, fd);
+  scope_guard guard_fd([fd] { close(fd); });
+  ASSERT_EQ(0, connect(fd, reinterpret_cast<sockaddr*>(&sin), sizeof(sin)));
+
+  {
+    // version identifier/method selection message
+    uint8_t buf[] = {0x05, 0x01, 0x00};
+    ASSERT_EQ(sizeof(buf), send(fd, buf, sizeof(buf), 0));
+  }
+
+  {
+    // method selection message
+    uint8_t buf[2];
+    ASSERT_EQ(sizeof(buf), recv(fd, buf, sizeof(buf), MSG_WAITALL));
+    ASSERT_EQ(0x00, buf[1]);
+  }
+
+  {
+    // the second session is over the limit and closed at once
+    int fd2 = socket(AF_INET, SOCK_STREAM, 0);
+    ASSERT_NE(-1, fd2);
+    scope_guard guard_fd2([fd2] { close(fd2); });
+    ASSERT_EQ(0, connect(fd2, reinterpret_cast<sockaddr*>(&sin), sizeof(sin)));
+    uint8_t buf[2];
+    EXPECT_GE(0, recv(fd2, buf, sizeof(buf), MSG_WAITALL));
+  }
+
+  caf::scoped_actor self;
+  self->sync_send(socks5, caf::get_atom::value, ranger::proxy::admission_atom::value).await(
+    [] (uint64_t accepted, uint64_t rejected_sessions, uint64_t rejected_handshakes,
+        uint64_t rejected_rate, uint64_t sessions, uint64_t handshakes) {
+      EXPECT_EQ(1, accepted);
+      EXPECT_EQ(1, rejected_sessions);
+      EXPECT_EQ(0, rejected_handshakes);
+      EXPECT_EQ(0, rejected_rate);
+      EXPECT_EQ(1, sessions);
+      EXPECT_EQ(1, handshakes);
+    }
+  );
+}
+
+TEST_F(echo_test, socks5_reuse_port) {
+  std::vector<ranger::proxy::socks5_service> services;
+  scope_guard guard_socks5([&services] {
+    for (auto& i : services) {
+      caf::anon_send_exit(i, caf::exit_reason::kill);
+    }
+  });
+
+  // a port no one else listens on
+  auto fd = ranger::proxy::new_reuse_port_acceptor("127.0.0.1", 0);
+  sockaddr_in sin = {0};
+  socklen_t len = sizeof(sin);
+  getsockname(fd, reinterpret_cast<sockaddr*>(&sin), &len);
+  close(fd);
+  auto port = ntohs(sin.sin_port);
+  ASSERT_NE(0, port);
+
+  caf::scoped_actor self;
+  for (auto i = 0; i < 2; ++i) {
+    auto socks5 = caf::io::spawn_io(ranger::proxy::socks5_service_impl,
+                                    ranger::proxy::session_timeouts(),
+                                    ranger::proxy::admission_limits(),
+                                    ranger::proxy::rate_spec(), ranger::proxy::rate_spec(),
+                                    false, false, std::string());
+    services.push_back(socks5);
+    self->send(socks5, ranger::proxy::reuse_port_atom::value, uint32_t{2});
+
+    // the services of other reactors couldn't listen on an ephemeral port
+    auto rejected = false;
+    self->sync_send(socks5, caf::publish_atom::value, static_cast<uint16_t>(0),
+                    std::vector<uint8_t>(), std::string(), std::string()).await(
+      [] (caf::ok_atom, uint16_t) {},
+      [&rejected] (caf::error_atom, const std::string&) {
+        rejected = true;
+      }
+    );
+    EXPECT_TRUE(rejected);
+
+    auto published = false;
+    self->sync_send(socks5, caf::publish_atom::value, std::string("127.0.0.1"), port,
+                    std::vector<uint8_t>(), std::string(), std::string()).await(
+      [&published, port] (caf::ok_atom, uint16_t socks5_port) {
+        published = socks5_port == port;
+      },
+      [] (caf::error_atom, const std::string& what) {
+        std::cout << "ERROR: " << what << std::endl;
+      }
+    );
+    ASSERT_TRUE(published);
+  }
+
+  for (auto i = 0; i < 8; ++i) {
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    ASSERT_NE(-1, fd);
+    scope_guard guard_fd([fd] { close(fd); });
+
+    sin.sin_family = AF_INET;
+    sin.sin_addr.s_addr = inet_addr("127.0.0.1");
+    sin.sin_port = htons(port);
+    ASSERT_EQ(0, connect(fd, reinterpret_cast<sockaddr*>(&sin), sizeof(sin)));
+
+    {
+      // version identifier/method selection message
+      uint8_t buf[] = {0x05, 0x01, 0x00};
+      ASSERT_EQ(sizeof(buf), send(fd, buf, sizeof(buf), 0));
+    }
+
+    {
+      // method selection message
+      uint8_t buf[2];
+      ASSERT_EQ(sizeof(buf), recv(fd, buf, sizeof(buf), MSG_WAITALL));
+      EXPECT_EQ(0x05, buf[0]);
+      EXPECT_EQ(0x00, buf[1]);
+    }
+  }
+}
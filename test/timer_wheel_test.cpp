@@ -0,0 +1,217 @@
+// ranger_proxy - A SOCKS5 proxy
+// Copyright (C) 2015  RangerUFO <ufownl@gmail.com>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include <gtest/gtest.h>
+#include "timer_wheel.cpp"
+#include <chrono>
+#include <iostream>
+#include <memory>
+
+namespace {
+
+std::shared_ptr<ranger::proxy::timer_wheel> make_wheel(boost::asio::io_service& ios,
+                                                       size_t slots = 8) {
+  return std::make_shared<ranger::proxy::timer_wheel>(ios, std::chrono::milliseconds(10),
+                                                      slots);
+}
+
+}
+
+TEST(timer_wheel, expire) {
+  boost::asio::io_service ios;
+  auto wheel = make_wheel(ios);
+  ranger::proxy::timer_wheel::timer t;
+  int fired = 0;
+  wheel->arm(t, 3, [&fired] { ++fired; });
+  EXPECT_TRUE(t.armed());
+  EXPECT_EQ(1u, wheel->size());
+
+  wheel->advance();
+  wheel->advance();
+  EXPECT_EQ(0, fired);
+  wheel->advance();
+  EXPECT_EQ(1, fired);
+  EXPECT_FALSE(t.armed());
+  EXPECT_EQ(0u, wheel->size());
+}
+
+TEST(timer_wheel, reset) {
+  boost::asio::io_service ios;
+  auto wheel = make_wheel(ios);
+  ranger::proxy::timer_wheel::timer t;
+  int fired = 0;
+  wheel->arm(t, 3, [&fired] { ++fired; });
+  for (auto i = 0; i < 20; ++i) {
+    wheel->advance();
+    t.reset();
+  }
+  EXPECT_EQ(0, fired);
+  wheel->advance();
+  wheel->advance();
+  EXPECT_EQ(0, fired);
+  wheel->advance();
+  EXPECT_EQ(1, fired);
+}
+
+TEST(timer_wheel, change_timeout) {
+  boost::asio::io_service ios;
+  auto wheel = make_wheel(ios);
+  ranger::proxy::timer_wheel::timer t;
+  int fired = 0;
+  wheel->arm(t, 30, [&fired] { ++fired; });
+  wheel->advance();
+  // an earlier deadline moves the timer right away
+  t.reset(2);
+  wheel->advance();
+  EXPECT_EQ(0, fired);
+  wheel->advance();
+  EXPECT_EQ(1, fired);
+
+  wheel->arm(t, 2, [&fired] { ++fired; });
+  t.reset(20);
+  for (auto i = 0; i < 19; ++i) {
+    wheel->advance();
+  }
+  EXPECT_EQ(1, fired);
+  wheel->advance();
+  EXPECT_EQ(2, fired);
+  t.reset(5);
+  EXPECT_FALSE(t.armed());
+}
+
+TEST(timer_wheel, cancel) {
+  boost::asio::io_service ios;
+  auto wheel = make_wheel(ios);
+  int fired = 0;
+  {
+    ranger::proxy::timer_wheel::timer t;
+    wheel->arm(t, 2, [&fired] { ++fired; });
+  }
+  ranger::proxy::timer_wheel::timer t;
+  wheel->arm(t, 2, [&fired] { ++fired; });
+  t.cancel();
+  EXPECT_EQ(0u, wheel->size());
+  for (auto i = 0; i < 10; ++i) {
+    wheel->advance();
+  }
+  EXPECT_EQ(0, fired);
+}
+
+TEST(timer_wheel, batch_and_long_timeouts) {
+  boost::asio::io_service ios;
+  auto wheel = make_wheel(ios);
+  std::vector<std::unique_ptr<ranger::proxy::timer_wheel::timer>> timers;
+  std::vector<int> fired;
+  // five share a deadline, the others go around the 8 slots a few times
+  for (auto timeout : {5, 5, 5, 5, 5, 13, 21, 100}) {
+    timers.emplace_back(new ranger::proxy::timer_wheel::timer);
+    wheel->arm(*timers.back(), timeout, [&fired, timeout] { fired.push_back(timeout); });
+  }
+
+  for (auto i = 0; i < 4; ++i) {
+    wheel->advance();
+  }
+  EXPECT_TRUE(fired.empty());
+  wheel->advance();
+  EXPECT_EQ(std::vector<int>({5, 5, 5, 5, 5}), fired);
+  for (auto i = 5; i < 100; ++i) {
+    wheel->advance();
+    if (i + 1 == 13) {
+      EXPECT_EQ(13, fired.back());
+    } else if (i + 1 == 21) {
+      EXPECT_EQ(21, fired.back());
+    }
+  }
+  EXPECT_EQ(100, fired.back());
+  EXPECT_EQ(8u, fired.size());
+}
+
+TEST(timer_wheel, callback_cancels_timer) {
+  boost::asio::io_service ios;
+  auto wheel = make_wheel(ios);
+  std::unique_ptr<ranger::proxy::timer_wheel::timer> a(new ranger::proxy::timer_wheel::timer);
+  std::unique_ptr<ranger::proxy::timer_wheel::timer> b(new ranger::proxy::timer_wheel::timer);
+  int fired = 0;
+  wheel->arm(*a, 1, [&] { ++fired; b.reset(); });
+  wheel->arm(*b, 9, [&] { ++fired; });
+  wheel->advance();
+  EXPECT_EQ(1, fired);
+  EXPECT_EQ(0u, wheel->size());
+}
+
+TEST(timer_wheel, ticks_on_io_service) {
+  boost::asio::io_service ios;
+  auto wheel = make_wheel(ios, 64);
+  ranger::proxy::timer_wheel::timer t;
+  auto begin = std::chrono::steady_clock::now();
+  std::chrono::steady_clock::time_point end;
+  wheel->arm(t, 5, [&end] { end = std::chrono::steady_clock::now(); });
+  wheel.reset();
+  // the wheel stops ticking once the timer expired, which ends run()
+  ios.run();
+  auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(end - begin);
+  EXPECT_GE(elapsed.count(), 40);
+  EXPECT_LT(elapsed.count(), 1000);
+}
+
+TEST(timer_wheel, local) {
+  boost::asio::io_service ios;
+  auto wheel = ranger::proxy::timer_wheel::local(ios);
+  EXPECT_EQ(wheel, ranger::proxy::timer_wheel::local(ios));
+  boost::asio::io_service other;
+  EXPECT_NE(wheel, ranger::proxy::timer_wheel::local(other));
+
+  auto fine = ranger::proxy::timer_wheel::local_fine(ios);
+  EXPECT_NE(wheel, fine);
+  EXPECT_EQ(fine, ranger::proxy::timer_wheel::local_fine(ios));
+  EXPECT_EQ(std::chrono::milliseconds(1000), wheel->tick());
+  EXPECT_EQ(std::chrono::milliseconds(10), fine->tick());
+}
+
+TEST(timer_wheel, bench) {
+  boost::asio::io_service ios;
+  auto wheel = make_wheel(ios, 512);
+  const size_t count = 100000;
+  std::vector<ranger::proxy::timer_wheel::timer> timers(count);
+  size_t fired = 0;
+
+  auto begin = std::chrono::steady_clock::now();
+  for (size_t i = 0; i < count; ++i) {
+    wheel->arm(timers[i], 300, [&fired] { ++fired; });
+  }
+  auto armed = std::chrono::steady_clock::now();
+  for (auto round = 0; round < 10; ++round) {
+    for (auto& t : timers) {
+      t.reset();
+    }
+  }
+  auto reset = std::chrono::steady_clock::now();
+  size_t ticks = 0;
+  while (fired < count) {
+    wheel->advance();
+    ++ticks;
+  }
+  auto end = std::chrono::steady_clock::now();
+  EXPECT_EQ(300u, ticks);
+
+  auto ns = [] (std::chrono::steady_clock::duration d, size_t n) {
+    return std::chrono::duration<double, std::nano>(d).count() / n;
+  };
+  std::cout << "[timer_wheel bench] " << count << " timers: arm "
+    << ns(armed - begin, count) << " ns, reset "
+    << ns(reset - armed, count * 10) << " ns, expire "
+    << ns(end - reset, count) << " ns per timer" << std::endl;
+}
@@ -0,0 +1,192 @@
+// ranger_proxy - A SOCKS5 proxy
+// Copyright (C) 2015  RangerUFO <ufownl@gmail.com>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+#include <gtest/gtest.h>
+#include "token_bucket.cpp"
+#include "receive_sizer.cpp"
+#include <iostream>
+#include <thread>
+
+using namespace ranger::proxy;
+using std::chrono::milliseconds;
+
+TEST(token_bucket, parse) {
+  rate_spec spec;
+  EXPECT_TRUE(parse_rate_spec("1m", spec));
+  EXPECT_EQ(1024u * 1024, spec.rate);
+  EXPECT_EQ(1024u * 1024, spec.burst);
+  EXPECT_TRUE(parse_rate_spec("100k:4m", spec));
+  EXPECT_EQ(100u * 1024, spec.rate);
+  EXPECT_EQ(4u * 1024 * 1024, spec.burst);
+  EXPECT_TRUE(parse_rate_spec("", spec));
+  EXPECT_EQ(0u, spec.rate);
+
+  EXPECT_FALSE(parse_rate_spec("0", spec));
+  EXPECT_FALSE(parse_rate_spec("1m:", spec));
+  EXPECT_FALSE(parse_rate_spec("fast", spec));
+  EXPECT_FALSE(parse_rate_spec("1g", spec));
+
+  // a burst of nothing never lets a byte through
+  EXPECT_FALSE(parse_rate_spec("100k:0", spec));
+  EXPECT_FALSE(parse_rate_spec("100k:0k", spec));
+}
+
+TEST(token_bucket, share) {
+  rate_spec spec;
+  spec.rate = 1000;
+  spec.burst = 10;
+  auto share = share_rate_spec(spec, 4);
+  EXPECT_EQ(250u, share.rate);
+  EXPECT_EQ(3u, share.burst);
+  // a part of a limit is never unlimited
+  share = share_rate_spec(spec, 2000);
+  EXPECT_EQ(1u, share.rate);
+  EXPECT_EQ(1u, share.burst);
+
+  share = share_rate_spec(rate_spec(), 4);
+  EXPECT_EQ(0u, share.rate);
+}
+
+TEST(token_bucket, refill) {
+  rate_spec spec;
+  spec.rate = 1000;
+  spec.burst = 500;
+  auto t = token_bucket::clock::now();
+  token_bucket bucket(spec, t);
+  EXPECT_EQ(token_bucket::clock::duration::zero(), bucket.wait(t));
+
+  // a read takes the bucket into debt, it waits until that is paid back
+  bucket.consume(1500);
+  auto wait = bucket.wait(t);
+  EXPECT_GT(wait, milliseconds(1000));
+  EXPECT_LE(wait, milliseconds(1002));
+  EXPECT_GT(bucket.wait(t + milliseconds(500)), milliseconds(500));
+  EXPECT_EQ(token_bucket::clock::duration::zero(), bucket.wait(t + milliseconds(1002)));
+
+  // idle time fills up to the burst and no further
+  bucket.wait(t + milliseconds(60000));
+  bucket.consume(500);
+  EXPECT_GT(bucket.wait(t + milliseconds(60000)), token_bucket::clock::duration::zero());
+
+  // fractions of a byte aren't lost between frequent refills
+  token_bucket slow(spec, t);
+  slow.consume(500);
+  auto now = t;
+  for (auto i = 0; i < 1000; ++i) {
+    now += std::chrono::microseconds(300);
+    slow.wait(now);
+  }
+  slow.consume(299);
+  EXPECT_EQ(token_bucket::clock::duration::zero(), slow.wait(now));
+  slow.consume(1);
+  EXPECT_GT(slow.wait(now), token_bucket::clock::duration::zero());
+}
+
+TEST(token_bucket, concurrent) {
+  // threads taking and refilling at once neither lose nor make tokens
+  rate_spec spec;
+  spec.rate = 1000000;
+  spec.burst = 1000000;
+  auto t = token_bucket::clock::now();
+  token_bucket bucket(spec, t);
+  bucket.consume(1000000);
+  std::vector<std::thread> threads;
+  for (auto i = 0; i < 4; ++i) {
+    threads.emplace_back([&, i] {
+      for (auto j = 0; j < 100000; ++j) {
+        bucket.consume(1);
+        bucket.wait(t + milliseconds(j / 1000 + i));
+      }
+    });
+  }
+  for (auto& th : threads) {
+    th.join();
+  }
+  // a token per microsecond for 103ms, 400000 taken
+  auto wait = bucket.wait(t + milliseconds(103));
+  EXPECT_EQ(std::chrono::nanoseconds((400000 - 103000 + 1) * 1000 + 1), wait);
+}
+
+TEST(token_bucket, map) {
+  rate_spec spec;
+  spec.rate = 1000;
+  spec.burst = 1000;
+  token_bucket_map users(spec);
+  auto alice = users.get("alice");
+  EXPECT_EQ(alice, users.get("alice"));
+  EXPECT_NE(alice, users.get("bob"));
+
+  // buckets nobody holds are dropped eventually
+  for (auto i = 0; i < 1000; ++i) {
+    users.get("user" + std::to_string(i));
+  }
+  EXPECT_LT(users.size(), 200u);
+  EXPECT_EQ(alice, users.get("alice"));
+}
+
+TEST(token_bucket, rate_limiter) {
+  rate_spec global;
+  global.rate = 10000;
+  global.burst = 64 * 1024;
+  rate_spec user;
+  user.rate = 1000;
+  user.burst = 2000;
+  auto t = token_bucket::clock::now();
+
+  rate_limiter limiter;
+  EXPECT_TRUE(limiter.empty());
+  limiter.add(nullptr);
+  limiter.add_user("alice");
+  EXPECT_TRUE(limiter.empty());
+
+  limiter.add(std::make_shared<token_bucket>(global, t));
+  limiter.set_users(std::make_shared<token_bucket_map>(user));
+  limiter.add_user("alice");
+  EXPECT_EQ(2000u, limiter.read_size(256 * 1024));
+  EXPECT_EQ(1024u, limiter.read_size(1024));
+
+  // the user's bucket runs out first and sets the pace
+  limiter.consume(3000);
+  auto wait = limiter.wait(t);
+  EXPECT_GT(wait, milliseconds(1000));
+  EXPECT_LT(wait, milliseconds(1002));
+}
+
+TEST(token_bucket, bench) {
+  rate_spec spec;
+  spec.rate = 1ULL << 40;
+  spec.burst = 1ULL << 40;
+  auto bucket = std::make_shared<token_bucket>(spec);
+  const size_t threads = 4;
+  const size_t reads = 1000000;
+  auto begin = token_bucket::clock::now();
+  std::vector<std::thread> workers;
+  for (size_t i = 0; i < threads; ++i) {
+    workers.emplace_back([&] {
+      rate_limiter limiter;
+      limiter.add(bucket);
+      for (size_t j = 0; j < reads; ++j) {
+        limiter.consume(16 * 1024);
+        limiter.wait(token_bucket::clock::now());
+      }
+    });
+  }
+  for (auto& th : workers) {
+    th.join();
+  }
+  auto elapsed = std::chrono::duration<double>(token_bucket::clock::now() - begin);
+  std::cout << "[token_bucket bench] " << threads << " threads on one bucket: "
+    << static_cast<uint64_t>(threads * reads / elapsed.count()) << " reads/s" << std::endl;
+}
@@ -0,0 +1,245 @@
+// ranger_proxy - A SOCKS5 proxy
+// Copyright (C) 2015  RangerUFO <ufownl@gmail.com>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include <gtest/gtest.h>
+#include "udp_relay.cpp"
+#include "dns_resolver.cpp"
+#include "aead_encryptor.cpp"
+#include "buffer_pool.cpp"
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+#include <iostream>
+#include <thread>
+
+namespace {
+
+using ranger::proxy::udp_relay;
+using ranger::proxy::aead_datagram;
+using boost::asio::ip::udp;
+using boost::asio::ip::address;
+
+// echoes datagrams on a thread of its own
+struct udp_echo {
+  udp_echo()
+    : sock(ios, udp::endpoint(address::from_string("127.0.0.1"), 0)) {
+    receive();
+    thread = std::thread([this] { ios.run(); });
+  }
+
+  ~udp_echo() {
+    ios.stop();
+    thread.join();
+  }
+
+  void receive() {
+    sock.async_receive_from(boost::asio::buffer(buf), from,
+      [this] (const boost::system::error_code& ec, size_t len) {
+        if (!ec) {
+          boost::system::error_code ignored_ec;
+          sock.send_to(boost::asio::buffer(buf, len), from, 0, ignored_ec);
+          receive();
+        }
+      }
+    );
+  }
+
+  boost::asio::io_service ios;
+  udp::socket sock;
+  udp::endpoint from;
+  char buf[2048];
+  std::thread thread;
+};
+
+// runs a relay for the client at 127.0.0.1 until destroyed
+struct relay_runner {
+  relay_runner(std::unique_ptr<aead_datagram> cipher = nullptr)
+    : relay(std::make_shared<udp_relay>(ios, address::from_string("127.0.0.1"),
+                                        address::from_string("127.0.0.1"), 0)) {
+    if (cipher) {
+      relay->set_cipher(std::move(cipher));
+    }
+    relay->start();
+    thread = std::thread([this] { ios.run(); });
+  }
+
+  ~relay_runner() {
+    if (thread.joinable()) {
+      stop();
+    }
+  }
+
+  // the stats may be read once the relay is stopped
+  void stop() {
+    ios.post([this] { relay->stop(); });
+    thread.join();
+  }
+
+  boost::asio::io_service ios;
+  std::shared_ptr<udp_relay> relay;
+  std::thread thread;
+};
+
+int client_socket(const char* addr) {
+  auto fd = socket(AF_INET, SOCK_DGRAM, 0);
+  sockaddr_in sin = {0};
+  sin.sin_family = AF_INET;
+  sin.sin_addr.s_addr = inet_addr(addr);
+  bind(fd, reinterpret_cast<sockaddr*>(&sin), sizeof(sin));
+  timeval tv = {2, 0};
+  setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+  return fd;
+}
+
+void send_to(int fd, const udp::endpoint& ep, const std::string& data) {
+  sendto(fd, data.data(), data.size(), 0, ep.data(), static_cast<socklen_t>(ep.size()));
+}
+
+std::string receive(int fd) {
+  char buf[2048];
+  auto n = recv(fd, buf, sizeof(buf), 0);
+  return n > 0 ? std::string(buf, n) : std::string();
+}
+
+// RSV, FRAG, ATYP and the IPv4 address and port
+std::string header(const udp::endpoint& ep, uint8_t frag = 0) {
+  std::string hdr = {0x00, 0x00, static_cast<char>(frag), 0x01};
+  auto addr = ep.address().to_v4().to_bytes();
+  hdr.append(addr.begin(), addr.end());
+  hdr.push_back(static_cast<char>(ep.port() >> 8));
+  hdr.push_back(static_cast<char>(ep.port() & 0xFF));
+  return hdr;
+}
+
+}
+
+TEST(udp_relay, echo) {
+  udp_echo echo;
+  relay_runner runner;
+  auto relay_ep = runner.relay->local_endpoint();
+  auto echo_ep = echo.sock.local_endpoint();
+  auto fd = client_socket("127.0.0.1");
+  for (auto i = 0; i < 32; ++i) {
+    send_to(fd, relay_ep, header(echo_ep) + "datagram " + std::to_string(i));
+  }
+  // the reply carries the address of the target it came from
+  for (auto i = 0; i < 32; ++i) {
+    EXPECT_EQ(header(echo_ep) + "datagram " + std::to_string(i), receive(fd));
+  }
+  close(fd);
+
+  runner.stop();
+  auto& stats = runner.relay->stats();
+  EXPECT_EQ(32, stats.client_recv);
+  EXPECT_EQ(32, stats.remote_send);
+  EXPECT_EQ(32, stats.remote_recv);
+  EXPECT_EQ(32, stats.client_send);
+  EXPECT_EQ(0, stats.dropped);
+}
+
+TEST(udp_relay, sealed_echo) {
+  std::vector<uint8_t> key = {'r', 'a', 'n', 'g', 'e', 'r'};
+  std::vector<uint8_t> salt(ranger::proxy::aead_salt_size, 0x5A);
+  for (auto type : {ranger::proxy::cipher_type::aes_128_gcm,
+                    ranger::proxy::cipher_type::chacha20_poly1305}) {
+    udp_echo echo;
+    std::unique_ptr<aead_datagram> server(new aead_datagram);
+    server->init(type, key, salt, true);
+    relay_runner runner(std::move(server));
+    aead_datagram client;
+    client.init(type, key, salt, false);
+    auto relay_ep = runner.relay->local_endpoint();
+    auto echo_ep = echo.sock.local_endpoint();
+    auto fd = client_socket("127.0.0.1");
+
+    // a datagram in the clear doesn't authenticate
+    send_to(fd, relay_ep, header(echo_ep) + "plain");
+    auto hdr = header(echo_ep);
+    std::string payload = "sealed";
+    char buf[2048];
+    auto len = client.seal(hdr.data(), hdr.size(), payload.data(), payload.size(), buf);
+    send_to(fd, relay_ep, std::string(buf, len));
+
+    auto reply = receive(fd);
+    auto n = client.open(reply.data(), reply.size(), buf);
+    ASSERT_EQ(static_cast<ssize_t>(hdr.size() + payload.size()), n);
+    EXPECT_EQ(hdr + payload, std::string(buf, n));
+    close(fd);
+    runner.stop();
+    EXPECT_EQ(1, runner.relay->stats().dropped);
+  }
+}
+
+TEST(udp_relay, drop) {
+  udp_echo echo;
+  relay_runner runner;
+  auto relay_ep = runner.relay->local_endpoint();
+  auto echo_ep = echo.sock.local_endpoint();
+  auto fd = client_socket("127.0.0.1");
+  send_to(fd, relay_ep, header(echo_ep) + "first");
+  EXPECT_EQ(header(echo_ep) + "first", receive(fd));
+
+  // fragments, unknown address types, and other ports and addresses
+  send_to(fd, relay_ep, header(echo_ep, 1) + "fragment");
+  send_to(fd, relay_ep, std::string({0x00, 0x00, 0x00, 0x02}) + "type");
+  auto other_port = client_socket("127.0.0.1");
+  send_to(other_port, relay_ep, header(echo_ep) + "other port");
+  auto other_addr = client_socket("127.0.0.2");
+  send_to(other_addr, relay_ep, header(echo_ep) + "other address");
+  send_to(fd, relay_ep, header(echo_ep) + "last");
+  EXPECT_EQ(header(echo_ep) + "last", receive(fd));
+  close(other_addr);
+  close(other_port);
+  close(fd);
+
+  runner.stop();
+  EXPECT_EQ(4, runner.relay->stats().dropped);
+  EXPECT_EQ(2, runner.relay->stats().client_send);
+}
+
+TEST(udp_relay, bench) {
+  udp_echo echo;
+  relay_runner runner;
+  auto relay_ep = runner.relay->local_endpoint();
+  auto echo_ep = echo.sock.local_endpoint();
+  auto fd = client_socket("127.0.0.1");
+  auto datagram = header(echo_ep) + std::string(512, 'x');
+  // a window of datagrams in flight, like a busy DNS client
+  const size_t rounds = 2000;
+  const size_t window = 32;
+  size_t received = 0;
+  auto begin = std::chrono::steady_clock::now();
+  for (size_t i = 0; i < rounds; ++i) {
+    for (size_t j = 0; j < window; ++j) {
+      send_to(fd, relay_ep, datagram);
+    }
+    for (size_t j = 0; j < window; ++j) {
+      if (receive(fd).size() == datagram.size()) {
+        ++received;
+      }
+    }
+  }
+  auto elapsed = std::chrono::steady_clock::now() - begin;
+  close(fd);
+  runner.stop();
+  auto& stats = runner.relay->stats();
+  EXPECT_GT(received, rounds * window * 9 / 10);
+  std::cout << "[udp_relay bench] " << received << " of " << rounds * window
+    << " datagrams echoed in " << std::chrono::duration<double, std::milli>(elapsed).count()
+    << " ms, " << static_cast<double>(stats.client_recv + stats.remote_recv) / std::max<uint64_t>(stats.batches, 1)
+    << " datagrams per receive call" << std::endl;
+}
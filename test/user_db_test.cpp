@@ -0,0 +1,95 @@
+// ranger_proxy - A SOCKS5 proxy
+// Copyright (C) 2015  RangerUFO <ufownl@gmail.com>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+#include <gtest/gtest.h>
+#include "user_db.cpp"
+#include <chrono>
+#include <iostream>
+#include <stdexcept>
+
+using ranger::proxy::user_db;
+
+namespace {
+
+bool auth(const user_db& db, const std::string& username, const std::string& password) {
+  auto cred = db.find(username.data(), username.size());
+  return cred && cred->check(password);
+}
+
+}  // namespace
+
+TEST(user_db, parse) {
+  std::string text =
+    "# comment\n"
+    "alice:secret\n"
+    "\n"
+    "bob:with:colon\r\n"
+    "carol:";
+  auto db = user_db::parse(text.data(), text.size(), "test");
+  EXPECT_EQ(3u, db->size());
+  EXPECT_TRUE(auth(*db, "alice", "secret"));
+  EXPECT_FALSE(auth(*db, "alice", "secret\n"));
+  EXPECT_TRUE(auth(*db, "bob", "with:colon"));
+  EXPECT_TRUE(auth(*db, "carol", ""));
+  EXPECT_EQ(nullptr, db->find("# comment", 9));
+  EXPECT_EQ(nullptr, db->find("dave", 4));
+  EXPECT_EQ(nullptr, db->find("", 0));
+
+  auto empty = user_db::parse(nullptr, 0, "empty");
+  EXPECT_EQ(0u, empty->size());
+  EXPECT_EQ(nullptr, empty->find("alice", 5));
+}
+
+TEST(user_db, errors) {
+  auto expect_error = [] (const std::string& text, const std::string& what) {
+    try {
+      user_db::parse(text.data(), text.size(), "users.txt");
+      ADD_FAILURE() << "no error for [" << text << "]";
+    } catch (const std::runtime_error& e) {
+      EXPECT_EQ(what, e.what());
+    }
+  };
+  expect_error("alice:secret\nbob\n", "Malformed user in user file[users.txt] at line 2");
+  expect_error(":secret", "Malformed user in user file[users.txt] at line 1");
+  expect_error(std::string(256, 'a') + ":secret", "Malformed user in user file[users.txt] at line 1");
+  expect_error("alice:" + std::string(256, 'a'), "Malformed user in user file[users.txt] at line 1");
+  expect_error("alice:a\nbob:b\nalice:c", "Duplicate user in user file[users.txt] at line 3");
+
+  EXPECT_THROW(user_db::load("/nonexistent/users.txt"), std::runtime_error);
+}
+
+TEST(user_db, bench) {
+  const size_t users = 200000;
+  std::string text;
+  for (size_t i = 0; i < users; ++i) {
+    text += "user" + std::to_string(i) + ":password" + std::to_string(i) + "\n";
+  }
+
+  auto begin = std::chrono::steady_clock::now();
+  auto db = user_db::parse(text.data(), text.size(), "bench");
+  auto build = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin);
+  ASSERT_EQ(users, db->size());
+
+  size_t found = 0;
+  begin = std::chrono::steady_clock::now();
+  for (size_t i = 0; i < 2 * users; ++i) {
+    auto name = "user" + std::to_string(i);
+    found += db->find(name.data(), name.size()) ? 1 : 0;
+  }
+  auto lookup = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin);
+  EXPECT_EQ(users, found);
+  std::cout << "[user_db bench] " << users << " users: built in " << build.count()
+    << "s, " << static_cast<uint64_t>(2 * users / lookup.count()) << " lookups/s" << std::endl;
+}
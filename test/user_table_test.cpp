@@ -0,0 +1,200 @@
+// ranger_proxy - A SOCKS5 proxy
+// Copyright (C) 2015  RangerUFO <ufownl@gmail.com>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+#include <gtest/gtest.h>
+#include "user_table.cpp"
+#include "user_db.cpp"
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <thread>
+#include <vector>
+#include <unistd.h>
+
+using ranger::proxy::user_table;
+
+namespace {
+
+void write_file(const std::string& path, const std::string& content) {
+  // replaced the way editors and deploy scripts do it
+  auto tmp = path + ".tmp";
+  std::ofstream(tmp) << content;
+  rename(tmp.c_str(), path.c_str());
+}
+
+template <class Predicate>
+bool wait_for(Predicate pred) {
+  for (auto i = 0; i < 200; ++i) {
+    if (pred()) {
+      return true;
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  }
+  return false;
+}
+
+}  // namespace
+
+TEST(user_table, auth) {
+  user_table tbl;
+  EXPECT_FALSE(tbl.auth("alice", "secret"));
+  EXPECT_TRUE(tbl.add("alice", "secret"));
+  EXPECT_TRUE(tbl.add("bob", ""));
+  EXPECT_EQ(2u, tbl.size());
+
+  EXPECT_TRUE(tbl.auth("alice", "secret"));
+  EXPECT_FALSE(tbl.auth("alice", "Secret"));
+  EXPECT_FALSE(tbl.auth("alice", ""));
+  EXPECT_TRUE(tbl.auth("bob", ""));
+  EXPECT_FALSE(tbl.auth("bob", "secret"));
+  EXPECT_FALSE(tbl.auth("carol", "secret"));
+}
+
+TEST(user_table, add_existing) {
+  user_table tbl;
+  EXPECT_TRUE(tbl.add("alice", "secret"));
+  EXPECT_FALSE(tbl.add("alice", "other"));
+  EXPECT_TRUE(tbl.auth("alice", "secret"));
+  EXPECT_FALSE(tbl.auth("alice", "other"));
+}
+
+TEST(user_table, tables_apart) {
+  // a thread alternating between tables must not keep using the
+  // snapshot of the other one
+  user_table a;
+  user_table b;
+  a.add("alice", "secret");
+  b.add("bob", "secret");
+  for (auto i = 0; i < 3; ++i) {
+    EXPECT_TRUE(a.auth("alice", "secret"));
+    EXPECT_FALSE(b.auth("alice", "secret"));
+    EXPECT_TRUE(b.auth("bob", "secret"));
+    EXPECT_FALSE(a.auth("bob", "secret"));
+  }
+}
+
+TEST(user_table, add_while_reading) {
+  user_table tbl;
+  tbl.add("user0", "password0");
+  std::atomic<bool> done(false);
+  std::atomic<size_t> failures(0);
+  std::vector<std::thread> readers;
+  for (auto i = 0; i < 4; ++i) {
+    readers.emplace_back([&] {
+      while (!done) {
+        if (!tbl.auth("user0", "password0")) {
+          ++failures;
+        }
+      }
+    });
+  }
+
+  const auto users = 200;
+  for (auto i = 1; i < users; ++i) {
+    EXPECT_TRUE(tbl.add("user" + std::to_string(i), "password" + std::to_string(i)));
+  }
+  done = true;
+  for (auto& t : readers) {
+    t.join();
+  }
+  EXPECT_EQ(0u, failures);
+  EXPECT_EQ(static_cast<size_t>(users), tbl.size());
+  EXPECT_TRUE(tbl.auth("user199", "password199"));
+}
+
+TEST(user_table, load) {
+  auto path = "/tmp/user_table_test_load." + std::to_string(getpid());
+  write_file(path, "alice:file\nbob:file\n");
+  user_table tbl;
+  tbl.add("alice", "added");
+  EXPECT_EQ(2u, tbl.load(path));
+  EXPECT_EQ(3u, tbl.size());
+  // added users shadow the file
+  EXPECT_TRUE(tbl.auth("alice", "added"));
+  EXPECT_FALSE(tbl.auth("alice", "file"));
+  EXPECT_TRUE(tbl.auth("bob", "file"));
+  EXPECT_FALSE(tbl.add("bob", "added"));
+
+  // a broken file keeps the users loaded before
+  write_file(path, "carol\n");
+  EXPECT_THROW(tbl.load(path), std::runtime_error);
+  EXPECT_TRUE(tbl.auth("bob", "file"));
+
+  write_file(path, "carol:file\n");
+  EXPECT_EQ(1u, tbl.load(path));
+  EXPECT_FALSE(tbl.auth("bob", "file"));
+  EXPECT_TRUE(tbl.auth("carol", "file"));
+  EXPECT_TRUE(tbl.auth("alice", "added"));
+  unlink(path.c_str());
+}
+
+TEST(user_table, watch) {
+  auto path = "/tmp/user_table_test_watch." + std::to_string(getpid());
+  write_file(path, "alice:old\n");
+  std::atomic<int> reloads(0);
+  std::atomic<int> failures(0);
+  user_table tbl;
+  auto n = tbl.watch(path, std::chrono::milliseconds(10), [&] (bool ok, const std::string&) {
+    ++(ok ? reloads : failures);
+  });
+  EXPECT_EQ(1u, n);
+  EXPECT_TRUE(tbl.auth("alice", "old"));
+
+  write_file(path, "alice:new\nbob:new\n");
+  EXPECT_TRUE(wait_for([&] { return tbl.auth("alice", "new"); }));
+  EXPECT_TRUE(tbl.auth("bob", "new"));
+  EXPECT_FALSE(tbl.auth("alice", "old"));
+
+  write_file(path, "alice\n");
+  EXPECT_TRUE(wait_for([&] { return failures > 0; }));
+  EXPECT_TRUE(tbl.auth("alice", "new"));
+
+  // the file didn't change, the request alone reloads it
+  auto before = reloads + failures;
+  user_table::request_reload();
+  EXPECT_TRUE(wait_for([&] { return reloads + failures > before; }));
+  unlink(path.c_str());
+}
+
+TEST(user_table, bench) {
+  user_table tbl;
+  for (auto i = 0; i < 1000; ++i) {
+    tbl.add("user" + std::to_string(i), "password" + std::to_string(i));
+  }
+
+  const size_t threads = 4;
+  const size_t logins = 100000;
+  std::atomic<size_t> succeeded(0);
+  auto begin = std::chrono::steady_clock::now();
+  std::vector<std::thread> workers;
+  for (size_t i = 0; i < threads; ++i) {
+    workers.emplace_back([&, i] {
+      size_t n = 0;
+      for (size_t j = 0; j < logins; ++j) {
+        auto id = std::to_string((i * logins + j) % 1000);
+        n += tbl.auth("user" + id, "password" + id) ? 1 : 0;
+      }
+      succeeded += n;
+    });
+  }
+  for (auto& t : workers) {
+    t.join();
+  }
+  auto elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin);
+  EXPECT_EQ(threads * logins, succeeded);
+  std::cout << "[user_table bench] " << threads << " threads: "
+    << static_cast<uint64_t>(threads * logins / elapsed.count()) << " logins/s" << std::endl;
+}
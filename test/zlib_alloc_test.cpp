@@ -0,0 +1,221 @@
+// ranger_proxy - A SOCKS5 proxy
+// Copyright (C) 2015  RangerUFO <ufownl@gmail.com>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include <gtest/gtest.h>
+#include "codec.cpp"
+#include "zlib_encryptor.cpp"
+#include "lz4_codec.cpp"
+#include "zstd_codec.cpp"
+#include <iostream>
+#include <random>
+#include <new>
+#include <stdlib.h>
+#include <string.h>
+
+// counts every allocation made by this executable
+namespace {
+
+size_t allocations = 0;
+size_t allocated_bytes = 0;
+
+}
+
+void* operator new(size_t size) {
+  ++allocations;
+  allocated_bytes += size;
+  auto ptr = malloc(size ? size : 1);
+  if (!ptr) {
+    throw std::bad_alloc();
+  }
+  return ptr;
+}
+
+void operator delete(void* ptr) noexcept {
+  free(ptr);
+}
+
+namespace {
+
+const size_t chunk_size = 64 * 1024;
+const size_t payload_size = 8 * 1024 * 1024;
+const size_t warm_up_size = 8 * chunk_size;
+
+std::vector<char> text_payload(size_t size) {
+  static const char* words[] = {
+    "<div class=\"item\">", "</div>", "<a href=\"/index.html\">", "</a>",
+    "proxy", "session", "tunnel", "the", "of", "and", "remote", "local",
+    "connection", "ranger", "<span>", "</span>", "\n", "  "
+  };
+  std::minstd_rand rd(1);
+  std::vector<char> buf;
+  buf.reserve(size);
+  while (buf.size() < size) {
+    auto word = words[rd() % (sizeof(words) / sizeof(words[0]))];
+    buf.insert(buf.end(), word, word + strlen(word));
+    buf.push_back(' ');
+  }
+  buf.resize(size);
+  return buf;
+}
+
+std::vector<char> random_payload(size_t size) {
+  std::minstd_rand rd(3);
+  std::vector<char> buf(size);
+  for (auto& c : buf) {
+    c = static_cast<char>(rd());
+  }
+  return buf;
+}
+
+struct alloc_count {
+  double allocations_per_mb;
+  double bytes_per_mb;
+};
+
+// Relays the payload chunk by chunk like a session does: one receive
+// buffer per direction, compressed by the local codec and decompressed
+// by the remote one. The first chunks warm up the streams and let the
+// buffers settle on their sizes.
+template <class Codec, class Init>
+alloc_count relay(const std::vector<char>& payload, bool in_place, Init init) {
+  Codec local;
+  init(local);
+  Codec remote;
+  init(remote);
+
+  std::vector<char> buf;
+  size_t count = 0;
+  size_t bytes = 0;
+  for (size_t pos = 0; pos < payload.size(); pos += chunk_size) {
+    auto begin_count = allocations;
+    auto begin_bytes = allocated_bytes;
+    buf.assign(payload.begin() + pos, payload.begin() + pos + chunk_size);
+    if (in_place) {
+      local.encrypt_in_place(buf);
+      remote.decrypt_in_place(buf);
+    } else {
+      auto out = remote.decrypt(local.encrypt(buf));
+      buf.swap(out);
+    }
+    if (pos >= warm_up_size) {
+      count += allocations - begin_count;
+      bytes += allocated_bytes - begin_bytes;
+    }
+    EXPECT_EQ(0, memcmp(buf.data(), payload.data() + pos, chunk_size));
+  }
+
+  auto mb = static_cast<double>(payload.size() - warm_up_size) / (1024 * 1024);
+  return {count / mb, bytes / mb};
+}
+
+}
+
+TEST(zlib_codec, in_place_round_trip) {
+  auto plain = text_payload(4 * chunk_size + 17);
+  ranger::proxy::zlib_codec local;
+  local.init();
+  ranger::proxy::zlib_codec remote;
+  remote.init();
+
+  std::vector<char> compressed;
+  for (size_t pos = 0; pos < plain.size(); pos += chunk_size) {
+    std::vector<char> buf(plain.begin() + pos,
+                          plain.begin() + std::min(pos + chunk_size, plain.size()));
+    local.encrypt_in_place(buf);
+    compressed.insert(compressed.end(), buf.begin(), buf.end());
+  }
+
+  std::vector<char> res;
+  for (size_t pos = 0; pos < compressed.size(); pos += 1000) {
+    std::vector<char> buf(compressed.begin() + pos,
+                          compressed.begin() + std::min(pos + 1000, compressed.size()));
+    remote.decrypt_in_place(buf);
+    res.insert(res.end(), buf.begin(), buf.end());
+  }
+  EXPECT_EQ(plain, res);
+}
+
+TEST(zlib_codec, bomb) {
+  // a few tens of KB that inflate to 32 MB
+  ranger::proxy::zlib_codec local;
+  local.init();
+  std::vector<char> buf(32 * 1024 * 1024, 0);
+  local.encrypt_in_place(buf);
+  ASSERT_LT(buf.size(), 64u * 1024);
+
+  ranger::proxy::zlib_codec remote;
+  remote.init();
+  auto begin_bytes = allocated_bytes;
+  EXPECT_THROW(remote.decrypt_in_place(buf), std::runtime_error);
+  // the doubling output buffers add up to less than three times the cap,
+  // plus the inflate state
+  EXPECT_LT(allocated_bytes - begin_bytes, 3 * ranger::proxy::max_output_size + 64 * 1024);
+}
+
+TEST(zlib_codec, allocations) {
+  struct payload {
+    const char* name;
+    std::vector<char> data;
+  };
+  std::vector<payload> payloads = {
+    {"text", text_payload(payload_size)},
+    {"random", random_payload(payload_size)}
+  };
+
+  for (auto& p : payloads) {
+    auto init = [] (ranger::proxy::zlib_codec& codec) {
+      codec.init(6);
+    };
+    auto copying = relay<ranger::proxy::zlib_codec>(p.data, false, init);
+    auto in_place = relay<ranger::proxy::zlib_codec>(p.data, true, init);
+    std::cout << "[zlib alloc] " << p.name
+      << ": copying " << copying.allocations_per_mb << " allocs/MB ("
+      << copying.bytes_per_mb / 1024 << " KB/MB)"
+      << ", in place " << in_place.allocations_per_mb << " allocs/MB ("
+      << in_place.bytes_per_mb / 1024 << " KB/MB)"
+      << std::endl;
+
+    // once warmed up the buffers just change hands
+    EXPECT_EQ(0, in_place.allocations_per_mb);
+    EXPECT_LT(in_place.allocations_per_mb, copying.allocations_per_mb);
+  }
+}
+
+TEST(zlib_codec, adaptive_allocations) {
+  struct payload {
+    const char* name;
+    std::vector<char> data;
+  };
+  std::vector<payload> payloads = {
+    {"text", text_payload(payload_size)},
+    {"random", random_payload(payload_size)}
+  };
+
+  for (auto& p : payloads) {
+    auto in_place = relay<ranger::proxy::codec_stage>(p.data, true,
+      [] (ranger::proxy::codec_stage& stage) {
+        stage.init(ranger::proxy::codec_spec(ranger::proxy::codec_type::zlib, 6, true));
+      }
+    );
+    std::cout << "[zlib alloc] adaptive " << p.name
+      << ": in place " << in_place.allocations_per_mb << " allocs/MB ("
+      << in_place.bytes_per_mb / 1024 << " KB/MB)"
+      << std::endl;
+
+    // frames are built and decoded in the stage's spare buffers
+    EXPECT_EQ(0, in_place.allocations_per_mb);
+  }
+}